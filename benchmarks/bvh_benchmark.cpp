@@ -0,0 +1,614 @@
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "render_data/bvh.h"
+#include "render_data/mesh.h"
+#include "render_data/quantized_bvh.h"
+#include "render_data/wide_bvh.h"
+#include "utill/logger.h"
+
+using render_data::BoundingBox;
+using render_data::BVH;
+using render_data::BVHBuildConfig;
+using render_data::BVHBuildMode;
+using render_data::BVHNode;
+using render_data::Mesh;
+using render_data::QuantizedBVH;
+using render_data::WideBVH;
+
+namespace {
+
+const uint32_t kBuildRepeatCount = 3;
+const uint32_t kViewCount = 4;
+const uint32_t kViewResolution = 256;
+// leaf primitive counts 1, 2, 3-4, 5-8, 9-16, 17-32, 33+
+const uint32_t kLeafBucketCount = 7;
+
+struct Ray {
+  glm::vec3 origin;
+  glm::vec3 direction;
+  glm::vec3 inv_direction;
+};
+
+struct TraversalStats {
+  uint64_t ray_count = 0;
+  uint64_t node_visits = 0;
+  uint64_t triangle_tests = 0;
+  uint64_t hit_count = 0;
+
+  double GetNodesPerRay() const {
+    return ray_count == 0 ? 0 : double(node_visits) / ray_count;
+  }
+  double GetTrianglesPerRay() const {
+    return ray_count == 0 ? 0 : double(triangle_tests) / ray_count;
+  }
+};
+
+struct TreeStats {
+  float sah_cost = 0;
+  // reachable from root
+  uint32_t node_count = 0;
+  size_t memory_size = 0;
+  uint32_t leaf_count = 0;
+  uint32_t max_depth = 0;
+  uint64_t leaf_depth_sum = 0;
+  std::array<uint32_t, kLeafBucketCount> leaf_histogram = {};
+
+  double GetAvgLeafDepth() const {
+    return leaf_count == 0 ? 0 : double(leaf_depth_sum) / leaf_count;
+  }
+};
+
+// One row of the report: tree built by 'build_mode', converted to 'layout'
+struct BenchmarkResult {
+  std::string scene;
+  std::string build_mode;
+  std::string layout;
+  // best of kBuildRepeatCount binary builds
+  double build_ms = 0;
+  // collapse or quantization of the binary tree, 0 for "binary"
+  double convert_ms = 0;
+  uint32_t references = 0;
+  TreeStats tree;
+  TraversalStats traversal;
+};
+
+float IntersectBox(const Ray& ray, const BoundingBox& bb, float t_max) {
+  float t_min = 0;
+  for (uint32_t axis = 0; axis < 3; axis++) {
+    glm::vec2 range = axis == 0 ? bb.x_range : axis == 1 ? bb.y_range
+                                                        : bb.z_range;
+    float t1 = (range.x - ray.origin[axis]) * ray.inv_direction[axis];
+    float t2 = (range.y - ray.origin[axis]) * ray.inv_direction[axis];
+    t_min = std::max(t_min, std::min(t1, t2));
+    t_max = std::min(t_max, std::max(t1, t2));
+  }
+  return t_min <= t_max ? t_min : -1;
+}
+
+// Moller-Trumbore, returns distance or -1
+float IntersectTriangle(const Ray& ray,
+                        glm::vec3 a,
+                        glm::vec3 b,
+                        glm::vec3 c) {
+  glm::vec3 e1 = b - a;
+  glm::vec3 e2 = c - a;
+  glm::vec3 p = glm::cross(ray.direction, e2);
+  float det = glm::dot(e1, p);
+  if (std::abs(det) < 1e-8f) {
+    return -1;
+  }
+  float inv_det = 1 / det;
+  glm::vec3 s = ray.origin - a;
+  float u = glm::dot(s, p) * inv_det;
+  if (u < 0 || u > 1) {
+    return -1;
+  }
+  glm::vec3 q = glm::cross(s, e1);
+  float v = glm::dot(ray.direction, q) * inv_det;
+  if (v < 0 || u + v > 1) {
+    return -1;
+  }
+  float t = glm::dot(e2, q) * inv_det;
+  return t > 1e-4f ? t : -1;
+}
+
+void TraceRay(const BVH& bvh,
+              const Mesh& mesh,
+              const Ray& ray,
+              TraversalStats& stats) {
+  const auto& nodes = bvh.GetNodes();
+  const auto& primitive_ord = bvh.GetPrimitiveOrd();
+  float closest = 1e30f;
+  bool is_hit = false;
+  std::vector<uint32_t> stack = {0};
+  ++stats.ray_count;
+  while (!stack.empty()) {
+    const BVHNode& node = nodes[stack.back()];
+    stack.pop_back();
+    ++stats.node_visits;
+    if (node.bvh_level == uint32_t(-1)) {
+      for (uint32_t i = node.left; i < node.right; i++) {
+        ++stats.triangle_tests;
+        uint32_t trg = primitive_ord[i];
+        float t = IntersectTriangle(ray, mesh.position[mesh.index[3 * trg].x],
+                                    mesh.position[mesh.index[3 * trg + 1].x],
+                                    mesh.position[mesh.index[3 * trg + 2].x]);
+        if (t > 0 && t < closest) {
+          closest = t;
+          is_hit = true;
+        }
+      }
+      continue;
+    }
+    float t_left = IntersectBox(ray, nodes[node.left].bounds, closest);
+    float t_right = IntersectBox(ray, nodes[node.right].bounds, closest);
+    uint32_t fst = node.left;
+    uint32_t snd = node.right;
+    if (t_right >= 0 && (t_left < 0 || t_right < t_left)) {
+      std::swap(fst, snd);
+      std::swap(t_left, t_right);
+    }
+    // push far child first so that near one is visited next
+    if (t_right >= 0) {
+      stack.push_back(snd);
+    }
+    if (t_left >= 0) {
+      stack.push_back(fst);
+    }
+  }
+  stats.hit_count += is_hit;
+}
+
+// Works for both WideBVH and QuantizedBVH nodes
+template <typename Node>
+void TraceRayWide(const std::vector<Node>& nodes,
+                  const std::vector<uint32_t>& primitive_ord,
+                  const Mesh& mesh,
+                  const Ray& ray,
+                  TraversalStats& stats) {
+  const uint32_t width = std::tuple_size_v<decltype(Node::child)>;
+  float closest = 1e30f;
+  bool is_hit = false;
+  std::vector<uint32_t> stack = {0};
+  ++stats.ray_count;
+  while (!stack.empty()) {
+    const Node& node = nodes[stack.back()];
+    stack.pop_back();
+    ++stats.node_visits;
+    std::array<std::pair<float, uint32_t>, width> hits;
+    uint32_t hit_count = 0;
+    for (uint32_t i = 0; i < width; i++) {
+      if (node.child[i] == uint32_t(-1)) {
+        continue;
+      }
+      float t = IntersectBox(ray, node.GetChildBounds(i), closest);
+      if (t < 0) {
+        continue;
+      }
+      uint32_t primitive_count = node.GetPrimitiveCount(i);
+      if (primitive_count == 0) {
+        // keep hits sorted far to near, so that the nearest is visited next
+        uint32_t pos = hit_count++;
+        for (; pos > 0 && hits[pos - 1].first < t; pos--) {
+          hits[pos] = hits[pos - 1];
+        }
+        hits[pos] = {t, node.child[i]};
+        continue;
+      }
+      uint32_t end = node.child[i] + primitive_count;
+      for (uint32_t j = node.child[i]; j < end; j++) {
+        ++stats.triangle_tests;
+        uint32_t trg = primitive_ord[j];
+        float t = IntersectTriangle(ray, mesh.position[mesh.index[3 * trg].x],
+                                    mesh.position[mesh.index[3 * trg + 1].x],
+                                    mesh.position[mesh.index[3 * trg + 2].x]);
+        if (t > 0 && t < closest) {
+          closest = t;
+          is_hit = true;
+        }
+      }
+    }
+    for (uint32_t i = 0; i < hit_count; i++) {
+      stack.push_back(hits[i].second);
+    }
+  }
+  stats.hit_count += is_hit;
+}
+
+template <typename Node>
+TraversalStats TraceRaysWide(const std::vector<Node>& nodes,
+                             const std::vector<uint32_t>& primitive_ord,
+                             const Mesh& mesh,
+                             const std::vector<Ray>& rays) {
+  TraversalStats stats;
+  for (const auto& ray : rays) {
+    TraceRayWide(nodes, primitive_ord, mesh, ray, stats);
+  }
+  return stats;
+}
+
+// bucket i holds leaves with (2^(i-1), 2^i] primitives, last one the rest
+uint32_t GetLeafBucket(uint32_t primitive_count) {
+  uint32_t bucket = 0;
+  while (bucket + 1 < kLeafBucketCount && (1u << bucket) < primitive_count) {
+    bucket++;
+  }
+  return bucket;
+}
+
+std::string GetLeafBucketName(uint32_t bucket) {
+  uint32_t low = bucket == 0 ? 1 : (1u << (bucket - 1)) + 1;
+  if (bucket + 1 == kLeafBucketCount) {
+    return std::to_string(low) + "+";
+  }
+  uint32_t high = 1u << bucket;
+  return low == high ? std::to_string(low)
+                     : std::to_string(low) + "-" + std::to_string(high);
+}
+
+void AddLeaf(TreeStats& stats, uint32_t primitive_count, uint32_t depth) {
+  ++stats.leaf_count;
+  ++stats.leaf_histogram[GetLeafBucket(primitive_count)];
+  stats.max_depth = std::max(stats.max_depth, depth);
+  stats.leaf_depth_sum += depth;
+}
+
+TreeStats CalcTreeStats(const BVH& bvh) {
+  const auto& nodes = bvh.GetNodes();
+  TreeStats stats;
+  stats.sah_cost = bvh.CalcSAHCost();
+  stats.memory_size = nodes.size() * sizeof(BVHNode);
+  if (nodes.empty()) {
+    return stats;
+  }
+  // gap slots left by the in place builders are not reachable from root
+  std::vector<std::pair<uint32_t, uint32_t>> stack = {{0, 0}};
+  while (!stack.empty()) {
+    auto [v, depth] = stack.back();
+    stack.pop_back();
+    ++stats.node_count;
+    if (nodes[v].bvh_level == uint32_t(-1)) {
+      AddLeaf(stats, nodes[v].right - nodes[v].left, depth);
+      continue;
+    }
+    stack.push_back({nodes[v].left, depth + 1});
+    stack.push_back({nodes[v].right, depth + 1});
+  }
+  return stats;
+}
+
+// Leaves are child slots of wide nodes, they count as one level deeper.
+// SAH cost uses the same unit costs as BVH::CalcSAHCost.
+template <typename Node>
+TreeStats CalcWideTreeStats(const std::vector<Node>& nodes) {
+  const uint32_t width = std::tuple_size_v<decltype(Node::child)>;
+  TreeStats stats;
+  stats.memory_size = nodes.size() * sizeof(Node);
+  if (nodes.empty()) {
+    return stats;
+  }
+  BoundingBox root_bounds;
+  for (uint32_t i = 0; i < width; i++) {
+    if (nodes[0].child[i] != uint32_t(-1)) {
+      root_bounds.Unite(nodes[0].GetChildBounds(i));
+    }
+  }
+  double area_sum = root_bounds.GetSurfaceArea();
+  std::vector<std::pair<uint32_t, uint32_t>> stack = {{0, 0}};
+  while (!stack.empty()) {
+    auto [v, depth] = stack.back();
+    stack.pop_back();
+    ++stats.node_count;
+    for (uint32_t i = 0; i < width; i++) {
+      if (nodes[v].child[i] == uint32_t(-1)) {
+        continue;
+      }
+      float area = nodes[v].GetChildBounds(i).GetSurfaceArea();
+      uint32_t primitive_count = nodes[v].GetPrimitiveCount(i);
+      if (primitive_count == 0) {
+        area_sum += area;
+        stack.push_back({nodes[v].child[i], depth + 1});
+        continue;
+      }
+      area_sum += double(area) * primitive_count;
+      AddLeaf(stats, primitive_count, depth + 1);
+    }
+  }
+  float root_area = root_bounds.GetSurfaceArea();
+  stats.sah_cost = root_area > 0 ? area_sum / root_area : 0;
+  return stats;
+}
+
+void LogResult(const BenchmarkResult& result) {
+  const TreeStats& tree = result.tree;
+  const TraversalStats& traversal = result.traversal;
+  std::string histogram;
+  for (uint32_t i = 0; i < kLeafBucketCount; i++) {
+    histogram += (i == 0 ? "" : " ") + GetLeafBucketName(i) + ":" +
+                 std::to_string(tree.leaf_histogram[i]);
+  }
+  LOG << result.build_mode << "/" << result.layout << ": build "
+      << result.build_ms << "ms, convert " << result.convert_ms
+      << "ms, SAH cost: " << tree.sah_cost
+      << ", references: " << result.references
+      << ", nodes: " << tree.node_count << " (" << tree.memory_size / 1024
+      << "KiB), depth: " << tree.max_depth
+      << ", avg leaf depth: " << tree.GetAvgLeafDepth()
+      << ", leaves [" << histogram << "], nodes/ray: "
+      << traversal.GetNodesPerRay()
+      << ", triangles/ray: " << traversal.GetTrianglesPerRay()
+      << ", hits: " << traversal.hit_count;
+}
+
+template <typename Node>
+void AddWideResult(const Mesh& mesh,
+                   const std::vector<Ray>& rays,
+                   const std::vector<uint32_t>& primitive_ord,
+                   const BenchmarkResult& source,
+                   const std::string& layout,
+                   double convert_ms,
+                   const std::vector<Node>& nodes,
+                   std::vector<BenchmarkResult>& results) {
+  BenchmarkResult result = source;
+  result.layout = layout;
+  result.convert_ms = convert_ms;
+  result.tree = CalcWideTreeStats(nodes);
+  result.traversal = TraceRaysWide(nodes, primitive_ord, mesh, rays);
+  LogResult(result);
+  results.push_back(result);
+}
+
+template <uint32_t Width>
+WideBVH<Width> RunWideBenchmark(const Mesh& mesh,
+                                const std::vector<Ray>& rays,
+                                const BVH& bvh,
+                                const BenchmarkResult& source,
+                                std::vector<BenchmarkResult>& results) {
+  auto start = std::chrono::steady_clock::now();
+  WideBVH<Width> wide_bvh(bvh);
+  std::chrono::duration<double, std::milli> collapse_time =
+      std::chrono::steady_clock::now() - start;
+  AddWideResult(mesh, rays, bvh.GetPrimitiveOrd(), source,
+                "wide" + std::to_string(Width), collapse_time.count(),
+                wide_bvh.GetNodes(), results);
+  return wide_bvh;
+}
+
+void RunQuantizedBenchmark(const Mesh& mesh,
+                           const std::vector<Ray>& rays,
+                           const BVH& bvh,
+                           const WideBVH<4>& wide_bvh,
+                           const BenchmarkResult& source,
+                           std::vector<BenchmarkResult>& results) {
+  auto start = std::chrono::steady_clock::now();
+  QuantizedBVH quantized_bvh(wide_bvh);
+  std::chrono::duration<double, std::milli> quantize_time =
+      std::chrono::steady_clock::now() - start;
+  AddWideResult(mesh, rays, bvh.GetPrimitiveOrd(), source, "quantized4",
+                quantize_time.count(), quantized_bvh.GetNodes(), results);
+}
+
+// Pinhole cameras around the scene looking at its center, same projection
+// as PixCordToRay in raytrace.hlsl with aspect 1
+std::vector<Ray> GenerateCameraRays(const BoundingBox& bounds) {
+  glm::vec3 center = bounds.GetCenter();
+  glm::vec3 size = bounds.GetSize();
+  float radius = std::max(std::max(size.x, size.z), 1e-3f);
+  std::vector<Ray> rays;
+  rays.reserve(kViewCount * kViewResolution * kViewResolution);
+  for (uint32_t view = 0; view < kViewCount; view++) {
+    float angle = view * (2 * acos(-1.0f) / kViewCount);
+    glm::vec3 origin = center + glm::vec3(std::sin(angle) * radius,
+                                          size.y * 0.5f,
+                                          std::cos(angle) * radius);
+    glm::vec3 dir_z = glm::normalize(center - origin);
+    glm::vec3 dir_x =
+        glm::normalize(glm::cross(glm::vec3(0, 1, 0), dir_z));
+    glm::vec3 dir_y = glm::cross(dir_z, dir_x);
+    for (uint32_t y = 0; y < kViewResolution; y++) {
+      for (uint32_t x = 0; x < kViewResolution; x++) {
+        float ss_x = (float(x) / kViewResolution) * 2 - 1;
+        float ss_y = 1 - (float(y) / kViewResolution) * 2;
+        Ray ray;
+        ray.origin = origin;
+        ray.direction = glm::normalize(dir_x * ss_x + dir_y * ss_y + dir_z);
+        ray.inv_direction = glm::vec3(1.0f) / ray.direction;
+        rays.push_back(ray);
+      }
+    }
+  }
+  return rays;
+}
+
+void RunBenchmark(const Mesh& mesh,
+                  const std::vector<Ray>& rays,
+                  const std::string& scene,
+                  const std::string& build_mode,
+                  BVHBuildConfig config,
+                  std::vector<BenchmarkResult>& results) {
+  BVH bvh;
+  double best_build_ms = 1e30;
+  for (uint32_t i = 0; i < kBuildRepeatCount; i++) {
+    auto start = std::chrono::steady_clock::now();
+    bvh = BVH(mesh, config);
+    std::chrono::duration<double, std::milli> build_time =
+        std::chrono::steady_clock::now() - start;
+    best_build_ms = std::min(best_build_ms, build_time.count());
+  }
+
+  BenchmarkResult result;
+  result.scene = scene;
+  result.build_mode = build_mode;
+  result.layout = "binary";
+  result.build_ms = best_build_ms;
+  result.references = bvh.GetPrimitiveOrd().size();
+  result.tree = CalcTreeStats(bvh);
+  for (const auto& ray : rays) {
+    TraceRay(bvh, mesh, ray, result.traversal);
+  }
+  LogResult(result);
+  results.push_back(result);
+
+  WideBVH<4> wide_bvh = RunWideBenchmark<4>(mesh, rays, bvh, result, results);
+  RunQuantizedBenchmark(mesh, rays, bvh, wide_bvh, result, results);
+  RunWideBenchmark<8>(mesh, rays, bvh, result, results);
+}
+
+void RunSceneBenchmarks(const std::string& obj_path,
+                        std::vector<BenchmarkResult>& results) {
+  Mesh mesh = Mesh::LoadFromObj(obj_path);
+  if (mesh.index.empty()) {
+    LOG << "Nothing to benchmark in " << obj_path;
+    return;
+  }
+  LOG << obj_path << ": " << mesh.index.size() / 3 << " triangles";
+
+  std::vector<Ray> rays =
+      GenerateCameraRays(BVH::CalcBounds(BVH::BuildPrimitivesBB(mesh)));
+  const std::pair<BVHBuildMode, std::string> modes[] = {
+      {BVHBuildMode::kVolumeSweep, "volume_sweep"},
+      {BVHBuildMode::kBinnedSAH, "binned_sah"},
+      {BVHBuildMode::kLinear, "linear"},
+      {BVHBuildMode::kSpatialSplit, "spatial_split"},
+  };
+  BVHBuildConfig config;
+  config.parallel_build = true;
+  for (const auto& [mode, mode_name] : modes) {
+    config.mode = mode;
+    RunBenchmark(mesh, rays, obj_path, mode_name, config, results);
+  }
+}
+
+std::string ToJSONString(const std::string& str) {
+  std::string res = "\"";
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      res += '\\';
+    }
+    res += c;
+  }
+  return res + "\"";
+}
+
+// Quoted, so that paths with commas stay one field
+std::string ToCSVString(const std::string& str) {
+  std::string res = "\"";
+  for (char c : str) {
+    if (c == '"') {
+      res += '"';
+    }
+    res += c;
+  }
+  return res + "\"";
+}
+
+bool WriteCSV(const std::string& path,
+              const std::vector<BenchmarkResult>& results) {
+  std::ofstream out(path);
+  if (!out) {
+    return false;
+  }
+  out << "scene,build_mode,layout,build_ms,convert_ms,sah_cost,references,"
+         "nodes,memory_bytes,leaves,max_depth,avg_leaf_depth,";
+  for (uint32_t i = 0; i < kLeafBucketCount; i++) {
+    out << "leaves_" << GetLeafBucketName(i) << ",";
+  }
+  out << "rays,nodes_per_ray,triangles_per_ray,hits\n";
+  for (const auto& result : results) {
+    out << ToCSVString(result.scene) << "," << result.build_mode << "," << result.layout
+        << "," << result.build_ms << "," << result.convert_ms << ","
+        << result.tree.sah_cost << "," << result.references << ","
+        << result.tree.node_count << "," << result.tree.memory_size << ","
+        << result.tree.leaf_count << "," << result.tree.max_depth << ","
+        << result.tree.GetAvgLeafDepth() << ",";
+    for (uint32_t count : result.tree.leaf_histogram) {
+      out << count << ",";
+    }
+    out << result.traversal.ray_count << ","
+        << result.traversal.GetNodesPerRay() << ","
+        << result.traversal.GetTrianglesPerRay() << ","
+        << result.traversal.hit_count << "\n";
+  }
+  return bool(out);
+}
+
+bool WriteJSON(const std::string& path,
+               const std::vector<BenchmarkResult>& results) {
+  std::ofstream out(path);
+  if (!out) {
+    return false;
+  }
+  out << "[\n";
+  for (size_t i = 0; i < results.size(); i++) {
+    const BenchmarkResult& result = results[i];
+    out << "  {\"scene\": " << ToJSONString(result.scene)
+        << ", \"build_mode\": " << ToJSONString(result.build_mode)
+        << ", \"layout\": " << ToJSONString(result.layout)
+        << ", \"build_ms\": " << result.build_ms
+        << ", \"convert_ms\": " << result.convert_ms
+        << ", \"sah_cost\": " << result.tree.sah_cost
+        << ", \"references\": " << result.references
+        << ", \"nodes\": " << result.tree.node_count
+        << ", \"memory_bytes\": " << result.tree.memory_size
+        << ", \"leaves\": " << result.tree.leaf_count
+        << ", \"max_depth\": " << result.tree.max_depth
+        << ", \"avg_leaf_depth\": " << result.tree.GetAvgLeafDepth()
+        << ", \"leaf_histogram\": {";
+    for (uint32_t j = 0; j < kLeafBucketCount; j++) {
+      out << (j == 0 ? "" : ", ") << ToJSONString(GetLeafBucketName(j))
+          << ": " << result.tree.leaf_histogram[j];
+    }
+    out << "}, \"rays\": " << result.traversal.ray_count
+        << ", \"nodes_per_ray\": " << result.traversal.GetNodesPerRay()
+        << ", \"triangles_per_ray\": "
+        << result.traversal.GetTrianglesPerRay()
+        << ", \"hits\": " << result.traversal.hit_count << "}"
+        << (i + 1 == results.size() ? "\n" : ",\n");
+  }
+  out << "]\n";
+  return bool(out);
+}
+
+}  // namespace
+
+// bvh_benchmark [--csv <path>] [--json <path>] [obj files...]
+int main(int argc, char** argv) {
+  std::vector<std::string> obj_paths;
+  std::string csv_path;
+  std::string json_path;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if ((arg == "--csv" || arg == "--json") && i + 1 < argc) {
+      (arg == "--csv" ? csv_path : json_path) = argv[++i];
+      continue;
+    }
+    obj_paths.push_back(arg);
+  }
+  if (obj_paths.empty()) {
+    obj_paths.push_back("../assets/objects/serpentine_city.obj");
+  }
+
+  std::vector<BenchmarkResult> results;
+  for (const auto& obj_path : obj_paths) {
+    RunSceneBenchmarks(obj_path, results);
+  }
+  if (results.empty()) {
+    LOG << "Nothing to benchmark";
+    return 1;
+  }
+  if (!csv_path.empty() && !WriteCSV(csv_path, results)) {
+    LOG << "Failed to write " << csv_path;
+    return 1;
+  }
+  if (!json_path.empty() && !WriteJSON(json_path, results)) {
+    LOG << "Failed to write " << json_path;
+    return 1;
+  }
+  return 0;
+}
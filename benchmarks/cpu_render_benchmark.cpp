@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <string>
+
+#include <glm/glm.hpp>
+
+#include "cpu_render/packet_tracer.h"
+#include "render_data/bvh.h"
+#include "render_data/camera_info.h"
+#include "render_data/mesh.h"
+#include "utill/logger.h"
+#include "utill/transform.h"
+
+using render_data::BVH;
+using render_data::BVHBuildConfig;
+using render_data::BVHBuildMode;
+using render_data::CameraInfo;
+using render_data::Mesh;
+
+namespace {
+
+#ifdef __AVX2__
+const char* kFloat8Path = "AVX2";
+#else
+const char* kFloat8Path = "scalar";
+#endif
+const uint32_t kRenderRepeatCount = 5;
+const uint32_t kImageWidth = 1280;
+const uint32_t kImageHeight = 768;
+
+// Camera in front of the scene looking along +z, like the initial camera of
+// examples::RayTracer
+CameraInfo GetSceneCamera(const Mesh& mesh) {
+  auto bounds = BVH::CalcBounds(BVH::BuildPrimitivesBB(mesh));
+  glm::vec3 center = bounds.GetCenter();
+  glm::vec3 size = bounds.GetSize();
+  float radius = std::max(std::max(size.x, size.y), 1e-3f);
+  CameraInfo camera;
+  camera.camera_to_world =
+      utill::Transform::Translation(center - glm::vec3(0, 0, radius));
+  camera.screen_width = kImageWidth;
+  camera.screen_height = kImageHeight;
+  camera.aspect = float(kImageWidth) / kImageHeight;
+  return camera;
+}
+
+void WritePPM(const cpu_render::Image& image, const std::string& path) {
+  std::ofstream out(path, std::ios::binary);
+  out << "P6\n" << image.width << " " << image.height << "\n255\n";
+  for (const glm::vec4& color : image.color) {
+    for (uint32_t i = 0; i < 3; i++) {
+      out.put(char(std::clamp(color[i], 0.0f, 1.0f) * 255));
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string obj_path = "../assets/objects/serpentine_city.obj";
+  std::string out_path = "cpu_render.ppm";
+  if (argc > 1) {
+    obj_path = argv[1];
+  }
+  if (argc > 2) {
+    out_path = argv[2];
+  }
+  Mesh mesh = Mesh::LoadFromObj(obj_path);
+  if (mesh.index.empty()) {
+    LOG << "Nothing to render";
+    return 1;
+  }
+
+  BVHBuildConfig config;
+  config.mode = BVHBuildMode::kBinnedSAH;
+  config.parallel_build = true;
+  BVH bvh(mesh, config);
+  mesh.ReorderPrimitives(bvh.GetPrimitiveOrd());
+
+  CameraInfo camera = GetSceneCamera(mesh);
+  cpu_render::PacketTracer tracer(mesh, bvh, {glm::vec4(0, 500, 20, 1)});
+  cpu_render::Image image;
+  double best_ms = 1e30;
+  for (uint32_t i = 0; i < kRenderRepeatCount; i++) {
+    auto start = std::chrono::high_resolution_clock::now();
+    tracer.Render(camera, image);
+    auto end = std::chrono::high_resolution_clock::now();
+    best_ms = std::min(
+        best_ms, std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  double mrays = double(kImageWidth) * kImageHeight / (best_ms * 1e3);
+  LOG << "Triangles: " << mesh.index.size() / 3 << " render: " << best_ms
+      << "ms (" << mrays << " Mrays/s primary), Float8 path: "
+      << kFloat8Path;
+  WritePPM(image, out_path);
+  LOG << "Image written to " << out_path;
+  return 0;
+}
@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "cpu_render/packet_tracer.h"
+#include "render_data/bvh.h"
+#include "render_data/camera_info.h"
+#include "render_data/mesh.h"
+#include "render_data/mesh_lod.h"
+#include "utill/logger.h"
+#include "utill/transform.h"
+
+using render_data::BoundingBox;
+using render_data::BVH;
+using render_data::BVHBuildConfig;
+using render_data::BVHBuildMode;
+using render_data::CameraInfo;
+using render_data::Mesh;
+using render_data::MeshLOD;
+
+namespace {
+
+const uint32_t kRenderRepeatCount = 3;
+const uint32_t kImageWidth = 640;
+const uint32_t kImageHeight = 384;
+// camera distance from the scene center in scene radii
+const float kDistanceFactors[] = {1, 2, 4, 8, 16};
+// same threshold as examples::RayTracer
+const float kMaxPixelError = 1.0f;
+// color difference that counts a pixel as changed
+const float kPixelDiffThreshold = 2.0f / 255;
+
+// One row of the report: 'level' rendered from 'distance_factor'
+struct BenchmarkResult {
+  float distance_factor = 0;
+  uint32_t level = 0;
+  uint32_t triangles = 0;
+  float error = 0;
+  float projected_error = 0;
+  // level SelectLOD picks from this distance
+  bool is_selected = false;
+  // best of kRenderRepeatCount
+  double render_ms = 0;
+  // against level 0 from the same camera
+  double mean_color_diff = 0;
+  double changed_pixels = 0;
+};
+
+// Camera looking along +z at the scene center, like the one of
+// cpu_render_benchmark
+CameraInfo GetSceneCamera(const BoundingBox& bounds, float distance) {
+  CameraInfo camera;
+  camera.camera_to_world = utill::Transform::Translation(
+      bounds.GetCenter() - glm::vec3(0, 0, distance));
+  camera.screen_width = kImageWidth;
+  camera.screen_height = kImageHeight;
+  camera.aspect = float(kImageWidth) / kImageHeight;
+  return camera;
+}
+
+double Render(const cpu_render::PacketTracer& tracer,
+              const CameraInfo& camera,
+              cpu_render::Image& image) {
+  double best_ms = 1e30;
+  for (uint32_t i = 0; i < kRenderRepeatCount; i++) {
+    auto start = std::chrono::high_resolution_clock::now();
+    tracer.Render(camera, image);
+    auto end = std::chrono::high_resolution_clock::now();
+    best_ms = std::min(
+        best_ms,
+        std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  return best_ms;
+}
+
+void CompareImages(const cpu_render::Image& reference,
+                   const cpu_render::Image& image,
+                   BenchmarkResult& result) {
+  double diff_sum = 0;
+  uint32_t changed_count = 0;
+  for (size_t i = 0; i < reference.color.size(); i++) {
+    glm::vec3 diff =
+        glm::abs(glm::vec3(image.color[i]) - glm::vec3(reference.color[i]));
+    diff_sum += (diff.x + diff.y + diff.z) / 3;
+    changed_count += std::max(std::max(diff.x, diff.y), diff.z) >
+                     kPixelDiffThreshold;
+  }
+  size_t pixel_count = std::max<size_t>(reference.color.size(), 1);
+  result.mean_color_diff = diff_sum / pixel_count;
+  result.changed_pixels = double(changed_count) / pixel_count;
+}
+
+bool WriteCSV(const std::string& path,
+              const std::vector<BenchmarkResult>& results) {
+  std::ofstream out(path);
+  if (!out) {
+    return false;
+  }
+  out << "distance_factor,level,triangles,error,projected_error_px,selected,"
+         "render_ms,mean_color_diff,changed_pixels\n";
+  for (const auto& result : results) {
+    out << result.distance_factor << "," << result.level << ","
+        << result.triangles << "," << result.error << ","
+        << result.projected_error << "," << result.is_selected << ","
+        << result.render_ms << "," << result.mean_color_diff << ","
+        << result.changed_pixels << "\n";
+  }
+  return bool(out);
+}
+
+}  // namespace
+
+// Renders every LOD of the scene on the CPU from several distances,
+// reporting render time and image difference to the full detail mesh.
+// lod_benchmark [--csv <path>] [obj file]
+int main(int argc, char** argv) {
+  std::string obj_path = "../assets/objects/serpentine_city.obj";
+  std::string csv_path;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--csv" && i + 1 < argc) {
+      csv_path = argv[++i];
+      continue;
+    }
+    obj_path = arg;
+  }
+  Mesh mesh = Mesh::LoadFromObj(obj_path);
+  if (mesh.index.empty()) {
+    LOG << "Nothing to render";
+    return 1;
+  }
+  BoundingBox bounds = BVH::CalcBounds(BVH::BuildPrimitivesBB(mesh));
+  float radius = glm::length(bounds.GetSize()) / 2;
+
+  BVHBuildConfig config;
+  config.mode = BVHBuildMode::kBinnedSAH;
+  config.parallel_build = true;
+  auto build_start = std::chrono::high_resolution_clock::now();
+  std::vector<MeshLOD> lods =
+      render_data::BuildLODChain(std::move(mesh), config);
+  auto build_end = std::chrono::high_resolution_clock::now();
+  LOG << "Built " << lods.size() << " LODs in "
+      << std::chrono::duration<double, std::milli>(build_end - build_start)
+             .count()
+      << "ms";
+
+  std::vector<float> level_error;
+  std::vector<cpu_render::PacketTracer> tracers;
+  tracers.reserve(lods.size());
+  for (const MeshLOD& lod : lods) {
+    level_error.push_back(lod.error);
+    tracers.emplace_back(lod.mesh, lod.bvh,
+                         std::vector<glm::vec4>{glm::vec4(0, 500, 20, 1)});
+  }
+
+  std::vector<BenchmarkResult> results;
+  cpu_render::Image reference;
+  cpu_render::Image image;
+  for (float distance_factor : kDistanceFactors) {
+    CameraInfo camera = GetSceneCamera(bounds, distance_factor * radius);
+    float distance = std::max(distance_factor * radius - radius, 0.0f);
+    uint32_t selected =
+        render_data::SelectLOD(level_error, distance, camera, kMaxPixelError);
+    for (uint32_t level = 0; level < lods.size(); level++) {
+      BenchmarkResult result;
+      result.distance_factor = distance_factor;
+      result.level = level;
+      result.triangles = lods[level].mesh.index.size() / 3;
+      result.error = lods[level].error;
+      result.projected_error =
+          render_data::CalcProjectedError(result.error, distance, camera);
+      result.is_selected = level == selected;
+      result.render_ms =
+          Render(tracers[level], camera, level == 0 ? reference : image);
+      if (level > 0) {
+        CompareImages(reference, image, result);
+      }
+      LOG << "Distance " << distance_factor << "r, LOD " << level
+          << (result.is_selected ? " (selected)" : "") << ": "
+          << result.triangles << " triangles, " << result.render_ms
+          << "ms, projected error: " << result.projected_error
+          << "px, mean color diff: " << result.mean_color_diff
+          << ", changed pixels: " << result.changed_pixels * 100 << "%";
+      results.push_back(result);
+    }
+  }
+  if (!csv_path.empty() && !WriteCSV(csv_path, results)) {
+    LOG << "Failed to write " << csv_path;
+    return 1;
+  }
+  return 0;
+}
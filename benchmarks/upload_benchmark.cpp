@@ -0,0 +1,157 @@
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "base/base.h"
+#include "base/context.h"
+#include "gpu_resources/buffer.h"
+#include "gpu_resources/physical_buffer.h"
+#include "render_data/transfer_scheduler.h"
+#include "render_graph/render_graph.h"
+#include "utill/error_handling.h"
+#include "utill/logger.h"
+
+namespace {
+
+const uint32_t kRepeatCount = 3;
+const vk::DeviceSize kUploadSizes[] = {16 << 20, 64 << 20, 256 << 20};
+// same budget as examples::RayTracer
+const vk::DeviceSize kFrameBudget = 32 << 20;
+const vk::DeviceSize kStagingSize = 64 << 20;
+
+// One row of the report: an upload of 'size' bytes
+struct BenchmarkResult {
+  vk::DeviceSize size = 0;
+  bool direct_write = false;
+  // destination got host visible memory, so direct writes were possible
+  bool is_mapped = false;
+  uint32_t frames = 0;
+  // best of kRepeatCount, until the last upload frame completes
+  double upload_ms = 0;
+  double throughput_gbs = 0;
+};
+
+// Uploads 'data' to a fresh device local buffer through a render graph with
+// only a TransferScheduler, rendering frames until the upload is complete
+BenchmarkResult RunUpload(const std::vector<char>& data, bool direct_write) {
+  render_graph::RenderGraph render_graph;
+  auto& resource_manager = render_graph.GetResourceManager();
+  gpu_resources::Buffer* staging_buffer = resource_manager.AddBuffer({});
+  gpu_resources::BufferProperties dst_properties{};
+  dst_properties.size = data.size();
+  dst_properties.usage_flags = vk::BufferUsageFlagBits::eStorageBuffer;
+  dst_properties.memory_flags = vk::MemoryPropertyFlagBits::eDeviceLocal;
+  gpu_resources::Buffer* dst = resource_manager.AddBuffer(dst_properties);
+
+  render_data::TransferSchedulerConfig config;
+  config.frame_budget = kFrameBudget;
+  config.staging_size = kStagingSize;
+  config.direct_write = direct_write;
+  render_data::TransferScheduler upload(
+      staging_buffer, &render_graph.GetFrameSemaphore(), {dst}, {}, config);
+  render_graph.AddPass(&upload);
+  render_graph.Init();
+
+  BenchmarkResult result;
+  result.size = data.size();
+  result.direct_write = direct_write;
+  result.is_mapped = dst->GetBuffer()->GetMappingStart() != nullptr;
+  // data outlives the upload, so it is copied only once, like scene data
+  std::shared_ptr<const char[]> unowned_data(data.data(), [](const char*) {});
+  auto start = std::chrono::high_resolution_clock::now();
+  CHECK(upload.ScheduleBufferTransfer(dst, unowned_data, data.size()))
+      << "Upload queue is full";
+  while (!upload.IsIdle()) {
+    render_graph.RenderFrame();
+    ++result.frames;
+  }
+  vk::Result wait_result = render_graph.GetFrameSemaphore().Wait();
+  CHECK_VK_RESULT(wait_result) << "Failed to wait for the upload";
+  auto end = std::chrono::high_resolution_clock::now();
+  result.upload_ms =
+      std::chrono::duration<double, std::milli>(end - start).count();
+  result.throughput_gbs = data.size() / (result.upload_ms * 1e6);
+  return result;
+}
+
+bool WriteCSV(const std::string& path,
+              const std::vector<BenchmarkResult>& results) {
+  std::ofstream out(path);
+  if (!out) {
+    return false;
+  }
+  out << "size_mib,direct_write,is_mapped,frames,upload_ms,"
+         "throughput_gbs\n";
+  for (const auto& result : results) {
+    out << (result.size >> 20) << "," << result.direct_write << ","
+        << result.is_mapped << "," << result.frames << ","
+        << result.upload_ms << "," << result.throughput_gbs << "\n";
+  }
+  return bool(out);
+}
+
+}  // namespace
+
+// Uploads buffers of several sizes through render_data::TransferScheduler,
+// once through staging and once with direct writes, reporting throughput.
+// Without host visible device local memory both take the staging path.
+// upload_benchmark [--csv <path>]
+int main(int argc, char** argv) {
+  std::string csv_path;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--csv" && i + 1 < argc) {
+      csv_path = argv[++i];
+    }
+  }
+
+  base::BaseConfig base_config = {
+      {VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME,
+       VK_EXT_DEBUG_UTILS_EXTENSION_NAME},
+      {},
+      "RL upload benchmark",
+      "RL",
+  };
+  base::ContextConfig context_config = {
+      {},
+      {VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+       VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME,
+       VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME,
+       VK_KHR_COPY_COMMANDS_2_EXTENSION_NAME},
+      1,
+      vk::QueueFlagBits::eCompute | vk::QueueFlagBits::eGraphics};
+  base::Base::Get().Init(base_config, vk::Extent2D{64, 64}, context_config);
+
+  std::vector<BenchmarkResult> results;
+  for (vk::DeviceSize size : kUploadSizes) {
+    std::vector<char> data(size);
+    for (size_t i = 0; i < data.size(); i++) {
+      data[i] = char(i * 7);
+    }
+    for (bool direct_write : {false, true}) {
+      BenchmarkResult best;
+      for (uint32_t i = 0; i < kRepeatCount; i++) {
+        BenchmarkResult result = RunUpload(data, direct_write);
+        if (i == 0 || result.upload_ms < best.upload_ms) {
+          best = result;
+        }
+      }
+      LOG << (size >> 20) << "MiB "
+          << (direct_write ? "direct write" : "staging")
+          << (direct_write && !best.is_mapped ? " (fell back to staging)"
+                                              : "")
+          << ": " << best.upload_ms << "ms in " << best.frames
+          << " frames, " << best.throughput_gbs << "GB/s";
+      results.push_back(best);
+    }
+  }
+  if (!csv_path.empty() && !WriteCSV(csv_path, results)) {
+    LOG << "Failed to write " << csv_path;
+    return 1;
+  }
+  return 0;
+}
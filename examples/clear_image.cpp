@@ -0,0 +1,33 @@
+#include "clear_image.h"
+
+#include "gpu_resources/physical_image.h"
+#include "utill/error_handling.h"
+
+namespace examples {
+
+ClearImagePass::ClearImagePass(gpu_resources::Image* target,
+                               vk::ClearColorValue color)
+    : Pass(0), target_(target), color_(color) {
+  DCHECK(target != nullptr) << "target must be valid gpu_resources::Image";
+  gpu_resources::ImageProperties target_requirements = {};
+  target_requirements.usage_flags = vk::ImageUsageFlagBits::eTransferDst;
+  target_->RequireProperties(target_requirements);
+}
+
+void ClearImagePass::OnPreRecord() {
+  gpu_resources::ResourceAccess target_access{
+      vk::PipelineStageFlagBits2KHR::eTransfer,
+      vk::AccessFlagBits2KHR::eTransferWrite,
+      vk::ImageLayout::eTransferDstOptimal};
+  target_->DeclareAccess(target_access, GetPassIdx());
+}
+
+void ClearImagePass::OnRecord(vk::CommandBuffer primary_cmd,
+                              const std::vector<vk::CommandBuffer>&) noexcept {
+  gpu_resources::PhysicalImage* image = target_->GetImage();
+  primary_cmd.clearColorImage(image->GetImage(),
+                              vk::ImageLayout::eTransferDstOptimal, color_,
+                              image->GetSubresourceRange());
+}
+
+}  // namespace examples
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "gpu_resources/image.h"
+#include "render_graph/render_graph.h"
+
+namespace examples {
+
+// Fills 'target' with a constant color every frame
+class ClearImagePass : public render_graph::Pass {
+  gpu_resources::Image* target_;
+  vk::ClearColorValue color_;
+
+ public:
+  ClearImagePass() = default;
+  ClearImagePass(gpu_resources::Image* target, vk::ClearColorValue color);
+  void OnPreRecord() override;
+  void OnRecord(vk::CommandBuffer primary_cmd,
+                const std::vector<vk::CommandBuffer>&) noexcept override;
+};
+
+}  // namespace examples
@@ -1,6 +1,10 @@
 #include "raytracer.h"
 
 #include <vcruntime.h>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <span>
 #include <vector>
 #include <vulkan/vulkan_enums.hpp>
 
@@ -12,10 +16,19 @@
 #include "gpu_resources/resource_access_syncronizer.h"
 #include "pipeline_handler/descriptor_binding.h"
 #include "render_data/bvh.h"
+#include "render_data/intersection_triangle.h"
 #include "render_data/mesh.h"
+#include "render_data/mesh_cluster.h"
+#include "render_data/mesh_lod.h"
+#include "render_data/quantized_bvh.h"
+#include "render_data/quantized_mesh.h"
+#include "render_data/scene_cache.h"
+#include "render_data/two_level_bvh.h"
+#include "render_data/wide_bvh.h"
 #include "utill/error_handling.h"
 #include "utill/input_manager.h"
 #include "utill/logger.h"
+#include "utill/thread_pool.h"
 
 using utill::Transform;
 
@@ -31,14 +44,61 @@ const static std::string kLightBufferName = "light_buffer";
 const static std::string kCameraInfoBufferName = "camera_info";
 const static std::string kStagingBufferName = "staging_buffer";
 const static std::string kBVHBufferName = "bvh_buffer";
+const static std::string kSceneObjPath =
+    "../assets/objects/serpentine_city.obj";
+const static std::string kSceneCachePath = kSceneObjPath + ".cache";
 const static float PI = acos(-1);
+// Lays out scene vertices in first use order of BVH leaves. Disable to
+// compare dispatch timings, the scene cache is bypassed then, since it holds
+// the reordered layout.
+const static bool kReorderVertices = true;
+// Intersects triangles from a pre-gathered render_data::IntersectionTriangle
+// buffer instead of indexed positions, shading still uses the index
+const static bool kUseTriangleBuffer = true;
+// Uploads render_data::MeshCluster table of the scene BVH for cluster
+// culling passes, not built for BVHLayout::kTwoLevel
+const static bool kBuildClusters = true;
+// BVHLayout::kTwoLevel instances use the coarsest scene LOD whose error
+// projects to at most this many pixels
+const static float kLODMaxPixelError = 1.0f;
+// scene geometry is uploaded at most this many bytes per frame
+const static vk::DeviceSize kUploadFrameBudget = 32 << 20;
+// host visible staging of frame budgeted uploads, independent of scene size
+const static vk::DeviceSize kUploadStagingSize = 64 << 20;
+// top level staging ring fits this many frames in flight
+const static uint32_t kTopLevelStagingFrames = 4;
+// Uploads scene geometry with render_data::AsyncUploader on a transfer
+// queue instead of the frame budgeted render_data::TransferScheduler
+const static bool kAsyncGeometryUpload = true;
+const static uint32_t kDispatchTimingFrames = 256;
+const static uint32_t kTimerFrameCount = 4;
 
 const static std::vector<std::string> kGeometryBufferNames = {
     kVertexBufferName, kNormalBufferName, kTexcoordBufferName,
     kIndexBufferName};
 
 static render_data::Mesh g_scene_mesh;
+static render_data::CompactIndex g_scene_compact_index;
+static render_data::SceneCache g_scene_cache;
 static render_data::BVH g_scene_bvh;
+static render_data::WideBVH<4> g_scene_wide_bvh;
+// WIDE_BVH_STACK_SIZE of raytrace.hlsl
+const static uint32_t kWideBVHStackSize = 64;
+static render_data::QuantizedBVH g_scene_quantized_bvh;
+static render_data::QuantizedMesh g_scene_quantized_mesh;
+static render_data::TwoLevelBVH g_scene_two_level;
+static std::vector<render_data::MeshInstance> g_scene_instances;
+// render_data::MeshLOD::error of scene LODs, bottom levels of
+// g_scene_two_level in the same order
+static std::vector<float> g_scene_lod_error;
+static render_data::BoundingBox g_scene_lod_bounds;
+static std::vector<render_data::IntersectionTriangle> g_scene_triangles;
+static std::vector<render_data::MeshCluster> g_scene_clusters;
+static std::unique_ptr<utill::TaskGroup> g_scene_load;
+static std::chrono::steady_clock::time_point g_scene_load_start;
+static BVHLayout g_bvh_layout = BVHLayout::kBinary;
+static IndexFormat g_index_format = IndexFormat::kPerAttribute;
+static VertexFormat g_vertex_format = VertexFormat::kFloat;
 static std::vector<glm::vec4> g_light_buffer = {{0, 500, 20, 1.0}};
 static CameraInfo g_camera_info;
 static bool g_is_update_camera_transform_ = false;
@@ -48,6 +108,12 @@ static int g_move_axis[][2] = {{GLFW_KEY_A, GLFW_KEY_D},
 
 using gpu_resources::GetDataSize;
 
+static int64_t GetMsSinceSceneLoadStart() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now() - g_scene_load_start)
+      .count();
+}
+
 static float GetAxisVal(int axis) {
   if (utill::InputManager::IsKeyPressed(g_move_axis[axis][0])) {
     return -1;
@@ -57,77 +123,339 @@ static float GetAxisVal(int axis) {
   return 0;
 }
 
+// Scene geometry in upload order, mapped from g_scene_cache when binary
+// layout can use it as is
+struct SceneGeometry {
+  std::span<const glm::vec4> position;
+  std::span<const glm::vec4> normal;
+  std::span<const glm::vec2> tex_coord;
+  std::span<const glm::uvec4> index;
+};
+
+// The cache holds the binary BVH and fp32 attributes, so only the default
+// binary layout with fp32 vertices uploads straight from its mapping. Wide
+// layouts are collapsed from it and quantized vertices need BVH bounds
+// grown by ExpandSceneBVHBounds, both work on owning copies.
+static bool IsUsingSceneCache() {
+  return g_bvh_layout == BVHLayout::kBinary &&
+         g_vertex_format != VertexFormat::kQuantized &&
+         g_scene_cache.IsLoaded();
+}
+
+static SceneGeometry GetSceneGeometry() {
+  if (IsUsingSceneCache()) {
+    return {g_scene_cache.GetPosition(), g_scene_cache.GetNormal(),
+            g_scene_cache.GetTexCoord(), g_scene_cache.GetIndex()};
+  }
+  const render_data::Mesh& mesh = g_bvh_layout == BVHLayout::kTwoLevel
+                                      ? g_scene_two_level.GetMesh()
+                                      : g_scene_mesh;
+  return {mesh.position, mesh.normal, mesh.tex_coord, mesh.index};
+}
+
+// Vertex attribute buffer contents in g_vertex_format
+struct VertexData {
+  std::span<const char> position;
+  std::span<const char> normal;
+  std::span<const char> tex_coord;
+};
+
 template <typename T>
-static void FillStagingBuffer(gpu_resources::Buffer* staging_buffer,
-                              const std::vector<T>& data,
-                              size_t& dst_offset) {
-  DCHECK(staging_buffer) << "Unexpected null";
-  size_t data_byte_size = GetDataSize(data);
-  void* map_start = staging_buffer->GetBuffer()->GetMappingStart();
-  DCHECK(map_start) << "Expected buffer memory to be mapped";
-  memcpy((char*)map_start + dst_offset, data.data(), data_byte_size);
-  dst_offset += data_byte_size;
-}
-
-static void RecordCopyFromStaging(vk::CommandBuffer cmd,
-                                  gpu_resources::Buffer* staging_buffer,
-                                  gpu_resources::Buffer* dst_buffer,
-                                  size_t& staging_offset,
-                                  size_t size) {
-  gpu_resources::Buffer::RecordCopy(cmd, *staging_buffer, *dst_buffer,
-                                    staging_offset, 0, size);
-  staging_offset += size;
-}
-
-size_t GeometryBuffers::AddBuffersToRenderGraph(
+static std::span<const char> AsBytes(std::span<const T> data) {
+  return {reinterpret_cast<const char*>(data.data()), GetDataSize(data)};
+}
+
+static VertexData GetVertexData() {
+  if (g_vertex_format == VertexFormat::kQuantized) {
+    return {AsBytes<glm::uvec2>(g_scene_quantized_mesh.GetPosition()),
+            AsBytes<uint32_t>(g_scene_quantized_mesh.GetNormal()),
+            AsBytes<uint32_t>(g_scene_quantized_mesh.GetTexCoord())};
+  }
+  SceneGeometry scene_geometry = GetSceneGeometry();
+  return {AsBytes(scene_geometry.position), AsBytes(scene_geometry.normal),
+          AsBytes(scene_geometry.tex_coord)};
+}
+
+static std::span<const render_data::BVHNode> GetSceneBVHNodes() {
+  if (IsUsingSceneCache()) {
+    return g_scene_cache.GetBVHNodes();
+  }
+  return g_scene_bvh.GetNodes();
+}
+
+static std::span<const uint32_t> GetSceneCompactIndex() {
+  if (IsUsingSceneCache()) {
+    return g_scene_cache.GetCompactIndex();
+  }
+  return g_scene_compact_index.data;
+}
+
+static std::span<const char> GetIndexData() {
+  if (g_index_format == IndexFormat::kPerAttribute) {
+    return AsBytes(GetSceneGeometry().index);
+  }
+  return AsBytes(GetSceneCompactIndex());
+}
+
+static std::span<const char> GetBVHData() {
+  switch (g_bvh_layout) {
+    case BVHLayout::kWide4:
+      return AsBytes<render_data::WideBVHNode<4>>(
+          g_scene_wide_bvh.GetNodes());
+    case BVHLayout::kQuantizedWide4:
+      return AsBytes<render_data::QuantizedBVHNode>(
+          g_scene_quantized_bvh.GetNodes());
+    case BVHLayout::kTwoLevel:
+      return AsBytes<render_data::BVHNode>(
+          g_scene_two_level.GetBottomLevelNodes());
+    default:
+      return AsBytes(GetSceneBVHNodes());
+  }
+}
+
+// Scene mesh instanced on a kInstanceGridSize x kInstanceGridSize grid,
+// bottom levels are the scene LODs, picked per instance by
+// SelectInstanceLODs
+static void InitTwoLevelScene(render_data::BVHBuildConfig blas_config) {
+  const uint32_t kInstanceGridSize = 2;
+  g_scene_lod_bounds = render_data::BVH::CalcBounds(
+      render_data::BVH::BuildPrimitivesBB(g_scene_mesh));
+  glm::vec3 scene_size = g_scene_lod_bounds.GetSize();
+  auto lod_build_start = std::chrono::steady_clock::now();
+  std::vector<render_data::MeshLOD> lods =
+      render_data::BuildLODChain(std::move(g_scene_mesh), blas_config);
+  auto lod_build_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - lod_build_start);
+  LOG << "Built " << lods.size() << " scene LODs in "
+      << lod_build_time.count() << "ms";
+  std::vector<render_data::Mesh> meshes;
+  std::vector<render_data::BVH> bottom_levels;
+  g_scene_lod_error.clear();
+  for (render_data::MeshLOD& lod : lods) {
+    LOG << "LOD " << meshes.size() << ": " << lod.mesh.index.size() / 3
+        << " triangles, error: " << lod.error;
+    meshes.push_back(std::move(lod.mesh));
+    bottom_levels.push_back(std::move(lod.bvh));
+    g_scene_lod_error.push_back(lod.error);
+  }
+  g_scene_two_level =
+      render_data::TwoLevelBVH(std::move(meshes), bottom_levels);
+
+  g_scene_instances.clear();
+  for (uint32_t x = 0; x < kInstanceGridSize; x++) {
+    for (uint32_t z = 0; z < kInstanceGridSize; z++) {
+      glm::vec3 offset(x * scene_size.x * 1.1f, 0, z * scene_size.z * 1.1f);
+      g_scene_instances.push_back({0, Transform::Translation(offset)});
+    }
+  }
+  g_scene_two_level.BuildTopLevel(g_scene_instances);
+}
+
+// Scene mesh reordered by its binary BVH, welded and with vertices in
+// first use order unless kReorderVertices is off. From kSceneCachePath
+// when it matches the obj file and build config. Binary layout with fp32
+// vertices uploads straight from the mapped cache, everything else gets
+// owning copies to convert.
+static void LoadScene(render_data::BVHBuildConfig bvh_config) {
+  auto load_start = std::chrono::steady_clock::now();
+  uint64_t cache_key =
+      kReorderVertices
+          ? render_data::SceneCache::CalcKey(kSceneObjPath, bvh_config)
+          : 0;
+  if (cache_key != 0 && g_scene_cache.Load(kSceneCachePath, cache_key)) {
+    if (!IsUsingSceneCache()) {
+      g_scene_mesh = g_scene_cache.GetMesh();
+      g_scene_bvh = g_scene_cache.GetBVH(bvh_config);
+      auto compact_index = g_scene_cache.GetCompactIndex();
+      g_scene_compact_index.is_16bit = g_scene_cache.IsCompactIndex16Bit();
+      g_scene_compact_index.data.assign(compact_index.begin(),
+                                        compact_index.end());
+    }
+    auto load_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - load_start);
+    LOG << "Loaded scene from " << kSceneCachePath << " in "
+        << load_time.count() << "ms";
+    return;
+  }
+
+  g_scene_mesh = render_data::Mesh::LoadFromObj(kSceneObjPath);
+  auto bvh_build_start = std::chrono::steady_clock::now();
+  g_scene_bvh = render_data::BVH(g_scene_mesh, bvh_config);
+  auto bvh_build_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - bvh_build_start);
+  LOG << "Built BVH in " << bvh_build_time.count()
+      << "ms, SAH cost: " << g_scene_bvh.CalcSAHCost();
+  g_scene_mesh.ReorderPrimitives(g_scene_bvh.GetPrimitiveOrd());
+  size_t corner_index_size = GetDataSize(g_scene_mesh.index);
+  g_scene_mesh.Weld();
+  float vertex_span = g_scene_bvh.CalcLeafVertexSpan(g_scene_mesh);
+  if (kReorderVertices) {
+    g_scene_mesh.ReorderVertices();
+    LOG << "Reordered vertices, average leaf vertex span: " << vertex_span
+        << " -> " << g_scene_bvh.CalcLeafVertexSpan(g_scene_mesh);
+  } else {
+    LOG << "Average leaf vertex span: " << vertex_span;
+  }
+  g_scene_compact_index = g_scene_mesh.GetCompactIndex();
+  LOG << "Welded mesh to " << g_scene_mesh.position.size()
+      << " vertices, index size: " << corner_index_size / 1024 << "KiB -> "
+      << GetDataSize(g_scene_compact_index.data) / 1024 << "KiB";
+  if (cache_key != 0 &&
+      render_data::SceneCache::Write(kSceneCachePath, cache_key, g_scene_mesh,
+                                     g_scene_compact_index, g_scene_bvh)) {
+    LOG << "Saved scene cache to " << kSceneCachePath;
+  }
+}
+
+// Distance from the camera to instance bounds sphere, transforms are rigid
+static void SelectInstanceLODs() {
+  glm::vec3 camera_pos = g_camera_info.camera_to_world.GetPos();
+  glm::vec3 center = g_scene_lod_bounds.GetCenter();
+  float radius = glm::length(g_scene_lod_bounds.GetSize()) / 2;
+  for (render_data::MeshInstance& instance : g_scene_instances) {
+    float distance = std::max(
+        glm::distance(instance.object_to_world.TransformPoint(center),
+                      camera_pos) -
+            radius,
+        0.0f);
+    instance.mesh_ind = render_data::SelectLOD(
+        g_scene_lod_error, distance, g_camera_info, kLODMaxPixelError);
+  }
+}
+
+// Encodes the attributes GetSceneGeometry() returns, so has to run after the
+// layout specific scene setup
+static void QuantizeSceneVertices() {
+  SceneGeometry scene_geometry = GetSceneGeometry();
+  g_scene_quantized_mesh = render_data::QuantizedMesh(
+      scene_geometry.position, scene_geometry.normal, scene_geometry.tex_coord);
+  render_data::QuantizationError error = g_scene_quantized_mesh.CalcError(
+      scene_geometry.position, scene_geometry.normal, scene_geometry.tex_coord);
+  size_t float_size = GetDataSize(scene_geometry.position) +
+                      GetDataSize(scene_geometry.normal) +
+                      GetDataSize(scene_geometry.tex_coord);
+  VertexData vertex_data = GetVertexData();
+  size_t quantized_size = vertex_data.position.size() +
+                          vertex_data.normal.size() +
+                          vertex_data.tex_coord.size();
+  LOG << "Quantized vertices: " << float_size / 1024 << "KiB -> "
+      << quantized_size / 1024 << "KiB";
+  LOG << "Quantization error, position max: " << error.max_position
+      << " mean: " << error.mean_position
+      << ", normal max: " << error.max_normal
+      << "deg mean: " << error.mean_normal
+      << "deg, tex_coord max: " << error.max_tex_coord
+      << " mean: " << error.mean_tex_coord;
+}
+
+// The shader intersects decoded positions, up to half a step away from the
+// ones the BVH was built from, the other half covers float error of the
+// decode. Wide layouts are collapsed from g_scene_bvh afterwards.
+static void ExpandSceneBVHBounds() {
+  glm::vec3 margin(g_scene_quantized_mesh.GetQuantization().step);
+  if (g_bvh_layout == BVHLayout::kTwoLevel) {
+    g_scene_two_level.ExpandBottomLevelBounds(margin);
+    g_scene_two_level.BuildTopLevel(g_scene_instances);
+  } else {
+    g_scene_bvh.ExpandBounds(margin);
+  }
+}
+
+// Uploads are split into budget sized requests, so only a scene of
+// hundreds of budgets could overflow the queue. 'Uploader' is
+// render_data::TransferScheduler or render_data::AsyncUploader. Scene data
+// are globals that outlive the uploads, so they are handed over without
+// owning them and copied to staging only.
+template <typename Uploader>
+static void ScheduleUpload(Uploader& upload,
+                           gpu_resources::Buffer* dst,
+                           std::span<const char> data) {
+  std::shared_ptr<const char[]> unowned_data(data.data(), [](const char*) {});
+  CHECK(upload.ScheduleBufferTransfer(dst, std::move(unowned_data),
+                                      data.size()))
+      << "Upload queue is full";
+}
+
+template <typename Uploader>
+static void ScheduleGeometryUpload(Uploader& upload,
+                                   const GeometryBuffers& geometry) {
+  // with the scene cache mapped, geometry is copied straight from its pages
+  VertexData vertex_data = GetVertexData();
+  ScheduleUpload(upload, geometry.position, vertex_data.position);
+  ScheduleUpload(upload, geometry.normal, vertex_data.normal);
+  ScheduleUpload(upload, geometry.tex_coord, vertex_data.tex_coord);
+  ScheduleUpload(upload, geometry.index, GetIndexData());
+  ScheduleUpload(upload, geometry.light, AsBytes<glm::vec4>(g_light_buffer));
+  ScheduleUpload(upload, geometry.bvh, GetBVHData());
+  if (geometry.triangles) {
+    ScheduleUpload(
+        upload, geometry.triangles,
+        AsBytes<render_data::IntersectionTriangle>(g_scene_triangles));
+  }
+  if (geometry.clusters) {
+    ScheduleUpload(upload, geometry.clusters,
+                   AsBytes<render_data::MeshCluster>(g_scene_clusters));
+  }
+}
+
+void GeometryBuffers::AddBuffersToRenderGraph(
     gpu_resources::ResourceManager& resource_manager) {
   gpu_resources::BufferProperties properties{};
-  size_t total_data_size = 0;
+  VertexData vertex_data = GetVertexData();
 
-  properties.size = GetDataSize(g_scene_mesh.position);
-  total_data_size += properties.size;
+  properties.size = vertex_data.position.size();
   position = resource_manager.AddBuffer(properties);
 
-  properties.size = GetDataSize(g_scene_mesh.normal);
-  total_data_size += properties.size;
+  properties.size = vertex_data.normal.size();
   normal = resource_manager.AddBuffer(properties);
 
-  properties.size = GetDataSize(g_scene_mesh.tex_coord);
-  total_data_size += properties.size;
+  properties.size = vertex_data.tex_coord.size();
   tex_coord = resource_manager.AddBuffer(properties);
 
-  properties.size = GetDataSize(g_scene_mesh.index);
-  total_data_size += properties.size;
+  properties.size = GetIndexData().size();
   index = resource_manager.AddBuffer(properties);
 
   properties.size = GetDataSize(g_light_buffer);
-  total_data_size += properties.size;
   light = resource_manager.AddBuffer(properties);
 
-  properties.size = GetDataSize(g_scene_bvh.GetNodes());
-  total_data_size += properties.size;
+  properties.size = GetBVHData().size();
   bvh = resource_manager.AddBuffer(properties);
-  return total_data_size;
+
+  if (!g_scene_triangles.empty()) {
+    properties.size = GetDataSize(g_scene_triangles);
+    triangles = resource_manager.AddBuffer(properties);
+  }
+
+  if (!g_scene_clusters.empty()) {
+    properties.size = GetDataSize(g_scene_clusters);
+    clusters = resource_manager.AddBuffer(properties);
+  }
+}
+
+std::vector<gpu_resources::Buffer*> GeometryBuffers::GetBuffers() const {
+  std::vector<gpu_resources::Buffer*> res = {position, normal, tex_coord,
+                                             index,    light,  bvh};
+  if (triangles) {
+    res.push_back(triangles);
+  }
+  if (clusters) {
+    res.push_back(clusters);
+  }
+  return res;
 }
 
 void GeometryBuffers::AddCommonRequierment(
     gpu_resources::BufferProperties requierment) {
-  position->RequireProperties(requierment);
-  normal->RequireProperties(requierment);
-  tex_coord->RequireProperties(requierment);
-  index->RequireProperties(requierment);
-  light->RequireProperties(requierment);
-  bvh->RequireProperties(requierment);
+  for (gpu_resources::Buffer* buffer : GetBuffers()) {
+    buffer->RequireProperties(requierment);
+  }
 }
 
 void GeometryBuffers::DeclareCommonAccess(gpu_resources::ResourceAccess access,
                                           uint32_t pass_idx) {
-  position->DeclareAccess(access, pass_idx);
-  normal->DeclareAccess(access, pass_idx);
-  tex_coord->DeclareAccess(access, pass_idx);
-  index->DeclareAccess(access, pass_idx);
-  light->DeclareAccess(access, pass_idx);
-  bvh->DeclareAccess(access, pass_idx);
+  for (gpu_resources::Buffer* buffer : GetBuffers()) {
+    buffer->DeclareAccess(access, pass_idx);
+  }
 }
 
 GeometryBindings::GeometryBindings(GeometryBuffers buffers,
@@ -145,27 +473,14 @@ GeometryBindings::GeometryBindings(GeometryBuffers buffers,
                                                     access_stage);
   bvh = pipeline_handler::BufferDescriptorBinding(buffers.bvh, type,
                                                   access_stage);
+  if (buffers.triangles) {
+    triangles = pipeline_handler::BufferDescriptorBinding(buffers.triangles,
+                                                          type, access_stage);
+  }
 }
 
-ResourceTransferPass::ResourceTransferPass(
-    GeometryBuffers geometry,
-    gpu_resources::Buffer* staging_buffer,
-    gpu_resources::Buffer* camera_info)
-    : geometry_(geometry),
-      staging_buffer_(staging_buffer),
-      camera_info_(camera_info) {
-  gpu_resources::BufferProperties required_transfer_src_properties{};
-  required_transfer_src_properties.memory_flags =
-      vk::MemoryPropertyFlagBits::eHostVisible;
-  required_transfer_src_properties.usage_flags =
-      vk::BufferUsageFlagBits::eTransferSrc;
-  staging_buffer_->RequireProperties(required_transfer_src_properties);
-
-  gpu_resources::BufferProperties required_transfer_dst_properties{};
-  required_transfer_dst_properties.usage_flags =
-      vk::BufferUsageFlagBits::eTransferDst;
-  geometry.AddCommonRequierment(required_transfer_dst_properties);
-
+ResourceTransferPass::ResourceTransferPass(gpu_resources::Buffer* camera_info)
+    : camera_info_(camera_info) {
   gpu_resources::BufferProperties required_camera_info_properties{};
   required_camera_info_properties.memory_flags =
       vk::MemoryPropertyFlagBits::eHostVisible;
@@ -173,56 +488,9 @@ ResourceTransferPass::ResourceTransferPass(
   camera_info_->RequireProperties(required_camera_info_properties);
 }
 
-void ResourceTransferPass::OnResourcesInitialized() noexcept {
-  size_t fill_offset = 0;
-  FillStagingBuffer(staging_buffer_, g_scene_mesh.position, fill_offset);
-  FillStagingBuffer(staging_buffer_, g_scene_mesh.normal, fill_offset);
-  FillStagingBuffer(staging_buffer_, g_scene_mesh.tex_coord, fill_offset);
-  FillStagingBuffer(staging_buffer_, g_scene_mesh.index, fill_offset);
-
-  FillStagingBuffer(staging_buffer_, g_light_buffer, fill_offset);
-  FillStagingBuffer(staging_buffer_, g_scene_bvh.GetNodes(), fill_offset);
-
-  auto device = base::Base::Get().GetContext().GetDevice();
-  device.flushMappedMemoryRanges(
-      staging_buffer_->GetBuffer()->GetMappedMemoryRange());
-}
-
-void ResourceTransferPass::OnPreRecord() {
-  vk::PipelineStageFlags2KHR pass_stage =
-      vk::PipelineStageFlagBits2KHR::eTransfer;
-  gpu_resources::ResourceAccess transfer_src_access{};
-  transfer_src_access.access_flags = vk::AccessFlagBits2KHR::eTransferRead;
-  transfer_src_access.stage_flags = pass_stage;
-  staging_buffer_->DeclareAccess(transfer_src_access, GetPassIdx());
-
-  gpu_resources::ResourceAccess transfer_dst_access{};
-  transfer_dst_access.access_flags = vk::AccessFlagBits2KHR::eTransferWrite;
-  transfer_dst_access.stage_flags = pass_stage;
-  geometry_.DeclareCommonAccess(transfer_dst_access, GetPassIdx());
-}
-
 void ResourceTransferPass::OnRecord(
-    vk::CommandBuffer primary_cmd,
+    vk::CommandBuffer,
     const std::vector<vk::CommandBuffer>&) noexcept {
-  if (is_first_record_) {
-    is_first_record_ = false;
-    size_t staging_offset = 0;
-    RecordCopyFromStaging(primary_cmd, staging_buffer_, geometry_.position,
-                          staging_offset, GetDataSize(g_scene_mesh.position));
-    RecordCopyFromStaging(primary_cmd, staging_buffer_, geometry_.normal,
-                          staging_offset, GetDataSize(g_scene_mesh.normal));
-    RecordCopyFromStaging(primary_cmd, staging_buffer_, geometry_.tex_coord,
-                          staging_offset, GetDataSize(g_scene_mesh.tex_coord));
-    RecordCopyFromStaging(primary_cmd, staging_buffer_, geometry_.index,
-                          staging_offset, GetDataSize(g_scene_mesh.index));
-
-    RecordCopyFromStaging(primary_cmd, staging_buffer_, geometry_.light,
-                          staging_offset, GetDataSize(g_light_buffer));
-    RecordCopyFromStaging(primary_cmd, staging_buffer_, geometry_.bvh,
-                          staging_offset, GetDataSize(g_scene_bvh.GetNodes()));
-  }
-
   void* camera_buffer_mapping = camera_info_->GetBuffer()->GetMappingStart();
   DCHECK(camera_buffer_mapping);
   memcpy(camera_buffer_mapping, &g_camera_info, sizeof(g_camera_info));
@@ -231,11 +499,25 @@ void ResourceTransferPass::OnRecord(
 RaytracerPass::RaytracerPass(GeometryBuffers geometry,
                              gpu_resources::Image* color_target,
                              gpu_resources::Image* depth_target,
-                             gpu_resources::Buffer* camera_info)
+                             gpu_resources::Buffer* camera_info,
+                             BVHLayout bvh_layout,
+                             IndexFormat index_format,
+                             VertexFormat vertex_format,
+                             const render_data::TransferScheduler* upload,
+                             const render_data::AsyncUploader* async_upload,
+                             TopLevelBuffers top_level)
     : geometry_(geometry),
       color_target_(color_target),
       depth_target_(depth_target),
-      camera_info_(camera_info) {
+      camera_info_(camera_info),
+      bvh_layout_(bvh_layout),
+      index_format_(index_format),
+      vertex_format_(vertex_format),
+      top_level_(top_level),
+      upload_(upload),
+      async_upload_(async_upload),
+      dispatch_timer_(kTimerFrameCount) {
+  DCHECK(upload_ || async_upload_) << "Raytracer needs a geometry uploader";
   gpu_resources::BufferProperties requeired_buffer_propertires{};
   requeired_buffer_propertires.memory_flags =
       vk::MemoryPropertyFlagBits::eDeviceLocal;
@@ -246,7 +528,9 @@ RaytracerPass::RaytracerPass(GeometryBuffers geometry,
   gpu_resources::ImageProperties required_image_prperties{};
   required_image_prperties.memory_flags =
       vk::MemoryPropertyFlagBits::eDeviceLocal;
-  required_image_prperties.usage_flags = vk::ImageUsageFlagBits::eStorage;
+  // targets are cleared while geometry uploads
+  required_image_prperties.usage_flags =
+      vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eTransferDst;
   color_target_->RequireProperties(required_image_prperties);
   depth_target_->RequireProperties(required_image_prperties);
 
@@ -267,31 +551,102 @@ RaytracerPass::RaytracerPass(GeometryBuffers geometry,
 
   camera_info_binding_ = pipeline_handler::BufferDescriptorBinding(
       camera_info_, vk::DescriptorType::eUniformBuffer, pass_shader_stage);
+
+  if (bvh_layout_ == BVHLayout::kTwoLevel) {
+    DCHECK(top_level_.nodes && top_level_.instances)
+        << "Two level layout needs top level buffers";
+    gpu_resources::BufferProperties required_top_level_properties{};
+    required_top_level_properties.usage_flags =
+        vk::BufferUsageFlagBits::eStorageBuffer;
+    top_level_.nodes->RequireProperties(required_top_level_properties);
+    top_level_.instances->RequireProperties(required_top_level_properties);
+    tlas_binding_ = pipeline_handler::BufferDescriptorBinding(
+        top_level_.nodes, vk::DescriptorType::eStorageBuffer,
+        pass_shader_stage);
+    instance_binding_ = pipeline_handler::BufferDescriptorBinding(
+        top_level_.instances, vk::DescriptorType::eStorageBuffer,
+        pass_shader_stage);
+  }
 }
 
 void RaytracerPass::OnReserveDescriptorSets(
     pipeline_handler::DescriptorPool& pool) noexcept {
-  pipeline_ = pipeline_handler::Compute(
-      {
-          &color_target_binding_,
-          &depth_target_binding_,
-          &geometry_bindings_.position,
-          &geometry_bindings_.normal,
-          &geometry_bindings_.tex_coord,
-          &geometry_bindings_.index,
-          &geometry_bindings_.light,
-          &camera_info_binding_,
-          &geometry_bindings_.bvh,
-      },
-      pool, {}, "raytrace.spv", "main");
+  std::string shader_name = "raytrace";
+  if (bvh_layout_ == BVHLayout::kWide4) {
+    shader_name += "_wide4";
+  } else if (bvh_layout_ == BVHLayout::kQuantizedWide4) {
+    shader_name += "_quantized4";
+  } else if (bvh_layout_ == BVHLayout::kTwoLevel) {
+    DCHECK(index_format_ == IndexFormat::kPerAttribute)
+        << "Two level layout has no compact index variant";
+    shader_name += "_two_level";
+  }
+  if (index_format_ == IndexFormat::kCompact32) {
+    shader_name += "_index32";
+  } else if (index_format_ == IndexFormat::kCompact16) {
+    shader_name += "_index16";
+  }
+  std::vector<vk::PushConstantRange> push_constants;
+  if (vertex_format_ == VertexFormat::kQuantized) {
+    shader_name += "_qvertex";
+    push_constants.push_back(
+        vk::PushConstantRange(vk::ShaderStageFlagBits::eCompute, 0,
+                              sizeof(render_data::VertexQuantization)));
+  }
+  if (geometry_.triangles) {
+    shader_name += "_triangles";
+  }
+  shader_name += ".spv";
+  std::vector<pipeline_handler::DescriptorBinding*> bindings = {
+      &color_target_binding_,
+      &depth_target_binding_,
+      &geometry_bindings_.position,
+      &geometry_bindings_.normal,
+      &geometry_bindings_.tex_coord,
+      &geometry_bindings_.index,
+      &geometry_bindings_.light,
+      &camera_info_binding_,
+      &geometry_bindings_.bvh,
+  };
+  if (bvh_layout_ == BVHLayout::kTwoLevel) {
+    bindings.push_back(&tlas_binding_);
+    bindings.push_back(&instance_binding_);
+  }
+  if (geometry_.triangles) {
+    bindings.push_back(&geometry_bindings_.triangles);
+  }
+  pipeline_ = pipeline_handler::Compute(bindings, pool, push_constants,
+                                        shader_name, "main");
 }
 
+// Upload pass goes first and has taken its last requests or acquired the
+// last buffers by now, so the geometry is complete before the dispatch
 void RaytracerPass::OnPreRecord() {
+  bool is_upload_idle =
+      upload_ ? upload_->IsIdle() : async_upload_->IsIdle();
+  if (!is_geometry_uploaded_ && is_upload_idle) {
+    is_geometry_uploaded_ = true;
+    LOG << "Scene geometry uploaded after " << GetMsSinceSceneLoadStart()
+        << "ms";
+  }
+  if (!is_geometry_uploaded_) {
+    gpu_resources::ResourceAccess clear_access{
+        vk::PipelineStageFlagBits2KHR::eTransfer,
+        vk::AccessFlagBits2KHR::eTransferWrite,
+        vk::ImageLayout::eTransferDstOptimal};
+    color_target_->DeclareAccess(clear_access, GetPassIdx());
+    depth_target_->DeclareAccess(clear_access, GetPassIdx());
+    return;
+  }
   gpu_resources::ResourceAccess scene_resource_access{};
   scene_resource_access.access_flags = vk::AccessFlagBits2KHR::eShaderRead;
   scene_resource_access.stage_flags =
       vk::PipelineStageFlagBits2KHR::eComputeShader;
   geometry_.DeclareCommonAccess(scene_resource_access, GetPassIdx());
+  if (top_level_.nodes) {
+    top_level_.nodes->DeclareAccess(scene_resource_access, GetPassIdx());
+    top_level_.instances->DeclareAccess(scene_resource_access, GetPassIdx());
+  }
   scene_resource_access.layout = vk::ImageLayout::eGeneral;
   color_target_->DeclareAccess(scene_resource_access, GetPassIdx());
   depth_target_->DeclareAccess(scene_resource_access, GetPassIdx());
@@ -299,26 +654,133 @@ void RaytracerPass::OnPreRecord() {
 
 void RaytracerPass::OnRecord(vk::CommandBuffer primary_cmd,
                              const std::vector<vk::CommandBuffer>&) noexcept {
+  if (!is_geometry_uploaded_) {
+    // raytrace background color
+    vk::ClearColorValue color(std::array<float, 4>{0.1f, 0.1f, 0.1f, 1.0f});
+    for (gpu_resources::Image* target : {color_target_, depth_target_}) {
+      gpu_resources::PhysicalImage* image = target->GetImage();
+      primary_cmd.clearColorImage(image->GetImage(),
+                                  vk::ImageLayout::eTransferDstOptimal, color,
+                                  image->GetSubresourceRange());
+    }
+    return;
+  }
   auto& swapchain = base::Base::Get().GetSwapchain();
+  if (vertex_format_ == VertexFormat::kQuantized) {
+    primary_cmd.pushConstants(pipeline_.GetLayout(),
+                              vk::ShaderStageFlagBits::eCompute, 0u,
+                              sizeof(render_data::VertexQuantization),
+                              &g_scene_quantized_mesh.GetQuantization());
+  }
+  dispatch_timer_.RecordStart(primary_cmd);
   pipeline_.RecordDispatch(primary_cmd, swapchain.GetExtent().width / 8,
                            swapchain.GetExtent().height / 8, 1);
+  dispatch_timer_.RecordEnd(primary_cmd);
+  if (dispatch_timer_.GetSampleCount() >= kDispatchTimingFrames) {
+    LOG << "Raytrace dispatch: " << dispatch_timer_.GetAverageMs()
+        << "ms average over " << dispatch_timer_.GetSampleCount()
+        << " frames";
+    dispatch_timer_.ResetStats();
+  }
+}
+
+// Everything the scene render graph needs, runs on a worker thread started
+// by RayTracer::StartSceneLoad. Doesn't touch the device.
+static void PrepareScene() {
+  render_data::BVHBuildConfig bvh_config;
+  bvh_config.mode = render_data::BVHBuildMode::kBinnedSAH;
+  bvh_config.parallel_build = true;
+  LoadScene(bvh_config);
+  bool is_index_16bit = IsUsingSceneCache()
+                            ? g_scene_cache.IsCompactIndex16Bit()
+                            : g_scene_compact_index.is_16bit;
+  if (g_bvh_layout != BVHLayout::kTwoLevel) {
+    g_index_format =
+        is_index_16bit ? IndexFormat::kCompact16 : IndexFormat::kCompact32;
+  }
+  if (g_bvh_layout == BVHLayout::kTwoLevel) {
+    InitTwoLevelScene(bvh_config);
+  }
+  if (g_vertex_format == VertexFormat::kQuantized) {
+    QuantizeSceneVertices();
+    ExpandSceneBVHBounds();
+  }
+  if (g_bvh_layout == BVHLayout::kWide4 ||
+      g_bvh_layout == BVHLayout::kQuantizedWide4) {
+    g_scene_wide_bvh = render_data::WideBVH<4>(g_scene_bvh);
+    LOG << "Collapsed BVH to " << g_scene_wide_bvh.GetNodes().size()
+        << " 4-wide nodes";
+    // the shader would drop children that don't fit its stack
+    uint32_t stack_size = g_scene_wide_bvh.CalcTraversalStackSize();
+    CHECK(stack_size <= kWideBVHStackSize)
+        << "4-wide BVH traversal needs a stack of " << stack_size
+        << ", lower BVHBuildConfig::max_depth";
+  }
+  if (g_bvh_layout == BVHLayout::kQuantizedWide4) {
+    g_scene_quantized_bvh = render_data::QuantizedBVH(g_scene_wide_bvh);
+  }
+  LOG << "BVH buffer size: " << GetBVHData().size() / 1024 << "KiB";
+  if (kUseTriangleBuffer) {
+    SceneGeometry scene_geometry = GetSceneGeometry();
+    g_scene_triangles = render_data::BuildIntersectionTriangles(
+        scene_geometry.position, scene_geometry.index);
+    LOG << "Triangle buffer size: "
+        << GetDataSize(g_scene_triangles) / 1024 << "KiB";
+  }
+  if (kBuildClusters && g_bvh_layout != BVHLayout::kTwoLevel) {
+    SceneGeometry scene_geometry = GetSceneGeometry();
+    g_scene_clusters = render_data::BuildMeshClusters(
+        GetSceneBVHNodes(), scene_geometry.position, scene_geometry.index);
+    LOG << "Split scene into " << g_scene_clusters.size()
+        << " clusters, cluster buffer size: "
+        << GetDataSize(g_scene_clusters) / 1024 << "KiB";
+  }
+  LOG << "Scene prepared in " << GetMsSinceSceneLoadStart() << "ms";
 }
 
-RayTracer::RayTracer() {
+void RayTracer::StartSceneLoad(BVHLayout bvh_layout,
+                               VertexFormat vertex_format) {
+  if (g_scene_load) {
+    DCHECK(g_bvh_layout == bvh_layout && g_vertex_format == vertex_format)
+        << "Scene is already loading with other layout";
+    return;
+  }
+  g_scene_load_start = std::chrono::steady_clock::now();
+  g_bvh_layout = bvh_layout;
+  g_vertex_format = vertex_format;
+  g_scene_load = std::make_unique<utill::TaskGroup>();
+  g_scene_load->Run(PrepareScene);
+}
+
+RayTracer::RayTracer(BVHLayout bvh_layout, VertexFormat vertex_format) {
   auto device = base::Base::Get().GetContext().GetDevice();
   auto& swapchain = base::Base::Get().GetSwapchain();
   ready_to_present_ = device.createSemaphore({});
-  auto& resource_manager = render_graph_.GetResourceManager();
+  StartSceneLoad(bvh_layout, vertex_format);
+
+  auto& resource_manager = placeholder_graph_.GetResourceManager();
+  gpu_resources::Image* placeholder_target =
+      resource_manager.AddImage(gpu_resources::ImageProperties{});
+  // raytrace background color
+  placeholder_clear_ = ClearImagePass(
+      placeholder_target,
+      vk::ClearColorValue(std::array<float, 4>{0.1f, 0.1f, 0.1f, 1.0f}));
+  placeholder_graph_.AddPass(&placeholder_clear_);
+  placeholder_present_ = BlitToSwapchainPass(placeholder_target);
+  placeholder_graph_.AddPass(
+      &placeholder_present_, vk::PipelineStageFlagBits2KHR::eTransfer,
+      ready_to_present_, swapchain.GetImageAvaliableSemaphore());
+  placeholder_graph_.Init();
+}
 
-  g_scene_mesh =
-      render_data::Mesh::LoadFromObj("../assets/objects/serpentine_city.obj");
-  g_scene_bvh =
-      render_data::BVH(render_data::BVH::BuildPrimitivesBB(g_scene_mesh));
-  g_scene_mesh.ReorderPrimitives(g_scene_bvh.GetPrimitiveOrd());
+void RayTracer::InitSceneRenderGraph() {
+  auto& swapchain = base::Base::Get().GetSwapchain();
+  auto& resource_manager = render_graph_.GetResourceManager();
 
+  geometry_.AddBuffersToRenderGraph(resource_manager);
   gpu_resources::BufferProperties buffer_properties{};
-  buffer_properties.size = geometry_.AddBuffersToRenderGraph(resource_manager);
-  staging_buffer_ = resource_manager.AddBuffer(buffer_properties);
+  gpu_resources::Buffer* staging_buffer =
+      resource_manager.AddBuffer(buffer_properties);
 
   gpu_resources::ImageProperties image_properties{};
   color_target_ = resource_manager.AddImage(image_properties);
@@ -328,12 +790,61 @@ RayTracer::RayTracer() {
   buffer_properties.size = sizeof(CameraInfo);
   camera_info_ = resource_manager.AddBuffer(buffer_properties);
 
-  resource_transfer_ =
-      ResourceTransferPass(geometry_, staging_buffer_, camera_info_);
+  if (g_bvh_layout == BVHLayout::kTwoLevel) {
+    // instance count is fixed, so top level size doesn't change
+    buffer_properties.size =
+        GetDataSize(g_scene_two_level.GetTopLevelNodes());
+    top_level_.nodes = resource_manager.AddBuffer(buffer_properties);
+    vk::DeviceSize top_level_size = buffer_properties.size;
+    buffer_properties.size = GetDataSize(g_scene_two_level.GetInstances());
+    top_level_.instances = resource_manager.AddBuffer(buffer_properties);
+    top_level_size += buffer_properties.size;
+
+    gpu_resources::Buffer* top_level_staging =
+        resource_manager.AddBuffer(gpu_resources::BufferProperties{});
+    render_data::TransferSchedulerConfig top_level_config;
+    top_level_config.frame_budget = top_level_size;
+    top_level_config.staging_size = top_level_size * kTopLevelStagingFrames;
+    top_level_upload_ = render_data::TransferScheduler(
+        top_level_staging, &render_graph_.GetFrameSemaphore(),
+        {top_level_.nodes, top_level_.instances}, {}, top_level_config);
+    ScheduleTopLevelUpload();
+  }
+
+  if (kAsyncGeometryUpload) {
+    render_data::AsyncUploaderConfig upload_config;
+    upload_config.batch_budget = kUploadFrameBudget;
+    async_upload_ = std::make_unique<render_data::AsyncUploader>(
+        staging_buffer, &render_graph_.GetFrameSemaphore(),
+        geometry_.GetBuffers(), upload_config);
+    ScheduleGeometryUpload(*async_upload_, geometry_);
+    // orders acquire barriers after the upload, which the pass already
+    // polled complete on the CPU
+    render_graph_.AddPass(async_upload_.get(),
+                          vk::PipelineStageFlagBits2KHR::eTransfer,
+                          async_upload_->GetTimelineWait());
+  } else {
+    render_data::TransferSchedulerConfig upload_config;
+    upload_config.frame_budget = kUploadFrameBudget;
+    upload_config.staging_size = kUploadStagingSize;
+    upload_ = render_data::TransferScheduler(
+        staging_buffer, &render_graph_.GetFrameSemaphore(),
+        geometry_.GetBuffers(), {}, upload_config);
+    ScheduleGeometryUpload(upload_, geometry_);
+    render_graph_.AddPass(&upload_);
+  }
+  if (top_level_.nodes) {
+    render_graph_.AddPass(&top_level_upload_);
+  }
+
+  resource_transfer_ = ResourceTransferPass(camera_info_);
   render_graph_.AddPass(&resource_transfer_);
 
-  raytrace_ =
-      RaytracerPass(geometry_, color_target_, depth_target_, camera_info_);
+  raytrace_ = RaytracerPass(geometry_, color_target_, depth_target_,
+                            camera_info_, g_bvh_layout, g_index_format,
+                            g_vertex_format,
+                            kAsyncGeometryUpload ? nullptr : &upload_,
+                            async_upload_.get(), top_level_);
   render_graph_.AddPass(&raytrace_);
 
   present_ = BlitToSwapchainPass(depth_target_);
@@ -343,6 +854,24 @@ RayTracer::RayTracer() {
   render_graph_.Init();
 }
 
+// Skipped while the previous top level is still queued, e.g. when frames in
+// flight fill the staging ring, so stale top levels don't pile up
+void RayTracer::ScheduleTopLevelUpload() {
+  if (!top_level_upload_.IsIdle()) {
+    return;
+  }
+  CHECK(top_level_upload_.ScheduleBufferTransfer(
+      top_level_.nodes,
+      render_data::MakeTransferData(std::vector<render_data::BVHNode>(
+          g_scene_two_level.GetTopLevelNodes())),
+      GetDataSize(g_scene_two_level.GetTopLevelNodes())));
+  CHECK(top_level_upload_.ScheduleBufferTransfer(
+      top_level_.instances,
+      render_data::MakeTransferData(std::vector<render_data::GPUInstance>(
+          g_scene_two_level.GetInstances())),
+      GetDataSize(g_scene_two_level.GetInstances())));
+}
+
 void UpdateCameraInfo() {
   auto m_state = utill::InputManager::GetMouseState();
   if (m_state.lmb_state.action == GLFW_PRESS &&
@@ -386,20 +915,52 @@ bool RayTracer::Draw() {
   g_camera_info.aspect =
       float(g_camera_info.screen_width) / g_camera_info.screen_height;
 
+  if (!is_scene_initialized_ && g_scene_load->IsDone()) {
+    // rethrows PrepareScene failures instead of rendering half built globals
+    g_scene_load->Wait();
+    // geometry uploads are spread over the first scene frames
+    InitSceneRenderGraph();
+    is_scene_initialized_ = true;
+  }
+
   if (!swapchain.AcquireNextImage()) {
     LOG << "Failed to acquire next image";
     return false;
   }
   swapchain.GetActiveImageInd();
-  render_graph_.RenderFrame();
+  if (!is_scene_initialized_) {
+    placeholder_graph_.RenderFrame();
+  } else {
+    if (g_bvh_layout == BVHLayout::kTwoLevel) {
+      // bottom levels stay resident, only the top level follows instances
+      SelectInstanceLODs();
+      g_scene_two_level.BuildTopLevel(g_scene_instances);
+      ScheduleTopLevelUpload();
+    }
+    render_graph_.RenderFrame();
+  }
   if (swapchain.Present(ready_to_present_) != vk::Result::eSuccess) {
     LOG << "Failed to present";
     return false;
   }
+  if (!is_first_frame_logged_) {
+    is_first_frame_logged_ = true;
+    LOG << "First frame presented after " << GetMsSinceSceneLoadStart()
+        << "ms";
+  }
+  if (is_scene_initialized_ && !is_first_scene_frame_logged_) {
+    is_first_scene_frame_logged_ = true;
+    LOG << "First scene frame presented after " << GetMsSinceSceneLoadStart()
+        << "ms";
+  }
   return true;
 }
 
 RayTracer::~RayTracer() {
+  // the global thread pool may be gone by the time statics are destroyed
+  g_scene_load.reset();
+  // its worker may still write the staging buffer of render_graph_
+  async_upload_.reset();
   auto device = base::Base::Get().GetContext().GetDevice();
   device.waitIdle();
   device.destroySemaphore(ready_to_present_);
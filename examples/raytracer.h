@@ -1,25 +1,57 @@
 #pragma once
 
 #include <vcruntime.h>
+#include <memory>
 #include <vector>
 
 #include "blit_to_swapchain.h"
+#include "clear_image.h"
+#include "gpu_executer/gpu_timer.h"
 #include "gpu_resources/buffer.h"
 #include "gpu_resources/image.h"
 #include "gpu_resources/resource_access_syncronizer.h"
 #include "gpu_resources/resource_manager.h"
 #include "pipeline_handler/compute.h"
 #include "pipeline_handler/descriptor_binding.h"
+#include "render_data/async_uploader.h"
+#include "render_data/camera_info.h"
+#include "render_data/transfer_scheduler.h"
 #include "render_graph/render_graph.h"
 #include "utill/transform.h"
 
 namespace examples {
 
-struct CameraInfo {
-  utill::Transform camera_to_world;
-  uint32_t screen_width;
-  uint32_t screen_height;
-  float aspect;
+using render_data::CameraInfo;
+
+// Node layout of the bvh buffer, each one has its own raytrace shader variant
+enum class BVHLayout {
+  // render_data::BVHNode, stackless traversal via parent links
+  kBinary,
+  // render_data::WideBVHNode<4>, stack traversal testing 4 children at once
+  kWide4,
+  // render_data::QuantizedBVHNode, kWide4 with 8 bit child bounds
+  kQuantizedWide4,
+  // render_data::TwoLevelBVH, binary top level over instances of binary
+  // bottom levels
+  kTwoLevel,
+};
+
+// Layout of the index buffer, each one has its own raytrace shader variant
+enum class IndexFormat {
+  // glm::uvec4 of (position, normal, tex_coord) indices per corner
+  kPerAttribute,
+  // render_data::CompactIndex of the welded mesh, 32 or 16 bit
+  kCompact32,
+  kCompact16,
+};
+
+// Format of the vertex attribute buffers, kQuantized uses raytrace shader
+// variants with _qvertex suffix
+enum class VertexFormat {
+  // glm::vec4 positions and normals, glm::vec2 tex_coords of render_data::Mesh
+  kFloat,
+  // render_data::QuantizedMesh, decode parameters as push constants
+  kQuantized,
 };
 
 struct GeometryBuffers {
@@ -29,15 +61,28 @@ struct GeometryBuffers {
   gpu_resources::Buffer* index;
   gpu_resources::Buffer* light;
   gpu_resources::Buffer* bvh;
+  // render_data::IntersectionTriangle buffer, null if not used
+  gpu_resources::Buffer* triangles = nullptr;
+  // render_data::MeshCluster buffer, null if not used. Not bound by
+  // RaytracerPass, meant for cluster culling passes.
+  gpu_resources::Buffer* clusters = nullptr;
 
-  size_t AddBuffersToRenderGraph(
+  void AddBuffersToRenderGraph(
       gpu_resources::ResourceManager& resource_manager);
+  // buffers that are used, uploaded with the scene
+  std::vector<gpu_resources::Buffer*> GetBuffers() const;
 
   void AddCommonRequierment(gpu_resources::BufferProperties requierment);
   void DeclareCommonAccess(gpu_resources::ResourceAccess access,
                            uint32_t pass_idx);
 };
 
+// Top level of BVHLayout::kTwoLevel, uploaded whenever it is rebuilt
+struct TopLevelBuffers {
+  gpu_resources::Buffer* nodes = nullptr;
+  gpu_resources::Buffer* instances = nullptr;
+};
+
 struct GeometryBindings {
   pipeline_handler::BufferDescriptorBinding position;
   pipeline_handler::BufferDescriptorBinding normal;
@@ -45,28 +90,23 @@ struct GeometryBindings {
   pipeline_handler::BufferDescriptorBinding index;
   pipeline_handler::BufferDescriptorBinding light;
   pipeline_handler::BufferDescriptorBinding bvh;
+  pipeline_handler::BufferDescriptorBinding triangles;
 
   GeometryBindings() = default;
   GeometryBindings(GeometryBuffers buffers, vk::ShaderStageFlags access_stage);
 };
 
+// Per frame writes of host visible buffers, scene geometry is uploaded by
+// render_data::TransferScheduler
 class ResourceTransferPass : public render_graph::Pass {
-  GeometryBuffers geometry_;
-  gpu_resources::Buffer* staging_buffer_;
   gpu_resources::Buffer* camera_info_;
-  bool is_first_record_ = true;
 
-  void OnPreRecord() override;
   void OnRecord(vk::CommandBuffer primary_cmd,
                 const std::vector<vk::CommandBuffer>&) noexcept override;
 
  public:
   ResourceTransferPass() = default;
-  ResourceTransferPass(GeometryBuffers geometry,
-                       gpu_resources::Buffer* staging_buffer,
-                       gpu_resources::Buffer* camera_info);
-
-  void OnResourcesInitialized() noexcept override;
+  explicit ResourceTransferPass(gpu_resources::Buffer* camera_info);
 };
 
 class RaytracerPass : public render_graph::Pass {
@@ -75,18 +115,37 @@ class RaytracerPass : public render_graph::Pass {
   gpu_resources::Image* color_target_;
   gpu_resources::Image* depth_target_;
   gpu_resources::Buffer* camera_info_;
+  BVHLayout bvh_layout_ = BVHLayout::kBinary;
+  IndexFormat index_format_ = IndexFormat::kPerAttribute;
+  VertexFormat vertex_format_ = VertexFormat::kFloat;
+  TopLevelBuffers top_level_;
+  // targets are cleared instead of traced until the one that isn't null
+  // uploads the geometry
+  const render_data::TransferScheduler* upload_ = nullptr;
+  const render_data::AsyncUploader* async_upload_ = nullptr;
+  bool is_geometry_uploaded_ = false;
+  // dispatch time, logged as average over kDispatchTimingFrames frames
+  gpu_executer::GpuTimer dispatch_timer_;
 
   GeometryBindings geometry_bindings_;
   pipeline_handler::ImageDescriptorBinding color_target_binding_;
   pipeline_handler::ImageDescriptorBinding depth_target_binding_;
   pipeline_handler::BufferDescriptorBinding camera_info_binding_;
+  pipeline_handler::BufferDescriptorBinding tlas_binding_;
+  pipeline_handler::BufferDescriptorBinding instance_binding_;
 
  public:
   RaytracerPass() = default;
   RaytracerPass(GeometryBuffers geometry,
                 gpu_resources::Image* color_target,
                 gpu_resources::Image* depth_target,
-                gpu_resources::Buffer* camera_info);
+                gpu_resources::Buffer* camera_info,
+                BVHLayout bvh_layout,
+                IndexFormat index_format,
+                VertexFormat vertex_format,
+                const render_data::TransferScheduler* upload,
+                const render_data::AsyncUploader* async_upload,
+                TopLevelBuffers top_level = {});
 
   void OnReserveDescriptorSets(
       pipeline_handler::DescriptorPool& pool) noexcept override;
@@ -96,21 +155,49 @@ class RaytracerPass : public render_graph::Pass {
                 const std::vector<vk::CommandBuffer>&) noexcept override;
 };
 
+/*
+ * Scene is prepared on a worker thread, see StartSceneLoad. Until it is
+ * ready frames show a placeholder of the background color, then the scene
+ * render graph is built and its geometry is uploaded over the next frames.
+ */
 class RayTracer {
+  render_data::TransferScheduler upload_;
+  // used instead of upload_ with kAsyncGeometryUpload
+  std::unique_ptr<render_data::AsyncUploader> async_upload_;
+  // top level of BVHLayout::kTwoLevel, rebuilt every frame, can't be
+  // rewritten in place while frames in flight read it
+  render_data::TransferScheduler top_level_upload_;
   ResourceTransferPass resource_transfer_;
   RaytracerPass raytrace_;
   BlitToSwapchainPass present_;
   render_graph::RenderGraph render_graph_;
+  ClearImagePass placeholder_clear_;
+  BlitToSwapchainPass placeholder_present_;
+  render_graph::RenderGraph placeholder_graph_;
   vk::Semaphore ready_to_present_;
+  bool is_scene_initialized_ = false;
+  bool is_first_frame_logged_ = false;
+  bool is_first_scene_frame_logged_ = false;
 
   GeometryBuffers geometry_;
   gpu_resources::Image* color_target_;
   gpu_resources::Image* depth_target_;
   gpu_resources::Buffer* camera_info_;
-  gpu_resources::Buffer* staging_buffer_;
+  TopLevelBuffers top_level_;
+
+  void InitSceneRenderGraph();
+  void ScheduleTopLevelUpload();
 
  public:
-  RayTracer();
+  // Starts loading the scene and building its BVH on the global thread
+  // pool. Call at process start, so that it overlaps device initialization.
+  // RayTracer calls it itself if it wasn't, arguments must match.
+  static void StartSceneLoad(
+      BVHLayout bvh_layout = BVHLayout::kBinary,
+      VertexFormat vertex_format = VertexFormat::kFloat);
+
+  explicit RayTracer(BVHLayout bvh_layout = BVHLayout::kBinary,
+                     VertexFormat vertex_format = VertexFormat::kFloat);
   RayTracer(const RayTracer&) = delete;
   void operator=(const RayTracer&) = delete;
 
@@ -27,6 +27,8 @@ void Run() {
 
 int main() {
   LOG << "RL start";
+  // overlaps scene parsing and BVH build with device initialization
+  examples::RayTracer::StartSceneLoad();
 
   base::BaseConfig base_config = {
       {VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME,
@@ -43,7 +45,8 @@ int main() {
        VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME,
        VK_KHR_COPY_COMMANDS_2_EXTENSION_NAME},
       2,
-      vk::QueueFlagBits::eCompute | vk::QueueFlagBits::eGraphics};
+      vk::QueueFlagBits::eCompute | vk::QueueFlagBits::eGraphics,
+      1};
 
   try {
     base::Base::Get().Init(base_config, vk::Extent2D{1280, 768},
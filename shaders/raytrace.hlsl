@@ -1,10 +1,64 @@
 [[vk::binding(0, 0)]] RWTexture2D<float4> color_target;
 [[vk::binding(1, 0)]] RWTexture2D<float> depth_target;
 
+#ifdef QUANTIZED_VERTEX
+// render_data::QuantizedMesh
+[[vk::binding(2, 0)]] StructuredBuffer<uint2> vertex_pos;
+[[vk::binding(3, 0)]] StructuredBuffer<uint> vertex_normal;
+[[vk::binding(4, 0)]] StructuredBuffer<uint> vertex_texcoord;
+
+// render_data::VertexQuantization
+struct VertexQuantization {
+  float4 origin;
+  float4 step;
+};
+
+[[vk::push_constant]] ConstantBuffer<VertexQuantization> vertex_quantization;
+
+float3 GetVertexPosition(uint ind) {
+  uint2 packed = vertex_pos[ind];
+  uint3 q = uint3(packed.x & 0xffff, packed.x >> 16, packed.y & 0xffff);
+  return vertex_quantization.origin.xyz +
+         float3(q) * vertex_quantization.step.xyz;
+}
+
+// Two snorm16 values, first one in low bits
+float3 DecodeOctahedral(uint packed) {
+  int2 q = asint(uint2(packed << 16, packed)) >> 16;
+  float2 e = max(float2(q) / 32767.0, -1.0);
+  float3 n = float3(e, 1 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0);
+  n.x += n.x >= 0 ? -t : t;
+  n.y += n.y >= 0 ? -t : t;
+  return normalize(n);
+}
+
+float3 GetVertexNormal(uint ind) {
+  return DecodeOctahedral(vertex_normal[ind]);
+}
+
+float2 GetVertexTexCoord(uint ind) {
+  uint packed = vertex_texcoord[ind];
+  return f16tof32(uint2(packed, packed >> 16));
+}
+#else
 [[vk::binding(2, 0)]] StructuredBuffer<float4> vertex_pos;
 [[vk::binding(3, 0)]] StructuredBuffer<float4> vertex_normal;
 [[vk::binding(4, 0)]] StructuredBuffer<float2> vertex_texcoord;
-[[vk::binding(5, 0)]] StructuredBuffer<uint4> vertex_ind;
+
+float3 GetVertexPosition(uint ind) {
+  return vertex_pos[ind].xyz;
+}
+
+float3 GetVertexNormal(uint ind) {
+  return vertex_normal[ind].xyz;
+}
+
+float2 GetVertexTexCoord(uint ind) {
+  return vertex_texcoord[ind];
+}
+#endif
+
 [[vk::binding(6, 0)]] StructuredBuffer<float4> light_pos;
 
 struct CameraInfo {
@@ -16,6 +70,38 @@ struct CameraInfo {
 
 [[vk::binding(7, 0)]] ConstantBuffer<CameraInfo> camera_info;
 
+#if defined(COMPACT_INDEX32) || defined(COMPACT_INDEX16)
+// render_data::CompactIndex, one index per corner into welded vertex arrays
+[[vk::binding(5, 0)]] StructuredBuffer<uint> vertex_ind;
+
+uint GetVertexInd(uint corner) {
+#ifdef COMPACT_INDEX16
+  return (vertex_ind[corner >> 1] >> ((corner & 1) * 16)) & 0xffff;
+#else
+  return vertex_ind[corner];
+#endif
+}
+
+uint GetPositionInd(uint corner) {
+  return GetVertexInd(corner);
+}
+
+uint GetNormalInd(uint corner) {
+  return GetVertexInd(corner);
+}
+#else
+// (position, normal, tex_coord) indices per corner
+[[vk::binding(5, 0)]] StructuredBuffer<uint4> vertex_ind;
+
+uint GetPositionInd(uint corner) {
+  return vertex_ind[corner].x;
+}
+
+uint GetNormalInd(uint corner) {
+  return vertex_ind[corner].y;
+}
+#endif
+
 struct Ray {
   float3 origin;
   float3 direction;
@@ -56,6 +142,76 @@ struct BoundingBox {
   }
 };
 
+#if defined(BVH_WIDE4) || defined(BVH_QUANTIZED4)
+#define WIDE_BVH_TRAVERSAL
+#endif
+
+#ifdef WIDE_BVH_TRAVERSAL
+// render_data::WideBVHNode<4>, child bounds as structure of arrays
+struct WideBVHNode {
+  float4 min_x;
+  float4 max_x;
+  float4 min_y;
+  float4 max_y;
+  float4 min_z;
+  float4 max_z;
+  uint4 child;
+  uint4 primitive_count;
+};
+
+// the host checks WideBVH::CalcTraversalStackSize() fits, see kWideBVHStackSize
+// of examples/raytracer.cpp
+#define WIDE_BVH_STACK_SIZE 64
+#endif
+
+#if defined(BVH_WIDE4)
+[[vk::binding(8, 0)]] StructuredBuffer<WideBVHNode> bvh_buffer;
+
+WideBVHNode LoadWideBVHNode(uint ind) {
+  return bvh_buffer[ind];
+}
+#elif defined(BVH_QUANTIZED4)
+// render_data::QuantizedBVHNode, one byte per child in bounds fields
+struct QuantizedBVHNode {
+  float3 origin;
+  uint exponents;
+  uint4 child;
+  uint2 primitive_count;
+  uint min_x;
+  uint max_x;
+  uint min_y;
+  uint max_y;
+  uint min_z;
+  uint max_z;
+};
+
+[[vk::binding(8, 0)]] StructuredBuffer<QuantizedBVHNode> bvh_buffer;
+
+float4 DequantizeBounds(uint packed, float origin, float step) {
+  uint4 q = (packed.xxxx >> uint4(0, 8, 16, 24)) & 0xff;
+  return origin + float4(q) * step;
+}
+
+// Decoded bounds are exact multiples of a power of two step, matching
+// render_data::QuantizedBVHNode::GetChildBounds, so they stay conservative.
+WideBVHNode LoadWideBVHNode(uint ind) {
+  QuantizedBVHNode q_node = bvh_buffer[ind];
+  uint3 biased_exp = (q_node.exponents.xxx >> uint3(0, 8, 16)) & 0xff;
+  float3 step = asfloat(biased_exp << 23);
+
+  WideBVHNode node;
+  node.min_x = DequantizeBounds(q_node.min_x, q_node.origin.x, step.x);
+  node.max_x = DequantizeBounds(q_node.max_x, q_node.origin.x, step.x);
+  node.min_y = DequantizeBounds(q_node.min_y, q_node.origin.y, step.y);
+  node.max_y = DequantizeBounds(q_node.max_y, q_node.origin.y, step.y);
+  node.min_z = DequantizeBounds(q_node.min_z, q_node.origin.z, step.z);
+  node.max_z = DequantizeBounds(q_node.max_z, q_node.origin.z, step.z);
+  node.child = q_node.child;
+  node.primitive_count =
+      (q_node.primitive_count.xxyy >> uint4(0, 16, 0, 16)) & 0xffff;
+  return node;
+}
+#else
 struct BVHNode {
   BoundingBox bounds;
   uint left;
@@ -65,6 +221,35 @@ struct BVHNode {
 };
 
 [[vk::binding(8, 0)]] StructuredBuffer<BVHNode> bvh_buffer;
+#endif
+
+#ifdef BVH_TWO_LEVEL
+#ifdef WIDE_BVH_TRAVERSAL
+#error "Two level traversal uses binary bottom levels"
+#endif
+#if defined(COMPACT_INDEX32) || defined(COMPACT_INDEX16)
+#error "Two level meshes use per attribute indices"
+#endif
+
+// render_data::GPUInstance
+struct Instance {
+  float4x4 world_to_object;
+  float4x4 object_to_world;
+  uint blas_root;
+  uint padding0;
+  uint padding1;
+  uint padding2;
+};
+
+// bvh_buffer holds bottom levels of all meshes, leaves of tlas_buffer index
+// instance_buffer
+[[vk::binding(9, 0)]] StructuredBuffer<BVHNode> tlas_buffer;
+[[vk::binding(10, 0)]] StructuredBuffer<Instance> instance_buffer;
+
+// render_data::TwoLevelBVH::kMaxTopLevelDepth + 1, the host limits the top
+// level depth so that both children of any node fit
+#define TLAS_STACK_SIZE 32
+#endif
 
 float4 PixCordToCameraSpace(uint pix_x, uint pix_y) {
   float uss_x = (float)(pix_x) / camera_info.screen_width;
@@ -91,6 +276,7 @@ struct Interseption {
   float2 bar_cord;
   float dst;
   uint trg_ind;
+  uint instance_ind;
   // uint it_count;
   // uint insp_left;
 };
@@ -128,35 +314,155 @@ struct Triangle {
 
 Triangle GetTriangleByInd(uint ind) {
   Triangle res;
-  res.a = vertex_pos[vertex_ind[3 * ind + 0].x].xyz;
-  res.b = vertex_pos[vertex_ind[3 * ind + 1].x].xyz;
-  res.c = vertex_pos[vertex_ind[3 * ind + 2].x].xyz;
+  res.a = GetVertexPosition(GetPositionInd(3 * ind + 0));
+  res.b = GetVertexPosition(GetPositionInd(3 * ind + 1));
+  res.c = GetVertexPosition(GetPositionInd(3 * ind + 2));
   return res;
 }
 
 float3 GetNormalAtBarCord(uint trg_ind, float2 bar_cord) {
-  float3 na = vertex_normal[vertex_ind[3 * trg_ind + 0].y].xyz;
-  float3 nb = vertex_normal[vertex_ind[3 * trg_ind + 1].y].xyz;
-  float3 nc = vertex_normal[vertex_ind[3 * trg_ind + 2].y].xyz;
+  float3 na = GetVertexNormal(GetNormalInd(3 * trg_ind + 0));
+  float3 nb = GetVertexNormal(GetNormalInd(3 * trg_ind + 1));
+  float3 nc = GetVertexNormal(GetNormalInd(3 * trg_ind + 2));
   float3 n = nb * bar_cord.x + nc * bar_cord.y
                              + na * (1 - (bar_cord.x + bar_cord.y));
   return normalize(n);
 }
 
-bool IsTraversalOmittable(float2 insp_t, float cur_res) {
-  return insp_t.x > insp_t.y || (cur_res > 0 && cur_res + 1e-2 < insp_t.x);
+#ifdef TRIANGLE_BUFFER
+// render_data::IntersectionTriangle, one per triangle in bvh leaf order
+struct IntersectionTriangle {
+  float4 a;
+  float4 e1;
+  float4 e2;
+};
+
+// bindings are consecutive, this one follows two level buffers if any
+#ifdef BVH_TWO_LEVEL
+#define TRIANGLE_BUFFER_BINDING 11
+#else
+#define TRIANGLE_BUFFER_BINDING 9
+#endif
+
+[[vk::binding(TRIANGLE_BUFFER_BINDING, 0)]]
+StructuredBuffer<IntersectionTriangle> triangle_buffer;
+
+// Moller-Trumbore, det here equals det_sys of Triangle::GetRayInterseption,
+// so culling and result match it
+float3 IntersectTriangle(uint ind, Ray r) {
+  IntersectionTriangle t = triangle_buffer[ind];
+  float3 p = cross(r.direction, t.e2.xyz);
+  float det = dot(t.e1.xyz, p);
+  if (det < 1e-4) {
+    det = -1;
+  }
+  float inv_det = 1.0 / det;
+  float3 s = r.origin - t.a.xyz;
+  float3 q = cross(s, t.e1.xyz);
+  float dst = dot(t.e2.xyz, q) * inv_det;
+  float u = dot(s, p) * inv_det;
+  float v = dot(r.direction, q) * inv_det;
+  bool isValid = det > 0 & dst > 1e-4 & 0 < u & u < 1 & 0 < v & v < 1 &
+                 u + v < 1;
+  return isValid ? float3(dst, u, v) : float3(-1, 0, 0);
+}
+
+float3 GetPointAtBarCord(uint trg_ind, float2 bar_cord) {
+  IntersectionTriangle t = triangle_buffer[trg_ind];
+  return t.a.xyz + t.e1.xyz * bar_cord.x + t.e2.xyz * bar_cord.y;
+}
+#else
+float3 IntersectTriangle(uint ind, Ray r) {
+  return GetTriangleByInd(ind).GetRayInterseption(r);
+}
+
+float3 GetPointAtBarCord(uint trg_ind, float2 bar_cord) {
+  return GetTriangleByInd(trg_ind).GetPointFromBarCord(bar_cord);
+}
+#endif
+
+#ifdef WIDE_BVH_TRAVERSAL
+float GetSafeInvDir(float speed) {
+  return 1.0 / (abs(speed) < 1e-8 ? (speed < 0 ? -1e-8 : 1e-8) : speed);
 }
 
 Interseption CastRay(Ray r) {
   uint cur_trg = (uint)-1;
   float3 cur_insp = float3(-1, 0, 0);
-  // uint insp_l = 0;
-  uint n_bvh_nodes = 0;
-  uint memb_size = 0;
-  // uint it_count = 0;
-  bvh_buffer.GetDimensions(n_bvh_nodes, memb_size);
+  float3 inv_dir = float3(GetSafeInvDir(r.direction.x),
+                          GetSafeInvDir(r.direction.y),
+                          GetSafeInvDir(r.direction.z));
+
+  uint stack[WIDE_BVH_STACK_SIZE];
+  uint stack_size = 0;
+  stack[stack_size++] = 0;
+  while (stack_size > 0) {
+    WideBVHNode node = LoadWideBVHNode(stack[--stack_size]);
+
+    float4 t1_x = (node.min_x - r.origin.x) * inv_dir.x;
+    float4 t2_x = (node.max_x - r.origin.x) * inv_dir.x;
+    float4 t1_y = (node.min_y - r.origin.y) * inv_dir.y;
+    float4 t2_y = (node.max_y - r.origin.y) * inv_dir.y;
+    float4 t1_z = (node.min_z - r.origin.z) * inv_dir.z;
+    float4 t2_z = (node.max_z - r.origin.z) * inv_dir.z;
+    float4 t_near = max(max(min(t1_x, t2_x), min(t1_y, t2_y)),
+                        max(min(t1_z, t2_z), 0));
+    float4 t_far = min(min(max(t1_x, t2_x), max(t1_y, t2_y)),
+                       max(t1_z, t2_z));
+    float t_limit = cur_insp.x > 0 ? cur_insp.x + 1e-2 : 1e30;
+
+    uint hit_mask = 0;
+    for (uint i = 0; i < 4; i++) {
+      if (node.child[i] == (uint)-1 || t_near[i] > t_far[i] ||
+          t_near[i] > t_limit) {
+        continue;
+      }
+      if (node.primitive_count[i] == 0) {
+        hit_mask |= 1u << i;
+        continue;
+      }
+      uint t_end = node.child[i] + node.primitive_count[i];
+      for (uint t_ind = node.child[i]; t_ind < t_end; t_ind++) {
+        float3 n_insp = IntersectTriangle(t_ind, r);
+        if (n_insp.x > 0 && (n_insp.x < cur_insp.x || cur_insp.x < 0)) {
+          cur_trg = t_ind;
+          cur_insp = n_insp;
+        }
+      }
+    }
 
-  for (uint cur_vrt = 0, prv_vrt = -1, nxt_vrt = 0; nxt_vrt != -1;
+    // push internal children far to near, so that the nearest is popped
+    // first. The bound only guards memory, the host checked the stack fits
+    while (hit_mask != 0 && stack_size < WIDE_BVH_STACK_SIZE) {
+      uint far_ind = 0;
+      float far_t = -1;
+      for (uint i = 0; i < 4; i++) {
+        if ((hit_mask & (1u << i)) != 0 && t_near[i] >= far_t) {
+          far_ind = i;
+          far_t = t_near[i];
+        }
+      }
+      hit_mask &= ~(1u << far_ind);
+      stack[stack_size++] = node.child[far_ind];
+    }
+  }
+
+  Interseption res;
+  res.trg_ind = cur_trg;
+  res.instance_ind = 0;
+  res.bar_cord = cur_insp.yz;
+  res.dst = cur_insp.x;
+  return res;
+}
+#else
+bool IsTraversalOmittable(float2 insp_t, float cur_res) {
+  return insp_t.x > insp_t.y || (cur_res > 0 && cur_res + 1e-2 < insp_t.x);
+}
+
+// Stackless traversal of the bvh_buffer subtree at 'root', updates
+// 'cur_trg' and 'cur_insp' if closer interseption is found
+void TraverseBVH(Ray r, uint root, inout uint cur_trg, inout float3 cur_insp) {
+  for (uint cur_vrt = root, prv_vrt = -1, nxt_vrt = root; nxt_vrt != -1;
        prv_vrt = cur_vrt, cur_vrt = nxt_vrt) {
     nxt_vrt = bvh_buffer[cur_vrt].parent;
     // ++it_count;
@@ -164,8 +470,7 @@ Interseption CastRay(Ray r) {
     if (bvh_buffer[cur_vrt].bvh_level == (uint)(-1)) {
       for (uint t_ind = bvh_buffer[cur_vrt].left; t_ind < bvh_buffer[cur_vrt].right; t_ind++) {
         // it_count += 2;
-        Triangle t = GetTriangleByInd(t_ind);
-        float3 n_insp = t.GetRayInterseption(r);
+        float3 n_insp = IntersectTriangle(t_ind, r);
         if (n_insp.x > 0 && (n_insp.x < cur_insp.x || cur_insp.x < 0)) {
           cur_trg = t_ind;
           cur_insp = n_insp;
@@ -195,15 +500,91 @@ Interseption CastRay(Ray r) {
       nxt_vrt = snd;
     }
   }
+}
+
+#ifdef BVH_TWO_LEVEL
+Interseption CastRay(Ray r) {
+  uint cur_trg = (uint)-1;
+  uint cur_instance = 0;
+  float3 cur_insp = float3(-1, 0, 0);
+
+  uint stack[TLAS_STACK_SIZE];
+  uint stack_size = 0;
+  stack[stack_size++] = 0;
+  while (stack_size > 0) {
+    uint cur_vrt = stack[--stack_size];
+    if (IsTraversalOmittable(tlas_buffer[cur_vrt].bounds.GetInspT(r),
+                             cur_insp.x)) {
+      continue;
+    }
+    if (tlas_buffer[cur_vrt].bvh_level != (uint)(-1)) {
+      // never fails for top levels of TwoLevelBVH, only guards memory
+      if (stack_size + 2 <= TLAS_STACK_SIZE) {
+        stack[stack_size++] = tlas_buffer[cur_vrt].right;
+        stack[stack_size++] = tlas_buffer[cur_vrt].left;
+      }
+      continue;
+    }
+    for (uint i = tlas_buffer[cur_vrt].left; i < tlas_buffer[cur_vrt].right;
+         i++) {
+      // direction is not normalized, so distances stay in world units
+      Ray object_ray;
+      object_ray.origin =
+          mul(instance_buffer[i].world_to_object, float4(r.origin, 1)).xyz;
+      object_ray.direction =
+          mul(instance_buffer[i].world_to_object, float4(r.direction, 0)).xyz;
+      uint prv_trg = cur_trg;
+      TraverseBVH(object_ray, instance_buffer[i].blas_root, cur_trg,
+                  cur_insp);
+      if (cur_trg != prv_trg) {
+        cur_instance = i;
+      }
+    }
+  }
+
+  Interseption res;
+  res.trg_ind = cur_trg;
+  res.instance_ind = cur_instance;
+  res.bar_cord = cur_insp.yz;
+  res.dst = cur_insp.x;
+  return res;
+}
+#else
+Interseption CastRay(Ray r) {
+  uint cur_trg = (uint)-1;
+  float3 cur_insp = float3(-1, 0, 0);
+  TraverseBVH(r, 0, cur_trg, cur_insp);
 
   Interseption res;
   res.trg_ind = cur_trg;
+  res.instance_ind = 0;
   res.bar_cord = cur_insp.yz;
-  // res.it_count = it_count;
   res.dst = cur_insp.x;
-  // res.insp_left = insp_l;
   return res;
 }
+#endif
+#endif
+
+#ifdef BVH_TWO_LEVEL
+float3 ToWorldPoint(Interseption insp, float3 pt) {
+  return mul(instance_buffer[insp.instance_ind].object_to_world,
+             float4(pt, 1)).xyz;
+}
+
+float3 ToWorldNormal(Interseption insp, float3 n) {
+  float3x3 world_to_object =
+      (float3x3)instance_buffer[insp.instance_ind].world_to_object;
+  return normalize(mul(transpose(world_to_object), n));
+}
+#else
+float3 ToWorldPoint(Interseption insp, float3 pt) {
+  return pt;
+}
+
+float3 ToWorldNormal(Interseption insp, float3 n) {
+  return n;
+}
+#endif
 
 float4 CalcLightAtInterseption(Interseption insp, Ray r) {
   // float t_flag = insp.insp_left / 4;
@@ -212,9 +593,10 @@ float4 CalcLightAtInterseption(Interseption insp, Ray r) {
   // float3 materialColor = float3((t_flag % 4) * 0.2 + 0.2, (t_flag2 % 4) * 0.2 + 0.2, (t_flag3 % 4) * 0.2 + 0.2);
   float3 materialColor = float3(1.0, 1.0, 1.0);
 	uint specPow = 256;
-  Triangle t = GetTriangleByInd(insp.trg_ind);
-  float3 insp_point = t.GetPointFromBarCord(insp.bar_cord);
-  float3 trg_n = GetNormalAtBarCord(insp.trg_ind, insp.bar_cord);
+  float3 insp_point =
+      ToWorldPoint(insp, GetPointAtBarCord(insp.trg_ind, insp.bar_cord));
+  float3 trg_n =
+      ToWorldNormal(insp, GetNormalAtBarCord(insp.trg_ind, insp.bar_cord));
   //float3 trg_n = -t.GetNormal();
 
   float diffuse = 0;
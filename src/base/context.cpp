@@ -10,13 +10,29 @@ namespace base {
 void Context::PickPhysicalDevice(ContextConfig& config) {
   PhysicalDevicePicker picker(&config, Base::Get().GetWindow().GetSurface());
   physical_device_ = picker.GetPickedDevice();
+  non_coherent_atom_size_ =
+      physical_device_.getProperties().limits.nonCoherentAtomSize;
   queue_family_index_ = picker.GetQueueFamilyIndex();
+  if (config.transfer_queue_count > 0) {
+    transfer_queue_family_index_ = picker.GetTransferQueueFamilyIndex();
+  }
+  if (transfer_queue_family_index_ == uint32_t(-1)) {
+    config.transfer_queue_count = 0;
+  }
 }
 
 void Context::CreateDevice(ContextConfig& config) {
   std::vector<float> queue_priorities(config.queue_count, 1.0);
-  vk::DeviceQueueCreateInfo queue_create_info(
-      vk::DeviceQueueCreateFlags{}, queue_family_index_, queue_priorities);
+  std::vector<float> transfer_queue_priorities(config.transfer_queue_count,
+                                               1.0);
+  std::vector<vk::DeviceQueueCreateInfo> queue_create_info = {
+      vk::DeviceQueueCreateInfo(vk::DeviceQueueCreateFlags{},
+                                queue_family_index_, queue_priorities)};
+  if (config.transfer_queue_count > 0) {
+    queue_create_info.push_back(vk::DeviceQueueCreateInfo(
+        vk::DeviceQueueCreateFlags{}, transfer_queue_family_index_,
+        transfer_queue_priorities));
+  }
   vk::PhysicalDeviceFeatures device_features;
   device_features.geometryShader = true;
   vk::DeviceCreateInfo device_info(vk::DeviceCreateFlags{}, queue_create_info,
@@ -42,6 +58,13 @@ void Context::CreateDevice(ContextConfig& config) {
     CHECK(device_queues_[q_ind])
         << "failed to retrive " << q_ind << "'th device queue";
   }
+  transfer_queues_.resize(config.transfer_queue_count);
+  for (uint32_t q_ind = 0; q_ind < transfer_queues_.size(); q_ind++) {
+    transfer_queues_[q_ind] =
+        device_.getQueue(transfer_queue_family_index_, q_ind);
+    CHECK(transfer_queues_[q_ind])
+        << "failed to retrive " << q_ind << "'th transfer queue";
+  }
 }
 
 Context::Context(ContextConfig config) {
@@ -65,14 +88,21 @@ void Context::operator=(Context&& other) noexcept {
 void Context::Swap(Context& other) noexcept {
   std::swap(device_, other.device_);
   std::swap(physical_device_, other.physical_device_);
+  std::swap(non_coherent_atom_size_, other.non_coherent_atom_size_);
   std::swap(queue_family_index_, other.queue_family_index_);
   device_queues_.swap(other.device_queues_);
+  std::swap(transfer_queue_family_index_, other.transfer_queue_family_index_);
+  transfer_queues_.swap(other.transfer_queues_);
 }
 
 vk::PhysicalDevice Context::GetPhysicalDevice() const {
   return physical_device_;
 }
 
+vk::DeviceSize Context::GetNonCoherentAtomSize() const {
+  return non_coherent_atom_size_;
+}
+
 vk::Device Context::GetDevice() const {
   return device_;
 }
@@ -81,12 +111,30 @@ uint32_t Context::GetQueueFamilyIndex() const {
   return queue_family_index_;
 }
 
+uint32_t Context::GetQueueCount() const {
+  return device_queues_.size();
+}
+
 vk::Queue Context::GetQueue(uint32_t queue_ind) const {
   DCHECK(queue_ind < device_queues_.size())
       << "queue_ind " << queue_ind << "out of range.";
   return device_queues_[queue_ind];
 }
 
+uint32_t Context::GetTransferQueueFamilyIndex() const {
+  return transfer_queue_family_index_;
+}
+
+uint32_t Context::GetTransferQueueCount() const {
+  return transfer_queues_.size();
+}
+
+vk::Queue Context::GetTransferQueue(uint32_t queue_ind) const {
+  DCHECK(queue_ind < transfer_queues_.size())
+      << "queue_ind " << queue_ind << "out of range.";
+  return transfer_queues_[queue_ind];
+}
+
 Context::~Context() {
   if (!device_) {
     return;
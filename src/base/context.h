@@ -16,6 +16,10 @@ struct ContextConfig {
   // all flags from 'required_flags'
   uint32_t queue_count;
   vk::QueueFlags required_flags;
+  // queues of another family that supports transfers, preferably one without
+  // graphics and compute, like dedicated DMA engines. None are created if
+  // the device has no such family.
+  uint32_t transfer_queue_count = 0;
 };
 
 /*
@@ -25,8 +29,11 @@ struct ContextConfig {
 class Context {
   vk::Device device_;
   vk::PhysicalDevice physical_device_;
+  vk::DeviceSize non_coherent_atom_size_ = 1;
   uint32_t queue_family_index_ = -1;
   std::vector<vk::Queue> device_queues_;
+  uint32_t transfer_queue_family_index_ = -1;
+  std::vector<vk::Queue> transfer_queues_;
 
   void PickPhysicalDevice(ContextConfig& config);
   void CreateDevice(ContextConfig& config);
@@ -40,9 +47,16 @@ class Context {
   void Swap(Context& other) noexcept;
 
   vk::PhysicalDevice GetPhysicalDevice() const;
+  // limit of the physical device, read once when it is picked
+  vk::DeviceSize GetNonCoherentAtomSize() const;
   vk::Device GetDevice() const;
   uint32_t GetQueueFamilyIndex() const;
+  uint32_t GetQueueCount() const;
   vk::Queue GetQueue(uint32_t queue_ind) const;
+  // -1 if no transfer queues were created
+  uint32_t GetTransferQueueFamilyIndex() const;
+  uint32_t GetTransferQueueCount() const;
+  vk::Queue GetTransferQueue(uint32_t queue_ind) const;
 
   ~Context();
 };
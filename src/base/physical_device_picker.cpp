@@ -31,6 +31,36 @@ uint32_t PhysicalDevicePicker::GetSuitableQueueFamilyIndex(
   return -1;
 }
 
+// Graphics and compute families support transfers without the flag, a
+// family with neither is the device's dedicated copy engine
+uint32_t PhysicalDevicePicker::GetTransferQueueFamilyIndex(
+    vk::PhysicalDevice device) const {
+  const vk::QueueFlags kTransferCapable = vk::QueueFlagBits::eTransfer |
+                                          vk::QueueFlagBits::eGraphics |
+                                          vk::QueueFlagBits::eCompute;
+  const vk::QueueFlags kGeneralPurpose =
+      vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute;
+  uint32_t main_family_index = GetSuitableQueueFamilyIndex(device);
+  auto queue_properties = device.getQueueFamilyProperties();
+  uint32_t res = -1;
+  for (uint32_t family_index = 0; family_index < queue_properties.size();
+       family_index++) {
+    const auto& queue = queue_properties[family_index];
+    if (family_index == main_family_index ||
+        !(queue.queueFlags & kTransferCapable) ||
+        queue.queueCount < config_->transfer_queue_count) {
+      continue;
+    }
+    if (!(queue.queueFlags & kGeneralPurpose)) {
+      return family_index;
+    }
+    if (res == uint32_t(-1)) {
+      res = family_index;
+    }
+  }
+  return res;
+}
+
 bool PhysicalDevicePicker::CheckExtensions(vk::PhysicalDevice device) {
   for (auto& [ext_name, is_available] : extension_availability_) {
     is_available = false;
@@ -99,6 +129,8 @@ void PhysicalDevicePicker::PickPhysicalDevice() {
         DeviceCmp(result_device_, current_device)) {
       result_device_ = current_device;
       result_queue_family_index_ = GetSuitableQueueFamilyIndex(result_device_);
+      result_transfer_queue_family_index_ =
+          GetTransferQueueFamilyIndex(result_device_);
     }
   }
 
@@ -109,6 +141,10 @@ void PhysicalDevicePicker::PickPhysicalDevice() {
   LOG << "Picked device: "
       << std::string(result_device_.getProperties().deviceName)
       << " With queue family: " << result_queue_family_index_;
+  if (config_->transfer_queue_count > 0) {
+    LOG << "Transfer queue family: "
+        << int32_t(result_transfer_queue_family_index_);
+  }
 }
 
 PhysicalDevicePicker::PhysicalDevicePicker(const ContextConfig* config,
@@ -128,4 +164,8 @@ uint32_t PhysicalDevicePicker::GetQueueFamilyIndex() const {
   return result_queue_family_index_;
 }
 
+uint32_t PhysicalDevicePicker::GetTransferQueueFamilyIndex() const {
+  return result_transfer_queue_family_index_;
+}
+
 }  // namespace base
@@ -14,10 +14,12 @@ class PhysicalDevicePicker {
   std::map<std::string, char> extension_availability_;
   vk::PhysicalDevice result_device_;
   uint32_t result_queue_family_index_ = -1;
+  uint32_t result_transfer_queue_family_index_ = -1;
 
   bool CheckFeatures(vk::PhysicalDevice device) const;
   bool CheckPresentModes(vk::PhysicalDevice device) const;
   uint32_t GetSuitableQueueFamilyIndex(vk::PhysicalDevice device) const;
+  uint32_t GetTransferQueueFamilyIndex(vk::PhysicalDevice device) const;
   bool CheckExtensions(vk::PhysicalDevice device);
   bool CheckSurfaceSupport(vk::PhysicalDevice device);
   bool IsDeviceSuitable(vk::PhysicalDevice device);
@@ -30,6 +32,8 @@ class PhysicalDevicePicker {
 
   vk::PhysicalDevice GetPickedDevice() const;
   uint32_t GetQueueFamilyIndex() const;
+  // -1 if the picked device has no transfer family other than the main one
+  uint32_t GetTransferQueueFamilyIndex() const;
 };
 
 }  // namespace base
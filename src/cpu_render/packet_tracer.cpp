@@ -0,0 +1,378 @@
+#include "cpu_render/packet_tracer.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <limits>
+
+#include "utill/error_handling.h"
+#include "utill/thread_pool.h"
+
+namespace cpu_render {
+
+const static uint32_t kTileSize = 16;
+// 8 rays of a packet cover kPacketWidth x kPacketHeight pixels
+const static uint32_t kPacketWidth = 4;
+const static uint32_t kPacketHeight = 2;
+const static uint32_t kStackSize = 64;
+const static glm::vec4 kBackgroundColor = {0.1, 0.1, 0.1, 1.0};
+const static float kAmbient = 0.2;
+const static float kSpecularPower = 128;
+
+static float GetSafeInvDir(float speed) {
+  return 1.0f / (std::abs(speed) < 1e-8f ? (speed < 0 ? -1e-8f : 1e-8f)
+                                         : speed);
+}
+
+static uint32_t GetLane(uint32_t x, uint32_t y) {
+  return y * kPacketWidth + x;
+}
+
+static Mask8 GetLaneMask(uint32_t bits) {
+  float lane_flag[8];
+  for (uint32_t lane = 0; lane < 8; lane++) {
+    lane_flag[lane] = (bits >> lane) & 1 ? 1.0f : 0.0f;
+  }
+  return Float8::Load(lane_flag) > Float8(0.0f);
+}
+
+PacketTracer::PacketTracer(const render_data::Mesh& mesh,
+                           const render_data::BVH& bvh,
+                           std::vector<glm::vec4> light_pos)
+    : mesh_(&mesh), bvh_(&bvh), light_pos_(std::move(light_pos)) {
+  triangle_.resize(mesh.index.size() / 3);
+  for (uint32_t i = 0; i < triangle_.size(); i++) {
+    glm::vec3 a = mesh.position[mesh.index[3 * i + 0].x];
+    glm::vec3 b = mesh.position[mesh.index[3 * i + 1].x];
+    glm::vec3 c = mesh.position[mesh.index[3 * i + 2].x];
+    triangle_[i].a = a;
+    triangle_[i].ab = b - a;
+    triangle_[i].ac = c - a;
+    triangle_[i].normal = glm::cross(b - a, c - a);
+  }
+}
+
+Mask8 PacketTracer::IntersectBox(const render_data::BoundingBox& bounds,
+                                 const RayPacket& rays,
+                                 const Float8& t_max,
+                                 Float8& t_near) const {
+  glm::vec2 ranges[3] = {bounds.x_range, bounds.y_range, bounds.z_range};
+  t_near = Float8(0.0f);
+  Float8 t_far = t_max;
+  for (uint32_t axis = 0; axis < 3; axis++) {
+    Float8 t1 = (Float8(ranges[axis].x) - rays.origin[axis]) *
+                rays.inv_direction[axis];
+    Float8 t2 = (Float8(ranges[axis].y) - rays.origin[axis]) *
+                rays.inv_direction[axis];
+    t_near = Max(t_near, Min(t1, t2));
+    t_far = Min(t_far, Max(t1, t2));
+  }
+  return rays.active & (t_near <= t_far);
+}
+
+// Same system as Triangle::GetRayInterseption in raytrace.hlsl, including
+// culling of triangles facing away from the ray
+void PacketTracer::IntersectTriangle(uint32_t trg_ind,
+                                     const RayPacket& rays,
+                                     HitPacket& hits) const {
+  const Triangle& trg = triangle_[trg_ind];
+  Vec3x8 s = {rays.origin.x - Float8(trg.a.x),
+              rays.origin.y - Float8(trg.a.y),
+              rays.origin.z - Float8(trg.a.z)};
+  const Vec3x8& d = rays.direction;
+
+  // det(-d, ab, ac) = -dot(d, cross(ab, ac))
+  Float8 det = -MulAdd(d.x, Float8(trg.normal.x),
+                       MulAdd(d.y, Float8(trg.normal.y),
+                              d.z * Float8(trg.normal.z)));
+  Mask8 valid = rays.active & (det >= Float8(1e-4f));
+  if (!valid.Any()) {
+    return;
+  }
+  Float8 inv_det = Float8(1.0f) / det;
+  // t = det(s, ab, ac) / det
+  Float8 t = MulAdd(s.x, Float8(trg.normal.x),
+                    MulAdd(s.y, Float8(trg.normal.y),
+                           s.z * Float8(trg.normal.z))) *
+             inv_det;
+  // u = det(-d, s, ac) / det = dot(d, cross(ac, s)) / det
+  Vec3x8 ac_s = {Float8(trg.ac.y) * s.z - Float8(trg.ac.z) * s.y,
+                 Float8(trg.ac.z) * s.x - Float8(trg.ac.x) * s.z,
+                 Float8(trg.ac.x) * s.y - Float8(trg.ac.y) * s.x};
+  Float8 u = MulAdd(d.x, ac_s.x, MulAdd(d.y, ac_s.y, d.z * ac_s.z)) * inv_det;
+  // v = det(-d, ab, s) / det = dot(d, cross(s, ab)) / det
+  Vec3x8 s_ab = {s.y * Float8(trg.ab.z) - s.z * Float8(trg.ab.y),
+                 s.z * Float8(trg.ab.x) - s.x * Float8(trg.ab.z),
+                 s.x * Float8(trg.ab.y) - s.y * Float8(trg.ab.x)};
+  Float8 v = MulAdd(d.x, s_ab.x, MulAdd(d.y, s_ab.y, d.z * s_ab.z)) * inv_det;
+
+  valid = valid & (t > Float8(1e-4f)) & (t < hits.dst) &
+          (u > Float8(0.0f)) & (u < Float8(1.0f)) & (v > Float8(0.0f)) &
+          (v < Float8(1.0f)) & (u + v < Float8(1.0f));
+  uint32_t bits = valid.GetBits();
+  if (bits == 0) {
+    return;
+  }
+  hits.dst = Select(valid, t, hits.dst);
+  hits.bar_u = Select(valid, u, hits.bar_u);
+  hits.bar_v = Select(valid, v, hits.bar_v);
+  for (; bits != 0; bits &= bits - 1) {
+    hits.trg_ind[std::countr_zero(bits)] = trg_ind;
+  }
+}
+
+// Closest hit for every active ray closer than its initial hits.dst
+void PacketTracer::CastRays(const RayPacket& rays, HitPacket& hits) const {
+  const auto& nodes = bvh_->GetNodes();
+  if (nodes.empty()) {
+    return;
+  }
+  Float8 t_near;
+  if (!IntersectBox(nodes[0].bounds, rays, hits.dst, t_near).Any()) {
+    return;
+  }
+  uint32_t stack[kStackSize];
+  uint32_t stack_size = 0;
+  stack[stack_size++] = 0;
+  while (stack_size > 0) {
+    const render_data::BVHNode& node = nodes[stack[--stack_size]];
+    if (node.bvh_level == uint32_t(-1)) {
+      for (uint32_t i = node.left; i < node.right; i++) {
+        IntersectTriangle(i, rays, hits);
+      }
+      continue;
+    }
+
+    Float8 left_t;
+    Float8 right_t;
+    Mask8 left_hit =
+        IntersectBox(nodes[node.left].bounds, rays, hits.dst, left_t);
+    Mask8 right_hit =
+        IntersectBox(nodes[node.right].bounds, rays, hits.dst, right_t);
+    if (!left_hit.Any() && !right_hit.Any()) {
+      continue;
+    }
+    if (!left_hit.Any() || !right_hit.Any()) {
+      stack[stack_size++] = left_hit.Any() ? node.left : node.right;
+      continue;
+    }
+    // push the child that more rays enter later first, so that the nearer
+    // one is traversed next
+    uint32_t right_first = (right_t < left_t).GetBits() & left_hit.GetBits();
+    uint32_t left_first = (left_t < right_t).GetBits() & right_hit.GetBits();
+    bool is_left_near =
+        std::popcount(left_first) >= std::popcount(right_first);
+    DCHECK(stack_size + 2 <= kStackSize) << "Traversal stack overflow";
+    stack[stack_size++] = is_left_near ? node.right : node.left;
+    stack[stack_size++] = is_left_near ? node.left : node.right;
+  }
+}
+
+glm::vec3 PacketTracer::GetNormalAtBarCord(uint32_t trg_ind,
+                                           glm::vec2 bar_cord) const {
+  const auto& index = mesh_->index;
+  uint32_t na_ind = index[3 * trg_ind + 0].y;
+  uint32_t nb_ind = index[3 * trg_ind + 1].y;
+  uint32_t nc_ind = index[3 * trg_ind + 2].y;
+  uint32_t normal_count = mesh_->normal.size();
+  if (na_ind >= normal_count || nb_ind >= normal_count ||
+      nc_ind >= normal_count) {
+    // raytrace.hlsl Triangle::GetNormal
+    const Triangle& trg = triangle_[trg_ind];
+    return glm::normalize(glm::cross(trg.ac, trg.ab));
+  }
+  glm::vec3 na = mesh_->normal[na_ind];
+  glm::vec3 nb = mesh_->normal[nb_ind];
+  glm::vec3 nc = mesh_->normal[nc_ind];
+  glm::vec3 n =
+      nb * bar_cord.x + nc * bar_cord.y + na * (1 - (bar_cord.x + bar_cord.y));
+  return glm::normalize(n);
+}
+
+// CalcLightAtInterseption for every lane with a hit, shadow rays of one
+// light are traced as a packet
+void PacketTracer::ShadePacket(const RayPacket& rays,
+                               const HitPacket& hits,
+                               glm::vec4* color) const {
+  float dst[8];
+  float bar_u[8];
+  float bar_v[8];
+  hits.dst.Store(dst);
+  hits.bar_u.Store(bar_u);
+  hits.bar_v.Store(bar_v);
+  float dir[3][8];
+  for (uint32_t axis = 0; axis < 3; axis++) {
+    rays.direction[axis].Store(dir[axis]);
+  }
+
+  uint32_t hit_bits = 0;
+  glm::vec3 insp_point[8];
+  glm::vec3 trg_n[8];
+  glm::vec3 ray_dir[8];
+  for (uint32_t lane = 0; lane < 8; lane++) {
+    color[lane] = kBackgroundColor;
+    if (!((rays.active.GetBits() >> lane) & 1) ||
+        hits.trg_ind[lane] == uint32_t(-1)) {
+      continue;
+    }
+    hit_bits |= 1 << lane;
+    const Triangle& trg = triangle_[hits.trg_ind[lane]];
+    insp_point[lane] = trg.a + trg.ab * bar_u[lane] + trg.ac * bar_v[lane];
+    trg_n[lane] = GetNormalAtBarCord(hits.trg_ind[lane],
+                                     glm::vec2(bar_u[lane], bar_v[lane]));
+    ray_dir[lane] = glm::vec3(dir[0][lane], dir[1][lane], dir[2][lane]);
+  }
+  if (hit_bits == 0) {
+    return;
+  }
+
+  float diffuse[8] = {};
+  float specular[8] = {};
+  for (const glm::vec4& light : light_pos_) {
+    float origin[3][8] = {};
+    float to_light[3][8] = {};
+    float light_dst[8] = {};
+    for (uint32_t lane = 0; lane < 8; lane++) {
+      if (!((hit_bits >> lane) & 1)) {
+        continue;
+      }
+      glm::vec3 to_light_vec = glm::vec3(light) - insp_point[lane];
+      light_dst[lane] = glm::length(to_light_vec);
+      to_light_vec = glm::normalize(to_light_vec);
+      glm::vec3 shadow_origin = insp_point[lane] + to_light_vec * 1e-4f;
+      for (uint32_t axis = 0; axis < 3; axis++) {
+        origin[axis][lane] = shadow_origin[axis];
+        to_light[axis][lane] = to_light_vec[axis];
+      }
+    }
+
+    RayPacket shadow_rays;
+    for (uint32_t axis = 0; axis < 3; axis++) {
+      shadow_rays.origin[axis] = Float8::Load(origin[axis]);
+      shadow_rays.direction[axis] = Float8::Load(to_light[axis]);
+      float inv_dir[8];
+      for (uint32_t lane = 0; lane < 8; lane++) {
+        inv_dir[lane] = GetSafeInvDir(to_light[axis][lane]);
+      }
+      shadow_rays.inv_direction[axis] = Float8::Load(inv_dir);
+    }
+    shadow_rays.active = GetLaneMask(hit_bits);
+    // any hit closer than the light is the same as the shader check of the
+    // closest one
+    HitPacket shadow_hits;
+    shadow_hits.dst = Float8::Load(light_dst);
+    std::fill(shadow_hits.trg_ind, shadow_hits.trg_ind + 8, uint32_t(-1));
+    CastRays(shadow_rays, shadow_hits);
+
+    for (uint32_t lane = 0; lane < 8; lane++) {
+      if (!((hit_bits >> lane) & 1) ||
+          shadow_hits.trg_ind[lane] != uint32_t(-1)) {
+        continue;
+      }
+      glm::vec3 to_light_vec(to_light[0][lane], to_light[1][lane],
+                             to_light[2][lane]);
+      glm::vec3 n = trg_n[lane];
+      glm::vec3 reflected =
+          ray_dir[lane] - 2.0f * glm::dot(n, ray_dir[lane]) * n;
+      diffuse[lane] += std::max(0.0f, glm::dot(n, to_light_vec));
+      specular[lane] += std::pow(
+          std::max(0.0f, glm::dot(to_light_vec, reflected)), kSpecularPower);
+    }
+  }
+
+  for (uint32_t lane = 0; lane < 8; lane++) {
+    if ((hit_bits >> lane) & 1) {
+      float light = diffuse[lane] + specular[lane] + kAmbient;
+      color[lane] = glm::vec4(light, light, light, 1.0f);
+    }
+  }
+}
+
+void PacketTracer::RenderTile(const render_data::CameraInfo& camera,
+                              uint32_t tile_x,
+                              uint32_t tile_y,
+                              Image& target) const {
+  glm::vec3 origin = camera.camera_to_world.TransformPoint(glm::vec3(0));
+  uint32_t x_end = std::min(tile_x + kTileSize, target.width);
+  uint32_t y_end = std::min(tile_y + kTileSize, target.height);
+  for (uint32_t py = tile_y; py < y_end; py += kPacketHeight) {
+    for (uint32_t px = tile_x; px < x_end; px += kPacketWidth) {
+      float dir[3][8] = {};
+      float inv_dir[3][8] = {};
+      uint32_t active_bits = 0;
+      for (uint32_t y = 0; y < kPacketHeight; y++) {
+        for (uint32_t x = 0; x < kPacketWidth; x++) {
+          if (px + x >= x_end || py + y >= y_end) {
+            continue;
+          }
+          uint32_t lane = GetLane(x, y);
+          active_bits |= 1 << lane;
+          // PixCordToRay in raytrace.hlsl
+          glm::vec2 camera_space_xy(float(px + x) / camera.screen_width,
+                                    float(py + y) / camera.screen_height);
+          camera_space_xy = camera_space_xy * 2.0f - glm::vec2(1, 1);
+          camera_space_xy.x *= camera.aspect;
+          camera_space_xy.y *= -1;
+          glm::vec3 dst_pos = camera.camera_to_world.TransformPoint(
+              glm::vec3(camera_space_xy.x, camera_space_xy.y, 1));
+          glm::vec3 ray_dir = glm::normalize(dst_pos - origin);
+          for (uint32_t axis = 0; axis < 3; axis++) {
+            dir[axis][lane] = ray_dir[axis];
+            inv_dir[axis][lane] = GetSafeInvDir(ray_dir[axis]);
+          }
+        }
+      }
+
+      RayPacket rays;
+      for (uint32_t axis = 0; axis < 3; axis++) {
+        rays.origin[axis] = Float8(origin[axis]);
+        rays.direction[axis] = Float8::Load(dir[axis]);
+        rays.inv_direction[axis] = Float8::Load(inv_dir[axis]);
+      }
+      rays.active = GetLaneMask(active_bits);
+
+      HitPacket hits;
+      hits.dst = Float8(std::numeric_limits<float>::max());
+      std::fill(hits.trg_ind, hits.trg_ind + 8, uint32_t(-1));
+      CastRays(rays, hits);
+
+      glm::vec4 color[8];
+      ShadePacket(rays, hits, color);
+      float dst[8];
+      hits.dst.Store(dst);
+      for (uint32_t y = 0; y < kPacketHeight; y++) {
+        for (uint32_t x = 0; x < kPacketWidth; x++) {
+          uint32_t lane = GetLane(x, y);
+          if (!((active_bits >> lane) & 1)) {
+            continue;
+          }
+          uint32_t pixel = (py + y) * target.width + px + x;
+          target.color[pixel] = color[lane];
+          target.depth[pixel] = hits.trg_ind[lane] == uint32_t(-1)
+                                    ? 0.0f
+                                    : std::max(0.0f, 1 - dst[lane] / 100);
+        }
+      }
+    }
+  }
+}
+
+void PacketTracer::Render(const render_data::CameraInfo& camera,
+                          Image& target) const {
+  target.width = camera.screen_width;
+  target.height = camera.screen_height;
+  target.color.assign(size_t(target.width) * target.height, kBackgroundColor);
+  target.depth.assign(size_t(target.width) * target.height, 0.0f);
+
+  uint32_t tile_count_x = (target.width + kTileSize - 1) / kTileSize;
+  uint32_t tile_count_y = (target.height + kTileSize - 1) / kTileSize;
+  utill::ParallelFor(0, tile_count_x * tile_count_y, 1,
+                     [&](size_t begin, size_t end) {
+                       for (size_t tile = begin; tile < end; tile++) {
+                         RenderTile(camera, (tile % tile_count_x) * kTileSize,
+                                    (tile / tile_count_x) * kTileSize, target);
+                       }
+                     });
+}
+
+}  // namespace cpu_render
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "cpu_render/simd.h"
+#include "render_data/bvh.h"
+#include "render_data/camera_info.h"
+#include "render_data/mesh.h"
+
+namespace cpu_render {
+
+struct Image {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  // row major, same values raytrace.hlsl writes to color/depth targets
+  std::vector<glm::vec4> color;
+  std::vector<float> depth;
+};
+
+/*
+ * CPU implementation of raytrace.hlsl over the binary BVH layout: same
+ * camera rays, triangle test and shading. Image is split into tiles rendered
+ * on utill::ThreadPool::GetGlobal(), each tile traces packets of 8 rays
+ * through the BVH together.
+ */
+class PacketTracer {
+  struct RayPacket {
+    Vec3x8 origin;
+    Vec3x8 direction;
+    Vec3x8 inv_direction;
+    Mask8 active;
+  };
+
+  struct HitPacket {
+    Float8 dst;
+    Float8 bar_u;
+    Float8 bar_v;
+    uint32_t trg_ind[8];
+  };
+
+  // edges and normal of a triangle in BVH leaf order
+  struct Triangle {
+    glm::vec3 a;
+    glm::vec3 ab;
+    glm::vec3 ac;
+    glm::vec3 normal;
+  };
+
+  const render_data::Mesh* mesh_ = nullptr;
+  const render_data::BVH* bvh_ = nullptr;
+  std::vector<Triangle> triangle_;
+  std::vector<glm::vec4> light_pos_;
+
+  Mask8 IntersectBox(const render_data::BoundingBox& bounds,
+                     const RayPacket& rays,
+                     const Float8& t_max,
+                     Float8& t_near) const;
+  void IntersectTriangle(uint32_t trg_ind,
+                         const RayPacket& rays,
+                         HitPacket& hits) const;
+  void CastRays(const RayPacket& rays, HitPacket& hits) const;
+
+  glm::vec3 GetNormalAtBarCord(uint32_t trg_ind, glm::vec2 bar_cord) const;
+  void ShadePacket(const RayPacket& rays,
+                   const HitPacket& hits,
+                   glm::vec4* color) const;
+  void RenderTile(const render_data::CameraInfo& camera,
+                  uint32_t tile_x,
+                  uint32_t tile_y,
+                  Image& target) const;
+
+ public:
+  // 'mesh' must be reordered with bvh.GetPrimitiveOrd(), like the one
+  // uploaded for the shader. Both must outlive the tracer.
+  PacketTracer(const render_data::Mesh& mesh,
+               const render_data::BVH& bvh,
+               std::vector<glm::vec4> light_pos);
+
+  // Renders camera.screen_width x camera.screen_height image
+  void Render(const render_data::CameraInfo& camera, Image& target) const;
+};
+
+}  // namespace cpu_render
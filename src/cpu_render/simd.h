@@ -0,0 +1,176 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#else
+#include <algorithm>
+#endif
+
+namespace cpu_render {
+
+/*
+ * 8 lane float vector and lane mask used by packet traversal. Maps to AVX2
+ * registers when compiled with AVX2 support, to plain arrays otherwise.
+ */
+#ifdef __AVX2__
+struct Mask8 {
+  __m256 v;
+
+  uint32_t GetBits() const { return _mm256_movemask_ps(v); }
+  bool Any() const { return GetBits() != 0; }
+
+  friend Mask8 operator&(Mask8 a, Mask8 b) { return {_mm256_and_ps(a.v, b.v)}; }
+  friend Mask8 operator|(Mask8 a, Mask8 b) { return {_mm256_or_ps(a.v, b.v)}; }
+};
+
+struct Float8 {
+  __m256 v;
+
+  Float8() = default;
+  Float8(__m256 val) : v(val) {}
+  Float8(float val) : v(_mm256_set1_ps(val)) {}
+
+  static Float8 Load(const float* src) { return {_mm256_loadu_ps(src)}; }
+  void Store(float* dst) const { _mm256_storeu_ps(dst, v); }
+
+  friend Float8 operator+(Float8 a, Float8 b) {
+    return {_mm256_add_ps(a.v, b.v)};
+  }
+  friend Float8 operator-(Float8 a, Float8 b) {
+    return {_mm256_sub_ps(a.v, b.v)};
+  }
+  friend Float8 operator*(Float8 a, Float8 b) {
+    return {_mm256_mul_ps(a.v, b.v)};
+  }
+  friend Float8 operator/(Float8 a, Float8 b) {
+    return {_mm256_div_ps(a.v, b.v)};
+  }
+  friend Float8 operator-(Float8 a) {
+    return {_mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f))};
+  }
+  friend Float8 Min(Float8 a, Float8 b) { return {_mm256_min_ps(a.v, b.v)}; }
+  friend Float8 Max(Float8 a, Float8 b) { return {_mm256_max_ps(a.v, b.v)}; }
+  // a * b + c
+  friend Float8 MulAdd(Float8 a, Float8 b, Float8 c) {
+    return {_mm256_fmadd_ps(a.v, b.v, c.v)};
+  }
+
+  friend Mask8 operator<(Float8 a, Float8 b) {
+    return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)};
+  }
+  friend Mask8 operator<=(Float8 a, Float8 b) {
+    return {_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)};
+  }
+  friend Mask8 operator>(Float8 a, Float8 b) {
+    return {_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)};
+  }
+  friend Mask8 operator>=(Float8 a, Float8 b) {
+    return {_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)};
+  }
+
+  // mask ? a : b per lane
+  friend Float8 Select(Mask8 mask, Float8 a, Float8 b) {
+    return {_mm256_blendv_ps(b.v, a.v, mask.v)};
+  }
+};
+#else
+struct Mask8 {
+  uint32_t bits;
+
+  uint32_t GetBits() const { return bits; }
+  bool Any() const { return bits != 0; }
+
+  friend Mask8 operator&(Mask8 a, Mask8 b) { return {a.bits & b.bits}; }
+  friend Mask8 operator|(Mask8 a, Mask8 b) { return {a.bits | b.bits}; }
+};
+
+struct Float8 {
+  float v[8];
+
+  Float8() = default;
+  Float8(float val) { std::fill(v, v + 8, val); }
+
+  static Float8 Load(const float* src) {
+    Float8 res;
+    std::copy(src, src + 8, res.v);
+    return res;
+  }
+  void Store(float* dst) const { std::copy(v, v + 8, dst); }
+
+  template <typename Op>
+  static Float8 Apply(Float8 a, Float8 b, Op op) {
+    Float8 res;
+    for (uint32_t i = 0; i < 8; i++) {
+      res.v[i] = op(a.v[i], b.v[i]);
+    }
+    return res;
+  }
+  template <typename Op>
+  static Mask8 Compare(Float8 a, Float8 b, Op op) {
+    Mask8 res{0};
+    for (uint32_t i = 0; i < 8; i++) {
+      res.bits |= uint32_t(op(a.v[i], b.v[i])) << i;
+    }
+    return res;
+  }
+
+  friend Float8 operator+(Float8 a, Float8 b) {
+    return Apply(a, b, [](float x, float y) { return x + y; });
+  }
+  friend Float8 operator-(Float8 a, Float8 b) {
+    return Apply(a, b, [](float x, float y) { return x - y; });
+  }
+  friend Float8 operator*(Float8 a, Float8 b) {
+    return Apply(a, b, [](float x, float y) { return x * y; });
+  }
+  friend Float8 operator/(Float8 a, Float8 b) {
+    return Apply(a, b, [](float x, float y) { return x / y; });
+  }
+  friend Float8 operator-(Float8 a) { return Float8(0.0f) - a; }
+  friend Float8 Min(Float8 a, Float8 b) {
+    return Apply(a, b, [](float x, float y) { return x < y ? x : y; });
+  }
+  friend Float8 Max(Float8 a, Float8 b) {
+    return Apply(a, b, [](float x, float y) { return x > y ? x : y; });
+  }
+  friend Float8 MulAdd(Float8 a, Float8 b, Float8 c) { return a * b + c; }
+
+  friend Mask8 operator<(Float8 a, Float8 b) {
+    return Compare(a, b, [](float x, float y) { return x < y; });
+  }
+  friend Mask8 operator<=(Float8 a, Float8 b) {
+    return Compare(a, b, [](float x, float y) { return x <= y; });
+  }
+  friend Mask8 operator>(Float8 a, Float8 b) {
+    return Compare(a, b, [](float x, float y) { return x > y; });
+  }
+  friend Mask8 operator>=(Float8 a, Float8 b) {
+    return Compare(a, b, [](float x, float y) { return x >= y; });
+  }
+
+  friend Float8 Select(Mask8 mask, Float8 a, Float8 b) {
+    Float8 res;
+    for (uint32_t i = 0; i < 8; i++) {
+      res.v[i] = (mask.bits >> i) & 1 ? a.v[i] : b.v[i];
+    }
+    return res;
+  }
+};
+#endif
+
+struct Vec3x8 {
+  Float8 x;
+  Float8 y;
+  Float8 z;
+
+  Float8& operator[](uint32_t axis) {
+    return axis == 0 ? x : axis == 1 ? y : z;
+  }
+  const Float8& operator[](uint32_t axis) const {
+    return axis == 0 ? x : axis == 1 ? y : z;
+  }
+};
+
+}  // namespace cpu_render
@@ -40,10 +40,13 @@ uint32_t& CommandPool::GetCmdAllocStep(vk::CommandBufferLevel cmd_level) {
   }
 }
 
-CommandPool::CommandPool() {
+CommandPool::CommandPool()
+    : CommandPool(base::Base::Get().GetContext().GetQueueFamilyIndex()) {}
+
+CommandPool::CommandPool(uint32_t queue_family_index) {
   auto device = base::Base::Get().GetContext().GetDevice();
   cmd_pool_ = device.createCommandPool(vk::CommandPoolCreateInfo(
-      vk::CommandPoolCreateFlagBits::eResetCommandBuffer));
+      vk::CommandPoolCreateFlagBits::eResetCommandBuffer, queue_family_index));
 }
 
 std::vector<vk::CommandBuffer> CommandPool::GetCmd(
@@ -28,7 +28,9 @@ class CommandPool {
   uint32_t& GetCmdAllocStep(vk::CommandBufferLevel cmd_level);
 
  public:
+  // command buffers for queues of the main family of base::Context
   CommandPool();
+  explicit CommandPool(uint32_t queue_family_index);
 
   CommandPool(const CommandPool&) = delete;
   void operator=(const CommandPool&) = delete;
@@ -10,7 +10,7 @@
 namespace gpu_executer {
 
 bool Executer::TaskInfo::HasSemaphoreOperations() const {
-  return external_wait || external_signal;
+  return external_wait || external_signal || timeline_wait;
 }
 
 void Executer::ScheduleTask(Task* task,
@@ -26,6 +26,15 @@ void Executer::ScheduleTask(Task* task,
   tasks_.back().secondary_cmd_count = secondary_cmd_count;
 }
 
+void Executer::ScheduleTask(Task* task,
+                            vk::PipelineStageFlags2KHR stage_flags,
+                            const TimelineWait* timeline_wait,
+                            uint32_t secondary_cmd_count) {
+  DCHECK(timeline_wait) << "Use the other overload for no waits";
+  ScheduleTask(task, stage_flags, {}, {}, secondary_cmd_count);
+  tasks_.back().timeline_wait = timeline_wait;
+}
+
 Executer::SubmitInfo Executer::RecordCmdBatch(uint32_t batch_start,
                                               uint32_t batch_end) {
   uint32_t secondary_cmd_count = 0;
@@ -62,6 +71,13 @@ Executer::SubmitInfo Executer::RecordCmdBatch(uint32_t batch_start,
       res.semaphore_to_wait.push_back(vk::SemaphoreSubmitInfoKHR(
           tasks_[i].external_wait, 0, tasks_[i].stage_flags));
     }
+    const TimelineWait* timeline_wait = tasks_[i].timeline_wait;
+    // a task with semaphore operations starts its batch, so the wait holds
+    // only tasks after it
+    if (timeline_wait && timeline_wait->value > 0) {
+      res.semaphore_to_wait.push_back(timeline_wait->semaphore->GetWaitInfo(
+          tasks_[i].stage_flags, timeline_wait->value));
+    }
   }
   primary_cmd.end();
 
@@ -84,6 +100,10 @@ void Executer::Execute() {
     ++batch_end_ind;
 
     auto batch = RecordCmdBatch(batch_start_ind, batch_end_ind);
+    if (batch_end_ind == tasks_.size()) {
+      batch.semaphore_to_signal.push_back(frame_semaphore_.GetSignalInfo(
+          vk::PipelineStageFlagBits2KHR::eAllCommands));
+    }
 
     ++primary_cmd_count;
     secondary_cmd_count += batch.secondary_cmd.size();
@@ -112,6 +132,10 @@ void Executer::Execute() {
   cmd_pool_.RecycleCmd(recycle_primary, recycle_secondary, fence);
 }
 
+const TimelineSemaphore& Executer::GetFrameSemaphore() const {
+  return frame_semaphore_;
+}
+
 void Executer::ExecuteOneTime(Task* task, uint32_t secondary_cmd_count) {
   vk::CommandBuffer primary_cmd =
       cmd_pool_.GetCmd(vk::CommandBufferLevel::ePrimary, 1)[0];
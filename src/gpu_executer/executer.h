@@ -10,6 +10,7 @@
 
 #include "gpu_executer/command_pool.h"
 #include "gpu_executer/task.h"
+#include "gpu_executer/timeline_semaphore.h"
 
 namespace gpu_executer {
 
@@ -19,6 +20,7 @@ class Executer {
     vk::PipelineStageFlags2KHR stage_flags = {};
     vk::Semaphore external_signal = {};
     vk::Semaphore external_wait = {};
+    const TimelineWait* timeline_wait = nullptr;
     uint32_t secondary_cmd_count = 0;
 
     bool HasSemaphoreOperations() const;
@@ -26,6 +28,7 @@ class Executer {
 
   CommandPool cmd_pool_;
   std::vector<TaskInfo> tasks_;
+  TimelineSemaphore frame_semaphore_;
 
   struct SubmitInfo {
     std::vector<vk::SemaphoreSubmitInfoKHR> semaphore_to_wait;
@@ -47,9 +50,18 @@ class Executer {
                     vk::Semaphore external_signal = {},
                     vk::Semaphore external_wait = {},
                     uint32_t secondary_cmd_count = 0);
+  // 'timeline_wait' is read every Execute, the owner keeps it alive
+  void ScheduleTask(Task* task,
+                    vk::PipelineStageFlags2KHR stage_flags,
+                    const TimelineWait* timeline_wait,
+                    uint32_t secondary_cmd_count = 0);
 
   void ExecuteOneTime(Task* task, uint32_t secondary_cmd_count = 0);
 
+  // Signaled when all work of an Execute is complete, the next one
+  // signals GetSignalValue() + 1
+  const TimelineSemaphore& GetFrameSemaphore() const;
+
   void Execute();
 };
 
@@ -0,0 +1,92 @@
+#include "gpu_executer/gpu_timer.h"
+
+#include "base/base.h"
+
+#include "utill/error_handling.h"
+
+namespace gpu_executer {
+
+GpuTimer::GpuTimer(uint32_t frame_count) : is_pending_(frame_count, false) {
+  DCHECK(frame_count > 0) << "Timer needs at least one frame";
+  auto& context = base::Base::Get().GetContext();
+  timestamp_period_ =
+      context.GetPhysicalDevice().getProperties().limits.timestampPeriod;
+  query_pool_ = context.GetDevice().createQueryPool(vk::QueryPoolCreateInfo(
+      {}, vk::QueryType::eTimestamp, 2 * frame_count));
+}
+
+GpuTimer::GpuTimer(GpuTimer&& other) noexcept {
+  Swap(other);
+}
+
+void GpuTimer::operator=(GpuTimer&& other) noexcept {
+  GpuTimer tmp;
+  tmp.Swap(other);
+  Swap(tmp);
+}
+
+void GpuTimer::Swap(GpuTimer& other) noexcept {
+  std::swap(query_pool_, other.query_pool_);
+  std::swap(timestamp_period_, other.timestamp_period_);
+  std::swap(frame_, other.frame_);
+  is_pending_.swap(other.is_pending_);
+  std::swap(time_sum_ms_, other.time_sum_ms_);
+  std::swap(sample_count_, other.sample_count_);
+}
+
+void GpuTimer::ReadBack(uint32_t slot) {
+  if (!is_pending_[slot]) {
+    return;
+  }
+  is_pending_[slot] = false;
+  uint64_t timestamps[2] = {};
+  auto device = base::Base::Get().GetContext().GetDevice();
+  vk::Result result = device.getQueryPoolResults(
+      query_pool_, 2 * slot, 2, sizeof(timestamps), timestamps,
+      sizeof(uint64_t),
+      vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+  CHECK_VK_RESULT(result) << "Failed to read timestamps";
+  time_sum_ms_ += (timestamps[1] - timestamps[0]) * timestamp_period_ * 1e-6;
+  ++sample_count_;
+}
+
+void GpuTimer::RecordStart(vk::CommandBuffer cmd) {
+  DCHECK(query_pool_) << "Timer is not initialized";
+  uint32_t slot = frame_ % is_pending_.size();
+  ReadBack(slot);
+  cmd.resetQueryPool(query_pool_, 2 * slot, 2);
+  cmd.writeTimestamp2KHR(vk::PipelineStageFlagBits2KHR::eTopOfPipe,
+                         query_pool_, 2 * slot);
+}
+
+void GpuTimer::RecordEnd(vk::CommandBuffer cmd) {
+  DCHECK(query_pool_) << "Timer is not initialized";
+  uint32_t slot = frame_ % is_pending_.size();
+  cmd.writeTimestamp2KHR(vk::PipelineStageFlagBits2KHR::eBottomOfPipe,
+                         query_pool_, 2 * slot + 1);
+  is_pending_[slot] = true;
+  ++frame_;
+}
+
+uint32_t GpuTimer::GetSampleCount() const {
+  return sample_count_;
+}
+
+double GpuTimer::GetAverageMs() const {
+  return sample_count_ == 0 ? 0 : time_sum_ms_ / sample_count_;
+}
+
+void GpuTimer::ResetStats() {
+  time_sum_ms_ = 0;
+  sample_count_ = 0;
+}
+
+GpuTimer::~GpuTimer() {
+  if (!query_pool_) {
+    return;
+  }
+  auto device = base::Base::Get().GetContext().GetDevice();
+  device.destroyQueryPool(query_pool_);
+}
+
+}  // namespace gpu_executer
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+namespace gpu_executer {
+
+/*
+ * Measures GPU time between RecordStart and RecordEnd with timestamp
+ * queries, once per recorded frame. Every frame uses its own pair of
+ * queries out of 'frame_count', results of a pair are read back right
+ * before it is reused, so the readback doesn't wait for recent frames.
+ */
+class GpuTimer {
+  vk::QueryPool query_pool_ = {};
+  // nanoseconds per timestamp tick
+  double timestamp_period_ = 0;
+  uint32_t frame_ = 0;
+  std::vector<bool> is_pending_;
+  double time_sum_ms_ = 0;
+  uint32_t sample_count_ = 0;
+
+  void ReadBack(uint32_t slot);
+
+ public:
+  GpuTimer() = default;
+  explicit GpuTimer(uint32_t frame_count);
+
+  GpuTimer(const GpuTimer&) = delete;
+  void operator=(const GpuTimer&) = delete;
+
+  GpuTimer(GpuTimer&& other) noexcept;
+  void operator=(GpuTimer&& other) noexcept;
+  void Swap(GpuTimer& other) noexcept;
+
+  void RecordStart(vk::CommandBuffer cmd);
+  void RecordEnd(vk::CommandBuffer cmd);
+
+  // Over results read back since the last ResetStats
+  uint32_t GetSampleCount() const;
+  double GetAverageMs() const;
+  void ResetStats();
+
+  ~GpuTimer();
+};
+
+}  // namespace gpu_executer
@@ -22,18 +22,51 @@ vk::Result TimelineSemaphore::Wait(uint64_t timeout) const {
   return device.waitSemaphores(wait_info, timeout);
 }
 
+vk::Result TimelineSemaphore::WaitFor(uint64_t value,
+                                      uint64_t timeout) const {
+  DCHECK(value <= counter_) << "Waiting for a value that is never signaled";
+  vk::SemaphoreWaitInfo wait_info({}, semaphore_, value);
+  auto device = base::Base::Get().GetContext().GetDevice();
+  return device.waitSemaphores(wait_info, timeout);
+}
+
 vk::SemaphoreSubmitInfoKHR TimelineSemaphore::GetWaitInfo(
     vk::PipelineStageFlags2KHR stage_to_wait_at) const noexcept {
   return vk::SemaphoreSubmitInfoKHR(semaphore_, counter_, stage_to_wait_at);
 }
 
+vk::SemaphoreSubmitInfoKHR TimelineSemaphore::GetWaitInfo(
+    vk::PipelineStageFlags2KHR stage_to_wait_at,
+    uint64_t value) const noexcept {
+  DCHECK(value <= counter_) << "Waiting for a value that is never signaled";
+  return vk::SemaphoreSubmitInfoKHR(semaphore_, value, stage_to_wait_at);
+}
+
 vk::SemaphoreSubmitInfoKHR TimelineSemaphore::GetSignalInfo(
     vk::PipelineStageFlags2KHR stage_to_wait_for) {
-  Wait();
   ++counter_;
   return vk::SemaphoreSubmitInfoKHR(semaphore_, counter_, stage_to_wait_for);
 }
 
+uint64_t TimelineSemaphore::GetSignalValue() const {
+  return counter_;
+}
+
+vk::Semaphore TimelineSemaphore::GetSemaphore() const {
+  return semaphore_;
+}
+
+uint64_t TimelineSemaphore::GetCompletedValue() const {
+  auto device = base::Base::Get().GetContext().GetDevice();
+  return device.getSemaphoreCounterValue(semaphore_);
+}
+
+void TimelineSemaphore::SignalFromHost(uint64_t value) {
+  DCHECK(value <= counter_) << "Signaling a value that wasn't handed out";
+  auto device = base::Base::Get().GetContext().GetDevice();
+  device.signalSemaphore(vk::SemaphoreSignalInfo(semaphore_, value));
+}
+
 TimelineSemaphore::~TimelineSemaphore() {
   Wait();
   auto device = base::Base::Get().GetContext().GetDevice();
@@ -15,12 +15,35 @@ class TimelineSemaphore {
   TimelineSemaphore& operator=(TimelineSemaphore& other) = delete;
 
   vk::Result Wait(uint64_t timeout = UINT64_MAX) const;
+  // Waits for 'value' only, signals of later values may be never submitted
+  vk::Result WaitFor(uint64_t value, uint64_t timeout = UINT64_MAX) const;
   vk::SemaphoreSubmitInfoKHR GetWaitInfo(
       vk::PipelineStageFlags2KHR stage_to_wait_at) const noexcept;
+  vk::SemaphoreSubmitInfoKHR GetWaitInfo(
+      vk::PipelineStageFlags2KHR stage_to_wait_at,
+      uint64_t value) const noexcept;
+  // Every call signals the next value, earlier signals may still be pending
   vk::SemaphoreSubmitInfoKHR GetSignalInfo(
       vk::PipelineStageFlags2KHR stage_to_wait_for);
 
+  // value of the last GetSignalInfo
+  uint64_t GetSignalValue() const;
+  vk::Semaphore GetSemaphore() const;
+  // value the device has reached, doesn't block
+  uint64_t GetCompletedValue() const;
+  // Signals 'value' from the host, for values whose submission failed. Every
+  // submitted signal of a lower value must be complete.
+  void SignalFromHost(uint64_t value);
+
   ~TimelineSemaphore();
 };
 
+// Wait of a render graph pass on 'semaphore' reaching 'value'. Read when the
+// frame is submitted, so its owner may raise 'value' every frame, 0 waits
+// for nothing.
+struct TimelineWait {
+  const TimelineSemaphore* semaphore = nullptr;
+  uint64_t value = 0;
+};
+
 }  // namespace gpu_executer
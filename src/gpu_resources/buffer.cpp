@@ -25,6 +25,11 @@ void Buffer::DeclareAccess(ResourceAccess access, uint32_t pass_idx) const {
   syncronizer_->AddAccess(buffer_, access, pass_idx);
 }
 
+uint64_t Buffer::GetLastAccessFrame() const {
+  DCHECK(syncronizer_) << kErrSyncronizerNotProvided;
+  return syncronizer_->GetLastAccessFrame(buffer_);
+}
+
 void Buffer::RecordCopy(vk::CommandBuffer cmd,
                         const Buffer& src,
                         const Buffer& dst,
@@ -2,6 +2,7 @@
 
 #include <vulkan/vulkan.hpp>
 
+#include <span>
 #include <string>
 #include <vector>
 
@@ -23,6 +24,8 @@ class Buffer {
  public:
   void RequireProperties(BufferProperties properties);
   void DeclareAccess(ResourceAccess access, uint32_t pass_idx) const;
+  // see PassAccessSyncronizer::GetLastAccessFrame
+  uint64_t GetLastAccessFrame() const;
 
   static void RecordCopy(vk::CommandBuffer cmd,
                          const Buffer& src,
@@ -53,6 +56,11 @@ static size_t GetDataSize(const std::vector<T>& data) {
   return sizeof(T) * data.size();
 }
 
+template <typename T>
+static size_t GetDataSize(std::span<const T> data) {
+  return sizeof(T) * data.size();
+}
+
 template <typename T>
 vk::DeviceSize Buffer::LoadDataFromVec(const std::vector<T>& data,
                                        vk::DeviceSize dst_offset) {
@@ -1,5 +1,7 @@
 #include "gpu_resources/device_memory_allocator.h"
 
+#include <algorithm>
+
 #include "base/base.h"
 
 #include "utill/error_handling.h"
@@ -44,6 +46,33 @@ uint32_t DeviceMemoryAllocator::FindTypeIndex(uint32_t type_bits) const {
   return result;
 }
 
+// Preferred memory takes at most this part of its heap, so a small BAR heap
+// stays usable for resources that require host visible memory
+const static vk::DeviceSize kPreferredHeapShare = 2;
+
+bool DeviceMemoryAllocator::CanFitPreferred(uint32_t type_index,
+                                            vk::DeviceSize size) const {
+  uint32_t heap_index =
+      device_memory_properties_.memoryTypes[type_index].heapIndex;
+  vk::DeviceSize heap_usage = size;
+  for (const auto& [type_ind, block] : memory_by_type_ind_) {
+    if (device_memory_properties_.memoryTypes[type_ind].heapIndex ==
+        heap_index) {
+      heap_usage += block.offset;
+    }
+  }
+  return heap_usage <=
+         device_memory_properties_.memoryHeaps[heap_index].size /
+             kPreferredHeapShare;
+}
+
+bool DeviceMemoryAllocator::IsNonCoherent(uint32_t type_index) const {
+  vk::MemoryPropertyFlags flags =
+      device_memory_properties_.memoryTypes[type_index].propertyFlags;
+  return (flags & vk::MemoryPropertyFlagBits::eHostVisible) &&
+         !(flags & vk::MemoryPropertyFlagBits::eHostCoherent);
+}
+
 void DeviceMemoryAllocator::ExtendPreallocBlock(uint32_t type_index,
                                                 vk::DeviceSize alignment,
                                                 vk::DeviceSize size) {
@@ -57,8 +86,26 @@ void DeviceMemoryAllocator::ExtendPreallocBlock(uint32_t type_index,
 }
 
 DeviceMemoryAllocator::DeviceMemoryAllocator() {
+  auto& context = base::Base::Get().GetContext();
   device_memory_properties_ =
-      base::Base::Get().GetContext().GetPhysicalDevice().getMemoryProperties();
+      context.GetPhysicalDevice().getMemoryProperties();
+  non_coherent_atom_size_ = context.GetNonCoherentAtomSize();
+  vk::MemoryPropertyFlags host_visible_device_local =
+      vk::MemoryPropertyFlagBits::eDeviceLocal |
+      vk::MemoryPropertyFlagBits::eHostVisible;
+  for (uint32_t type_index = 0;
+       type_index < device_memory_properties_.memoryTypeCount; type_index++) {
+    const vk::MemoryType& type =
+        device_memory_properties_.memoryTypes[type_index];
+    if ((type.propertyFlags & host_visible_device_local) ==
+        host_visible_device_local) {
+      DLOG << "Memory type " << type_index
+           << " is device local and host visible, heap size "
+           << (device_memory_properties_.memoryHeaps[type.heapIndex].size >>
+               20)
+           << "MiB";
+    }
+  }
 }
 
 void DeviceMemoryAllocator::Allocate() {
@@ -67,9 +114,13 @@ void DeviceMemoryAllocator::Allocate() {
     DLOG << "Allocating " << block.offset << " bytes of memory type "
          << type_ind;
 
-    block.size = block.offset;
+    block.size = IsNonCoherent(type_ind)
+                     ? block.GetAlignedOffset(non_coherent_atom_size_)
+                     : block.offset;
     block.offset = 0;
     block.type_index = type_ind;
+    block.property_flags =
+        device_memory_properties_.memoryTypes[type_ind].propertyFlags;
     block.memory = device.allocateMemory(
         vk::MemoryAllocateInfo{block.size, block.type_index});
     if (device_memory_properties_.memoryTypes[type_ind].propertyFlags &
@@ -86,14 +137,28 @@ void DeviceMemoryAllocator::Allocate() {
 
 MemoryBlock* DeviceMemoryAllocator::RequestMemory(
     vk::MemoryRequirements requierments,
-    vk::MemoryPropertyFlags property_flags) {
+    vk::MemoryPropertyFlags property_flags,
+    vk::MemoryPropertyFlags preferred_flags) {
   uint32_t type_bits = GetSuitableTypeBits(requierments, property_flags);
   uint32_t type_index = FindTypeIndex(type_bits);
-  ExtendPreallocBlock(type_index, requierments.alignment, requierments.size);
+  uint32_t preferred_type_bits =
+      GetSuitableTypeBits(requierments, property_flags | preferred_flags);
+  if (preferred_flags && preferred_type_bits != 0) {
+    uint32_t preferred_type_index = FindTypeIndex(preferred_type_bits);
+    if (CanFitPreferred(preferred_type_index, requierments.size)) {
+      type_index = preferred_type_index;
+    }
+  }
+  // both are powers of two
+  vk::DeviceSize alignment =
+      IsNonCoherent(type_index)
+          ? std::max(requierments.alignment, non_coherent_atom_size_)
+          : requierments.alignment;
+  ExtendPreallocBlock(type_index, alignment, requierments.size);
   // store info for actual allocation for future use
   MemoryBlock result;
   result.type_index = type_index;
-  result.offset = requierments.alignment;
+  result.offset = alignment;
   result.size = requierments.size;
   allocations_.push_back(result);
   return &allocations_.back();
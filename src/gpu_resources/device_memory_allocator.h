@@ -12,11 +12,14 @@ namespace gpu_resources {
 class DeviceMemoryAllocator {
   std::map<uint32_t, MemoryBlock> memory_by_type_ind_;
   vk::PhysicalDeviceMemoryProperties device_memory_properties_;
+  vk::DeviceSize non_coherent_atom_size_ = 1;
   std::list<MemoryBlock> allocations_;
 
   uint32_t GetSuitableTypeBits(vk::MemoryRequirements requierments,
                                vk::MemoryPropertyFlags property_flags) const;
   uint32_t FindTypeIndex(uint32_t type_bits) const;
+  bool CanFitPreferred(uint32_t type_index, vk::DeviceSize size) const;
+  bool IsNonCoherent(uint32_t type_index) const;
   void ExtendPreallocBlock(uint32_t type_index,
                            vk::DeviceSize alignment,
                            vk::DeviceSize size);
@@ -27,8 +30,14 @@ class DeviceMemoryAllocator {
   DeviceMemoryAllocator(const DeviceMemoryAllocator&) = delete;
   void operator=(const DeviceMemoryAllocator&) = delete;
 
+  // Memory of a type with 'preferred_flags' too if there is one and its heap
+  // has room, like device local memory that is host visible on devices with
+  // unified memory or resizable BAR. Allocations in host visible memory that
+  // isn't coherent start and end on nonCoherentAtomSize boundaries, so
+  // flushes rounded out to them don't touch other allocations.
   MemoryBlock* RequestMemory(vk::MemoryRequirements requierments,
-                             vk::MemoryPropertyFlags property_flags);
+                             vk::MemoryPropertyFlags property_flags,
+                             vk::MemoryPropertyFlags preferred_flags = {});
   void Allocate();
 
   ~DeviceMemoryAllocator();
@@ -16,8 +16,10 @@ MemoryBlock MemoryBlock::Suballocate(vk::DeviceSize block_size,
                                      vk::DeviceSize alignment) {
   vk::DeviceSize n_offset = GetAlignedOffset(alignment);
   DCHECK(n_offset + block_size <= size) << "No enough space for suballocation";
-  MemoryBlock result = {memory, block_size, n_offset, type_index,
-                        (char*)mapping_start + n_offset};
+  void* block_mapping_start =
+      mapping_start ? (char*)mapping_start + n_offset : nullptr;
+  MemoryBlock result = {memory,     block_size,          n_offset,
+                        type_index, block_mapping_start, property_flags};
   offset = n_offset + block_size;
   return result;
 }
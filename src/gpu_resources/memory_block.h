@@ -10,6 +10,7 @@ struct MemoryBlock {
   vk::DeviceSize offset = 0;
   uint32_t type_index = UINT32_MAX;
   void* mapping_start = nullptr;
+  vk::MemoryPropertyFlags property_flags = {};
 
   vk::DeviceSize GetAlignedOffset(vk::DeviceSize alignment) const;
   MemoryBlock Suballocate(vk::DeviceSize block_size, vk::DeviceSize alignment);
@@ -16,7 +16,8 @@ PassAccessSyncronizer::PassAccessSyncronizer(uint32_t resource_count,
                                              uint32_t pass_count)
     : resource_syncronizers_(resource_count),
       pass_image_barriers_(pass_count + 1),
-      pass_buffer_barriers_(pass_count + 1) {}
+      pass_buffer_barriers_(pass_count + 1),
+      resource_access_frames_(resource_count, 0) {}
 
 void PassAccessSyncronizer::AddAccess(PhysicalBuffer* buffer,
                                       ResourceAccess access,
@@ -24,6 +25,7 @@ void PassAccessSyncronizer::AddAccess(PhysicalBuffer* buffer,
   DCHECK(buffer) << kErrResourceIsNull;
   uint32_t buffer_idx = buffer->GetIdx();
   DCHECK(buffer_idx < resource_syncronizers_.size()) << kErrInvalidResourceIdx;
+  resource_access_frames_[buffer_idx] = frame_;
   AccessDependency dep =
       resource_syncronizers_[buffer_idx].AddAccess(pass_idx, access);
   if (dep.src.access_flags == vk::AccessFlagBits2KHR::eNone &&
@@ -71,6 +73,18 @@ void PassAccessSyncronizer::RecordPassCommandBuffers(vk::CommandBuffer cmd,
       vk::DependencyInfoKHR({}, {}, buffer_barriers, image_barriers));
 }
 
+void PassAccessSyncronizer::SetFrame(uint64_t frame) {
+  frame_ = frame;
+}
+
+uint64_t PassAccessSyncronizer::GetLastAccessFrame(
+    const PhysicalBuffer* buffer) const {
+  DCHECK(buffer) << kErrResourceIsNull;
+  DCHECK(buffer->GetIdx() < resource_access_frames_.size())
+      << kErrInvalidResourceIdx;
+  return resource_access_frames_[buffer->GetIdx()];
+}
+
 std::vector<vk::BufferMemoryBarrier2KHR>
 PassAccessSyncronizer::GetBufferPostPassBarriers(uint32_t pass_idx) {
   std::vector<vk::BufferMemoryBarrier2KHR> res;
@@ -16,6 +16,9 @@ class PassAccessSyncronizer {
   std::vector<ResourceAccessSyncronizer> resource_syncronizers_;
   std::vector<std::vector<vk::ImageMemoryBarrier2KHR>> pass_image_barriers_;
   std::vector<std::vector<vk::BufferMemoryBarrier2KHR>> pass_buffer_barriers_;
+  uint64_t frame_ = 0;
+  // frame of the last access of each resource
+  std::vector<uint64_t> resource_access_frames_;
 
  public:
   PassAccessSyncronizer() = default;
@@ -29,6 +32,12 @@ class PassAccessSyncronizer {
                  uint32_t pass_idx);
   void RecordPassCommandBuffers(vk::CommandBuffer cmd, uint32_t pass_idx);
 
+  // Frame that accesses are added for, a value of the render graph frame
+  // semaphore reached once the frame completes
+  void SetFrame(uint64_t frame);
+  // 0 if 'buffer' was never accessed
+  uint64_t GetLastAccessFrame(const PhysicalBuffer* buffer) const;
+
   std::vector<vk::BufferMemoryBarrier2KHR> GetBufferPostPassBarriers(
       uint32_t pass_idx);
   std::vector<vk::ImageMemoryBarrier2KHR> GetImagePostPassBarriers(
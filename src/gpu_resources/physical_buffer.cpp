@@ -10,9 +10,10 @@ using namespace error_messages;
 
 BufferProperties BufferProperties::Unite(const BufferProperties& lhs,
                                          const BufferProperties& rhs) {
-  return BufferProperties{std::max(lhs.size, rhs.size),
-                          lhs.usage_flags | rhs.usage_flags,
-                          lhs.memory_flags | rhs.memory_flags};
+  return BufferProperties{
+      std::max(lhs.size, rhs.size), lhs.usage_flags | rhs.usage_flags,
+      lhs.memory_flags | rhs.memory_flags,
+      lhs.preferred_memory_flags | rhs.preferred_memory_flags};
 }
 
 void PhysicalBuffer::CreateVkBuffer() {
@@ -36,7 +37,8 @@ void PhysicalBuffer::RequestMemory(DeviceMemoryAllocator& allocator) {
   DCHECK(!memory_) << kErrMemoryAlreadyRequested;
   auto device = base::Base::Get().GetContext().GetDevice();
   auto mem_requierments = device.getBufferMemoryRequirements(buffer_);
-  memory_ = allocator.RequestMemory(mem_requierments, properties_.memory_flags);
+  memory_ = allocator.RequestMemory(mem_requierments, properties_.memory_flags,
+                                   properties_.preferred_memory_flags);
 }
 
 vk::BindBufferMemoryInfo PhysicalBuffer::GetBindMemoryInfo() const {
@@ -89,10 +91,32 @@ void* PhysicalBuffer::GetMappingStart() const {
   return memory_->mapping_start;
 }
 
+vk::MemoryPropertyFlags PhysicalBuffer::GetMemoryFlags() const {
+  DCHECK(memory_) << kErrMemoryNotRequested;
+  DCHECK(memory_->memory) << kErrMemoryNotAllocated;
+  return memory_->property_flags;
+}
+
 vk::MappedMemoryRange PhysicalBuffer::GetMappedMemoryRange() const {
   DCHECK(memory_) << kErrMemoryNotRequested;
+  return GetMappedMemoryRange(0, memory_->size);
+}
+
+// DeviceMemoryAllocator keeps atoms of non coherent memory to one
+// allocation, so the rounded range stays inside this buffer's
+vk::MappedMemoryRange PhysicalBuffer::GetMappedMemoryRange(
+    vk::DeviceSize offset,
+    vk::DeviceSize size) const {
+  DCHECK(memory_) << kErrMemoryNotRequested;
   DCHECK(memory_->memory) << kErrMemoryNotAllocated;
-  return vk::MappedMemoryRange(memory_->memory, memory_->offset, memory_->size);
+  DCHECK(offset + size <= memory_->size) << "Range exceeds the buffer";
+  vk::DeviceSize atom_size =
+      base::Base::Get().GetContext().GetNonCoherentAtomSize();
+  vk::DeviceSize begin = (memory_->offset + offset) / atom_size * atom_size;
+  vk::DeviceSize end =
+      (memory_->offset + offset + size + atom_size - 1) / atom_size *
+      atom_size;
+  return vk::MappedMemoryRange(memory_->memory, begin, end - begin);
 }
 
 vk::BufferMemoryBarrier2KHR PhysicalBuffer::GenerateBarrier(
@@ -10,6 +10,8 @@ struct BufferProperties {
   vk::DeviceSize size = 0;
   vk::BufferUsageFlags usage_flags = {};
   vk::MemoryPropertyFlags memory_flags = {};
+  // used if memory with them fits, see DeviceMemoryAllocator::RequestMemory
+  vk::MemoryPropertyFlags preferred_memory_flags = {};
 
   static BufferProperties Unite(const BufferProperties& lhs,
                                 const BufferProperties& rhs);
@@ -45,8 +47,16 @@ class PhysicalBuffer {
   uint32_t GetIdx() const;
   vk::Buffer GetBuffer() const;
   vk::DeviceSize GetSize() const;
+  // nullptr if the memory isn't host visible
   void* GetMappingStart() const;
+  // flags of the memory type actually used
+  vk::MemoryPropertyFlags GetMemoryFlags() const;
+  // Memory of bytes [offset, offset + size) of the buffer rounded out to
+  // nonCoherentAtomSize, as flushes and invalidates require. Whole buffer
+  // without arguments.
   vk::MappedMemoryRange GetMappedMemoryRange() const;
+  vk::MappedMemoryRange GetMappedMemoryRange(vk::DeviceSize offset,
+                                             vk::DeviceSize size) const;
 
   vk::BufferMemoryBarrier2KHR GenerateBarrier(
       vk::PipelineStageFlags2KHR src_stage_flags,
@@ -180,4 +180,16 @@ void PhysicalImage::RecordBlit(vk::CommandBuffer cmd,
   cmd.blitImage2KHR(blit_info);
 }
 
+void PhysicalImage::RecordCopy(
+    vk::CommandBuffer cmd,
+    const PhysicalImage& src,
+    vk::Buffer dst,
+    const std::vector<vk::BufferImageCopy2KHR>& copy_regions) {
+  DCHECK(src.image_) << "src image: " << kErrNotInitialized;
+  DCHECK(dst) << "dst buffer: " << kErrResourceIsNull;
+  vk::CopyImageToBufferInfo2KHR copy(
+      src.image_, vk::ImageLayout::eTransferSrcOptimal, dst, copy_regions);
+  cmd.copyImageToBuffer2KHR(copy);
+}
+
 }  // namespace gpu_resources
@@ -2,6 +2,9 @@
 
 #include <stdint.h>
 #include <vulkan/vulkan.hpp>
+
+#include <vector>
+
 #include "gpu_resources/device_memory_allocator.h"
 
 namespace gpu_resources {
@@ -74,6 +77,12 @@ class PhysicalImage {
   static void RecordBlit(vk::CommandBuffer cmd,
                          const PhysicalImage& src,
                          const PhysicalImage& dst);
+  // 'src' must be in eTransferSrcOptimal layout
+  static void RecordCopy(
+      vk::CommandBuffer cmd,
+      const PhysicalImage& src,
+      vk::Buffer dst,
+      const std::vector<vk::BufferImageCopy2KHR>& copy_regions);
 };
 
 }  // namespace gpu_resources
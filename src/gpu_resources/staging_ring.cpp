@@ -0,0 +1,160 @@
+#include "gpu_resources/staging_ring.h"
+
+#include <algorithm>
+
+#include "base/base.h"
+
+#include "gpu_resources/common.h"
+#include "gpu_resources/physical_buffer.h"
+#include "utill/error_handling.h"
+
+namespace gpu_resources {
+
+using namespace error_messages;
+
+static vk::DeviceSize AlignUp(vk::DeviceSize val, vk::DeviceSize alignment) {
+  return (val + alignment - 1) / alignment * alignment;
+}
+
+bool StagingRing::Retirement::IsComplete() const {
+  auto device = base::Base::Get().GetContext().GetDevice();
+  if (fence) {
+    return device.getFenceStatus(fence) == vk::Result::eSuccess;
+  }
+  return device.getSemaphoreCounterValue(semaphore) >= value;
+}
+
+void StagingRing::Retirement::Wait() const {
+  auto device = base::Base::Get().GetContext().GetDevice();
+  vk::Result result;
+  if (fence) {
+    result = device.waitForFences(fence, true, UINT64_MAX);
+  } else {
+    result =
+        device.waitSemaphores(vk::SemaphoreWaitInfo({}, semaphore, value),
+                              UINT64_MAX);
+  }
+  CHECK_VK_RESULT(result) << "Failed to wait for staging ring submission";
+}
+
+StagingRing::StagingRing(Buffer* buffer,
+                         vk::DeviceSize size,
+                         vk::BufferUsageFlags usage_flags)
+    : buffer_(buffer), size_(size) {
+  DCHECK(buffer_) << kErrResourceIsNull;
+  DCHECK(size_ > 0) << kErrCantBeEmpty;
+  BufferProperties required_properties{};
+  required_properties.size = size_;
+  required_properties.usage_flags = usage_flags;
+  required_properties.memory_flags = vk::MemoryPropertyFlagBits::eHostVisible;
+  buffer_->RequireProperties(required_properties);
+}
+
+vk::DeviceSize StagingRing::GetAllocationStart(
+    vk::DeviceSize size,
+    vk::DeviceSize alignment) const {
+  vk::DeviceSize pos = head_ % size_;
+  vk::DeviceSize start = AlignUp(pos, alignment);
+  if (start + size > size_) {
+    // the ring beginning is aligned for anything
+    return head_ + size_ - pos;
+  }
+  return head_ + start - pos;
+}
+
+StagingRange StagingRing::AllocateAt(vk::DeviceSize start,
+                                     vk::DeviceSize size) {
+  DCHECK(buffer_->GetBuffer()) << kErrNotInitialized;
+  char* mapping_start =
+      static_cast<char*>(buffer_->GetBuffer()->GetMappingStart());
+  DCHECK(mapping_start) << kErrMemoryNotMapped;
+  head_ = start + size;
+  vk::DeviceSize offset = start % size_;
+  return {offset, std::span<char>(mapping_start + offset, size)};
+}
+
+std::optional<StagingRange> StagingRing::TryAllocate(
+    vk::DeviceSize size,
+    vk::DeviceSize alignment) {
+  DCHECK(size > 0 && alignment > 0) << kErrCantBeEmpty;
+  Reclaim();
+  vk::DeviceSize start = GetAllocationStart(size, alignment);
+  if (start + size - tail_ > size_) {
+    return std::nullopt;
+  }
+  return AllocateAt(start, size);
+}
+
+StagingRange StagingRing::Allocate(vk::DeviceSize size,
+                                   vk::DeviceSize alignment) {
+  CHECK(size <= size_) << kErrNotEnoughSpace;
+  std::optional<StagingRange> res = TryAllocate(size, alignment);
+  while (!res) {
+    CHECK(!retirements_.empty())
+        << "Staging ring is full of ranges that are never retired";
+    retirements_.front().Wait();
+    res = TryAllocate(size, alignment);
+  }
+  return *res;
+}
+
+vk::DeviceSize StagingRing::GetAvailableSize(vk::DeviceSize alignment) {
+  Reclaim();
+  vk::DeviceSize free_size = size_ - (head_ - tail_);
+  vk::DeviceSize pos = head_ % size_;
+  vk::DeviceSize start = AlignUp(pos, alignment);
+  vk::DeviceSize res = 0;
+  if (start < size_ && free_size > start - pos) {
+    res = std::min(size_ - start, free_size - (start - pos));
+  }
+  // wrapping to the beginning wastes the rest of the ring
+  if (free_size > size_ - pos) {
+    res = std::max(res, free_size - (size_ - pos));
+  }
+  return res;
+}
+
+void StagingRing::Retire(vk::Fence fence) {
+  DCHECK(fence) << kErrResourceIsNull;
+  if (head_ == retired_head_) {
+    return;
+  }
+  retirements_.push_back({fence, {}, 0, head_});
+  retired_head_ = head_;
+}
+
+void StagingRing::Retire(vk::Semaphore semaphore, uint64_t value) {
+  DCHECK(semaphore) << kErrResourceIsNull;
+  if (head_ == retired_head_) {
+    return;
+  }
+  retirements_.push_back({{}, semaphore, value, head_});
+  retired_head_ = head_;
+}
+
+void StagingRing::Reclaim() {
+  while (!retirements_.empty() && retirements_.front().IsComplete()) {
+    tail_ = retirements_.front().end;
+    retirements_.pop_front();
+  }
+  // an empty ring restarts from the beginning, so it fits its whole size
+  if (head_ == tail_) {
+    head_ = AlignUp(head_, size_);
+    tail_ = head_;
+    retired_head_ = head_;
+  }
+}
+
+Buffer* StagingRing::GetBuffer() const {
+  return buffer_;
+}
+
+vk::DeviceSize StagingRing::GetSize() const {
+  return size_;
+}
+
+vk::DeviceSize StagingRing::GetUsedSize() const {
+  return head_ - tail_;
+}
+
+}  // namespace gpu_resources
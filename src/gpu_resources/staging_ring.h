@@ -0,0 +1,86 @@
+#pragma once
+
+#include <deque>
+#include <optional>
+#include <span>
+
+#include <vulkan/vulkan.hpp>
+
+#include "gpu_resources/buffer.h"
+
+namespace gpu_resources {
+
+struct StagingRange {
+  // offset in the ring buffer
+  vk::DeviceSize offset = 0;
+  std::span<char> data;
+};
+
+/*
+ * Fixed size host visible ring over 'buffer' of the render graph. Ranges
+ * are handed out one after another, a range that doesn't fit before the
+ * end of the ring starts from its beginning. Ranges allocated since the
+ * last Retire() are reclaimed together, once the fence or timeline value
+ * of the submission reading them completes, in retire order.
+ *
+ * Ranges must be allocated after render graph initialization, when the
+ * buffer is mapped. Host writes to them are flushed and device writes
+ * invalidated by the caller.
+ */
+class StagingRing {
+  struct Retirement {
+    vk::Fence fence;
+    vk::Semaphore semaphore;
+    uint64_t value = 0;
+    // ring position after the last retired range
+    vk::DeviceSize end = 0;
+
+    bool IsComplete() const;
+    void Wait() const;
+  };
+
+  Buffer* buffer_ = nullptr;
+  vk::DeviceSize size_ = 0;
+  // positions grow monotonically, offsets are them modulo 'size_'
+  vk::DeviceSize head_ = 0;
+  vk::DeviceSize tail_ = 0;
+  vk::DeviceSize retired_head_ = 0;
+  std::deque<Retirement> retirements_;
+
+  // Position the next range of 'size' starts at, padding included
+  vk::DeviceSize GetAllocationStart(vk::DeviceSize size,
+                                    vk::DeviceSize alignment) const;
+  StagingRange AllocateAt(vk::DeviceSize start, vk::DeviceSize size);
+
+ public:
+  StagingRing() = default;
+  // 'usage_flags' are eTransferDst for rings the device writes to
+  StagingRing(Buffer* buffer,
+              vk::DeviceSize size,
+              vk::BufferUsageFlags usage_flags =
+                  vk::BufferUsageFlagBits::eTransferSrc);
+
+  // Range of 'size' bytes at an offset aligned to 'alignment', nullopt if
+  // the ring has no room for it even after reclaiming completed ranges
+  std::optional<StagingRange> TryAllocate(vk::DeviceSize size,
+                                          vk::DeviceSize alignment = 1);
+  // Same, but blocks on retired submissions until the range fits
+  StagingRange Allocate(vk::DeviceSize size, vk::DeviceSize alignment = 1);
+  // Largest size TryAllocate() with 'alignment' succeeds for right now
+  vk::DeviceSize GetAvailableSize(vk::DeviceSize alignment = 1);
+
+  // Ranges allocated since the last call are free once 'fence' is signaled,
+  // the fence must stay alive until then
+  void Retire(vk::Fence fence);
+  // or once timeline 'semaphore' reaches 'value'
+  void Retire(vk::Semaphore semaphore, uint64_t value);
+  // Frees ranges of completed submissions, doesn't block
+  void Reclaim();
+
+  Buffer* GetBuffer() const;
+  vk::DeviceSize GetSize() const;
+  // Bytes allocated and not reclaimed yet, padding included
+  vk::DeviceSize GetUsedSize() const;
+};
+
+}  // namespace gpu_resources
@@ -0,0 +1,350 @@
+#include "render_data/async_uploader.h"
+
+#include <algorithm>
+
+#include "base/base.h"
+#include "gpu_resources/physical_buffer.h"
+#include "utill/error_handling.h"
+#include "utill/logger.h"
+
+namespace render_data {
+
+static uint32_t GetUploadQueueFamilyIndex() {
+  auto& context = base::Base::Get().GetContext();
+  if (context.GetTransferQueueCount() > 0) {
+    return context.GetTransferQueueFamilyIndex();
+  }
+  return context.GetQueueFamilyIndex();
+}
+
+// Queue 0 of the main family is submitted to from the render thread, the
+// worker can't share it
+static vk::Queue GetUploadQueue() {
+  auto& context = base::Base::Get().GetContext();
+  if (context.GetTransferQueueCount() > 0) {
+    return context.GetTransferQueue(0);
+  }
+  LOG << "No transfer queue family, uploading on the main one";
+  CHECK(context.GetQueueCount() > 1)
+      << "Async uploads need a transfer queue or a second main family queue";
+  return context.GetQueue(context.GetQueueCount() - 1);
+}
+
+AsyncUploader::AsyncUploader(
+    gpu_resources::Buffer* staging_buffer,
+    const gpu_executer::TimelineSemaphore* frame_semaphore,
+    const std::vector<gpu_resources::Buffer*>& dst_buffers,
+    AsyncUploaderConfig config)
+    : Pass(0),
+      staging_buffer_(staging_buffer),
+      frame_semaphore_(frame_semaphore),
+      config_(config),
+      queue_family_index_(GetUploadQueueFamilyIndex()),
+      queue_(GetUploadQueue()),
+      timeline_wait_{&semaphore_, 0},
+      cmd_pool_(queue_family_index_),
+      requests_(config.queue_max_size) {
+  DCHECK(staging_buffer_) << "Staging buffer must not be nullptr";
+  DCHECK(frame_semaphore_) << "Frame semaphore must not be nullptr";
+  DCHECK(config_.batch_budget > 0) << "Batch budget must be > 0";
+  gpu_resources::BufferProperties required_staging_properties{};
+  required_staging_properties.size = config_.batch_budget;
+  required_staging_properties.usage_flags =
+      vk::BufferUsageFlagBits::eTransferSrc;
+  required_staging_properties.memory_flags =
+      vk::MemoryPropertyFlagBits::eHostVisible;
+  staging_buffer_->RequireProperties(required_staging_properties);
+
+  gpu_resources::BufferProperties required_dst_properties{};
+  required_dst_properties.usage_flags = vk::BufferUsageFlagBits::eTransferDst;
+  for (gpu_resources::Buffer* buffer : dst_buffers) {
+    buffer->RequireProperties(required_dst_properties);
+  }
+}
+
+bool AsyncUploader::ScheduleBufferTransfer(
+    gpu_resources::Buffer* dst,
+    const void* data,
+    std::vector<vk::BufferCopy2KHR> copy_regions) {
+  std::vector<std::vector<vk::BufferCopy2KHR>> chunks =
+      SplitCopyRegions(copy_regions, config_.batch_budget);
+  if (requests_.GetCapacity() - requests_.GetSize() < chunks.size()) {
+    return false;
+  }
+  for (auto& chunk : chunks) {
+    requests_.PushBack(BufferTransferRequest(
+        dst, static_cast<const char*>(data), std::move(chunk)));
+    ++pending_count_[dst];
+  }
+  return true;
+}
+
+bool AsyncUploader::ScheduleBufferTransfer(gpu_resources::Buffer* dst,
+                                           const void* data,
+                                           vk::DeviceSize data_size,
+                                           vk::DeviceSize dst_offset) {
+  return ScheduleBufferTransfer(
+      dst, data, {vk::BufferCopy2KHR(0, dst_offset, data_size)});
+}
+
+bool AsyncUploader::ScheduleBufferTransfer(
+    gpu_resources::Buffer* dst,
+    std::shared_ptr<const char[]> data,
+    std::vector<vk::BufferCopy2KHR> copy_regions) {
+  std::vector<std::vector<vk::BufferCopy2KHR>> chunks =
+      SplitCopyRegions(copy_regions, config_.batch_budget);
+  if (requests_.GetCapacity() - requests_.GetSize() < chunks.size()) {
+    return false;
+  }
+  for (auto& chunk : chunks) {
+    requests_.PushBack(BufferTransferRequest(dst, data, std::move(chunk)));
+    ++pending_count_[dst];
+  }
+  return true;
+}
+
+bool AsyncUploader::ScheduleBufferTransfer(gpu_resources::Buffer* dst,
+                                           std::shared_ptr<const char[]> data,
+                                           vk::DeviceSize data_size,
+                                           vk::DeviceSize dst_offset) {
+  return ScheduleBufferTransfer(
+      dst, std::move(data), {vk::BufferCopy2KHR(0, dst_offset, data_size)});
+}
+
+bool AsyncUploader::IsPending(const gpu_resources::Buffer* dst) const {
+  return pending_count_.contains(dst);
+}
+
+bool AsyncUploader::IsIdle() const {
+  return pending_count_.empty();
+}
+
+const gpu_executer::TimelineWait* AsyncUploader::GetTimelineWait() const {
+  return &timeline_wait_;
+}
+
+bool AsyncUploader::IsOwnershipTransferred() const {
+  return queue_family_index_ !=
+         base::Base::Get().GetContext().GetQueueFamilyIndex();
+}
+
+bool AsyncUploader::IsQueued(const gpu_resources::Buffer* dst) const {
+  for (size_t i = 0; i < requests_.GetSize(); i++) {
+    if (requests_[i].GetDst() == dst) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void AsyncUploader::TakeBatch() {
+  auto batch = std::make_unique<Batch>();
+  vk::DeviceSize budget_left = config_.batch_budget;
+  while (!requests_.IsEmpty()) {
+    const BufferTransferRequest& request = requests_.GetFront();
+    bool is_overlapping = std::any_of(
+        batch->requests.begin(), batch->requests.end(),
+        [&request](const BufferTransferRequest& taken) {
+          return taken.IsOverlapping(request);
+        });
+    if (request.GetDataSize() > budget_left || is_overlapping) {
+      break;
+    }
+    budget_left -= request.GetDataSize();
+    batch->requests.push_back(requests_.PopFront());
+  }
+  if (batch->requests.empty()) {
+    return;
+  }
+  for (const auto& request : batch->requests) {
+    gpu_resources::Buffer* dst = request.GetDst();
+    if (std::find(transfer_owned_.begin(), transfer_owned_.end(), dst) !=
+        transfer_owned_.end()) {
+      continue;
+    }
+    transfer_owned_.push_back(dst);
+    // frames in flight may still use it, acquired_ ones count as accessed
+    if (dst->GetLastAccessFrame() != 0) {
+      batch->reclaimed.push_back(dst);
+    }
+  }
+  for (const auto& request : batch->requests) {
+    gpu_resources::Buffer* dst = request.GetDst();
+    if (std::find(batch->released.begin(), batch->released.end(), dst) ==
+            batch->released.end() &&
+        !IsQueued(dst)) {
+      batch->released.push_back(dst);
+      std::erase(transfer_owned_, dst);
+    }
+  }
+  if (!batch->reclaimed.empty()) {
+    batch->wait = frame_semaphore_->GetWaitInfo(
+        vk::PipelineStageFlagBits2KHR::eTransfer,
+        frame_semaphore_->GetSignalValue() + 1);
+    reclaimed_ = batch->reclaimed;
+  }
+  batch->signal =
+      semaphore_.GetSignalInfo(vk::PipelineStageFlagBits2KHR::eAllCommands);
+  batch_ = std::move(batch);
+  submit_job_.Run([this]() { SubmitBatch(*batch_); });
+}
+
+void AsyncUploader::SubmitBatch(const Batch& batch) {
+  vk::CommandBuffer cmd =
+      cmd_pool_.GetCmd(vk::CommandBufferLevel::ePrimary, 1)[0];
+  cmd.begin(vk::CommandBufferBeginInfo(
+      vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+  if (IsOwnershipTransferred() && !batch.reclaimed.empty()) {
+    uint32_t src_family_index =
+        base::Base::Get().GetContext().GetQueueFamilyIndex();
+    std::vector<vk::BufferMemoryBarrier2KHR> acquire_barriers;
+    for (gpu_resources::Buffer* dst : batch.reclaimed) {
+      acquire_barriers.push_back(vk::BufferMemoryBarrier2KHR(
+          vk::PipelineStageFlagBits2KHR::eNone, vk::AccessFlagBits2KHR::eNone,
+          vk::PipelineStageFlagBits2KHR::eTransfer,
+          vk::AccessFlagBits2KHR::eTransferWrite, src_family_index,
+          queue_family_index_, dst->GetVkBuffer(), 0, VK_WHOLE_SIZE));
+    }
+    cmd.pipelineBarrier2KHR(
+        vk::DependencyInfoKHR({}, {}, acquire_barriers, {}));
+  }
+  vk::DeviceSize staging_offset = 0;
+  for (const auto& request : batch.requests) {
+    std::vector<vk::BufferCopy2KHR> copy_regions = request.GetCopyRegions();
+    for (auto& region : copy_regions) {
+      staging_buffer_->LoadDataFromPtr(
+          (void*)(request.GetData() + region.srcOffset), region.size,
+          staging_offset);
+      region.srcOffset = staging_offset;
+      staging_offset += region.size;
+    }
+    gpu_resources::Buffer::RecordCopy(cmd, *staging_buffer_,
+                                      *request.GetDst(), copy_regions);
+  }
+  // with a single queue family the semaphore alone makes writes visible
+  if (IsOwnershipTransferred()) {
+    uint32_t dst_family_index =
+        base::Base::Get().GetContext().GetQueueFamilyIndex();
+    std::vector<vk::BufferMemoryBarrier2KHR> release_barriers;
+    for (gpu_resources::Buffer* dst : batch.released) {
+      release_barriers.push_back(vk::BufferMemoryBarrier2KHR(
+          vk::PipelineStageFlagBits2KHR::eTransfer,
+          vk::AccessFlagBits2KHR::eTransferWrite,
+          vk::PipelineStageFlagBits2KHR::eNone, vk::AccessFlagBits2KHR::eNone,
+          queue_family_index_, dst_family_index, dst->GetVkBuffer(), 0,
+          VK_WHOLE_SIZE));
+    }
+    cmd.pipelineBarrier2KHR(
+        vk::DependencyInfoKHR({}, {}, release_barriers, {}));
+  }
+  cmd.end();
+
+  auto device = base::Base::Get().GetContext().GetDevice();
+  device.flushMappedMemoryRanges(
+      staging_buffer_->GetBuffer()->GetMappedMemoryRange());
+  vk::CommandBufferSubmitInfoKHR cmd_submit_info(cmd);
+  std::vector<vk::SemaphoreSubmitInfoKHR> wait_infos;
+  if (!batch.reclaimed.empty()) {
+    wait_infos.push_back(batch.wait);
+  }
+  vk::SubmitInfo2KHR submit_info({}, wait_infos, cmd_submit_info,
+                                 batch.signal);
+  auto fence = device.createFence({});
+  queue_.submit2KHR(submit_info, fence);
+  submitted_value_ = batch.signal.value;
+  cmd_pool_.RecycleCmd({cmd}, {}, fence);
+}
+
+void AsyncUploader::OnPreRecord() {
+  acquired_.clear();
+  reclaimed_.clear();
+  if (batch_ && submit_job_.IsDone()) {
+    // a failed submission is never signaled, the frame gets its error
+    submit_job_.Wait();
+  }
+  if (batch_ && submit_job_.IsDone() &&
+      semaphore_.GetCompletedValue() >= batch_->signal.value) {
+    for (const auto& request : batch_->requests) {
+      auto it = pending_count_.find(request.GetDst());
+      if (--it->second == 0) {
+        pending_count_.erase(it);
+      }
+    }
+    acquired_ = std::move(batch_->released);
+    // already reached, so the frame doesn't wait on the device, it only
+    // orders the acquire after the release
+    timeline_wait_.value = batch_->signal.value;
+    batch_.reset();
+  }
+
+  // before TakeBatch, so acquired destinations count as accessed
+  gpu_resources::ResourceAccess transfer_access{};
+  transfer_access.access_flags = vk::AccessFlagBits2KHR::eTransferWrite;
+  transfer_access.stage_flags = vk::PipelineStageFlagBits2KHR::eTransfer;
+  for (gpu_resources::Buffer* buffer : acquired_) {
+    buffer->DeclareAccess(transfer_access, GetPassIdx());
+  }
+  if (!batch_) {
+    TakeBatch();
+  }
+  // earlier accesses of the render graph get barriers before the release
+  for (gpu_resources::Buffer* buffer : reclaimed_) {
+    if (std::find(acquired_.begin(), acquired_.end(), buffer) ==
+        acquired_.end()) {
+      buffer->DeclareAccess(transfer_access, GetPassIdx());
+    }
+  }
+}
+
+void AsyncUploader::OnRecord(vk::CommandBuffer primary_cmd,
+                             const std::vector<vk::CommandBuffer>&) noexcept {
+  if (!IsOwnershipTransferred() ||
+      (acquired_.empty() && reclaimed_.empty())) {
+    return;
+  }
+  uint32_t main_family_index =
+      base::Base::Get().GetContext().GetQueueFamilyIndex();
+  std::vector<vk::BufferMemoryBarrier2KHR> acquire_barriers;
+  for (gpu_resources::Buffer* buffer : acquired_) {
+    acquire_barriers.push_back(vk::BufferMemoryBarrier2KHR(
+        vk::PipelineStageFlagBits2KHR::eNone, vk::AccessFlagBits2KHR::eNone,
+        vk::PipelineStageFlagBits2KHR::eTransfer,
+        vk::AccessFlagBits2KHR::eTransferWrite, queue_family_index_,
+        main_family_index, buffer->GetVkBuffer(), 0, VK_WHOLE_SIZE));
+  }
+  // a buffer may be acquired and released again in one frame, the release
+  // is recorded after the acquire
+  std::vector<vk::BufferMemoryBarrier2KHR> release_barriers;
+  for (gpu_resources::Buffer* buffer : reclaimed_) {
+    release_barriers.push_back(vk::BufferMemoryBarrier2KHR(
+        vk::PipelineStageFlagBits2KHR::eTransfer, vk::AccessFlagBits2KHR::eNone,
+        vk::PipelineStageFlagBits2KHR::eNone, vk::AccessFlagBits2KHR::eNone,
+        main_family_index, queue_family_index_, buffer->GetVkBuffer(), 0,
+        VK_WHOLE_SIZE));
+  }
+  if (!acquire_barriers.empty()) {
+    primary_cmd.pipelineBarrier2KHR(
+        vk::DependencyInfoKHR({}, {}, acquire_barriers, {}));
+  }
+  if (!release_barriers.empty()) {
+    primary_cmd.pipelineBarrier2KHR(
+        vk::DependencyInfoKHR({}, {}, release_barriers, {}));
+  }
+}
+
+AsyncUploader::~AsyncUploader() {
+  // OnPreRecord reported earlier failures, a later one has nobody to go to
+  try {
+    submit_job_.Wait();
+  } catch (const std::exception& e) {
+    LOG << "Dropping async upload batch: " << e.what();
+  }
+  // command buffers of the batch must be done before cmd_pool_ goes
+  semaphore_.WaitFor(submitted_value_);
+  // semaphore_ waits for its last signal value when destroyed
+  if (submitted_value_ < semaphore_.GetSignalValue()) {
+    semaphore_.SignalFromHost(semaphore_.GetSignalValue());
+  }
+}
+
+}  // namespace render_data
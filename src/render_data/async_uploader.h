@@ -0,0 +1,132 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "gpu_executer/command_pool.h"
+#include "gpu_executer/timeline_semaphore.h"
+#include "gpu_resources/buffer.h"
+#include "render_data/transfer_scheduler.h"
+#include "render_graph/pass.h"
+#include "utill/ring_buffer.h"
+#include "utill/thread_pool.h"
+
+namespace render_data {
+
+struct AsyncUploaderConfig {
+  // staging buffer size, max bytes of one batch
+  vk::DeviceSize batch_budget = 16 << 20;
+  // max queued requests
+  uint32_t queue_max_size = 256;
+};
+
+/*
+ * Uploads buffers on a transfer queue while frames keep rendering. Queued
+ * requests are taken into a batch while they fit config.batch_budget, a
+ * worker thread writes it to 'staging_buffer', records and submits it to
+ * the transfer queue of base::Context, signaling the semaphore of
+ * GetTimelineWait(). Without a transfer queue family the last main family
+ * queue is used. Ownership of a destination is released to the main queue
+ * family once the batch has its last queued request.
+ *
+ * A destination the render graph has accessed before is released by the
+ * pass to the transfer queue family in the frame its batch is taken, and
+ * the batch waits for 'frame_semaphore' to reach that frame, so frames in
+ * flight are done with it before it gets overwritten.
+ *
+ * As a render graph pass, added with the TimelineWait of GetTimelineWait(),
+ * it polls the batch semaphore on the CPU every frame. Only once the batch
+ * is complete does the pass acquire released destinations and declare
+ * transfer writes on them, so later passes get their barriers generated.
+ * The handoff is the CPU poll: the TimelineWait is raised to a value the
+ * semaphore has already reached, so the frame never stalls on it, it only
+ * orders the acquire after the release on the device. Only one batch is in
+ * flight, the next one is taken after the acquire.
+ *
+ * Render graph must not access a destination while IsPending() for it, and
+ * its contents outside uploaded regions are undefined after the upload.
+ */
+class AsyncUploader : public render_graph::Pass {
+  struct Batch {
+    std::vector<BufferTransferRequest> requests;
+    // destinations with no requests left in the queue
+    std::vector<gpu_resources::Buffer*> released;
+    // destinations released by the main queue family in 'wait' frame
+    std::vector<gpu_resources::Buffer*> reclaimed;
+    vk::SemaphoreSubmitInfoKHR wait;
+    vk::SemaphoreSubmitInfoKHR signal;
+  };
+
+  gpu_resources::Buffer* staging_buffer_;
+  const gpu_executer::TimelineSemaphore* frame_semaphore_;
+  AsyncUploaderConfig config_;
+  uint32_t queue_family_index_;
+  vk::Queue queue_;
+  gpu_executer::TimelineSemaphore semaphore_;
+  gpu_executer::TimelineWait timeline_wait_;
+  gpu_executer::CommandPool cmd_pool_;
+  utill::RingBuffer<BufferTransferRequest> requests_;
+  // scheduled requests that aren't acquired yet, per destination
+  std::map<const gpu_resources::Buffer*, uint32_t> pending_count_;
+  // written by the worker until submit_job_ is done
+  std::unique_ptr<Batch> batch_;
+  // signal value of the last batch that reached the queue, written by the
+  // worker until submit_job_ is done
+  uint64_t submitted_value_ = 0;
+  // written by taken batches and not released yet
+  std::vector<gpu_resources::Buffer*> transfer_owned_;
+  // acquired and released by the current frame
+  std::vector<gpu_resources::Buffer*> acquired_;
+  std::vector<gpu_resources::Buffer*> reclaimed_;
+  utill::TaskGroup submit_job_;
+
+  bool IsOwnershipTransferred() const;
+  bool IsQueued(const gpu_resources::Buffer* dst) const;
+  void TakeBatch();
+  void SubmitBatch(const Batch& batch);
+
+ public:
+  AsyncUploader(gpu_resources::Buffer* staging_buffer,
+                const gpu_executer::TimelineSemaphore* frame_semaphore,
+                const std::vector<gpu_resources::Buffer*>& dst_buffers,
+                AsyncUploaderConfig config = {});
+
+  AsyncUploader(const AsyncUploader&) = delete;
+  void operator=(const AsyncUploader&) = delete;
+
+  // Same as TransferScheduler::ScheduleBufferTransfer, regions are split
+  // into requests of at most a batch budget
+  bool ScheduleBufferTransfer(gpu_resources::Buffer* dst,
+                              const void* data,
+                              std::vector<vk::BufferCopy2KHR> copy_regions);
+  bool ScheduleBufferTransfer(gpu_resources::Buffer* dst,
+                              const void* data,
+                              vk::DeviceSize data_size,
+                              vk::DeviceSize dst_offset = 0);
+  bool ScheduleBufferTransfer(gpu_resources::Buffer* dst,
+                              std::shared_ptr<const char[]> data,
+                              std::vector<vk::BufferCopy2KHR> copy_regions);
+  bool ScheduleBufferTransfer(gpu_resources::Buffer* dst,
+                              std::shared_ptr<const char[]> data,
+                              vk::DeviceSize data_size,
+                              vk::DeviceSize dst_offset = 0);
+
+  // 'dst' has uploads that the current frame hasn't acquired
+  bool IsPending(const gpu_resources::Buffer* dst) const;
+  bool IsIdle() const;
+
+  // Value of the last acquired batch, already reached when the frame
+  // acquiring it is submitted
+  const gpu_executer::TimelineWait* GetTimelineWait() const;
+
+  void OnPreRecord() override;
+  void OnRecord(vk::CommandBuffer primary_cmd,
+                const std::vector<vk::CommandBuffer>&) noexcept override;
+
+  ~AsyncUploader();
+};
+
+}  // namespace render_data
@@ -1,9 +1,29 @@
 #include "render_data/bvh.h"
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <limits>
+#include <queue>
+
+#include "utill/error_handling.h"
 #include "utill/logger.h"
+#include "utill/thread_pool.h"
 
 namespace render_data {
 
+// subtrees smaller than this are built on the thread that split them
+const static uint32_t kParallelBuildMinPrimitives = 1 << 12;
+const static uint32_t kParallelBBGrain = 1 << 14;
+const static uint32_t kMortonBitsPerAxis = 10;
+const static uint32_t kMortonCodeBits = 3 * kMortonBitsPerAxis;
+// 30 bit codes are sorted in 3 passes
+const static uint32_t kRadixBits = 10;
+const static uint32_t kRadixSortGrain = 1 << 16;
+// spatial splits are only tried for nodes whose object split children
+// overlap by more than this fraction of the root surface area
+const static float kSpatialSplitMinOverlap = 1e-5;
+
 static void interseptRange(glm::vec2& a, const glm::vec2& b) {
   a.x = std::max(a.x, b.x);
   a.y = std::min(a.y, b.y);
@@ -46,17 +66,35 @@ BoundingBox BoundingBox::GetUnion(BoundingBox other) const {
   return other.Unite(*this);
 }
 
+BoundingBox& BoundingBox::Expand(const glm::vec3& margin) {
+  x_range += glm::vec2(-margin.x, margin.x);
+  y_range += glm::vec2(-margin.y, margin.y);
+  z_range += glm::vec2(-margin.z, margin.z);
+  return *this;
+}
+
 glm::vec3 BoundingBox::GetSize() const {
   return glm::vec3(std::max(x_range.y - x_range.x, 0.0f),
                    std::max(y_range.y - y_range.x, 0.0f),
                    std::max(z_range.y - z_range.x, 0.0f));
 }
 
+glm::vec3 BoundingBox::GetCenter() const {
+  return glm::vec3(x_range.x + x_range.y, y_range.x + y_range.y,
+                   z_range.x + z_range.y) *
+         0.5f;
+}
+
 float BoundingBox::GetVolume() const {
   glm::vec3 sz = GetSize();
   return sz.x * sz.y * sz.z;
 }
 
+float BoundingBox::GetSurfaceArea() const {
+  glm::vec3 sz = GetSize();
+  return 2 * (sz.x * sz.y + sz.y * sz.z + sz.z * sz.x);
+}
+
 bool BoundingBox::IsEmpty() const {
   glm::vec3 sz = GetSize();
   return sz.x == 0 || sz.y == 0 || sz.z == 0;
@@ -128,6 +166,93 @@ BVH::NodeSeparation BVH::CalcOptimalSeparation(
   return res;
 }
 
+BVH::NodeSeparation BVH::CalcBinnedSeparation(
+    std::vector<std::pair<BoundingBox, uint32_t>>& primitives,
+    uint32_t v,
+    uint32_t l,
+    uint32_t r) {
+  NodeSeparation res;
+  res.sep_ind = l;
+  res.cost = r - l;
+
+  BoundingBox centroid_bb;
+  for (uint32_t i = l; i < r; i++) {
+    centroid_bb.Unite(primitives[i].first.GetCenter());
+  }
+  glm::vec3 centroid_size = centroid_bb.GetSize();
+  uint32_t axis = 0;
+  if (centroid_size.y > centroid_size[axis]) {
+    axis = 1;
+  }
+  if (centroid_size.z > centroid_size[axis]) {
+    axis = 2;
+  }
+  if (centroid_size[axis] <= 0) {
+    return res;
+  }
+
+  struct Bin {
+    BoundingBox bounds;
+    uint32_t count = 0;
+  };
+  const uint32_t bin_count = std::max(config_.bin_count, 2u);
+  const float axis_start = glm::vec3(centroid_bb.x_range.x,
+                                     centroid_bb.y_range.x,
+                                     centroid_bb.z_range.x)[axis];
+  const float bin_scale = bin_count / centroid_size[axis];
+  auto get_bin = [&](const BoundingBox& bb) {
+    float offset = (bb.GetCenter()[axis] - axis_start) * bin_scale;
+    return std::min(uint32_t(std::max(offset, 0.0f)), bin_count - 1);
+  };
+
+  std::vector<Bin> bins(bin_count);
+  for (uint32_t i = l; i < r; i++) {
+    Bin& bin = bins[get_bin(primitives[i].first)];
+    bin.bounds.Unite(primitives[i].first);
+    ++bin.count;
+  }
+
+  // right_bins[i] holds union of bins [i, bin_count)
+  std::vector<Bin> right_bins(bin_count);
+  right_bins[bin_count - 1] = bins[bin_count - 1];
+  for (uint32_t i = bin_count - 1; i > 0; i--) {
+    right_bins[i - 1] = right_bins[i];
+    right_bins[i - 1].bounds.Unite(bins[i - 1].bounds);
+    right_bins[i - 1].count += bins[i - 1].count;
+  }
+
+  float cur_area = node_[v].bounds.GetSurfaceArea();
+  uint32_t best_bin = bin_count;
+  Bin left;
+  for (uint32_t i = 0; i + 1 < bin_count; i++) {
+    left.bounds.Unite(bins[i].bounds);
+    left.count += bins[i].count;
+    const Bin& right = right_bins[i + 1];
+    if (left.count == 0 || right.count == 0) {
+      continue;
+    }
+    float cur_cost =
+        left.count * (left.bounds.GetSurfaceArea() / cur_area) +
+        right.count * (right.bounds.GetSurfaceArea() / cur_area);
+    if (cur_cost < res.cost) {
+      res.left_bb = left.bounds;
+      res.right_bb = right.bounds;
+      res.cost = cur_cost;
+      res.sep_ind = l + left.count;
+      best_bin = i;
+    }
+  }
+  if (best_bin == bin_count) {
+    return res;
+  }
+
+  std::partition(primitives.begin() + l, primitives.begin() + r,
+                 [&](const std::pair<BoundingBox, uint32_t>& primitive) {
+                   return get_bin(primitive.first) <= best_bin;
+                 });
+  return res;
+}
+
 void BVH::MakeLeaf(std::vector<std::pair<BoundingBox, uint32_t>>& primitives,
                    uint32_t v,
                    uint32_t l,
@@ -144,58 +269,561 @@ void BVH::Construct(std::vector<std::pair<BoundingBox, uint32_t>>& primitives,
                     uint32_t v,
                     uint32_t l,
                     uint32_t r,
-                    uint32_t d,
-                    uint32_t max_d,
-                    uint32_t min_node_primitives) {
-  if (r - l <= min_node_primitives || d == max_d) {
+                    uint32_t d) {
+  if (r - l <= config_.min_node_primitives || d == config_.max_depth) {
     MakeLeaf(primitives, v, l, r);
     return;
   }
 
-  OrderPrimitives(primitives, v, l, r);
-  NodeSeparation sep = CalcOptimalSeparation(primitives, v, l, r);
+  NodeSeparation sep;
+  if (config_.mode == BVHBuildMode::kBinnedSAH) {
+    sep = CalcBinnedSeparation(primitives, v, l, r);
+  } else {
+    OrderPrimitives(primitives, v, l, r);
+    sep = CalcOptimalSeparation(primitives, v, l, r);
+  }
 
   if (sep.cost + 0.5 > r - l) {
     MakeLeaf(primitives, v, l, r);
     return;
   }
 
+  // left subtree occupies [v + 1, v + left_size), right one starts at
+  // v + left_size, so both can be built independently
+  uint32_t left_size = 2 * (sep.sep_ind - l);
   node_[v].left = v + 1;
   node_[v + 1].bounds = sep.left_bb;
   node_[v + 1].parent = v;
   node_[v + 1].bvh_level = node_[v].bvh_level;
-  Construct(primitives, v + 1, l, sep.sep_ind, d + 1, max_d,
-            min_node_primitives);
 
-  uint32_t left_size = 2 * (sep.sep_ind - l);
   node_[v].right = v + left_size;
   node_[v + left_size].bounds = sep.right_bb;
   node_[v + left_size].parent = v;
   node_[v + left_size].bvh_level = node_[v].bvh_level;
-  Construct(primitives, v + left_size, sep.sep_ind, r, d + 1, max_d,
-            min_node_primitives);
+
+  if (config_.parallel_build && r - l >= kParallelBuildMinPrimitives) {
+    utill::TaskGroup subtrees;
+    subtrees.Run([this, &primitives, v, l, d, sep_ind = sep.sep_ind]() {
+      Construct(primitives, v + 1, l, sep_ind, d + 1);
+    });
+    Construct(primitives, v + left_size, sep.sep_ind, r, d + 1);
+    subtrees.Wait();
+    return;
+  }
+  Construct(primitives, v + 1, l, sep.sep_ind, d + 1);
+  Construct(primitives, v + left_size, sep.sep_ind, r, d + 1);
 }
 
-BVH::BVH(std::vector<std::pair<BoundingBox, uint32_t>>&& primitives) {
+// spreads lower 10 bits of v so that there are two zero bits between each
+static uint32_t ExpandMortonBits(uint32_t v) {
+  v = (v * 0x00010001u) & 0xFF0000FFu;
+  v = (v * 0x00000101u) & 0x0F00F00Fu;
+  v = (v * 0x00000011u) & 0xC30C30C3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+
+static uint32_t CalcMortonCode(glm::vec3 unit_pos) {
+  const float cell_count = 1 << kMortonBitsPerAxis;
+  glm::vec3 cell = glm::min(glm::max(unit_pos * cell_count, glm::vec3(0.0f)),
+                            glm::vec3(cell_count - 1));
+  return (ExpandMortonBits(uint32_t(cell.x)) << 2) |
+         (ExpandMortonBits(uint32_t(cell.y)) << 1) |
+         ExpandMortonBits(uint32_t(cell.z));
+}
+
+// Stable LSD radix sort of 'values' by the lower 'key_bits' bits of 'keys'.
+// Every pass counts digits per chunk, in parallel if 'parallel', then
+// scatters chunks to offsets obtained from a (digit, chunk) ordered prefix
+// sum.
+static void RadixSortByKey(std::vector<uint32_t>& keys,
+                           std::vector<uint32_t>& values,
+                           uint32_t key_bits,
+                           bool parallel) {
+  const uint32_t digit_count = 1 << kRadixBits;
+  const size_t size = keys.size();
+  const size_t chunk_count = (size + kRadixSortGrain - 1) / kRadixSortGrain;
+  const size_t grain = parallel ? 1 : chunk_count;
+  std::vector<uint32_t> tmp_keys(size);
+  std::vector<uint32_t> tmp_values(size);
+  std::vector<std::array<size_t, digit_count>> chunk_offsets(chunk_count);
+
+  for (uint32_t shift = 0; shift < key_bits; shift += kRadixBits) {
+    utill::ParallelFor(0, chunk_count, grain, [&](size_t begin, size_t end) {
+      for (size_t chunk = begin; chunk < end; chunk++) {
+        auto& count = chunk_offsets[chunk];
+        count.fill(0);
+        size_t chunk_end = std::min(size, (chunk + 1) * kRadixSortGrain);
+        for (size_t i = chunk * kRadixSortGrain; i < chunk_end; i++) {
+          ++count[(keys[i] >> shift) & (digit_count - 1)];
+        }
+      }
+    });
+
+    size_t offset = 0;
+    for (uint32_t digit = 0; digit < digit_count; digit++) {
+      for (auto& count : chunk_offsets) {
+        size_t chunk_count_of_digit = count[digit];
+        count[digit] = offset;
+        offset += chunk_count_of_digit;
+      }
+    }
+
+    utill::ParallelFor(0, chunk_count, grain, [&](size_t begin, size_t end) {
+      for (size_t chunk = begin; chunk < end; chunk++) {
+        auto& dst = chunk_offsets[chunk];
+        size_t chunk_end = std::min(size, (chunk + 1) * kRadixSortGrain);
+        for (size_t i = chunk * kRadixSortGrain; i < chunk_end; i++) {
+          size_t dst_ind = dst[(keys[i] >> shift) & (digit_count - 1)]++;
+          tmp_keys[dst_ind] = keys[i];
+          tmp_values[dst_ind] = values[i];
+        }
+      }
+    });
+    keys.swap(tmp_keys);
+    values.swap(tmp_values);
+  }
+}
+
+void BVH::EmitLinear(std::vector<std::pair<BoundingBox, uint32_t>>& primitives,
+                     const std::vector<uint32_t>& codes,
+                     uint32_t v,
+                     uint32_t l,
+                     uint32_t r,
+                     uint32_t d) {
+  if (r - l <= config_.min_node_primitives || d == config_.max_depth) {
+    node_[v].bounds = BoundingBox{};
+    for (uint32_t i = l; i < r; i++) {
+      node_[v].bounds.Unite(primitives[i].first);
+    }
+    MakeLeaf(primitives, v, l, r);
+    return;
+  }
+
+  // split where the highest bit that differs inside the range flips. Range
+  // of equal codes is split in half
+  uint32_t sep_ind = l + (r - l) / 2;
+  uint32_t diff = codes[l] ^ codes[r - 1];
+  if (diff != 0) {
+    uint32_t split_bit = 1u << (31 - std::countl_zero(diff));
+    sep_ind = std::partition_point(codes.begin() + l, codes.begin() + r,
+                                   [split_bit](uint32_t code) {
+                                     return (code & split_bit) == 0;
+                                   }) -
+              codes.begin();
+  }
+
+  uint32_t left_size = 2 * (sep_ind - l);
+  node_[v].left = v + 1;
+  node_[v + 1].parent = v;
+  node_[v + 1].bvh_level = node_[v].bvh_level;
+  node_[v].right = v + left_size;
+  node_[v + left_size].parent = v;
+  node_[v + left_size].bvh_level = node_[v].bvh_level;
+
+  if (config_.parallel_build && r - l >= kParallelBuildMinPrimitives) {
+    utill::TaskGroup subtrees;
+    subtrees.Run([this, &primitives, &codes, v, l, d, sep_ind]() {
+      EmitLinear(primitives, codes, v + 1, l, sep_ind, d + 1);
+    });
+    EmitLinear(primitives, codes, v + left_size, sep_ind, r, d + 1);
+    subtrees.Wait();
+  } else {
+    EmitLinear(primitives, codes, v + 1, l, sep_ind, d + 1);
+    EmitLinear(primitives, codes, v + left_size, sep_ind, r, d + 1);
+  }
+  node_[v].bounds = node_[v + 1].bounds.GetUnion(node_[v + left_size].bounds);
+}
+
+void BVH::ConstructLinear(
+    std::vector<std::pair<BoundingBox, uint32_t>>& primitives) {
+  const BoundingBox& root_bb = node_[0].bounds;
+  glm::vec3 root_min(root_bb.x_range.x, root_bb.y_range.x, root_bb.z_range.x);
+  glm::vec3 root_size = root_bb.GetSize();
+  glm::vec3 inv_size(root_size.x > 0 ? 1 / root_size.x : 0,
+                     root_size.y > 0 ? 1 / root_size.y : 0,
+                     root_size.z > 0 ? 1 / root_size.z : 0);
+
+  // a grain of the whole range runs on the calling thread
+  const size_t grain =
+      config_.parallel_build ? kParallelBBGrain : primitives.size();
+  std::vector<uint32_t> codes(primitives.size());
+  std::vector<uint32_t> order(primitives.size());
+  utill::ParallelFor(0, primitives.size(), grain,
+                     [&](size_t begin, size_t end) {
+                       for (size_t i = begin; i < end; i++) {
+                         glm::vec3 center = primitives[i].first.GetCenter();
+                         codes[i] = CalcMortonCode((center - root_min) *
+                                                   inv_size);
+                         order[i] = i;
+                       }
+                     });
+  RadixSortByKey(codes, order, kMortonCodeBits, config_.parallel_build);
+
+  std::vector<std::pair<BoundingBox, uint32_t>> sorted(primitives.size());
+  utill::ParallelFor(0, primitives.size(), grain,
+                     [&](size_t begin, size_t end) {
+                       for (size_t i = begin; i < end; i++) {
+                         sorted[i] = primitives[order[i]];
+                       }
+                     });
+  primitives.swap(sorted);
+  EmitLinear(primitives, codes, 0, 0, primitives.size(), 0);
+}
+
+static glm::vec2& getAxisRange(BoundingBox& bb, uint32_t axis) {
+  return axis == 0 ? bb.x_range : axis == 1 ? bb.y_range : bb.z_range;
+}
+
+static glm::vec2 getAxisRange(const BoundingBox& bb, uint32_t axis) {
+  return axis == 0 ? bb.x_range : axis == 1 ? bb.y_range : bb.z_range;
+}
+
+static bool isInverted(const BoundingBox& bb) {
+  return bb.x_range.x > bb.x_range.y || bb.y_range.x > bb.y_range.y ||
+         bb.z_range.x > bb.z_range.y;
+}
+
+// Bounds of the part of triangle 'trg' of 'mesh' inside [lo, hi] slab along
+// 'axis', limited by 'reference' bounds
+static BoundingBox clipTriangle(const Mesh& mesh,
+                                uint32_t trg,
+                                const BoundingBox& reference,
+                                uint32_t axis,
+                                float lo,
+                                float hi) {
+  glm::vec3 vert[3];
+  for (uint32_t i = 0; i < 3; i++) {
+    vert[i] = mesh.position[mesh.index[3 * trg + i].x];
+  }
+  BoundingBox res;
+  for (uint32_t i = 0; i < 3; i++) {
+    const glm::vec3& a = vert[i];
+    const glm::vec3& b = vert[(i + 1) % 3];
+    if (lo <= a[axis] && a[axis] <= hi) {
+      res.Unite(a);
+    }
+    for (float plane : {lo, hi}) {
+      if ((a[axis] < plane && plane < b[axis]) ||
+          (b[axis] < plane && plane < a[axis])) {
+        glm::vec3 pt = a + (b - a) * ((plane - a[axis]) / (b[axis] - a[axis]));
+        pt[axis] = plane;
+        res.Unite(pt);
+      }
+    }
+  }
+  return res.Intersept(reference);
+}
+
+BVH::SpatialSeparation BVH::CalcSpatialSeparation(
+    const Mesh& mesh,
+    const std::vector<std::pair<BoundingBox, uint32_t>>& references,
+    uint32_t v) {
+  SpatialSeparation res;
+  res.cost = references.size();
+
+  struct Bin {
+    BoundingBox bounds;
+    uint32_t entries = 0;
+    uint32_t exits = 0;
+  };
+  const uint32_t bin_count = std::max(config_.bin_count, 2u);
+  float cur_area = node_[v].bounds.GetSurfaceArea();
+  for (uint32_t axis = 0; axis < 3; axis++) {
+    glm::vec2 range = getAxisRange(node_[v].bounds, axis);
+    float bin_size = (range.y - range.x) / bin_count;
+    if (bin_size <= 0) {
+      continue;
+    }
+    auto get_bin = [&](float pos) {
+      float offset = (pos - range.x) / bin_size;
+      return std::min(uint32_t(std::max(offset, 0.0f)), bin_count - 1);
+    };
+
+    std::vector<Bin> bins(bin_count);
+    for (const auto& [bounds, trg] : references) {
+      glm::vec2 ref_range = getAxisRange(bounds, axis);
+      uint32_t first_bin = get_bin(ref_range.x);
+      uint32_t last_bin = get_bin(ref_range.y);
+      ++bins[first_bin].entries;
+      ++bins[last_bin].exits;
+      if (first_bin == last_bin) {
+        bins[first_bin].bounds.Unite(bounds);
+        continue;
+      }
+      for (uint32_t bin = first_bin; bin <= last_bin; bin++) {
+        float lo = range.x + bin * bin_size;
+        float hi = bin + 1 == bin_count ? range.y : lo + bin_size;
+        BoundingBox piece = clipTriangle(mesh, trg, bounds, axis, lo, hi);
+        if (!isInverted(piece)) {
+          bins[bin].bounds.Unite(piece);
+        }
+      }
+    }
+
+    // right_bins[i] holds union of bins [i, bin_count)
+    std::vector<Bin> right_bins(bin_count);
+    right_bins[bin_count - 1] = bins[bin_count - 1];
+    for (uint32_t i = bin_count - 1; i > 0; i--) {
+      right_bins[i - 1] = right_bins[i];
+      right_bins[i - 1].bounds.Unite(bins[i - 1].bounds);
+      right_bins[i - 1].exits += bins[i - 1].exits;
+    }
+
+    Bin left;
+    for (uint32_t i = 0; i + 1 < bin_count; i++) {
+      left.bounds.Unite(bins[i].bounds);
+      left.entries += bins[i].entries;
+      const Bin& right = right_bins[i + 1];
+      if (left.entries == 0 || right.exits == 0) {
+        continue;
+      }
+      float cur_cost =
+          left.entries * (left.bounds.GetSurfaceArea() / cur_area) +
+          right.exits * (right.bounds.GetSurfaceArea() / cur_area);
+      if (cur_cost < res.cost) {
+        res.left_bb = left.bounds;
+        res.right_bb = right.bounds;
+        res.left_count = left.entries;
+        res.right_count = right.exits;
+        res.axis = axis;
+        res.position = range.x + (i + 1) * bin_size;
+        res.cost = cur_cost;
+      }
+    }
+  }
+  return res;
+}
+
+// Straddling references are duplicated, unless moving the whole reference
+// to one side is cheaper (reference unsplitting)
+void BVH::SplitReferences(
+    const Mesh& mesh,
+    std::vector<std::pair<BoundingBox, uint32_t>>& references,
+    const SpatialSeparation& sep,
+    std::vector<std::pair<BoundingBox, uint32_t>>& left,
+    std::vector<std::pair<BoundingBox, uint32_t>>& right) {
+  BoundingBox left_bb;
+  BoundingBox right_bb;
+  std::vector<uint32_t> straddling;
+  for (uint32_t i = 0; i < references.size(); i++) {
+    glm::vec2 range = getAxisRange(references[i].first, sep.axis);
+    if (range.y <= sep.position) {
+      left_bb.Unite(references[i].first);
+      left.push_back(references[i]);
+    } else if (range.x >= sep.position) {
+      right_bb.Unite(references[i].first);
+      right.push_back(references[i]);
+    } else {
+      straddling.push_back(i);
+    }
+  }
+
+  const float kInf = std::numeric_limits<float>::max();
+  uint32_t left_count = left.size() + straddling.size();
+  uint32_t right_count = right.size() + straddling.size();
+  for (uint32_t i : straddling) {
+    const auto& [bounds, trg] = references[i];
+    BoundingBox left_part =
+        clipTriangle(mesh, trg, bounds, sep.axis, -kInf, sep.position);
+    BoundingBox right_part =
+        clipTriangle(mesh, trg, bounds, sep.axis, sep.position, kInf);
+    if (isInverted(left_part) || isInverted(right_part)) {
+      // numerically on one side only
+      bool to_left = !isInverted(left_part);
+      (to_left ? left_bb : right_bb).Unite(bounds);
+      (to_left ? left : right).push_back(references[i]);
+      --(to_left ? right_count : left_count);
+      continue;
+    }
+    BoundingBox split_left_bb = left_bb.GetUnion(left_part);
+    BoundingBox split_right_bb = right_bb.GetUnion(right_part);
+    BoundingBox whole_left_bb = left_bb.GetUnion(bounds);
+    BoundingBox whole_right_bb = right_bb.GetUnion(bounds);
+    float split_cost = split_left_bb.GetSurfaceArea() * left_count +
+                       split_right_bb.GetSurfaceArea() * right_count;
+    float whole_left_cost = whole_left_bb.GetSurfaceArea() * left_count +
+                            right_bb.GetSurfaceArea() * (right_count - 1);
+    float whole_right_cost = left_bb.GetSurfaceArea() * (left_count - 1) +
+                             whole_right_bb.GetSurfaceArea() * right_count;
+    if (split_cost <= std::min(whole_left_cost, whole_right_cost)) {
+      left_bb = split_left_bb;
+      right_bb = split_right_bb;
+      left.push_back({left_part, trg});
+      right.push_back({right_part, trg});
+    } else if (whole_left_cost <= whole_right_cost) {
+      left_bb = whole_left_bb;
+      left.push_back(references[i]);
+      --right_count;
+    } else {
+      right_bb = whole_right_bb;
+      right.push_back(references[i]);
+      --left_count;
+    }
+  }
+}
+
+void BVH::ConstructSpatial(
+    const Mesh& mesh,
+    std::vector<std::pair<BoundingBox, uint32_t>>& references,
+    uint32_t v,
+    uint32_t d) {
+  uint32_t count = references.size();
+  auto make_leaf = [&]() {
+    node_[v].left = primitive_ord_.size();
+    node_[v].right = primitive_ord_.size() + count;
+    node_[v].bvh_level = (int32_t)(-1);
+    for (const auto& reference : references) {
+      primitive_ord_.push_back(reference.second);
+    }
+  };
+  if (count <= config_.min_node_primitives || d == config_.max_depth) {
+    make_leaf();
+    return;
+  }
+
+  NodeSeparation sep = CalcBinnedSeparation(references, v, 0, count);
+  float overlap = sep.left_bb.GetInterseption(sep.right_bb).GetSurfaceArea();
+  std::vector<std::pair<BoundingBox, uint32_t>> left;
+  std::vector<std::pair<BoundingBox, uint32_t>> right;
+  if ((sep.cost >= count ||
+       overlap > kSpatialSplitMinOverlap * node_[0].bounds.GetSurfaceArea()) &&
+      reference_budget_ > 0) {
+    SpatialSeparation spatial_sep = CalcSpatialSeparation(mesh, references, v);
+    uint32_t duplicate_count =
+        spatial_sep.left_count + spatial_sep.right_count - count;
+    if (spatial_sep.cost < sep.cost && duplicate_count <= reference_budget_) {
+      SplitReferences(mesh, references, spatial_sep, left, right);
+      if (left.empty() || right.empty()) {
+        left.clear();
+        right.clear();
+      } else {
+        sep.cost = spatial_sep.cost;
+        reference_budget_ -= left.size() + right.size() - count;
+      }
+    }
+  }
+
+  if (sep.cost + 0.5 > count) {
+    make_leaf();
+    return;
+  }
+  if (left.empty()) {
+    left.assign(references.begin(), references.begin() + sep.sep_ind);
+    right.assign(references.begin() + sep.sep_ind, references.end());
+  }
+  references.clear();
+  references.shrink_to_fit();
+
+  // children are appended in pre-order, so every node still has a greater
+  // index than its parent
+  uint32_t left_v = node_.size();
+  node_.emplace_back();
+  node_[left_v].bounds = CalcBounds(left);
+  node_[left_v].parent = v;
+  node_[left_v].bvh_level = node_[v].bvh_level;
+  node_[v].left = left_v;
+  ConstructSpatial(mesh, left, left_v, d + 1);
+
+  uint32_t right_v = node_.size();
+  node_.emplace_back();
+  node_[right_v].bounds = CalcBounds(right);
+  node_[right_v].parent = v;
+  node_[right_v].bvh_level = node_[v].bvh_level;
+  node_[v].right = right_v;
+  ConstructSpatial(mesh, right, right_v, d + 1);
+}
+
+BVH::BVH(std::vector<std::pair<BoundingBox, uint32_t>>&& primitives,
+         BVHBuildConfig config)
+    : config_(config) {
+  DCHECK(config_.mode != BVHBuildMode::kSpatialSplit)
+      << "Spatial splits need triangles, build from Mesh instead";
   primitive_ord_.resize(primitives.size());
-  bb_pool_.resize(primitives.size() + 1);
+  if (config_.mode == BVHBuildMode::kVolumeSweep) {
+    bb_pool_.resize(primitives.size() + 1);
+  }
   node_.resize(primitives.size() * 2 - 1);
-  for (const auto& [pbb, ind] : primitives) {
-    node_[0].bounds.Unite(pbb);
+  node_[0].bounds = CalcBounds(primitives, config_.parallel_build);
+  if (config_.mode == BVHBuildMode::kLinear) {
+    ConstructLinear(primitives);
+  } else {
+    Construct(primitives, 0, 0, primitives.size(), 0);
   }
-  Construct(primitives, 0, 0, primitives.size(), 0, 32, 8);
   bb_pool_.clear();
   bb_pool_.shrink_to_fit();
 }
 
+BVH::BVH(const Mesh& mesh, BVHBuildConfig config) : config_(config) {
+  if (config_.mode != BVHBuildMode::kSpatialSplit) {
+    *this = BVH(BuildPrimitivesBB(mesh), config_);
+    return;
+  }
+  auto references = BuildPrimitivesBB(mesh);
+  if (references.empty()) {
+    return;
+  }
+  reference_budget_ = config_.spatial_split_budget * references.size();
+  primitive_ord_.reserve(references.size() + reference_budget_);
+  node_.reserve(2 * (references.size() + reference_budget_) - 1);
+  node_.emplace_back();
+  node_[0].bounds = CalcBounds(references, config_.parallel_build);
+  ConstructSpatial(mesh, references, 0, 0);
+  reference_budget_ = 0;
+}
+
+BVH::BVH(std::vector<BVHNode>&& nodes,
+         std::vector<uint32_t>&& primitive_ord,
+         BVHBuildConfig config)
+    : config_(config),
+      node_(std::move(nodes)),
+      primitive_ord_(std::move(primitive_ord)) {}
+
 std::vector<std::pair<BoundingBox, uint32_t>> BVH::BuildPrimitivesBB(
     const Mesh& mesh) {
   std::vector<std::pair<BoundingBox, uint32_t>> res(mesh.index.size() / 3);
-  for (uint32_t i = 0; i * 3 < mesh.index.size(); i++) {
-    res[i].first.Unite(mesh.position[mesh.index[3 * i + 0].x]);
-    res[i].first.Unite(mesh.position[mesh.index[3 * i + 1].x]);
-    res[i].first.Unite(mesh.position[mesh.index[3 * i + 2].x]);
-    res[i].second = i;
+  utill::ParallelFor(0, res.size(), kParallelBBGrain,
+                     [&](size_t begin, size_t end) {
+                       for (size_t i = begin; i < end; i++) {
+                         res[i].first.Unite(
+                             mesh.position[mesh.index[3 * i + 0].x]);
+                         res[i].first.Unite(
+                             mesh.position[mesh.index[3 * i + 1].x]);
+                         res[i].first.Unite(
+                             mesh.position[mesh.index[3 * i + 2].x]);
+                         res[i].second = i;
+                       }
+                     });
+  return res;
+}
+
+BoundingBox BVH::CalcBounds(
+    const std::vector<std::pair<BoundingBox, uint32_t>>& primitives,
+    bool parallel) {
+  auto unite_range = [&primitives](size_t begin, size_t end) {
+    BoundingBox res;
+    for (size_t i = begin; i < end; i++) {
+      res.Unite(primitives[i].first);
+    }
+    return res;
+  };
+  if (!parallel) {
+    return unite_range(0, primitives.size());
+  }
+  // min/max are exact, so the result doesn't depend on chunking
+  size_t chunk_count =
+      (primitives.size() + kParallelBBGrain - 1) / kParallelBBGrain;
+  std::vector<BoundingBox> chunk_bounds(chunk_count);
+  utill::ParallelFor(0, chunk_count, 1, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      chunk_bounds[i] = unite_range(
+          i * kParallelBBGrain,
+          std::min(primitives.size(), (i + 1) * kParallelBBGrain));
+    }
+  });
+  BoundingBox res;
+  for (const auto& bounds : chunk_bounds) {
+    res.Unite(bounds);
   }
   return res;
 }
@@ -208,4 +836,192 @@ const std::vector<uint32_t>& BVH::GetPrimitiveOrd() const {
   return primitive_ord_;
 }
 
+void BVH::ExpandBounds(const glm::vec3& margin) {
+  for (BVHNode& node : node_) {
+    node.bounds.Expand(margin);
+  }
+}
+
+float BVH::CalcSAHCost(float traversal_cost, float intersection_cost) const {
+  if (node_.empty()) {
+    return 0;
+  }
+  float root_area = node_[0].bounds.GetSurfaceArea();
+  if (root_area <= 0) {
+    return 0;
+  }
+  float cost = 0;
+  std::vector<uint32_t> stack = {0};
+  while (!stack.empty()) {
+    const BVHNode& node = node_[stack.back()];
+    stack.pop_back();
+    float area = node.bounds.GetSurfaceArea();
+    if (node.bvh_level == uint32_t(-1)) {
+      cost += area * (node.right - node.left) * intersection_cost;
+      continue;
+    }
+    cost += area * traversal_cost;
+    stack.push_back(node.left);
+    stack.push_back(node.right);
+  }
+  return cost / root_area;
+}
+
+float BVH::CalcLeafVertexSpan(const Mesh& mesh) const {
+  double span_sum = 0;
+  uint32_t leaf_count = 0;
+  std::vector<uint32_t> stack;
+  if (!node_.empty()) {
+    stack.push_back(0);
+  }
+  while (!stack.empty()) {
+    const BVHNode& node = node_[stack.back()];
+    stack.pop_back();
+    if (node.bvh_level != uint32_t(-1)) {
+      stack.push_back(node.left);
+      stack.push_back(node.right);
+      continue;
+    }
+    if (node.left == node.right) {
+      continue;
+    }
+    uint32_t min_ind = uint32_t(-1);
+    uint32_t max_ind = 0;
+    for (uint32_t i = 3 * node.left; i < 3 * node.right; i++) {
+      DCHECK(i < mesh.index.size()) << "Mesh is not reordered by this BVH";
+      min_ind = std::min(min_ind, mesh.index[i].x);
+      max_ind = std::max(max_ind, mesh.index[i].x);
+    }
+    span_sum += max_ind - min_ind + 1;
+    ++leaf_count;
+  }
+  return leaf_count == 0 ? 0 : span_sum / leaf_count;
+}
+
+void BVH::InitRefitState() {
+  primitive_leaf_.assign(primitive_ord_.size(), uint32_t(-1));
+  sah_area_sum_ = 0;
+  for (uint32_t v = 0; v < node_.size(); v++) {
+    if (v != 0 && node_[v].parent == uint32_t(-1)) {
+      continue;
+    }
+    sah_area_sum_ += GetSAHAreaWeight(v) * node_[v].bounds.GetSurfaceArea();
+    if (node_[v].bvh_level != uint32_t(-1)) {
+      continue;
+    }
+    for (uint32_t i = node_[v].left; i < node_[v].right; i++) {
+      primitive_leaf_[i] = v;
+    }
+  }
+  build_sah_area_sum_ = sah_area_sum_;
+  build_root_area_ = node_[0].bounds.GetSurfaceArea();
+}
+
+// cost weight of the node area in CalcSAHCost with unit costs
+double BVH::GetSAHAreaWeight(uint32_t v) const {
+  if (node_[v].bvh_level == uint32_t(-1)) {
+    return node_[v].right - node_[v].left;
+  }
+  return 1;
+}
+
+bool BVH::RefitNode(const Mesh& mesh, uint32_t v) {
+  BVHNode& node = node_[v];
+  BoundingBox bounds;
+  if (node.bvh_level == uint32_t(-1)) {
+    for (uint32_t i = node.left; i < node.right; i++) {
+      bounds.Unite(mesh.position[mesh.index[3 * i + 0].x]);
+      bounds.Unite(mesh.position[mesh.index[3 * i + 1].x]);
+      bounds.Unite(mesh.position[mesh.index[3 * i + 2].x]);
+    }
+  } else {
+    bounds = node_[node.left].bounds.GetUnion(node_[node.right].bounds);
+  }
+  if (bounds == node.bounds) {
+    return false;
+  }
+  sah_area_sum_ += GetSAHAreaWeight(v) *
+                   (bounds.GetSurfaceArea() - node.bounds.GetSurfaceArea());
+  node.bounds = bounds;
+  return true;
+}
+
+std::vector<BVHNodeRange> BVH::CollectNodeRanges(
+    std::vector<uint32_t>& changed_nodes) {
+  std::sort(changed_nodes.begin(), changed_nodes.end());
+  std::vector<BVHNodeRange> res;
+  for (uint32_t v : changed_nodes) {
+    if (!res.empty() && res.back().first + res.back().count == v) {
+      ++res.back().count;
+    } else {
+      res.push_back(BVHNodeRange{v, 1});
+    }
+  }
+  return res;
+}
+
+std::vector<BVHNodeRange> BVH::Refit(
+    const Mesh& mesh,
+    const std::vector<uint32_t>& dirty_primitives) {
+  if (primitive_leaf_.empty()) {
+    InitRefitState();
+  }
+  // children always have greater index than their parent, so popping the
+  // largest index first updates every node after all of its dirty children.
+  // Duplicates come out consecutively
+  std::priority_queue<uint32_t> to_update;
+  for (uint32_t primitive : dirty_primitives) {
+    DCHECK(primitive < primitive_leaf_.size()) << "Invalid primitive index";
+    to_update.push(primitive_leaf_[primitive]);
+  }
+  std::vector<uint32_t> changed_nodes;
+  uint32_t last_updated = uint32_t(-1);
+  while (!to_update.empty()) {
+    uint32_t v = to_update.top();
+    to_update.pop();
+    if (v == last_updated) {
+      continue;
+    }
+    last_updated = v;
+    if (!RefitNode(mesh, v)) {
+      continue;
+    }
+    changed_nodes.push_back(v);
+    if (node_[v].parent != uint32_t(-1)) {
+      to_update.push(node_[v].parent);
+    }
+  }
+  return CollectNodeRanges(changed_nodes);
+}
+
+std::vector<BVHNodeRange> BVH::Refit(const Mesh& mesh) {
+  if (primitive_leaf_.empty()) {
+    InitRefitState();
+  }
+  std::vector<uint32_t> changed_nodes;
+  for (uint32_t v = node_.size(); v > 0; v--) {
+    // skip node slots that were reserved but not used by the build
+    if (v - 1 != 0 && node_[v - 1].parent == uint32_t(-1)) {
+      continue;
+    }
+    if (RefitNode(mesh, v - 1)) {
+      changed_nodes.push_back(v - 1);
+    }
+  }
+  return CollectNodeRanges(changed_nodes);
+}
+
+float BVH::GetRefitDegradation() const {
+  if (primitive_leaf_.empty() || build_sah_area_sum_ <= 0) {
+    return 1;
+  }
+  float root_area = node_[0].bounds.GetSurfaceArea();
+  if (root_area <= 0) {
+    return 1;
+  }
+  double sah_cost = sah_area_sum_ / root_area;
+  double build_sah_cost = build_sah_area_sum_ / build_root_area_;
+  return float(sah_cost / build_sah_cost);
+}
+
 }  // namespace render_data
@@ -20,10 +20,17 @@ struct BoundingBox {
   BoundingBox& Unite(const glm::vec3& pt);
   BoundingBox GetUnion(BoundingBox other) const;
 
+  // Moves every side out by 'margin'
+  BoundingBox& Expand(const glm::vec3& margin);
+
   glm::vec3 GetSize() const;
+  glm::vec3 GetCenter() const;
   float GetVolume() const;
+  float GetSurfaceArea() const;
   bool IsEmpty() const;
   bool Contains(const BoundingBox& other) const;
+
+  bool operator==(const BoundingBox& other) const = default;
 };
 
 struct BVHNode {
@@ -34,10 +41,55 @@ struct BVHNode {
   uint32_t bvh_level = 0;
 };
 
+// [first, first + count) range of indices in BVH::GetNodes()
+struct BVHNodeRange {
+  uint32_t first = 0;
+  uint32_t count = 0;
+};
+
+enum class BVHBuildMode {
+  // full sort of every node along its largest axis + volume cost sweep
+  kVolumeSweep,
+  // centroid binning with surface area heuristic, partitions in place
+  kBinnedSAH,
+  // morton code sort of primitive centroids, hierarchy from code prefixes.
+  // Fastest to build, meant for per-frame rebuilds of dynamic geometry
+  kLinear,
+  // kBinnedSAH that may also split primitive references by a plane,
+  // duplicating them into both children. Slowest to build and serial, meant
+  // for offline prepared scenes with long thin triangles.
+  // Needs BVH(const Mesh&, BVHBuildConfig)
+  kSpatialSplit,
+};
+
+struct BVHBuildConfig {
+  BVHBuildMode mode = BVHBuildMode::kVolumeSweep;
+  uint32_t max_depth = 32;
+  uint32_t min_node_primitives = 8;
+  // used by kBinnedSAH and kSpatialSplit
+  uint32_t bin_count = 16;
+  // kSpatialSplit only: max number of extra references created by splits,
+  // relative to primitive count
+  float spatial_split_budget = 0.3;
+  // builds independent subtrees on utill::ThreadPool::GetGlobal(). Node
+  // layout does not depend on execution order, so the result is identical
+  // to the serial build.
+  bool parallel_build = false;
+};
+
 class BVH {
+  BVHBuildConfig config_;
   std::vector<BVHNode> node_;
   std::vector<uint32_t> primitive_ord_;
   std::vector<BoundingBox> bb_pool_;
+  // references kSpatialSplit build may still add
+  uint32_t reference_budget_ = 0;
+
+  // refit state, initialized by the first Refit call
+  std::vector<uint32_t> primitive_leaf_;
+  double build_sah_area_sum_ = 0;
+  double build_root_area_ = 0;
+  double sah_area_sum_ = 0;
 
   void OrderPrimitives(
       std::vector<std::pair<BoundingBox, uint32_t>>& primitives,
@@ -58,6 +110,12 @@ class BVH {
       uint32_t l,
       uint32_t r);
 
+  NodeSeparation CalcBinnedSeparation(
+      std::vector<std::pair<BoundingBox, uint32_t>>& primitives,
+      uint32_t v,
+      uint32_t l,
+      uint32_t r);
+
   void MakeLeaf(std::vector<std::pair<BoundingBox, uint32_t>>& primitives,
                 uint32_t v,
                 uint32_t l,
@@ -67,19 +125,99 @@ class BVH {
                  uint32_t v,
                  uint32_t l,
                  uint32_t r,
-                 uint32_t d,
-                 uint32_t max_d = 32,
-                 uint32_t min_node_primitives = 4);
+                 uint32_t d);
+
+  void ConstructLinear(
+      std::vector<std::pair<BoundingBox, uint32_t>>& primitives);
+  void EmitLinear(std::vector<std::pair<BoundingBox, uint32_t>>& primitives,
+                  const std::vector<uint32_t>& codes,
+                  uint32_t v,
+                  uint32_t l,
+                  uint32_t r,
+                  uint32_t d);
+
+  struct SpatialSeparation {
+    BoundingBox left_bb;
+    BoundingBox right_bb;
+    uint32_t left_count = 0;
+    uint32_t right_count = 0;
+    uint32_t axis = 0;
+    float position = 0;
+    float cost = 0;
+  };
+
+  SpatialSeparation CalcSpatialSeparation(
+      const Mesh& mesh,
+      const std::vector<std::pair<BoundingBox, uint32_t>>& references,
+      uint32_t v);
+  void SplitReferences(
+      const Mesh& mesh,
+      std::vector<std::pair<BoundingBox, uint32_t>>& references,
+      const SpatialSeparation& sep,
+      std::vector<std::pair<BoundingBox, uint32_t>>& left,
+      std::vector<std::pair<BoundingBox, uint32_t>>& right);
+  void ConstructSpatial(
+      const Mesh& mesh,
+      std::vector<std::pair<BoundingBox, uint32_t>>& references,
+      uint32_t v,
+      uint32_t d);
+
+  void InitRefitState();
+  double GetSAHAreaWeight(uint32_t v) const;
+  bool RefitNode(const Mesh& mesh, uint32_t v);
+  static std::vector<BVHNodeRange> CollectNodeRanges(
+      std::vector<uint32_t>& changed_nodes);
 
  public:
   BVH() = default;
-  BVH(std::vector<std::pair<BoundingBox, uint32_t>>&& primitives);
+  BVH(std::vector<std::pair<BoundingBox, uint32_t>>&& primitives,
+      BVHBuildConfig config = {});
+  // Builds over triangles of 'mesh', the only way to use kSpatialSplit.
+  // Spatial splits may put one triangle into several leaves, so
+  // GetPrimitiveOrd() can contain repeated indices and be longer than the
+  // triangle count.
+  BVH(const Mesh& mesh, BVHBuildConfig config = {});
+  // Takes a tree built earlier with 'config', e.g. loaded from SceneCache
+  BVH(std::vector<BVHNode>&& nodes,
+      std::vector<uint32_t>&& primitive_ord,
+      BVHBuildConfig config);
 
   static std::vector<std::pair<BoundingBox, uint32_t>> BuildPrimitivesBB(
       const Mesh& mesh);
+  static BoundingBox CalcBounds(
+      const std::vector<std::pair<BoundingBox, uint32_t>>& primitives,
+      bool parallel = false);
 
   const std::vector<BVHNode>& GetNodes() const;
   const std::vector<uint32_t>& GetPrimitiveOrd() const;
+
+  // Expected cost of tracing a ray through the tree, normalized by the root
+  // surface area. Lower is better, comparable between build modes.
+  float CalcSAHCost(float traversal_cost = 1.0,
+                    float intersection_cost = 1.0) const;
+  // Memory locality of leaf intersection: average over leaves of the
+  // distance between the smallest and largest position index referenced by
+  // leaf triangles, plus one. 'mesh' must be reordered with
+  // GetPrimitiveOrd(). Lower is better, at least the leaf vertex count.
+  float CalcLeafVertexSpan(const Mesh& mesh) const;
+
+  // Refit recomputes bounds bottom-up from current vertex positions without
+  // changing topology. 'mesh' must be reordered with GetPrimitiveOrd(), so
+  // primitive indices are the ones used in leaves. Returns sorted, disjoint
+  // ranges of nodes with changed bounds - only those need to be re-uploaded.
+  // Leaves of kSpatialSplit trees get whole triangle bounds back.
+  std::vector<BVHNodeRange> Refit(const Mesh& mesh,
+                                  const std::vector<uint32_t>& dirty_primitives);
+  std::vector<BVHNodeRange> Refit(const Mesh& mesh);
+
+  // Grows bounds of every node by 'margin' on each side, so they still
+  // contain vertices moved by up to 'margin', e.g. decoded from a
+  // QuantizedMesh.
+  void ExpandBounds(const glm::vec3& margin);
+
+  // Ratio of current SAH cost to the one right after build. Refitted trees
+  // only get worse, rebuild once this grows past ~1.5.
+  float GetRefitDegradation() const;
 };
 
 }  // namespace render_data
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "utill/transform.h"
+
+namespace render_data {
+
+// Layout matches CameraInfo constant buffer in raytrace.hlsl
+struct CameraInfo {
+  utill::Transform camera_to_world;
+  uint32_t screen_width;
+  uint32_t screen_height;
+  float aspect;
+};
+
+}  // namespace render_data
@@ -0,0 +1,29 @@
+#include "render_data/intersection_triangle.h"
+
+#include "utill/error_handling.h"
+#include "utill/thread_pool.h"
+
+namespace render_data {
+
+const static size_t kBuildGrain = 1 << 16;
+
+std::vector<IntersectionTriangle> BuildIntersectionTriangles(
+    std::span<const glm::vec4> position,
+    std::span<const glm::uvec4> index) {
+  DCHECK(index.size() % 3 == 0) << "Index must hold whole triangles";
+  std::vector<IntersectionTriangle> res(index.size() / 3);
+  utill::ParallelFor(
+      0, res.size(), kBuildGrain, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+          glm::vec3 a(position[index[3 * i + 0].x]);
+          glm::vec3 b(position[index[3 * i + 1].x]);
+          glm::vec3 c(position[index[3 * i + 2].x]);
+          res[i].a = glm::vec4(a, 1);
+          res[i].e1 = glm::vec4(b - a, 0);
+          res[i].e2 = glm::vec4(c - a, 0);
+        }
+      });
+  return res;
+}
+
+}  // namespace render_data
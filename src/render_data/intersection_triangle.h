@@ -0,0 +1,29 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace render_data {
+
+// Triangle prepared for Moller-Trumbore intersection, one per triangle of a
+// mesh reordered with BVH::GetPrimitiveOrd(), so leaves read consecutive
+// entries. w components are unused.
+struct IntersectionTriangle {
+  glm::vec4 a;
+  // b - a
+  glm::vec4 e1;
+  // c - a
+  glm::vec4 e2;
+};
+
+static_assert(sizeof(IntersectionTriangle) == 48,
+              "Must match IntersectionTriangle in raytrace.hlsl");
+
+// 'index' holds 3 corners per triangle, position index in x component
+std::vector<IntersectionTriangle> BuildIntersectionTriangles(
+    std::span<const glm::vec4> position,
+    std::span<const glm::uvec4> index);
+
+}  // namespace render_data
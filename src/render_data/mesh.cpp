@@ -3,11 +3,27 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
 
+#include <algorithm>
+#include <numeric>
+#include <tuple>
+#include <unordered_map>
+
+#include "render_data/obj_parser.h"
 #include "utill/error_handling.h"
 #include "utill/logger.h"
+#include "utill/mapped_file.h"
 
 namespace render_data {
 
+struct CornerHash {
+  size_t operator()(const glm::uvec3& corner) const {
+    uint64_t hash = ((uint64_t(corner.x) << 32) | corner.y) *
+                    0x9e3779b97f4a7c15;
+    hash ^= corner.z + (hash >> 29);
+    return hash * 0xbf58476d1ce4e5b9;
+  }
+};
+
 static std::vector<glm::vec4> UnflattenCordVec(
     const std::vector<tinyobj::real_t>& src,
     float w_comp) {
@@ -20,7 +36,7 @@ static std::vector<glm::vec4> UnflattenCordVec(
   return res;
 }
 
-Mesh Mesh::LoadFromObj(const std::string& obj_file_path) {
+static Mesh LoadWithTinyObj(const std::string& obj_file_path) {
   Mesh result;
   tinyobj::ObjReader reader;
   tinyobj::ObjReaderConfig cfg;
@@ -63,6 +79,18 @@ Mesh Mesh::LoadFromObj(const std::string& obj_file_path) {
   return result;
 }
 
+Mesh Mesh::LoadFromObj(const std::string& obj_file_path) {
+  utill::MappedFile file(obj_file_path);
+  Mesh result;
+  if (file.IsOpen() &&
+      ParseObj(std::string_view(file.GetData(), file.GetSize()), result)) {
+    LOG << "Loaded mesh from obj: " << obj_file_path;
+    return result;
+  }
+  // unsupported by ParseObj or unreadable, tinyobj reports the details
+  return LoadWithTinyObj(obj_file_path);
+}
+
 Mesh::Mesh(Mesh&& other) noexcept {
   Mesh tmp;
   tmp.Swap(other);
@@ -97,7 +125,7 @@ static vk::DeviceSize RecordCopy(vk::CommandBuffer cmd,
 
 void Mesh::ReorderPrimitives(const std::vector<uint32_t>& primirive_order) {
   std::vector<glm::uvec4> n_index;
-  n_index.reserve(index.size());
+  n_index.reserve(3 * primirive_order.size());
   for (uint32_t n_ind : primirive_order) {
     n_index.push_back(index[3 * n_ind + 0]);
     n_index.push_back(index[3 * n_ind + 1]);
@@ -106,4 +134,107 @@ void Mesh::ReorderPrimitives(const std::vector<uint32_t>& primirive_order) {
   index.swap(n_index);
 }
 
+void Mesh::Weld() {
+  bool has_normal = !normal.empty();
+  bool has_tex_coord = !tex_coord.empty();
+  std::unordered_map<glm::uvec3, uint32_t, CornerHash> vertex_ind;
+  vertex_ind.reserve(index.size());
+  std::vector<glm::uvec3> vertex;
+  std::vector<uint32_t> corner_vertex;
+  corner_vertex.reserve(index.size());
+  for (const glm::uvec4& corner : index) {
+    auto [it, is_new] = vertex_ind.emplace(glm::uvec3(corner), vertex.size());
+    if (is_new) {
+      DCHECK(corner.x < position.size()) << "Invalid position index";
+      vertex.push_back(glm::uvec3(corner));
+    }
+    corner_vertex.push_back(it->second);
+  }
+  vertex_ind.clear();
+
+  // source order, so that welding alone doesn't change memory locality
+  std::vector<uint32_t> order(vertex.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&vertex](uint32_t a, uint32_t b) {
+    return std::tie(vertex[a].x, vertex[a].y, vertex[a].z) <
+           std::tie(vertex[b].x, vertex[b].y, vertex[b].z);
+  });
+  std::vector<uint32_t> new_ind(vertex.size());
+  Mesh result;
+  result.position.reserve(vertex.size());
+  for (uint32_t i = 0; i < order.size(); i++) {
+    const glm::uvec3& src = vertex[order[i]];
+    new_ind[order[i]] = i;
+    result.position.push_back(position[src.x]);
+    if (has_normal) {
+      result.normal.push_back(src.y < normal.size() ? normal[src.y]
+                                                    : glm::vec4(0));
+    }
+    if (has_tex_coord) {
+      result.tex_coord.push_back(src.z < tex_coord.size() ? tex_coord[src.z]
+                                                          : glm::vec2(0));
+    }
+  }
+  result.index.reserve(index.size());
+  for (uint32_t v : corner_vertex) {
+    v = new_ind[v];
+    result.index.push_back(glm::uvec4(v, has_normal ? v : uint32_t(-1),
+                                      has_tex_coord ? v : uint32_t(-1), 0));
+  }
+  Swap(result);
+}
+
+// Renumbers 'component' of every corner index in first use order, missing
+// attribute indices are kept
+template <typename T>
+static void ReorderAttribute(std::vector<T>& attribute,
+                             std::vector<glm::uvec4>& index,
+                             uint32_t component) {
+  if (attribute.empty()) {
+    return;
+  }
+  std::vector<uint32_t> new_ind(attribute.size(), uint32_t(-1));
+  std::vector<T> result;
+  result.reserve(attribute.size());
+  for (glm::uvec4& corner : index) {
+    uint32_t& ind = corner[component];
+    if (ind >= attribute.size()) {
+      continue;
+    }
+    if (new_ind[ind] == uint32_t(-1)) {
+      new_ind[ind] = result.size();
+      result.push_back(attribute[ind]);
+    }
+    ind = new_ind[ind];
+  }
+  attribute.swap(result);
+}
+
+void Mesh::ReorderVertices() {
+  ReorderAttribute(position, index, 0);
+  ReorderAttribute(normal, index, 1);
+  ReorderAttribute(tex_coord, index, 2);
+}
+
+CompactIndex Mesh::GetCompactIndex() const {
+  CompactIndex result;
+  result.is_16bit = position.size() <= 0x10000;
+  if (result.is_16bit) {
+    result.data.assign((index.size() + 1) / 2, 0);
+  } else {
+    result.data.resize(index.size());
+  }
+  for (uint32_t i = 0; i < index.size(); i++) {
+    DCHECK((index[i].y == index[i].x || index[i].y == uint32_t(-1)) &&
+           (index[i].z == index[i].x || index[i].z == uint32_t(-1)))
+        << "Mesh is not welded";
+    if (result.is_16bit) {
+      result.data[i / 2] |= index[i].x << (16 * (i % 2));
+    } else {
+      result.data[i] = index[i].x;
+    }
+  }
+  return result;
+}
+
 }  // namespace render_data
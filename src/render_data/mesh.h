@@ -10,6 +10,13 @@
 
 namespace render_data {
 
+// One index per triangle corner into welded vertex arrays, see Mesh::Weld
+struct CompactIndex {
+  // 16 bit indices are packed in pairs into 'data', first one in low bits
+  bool is_16bit = false;
+  std::vector<uint32_t> data;
+};
+
 struct Mesh {
   std::vector<glm::vec4> position;
   std::vector<glm::vec4> normal;
@@ -27,7 +34,23 @@ struct Mesh {
 
   void Swap(Mesh& other) noexcept;
 
+  // Triangle i of the result is triangle primirive_order[i] of the source.
+  // Indices may repeat, duplicated triangles share vertices.
   void ReorderPrimitives(const std::vector<uint32_t>& primirive_order);
+
+  // Deduplicates (position, normal, tex_coord) index tuples of corners into
+  // unified vertices, so that all components of index[i] are the same
+  // vertex index. Triangle order is kept, vertices are sorted by their
+  // source index tuples. Attributes missing on a corner become zero,
+  // attributes missing in the whole mesh stay empty with uint32_t(-1)
+  // indices.
+  void Weld();
+  // Lays out every vertex attribute in first use order of triangles, so
+  // consecutive triangles read nearby vertices. Unreferenced entries are
+  // dropped. Meant to run after ReorderPrimitives with BVH primitive order.
+  void ReorderVertices();
+  // Index of welded mesh, 16 bit if vertex count allows
+  CompactIndex GetCompactIndex() const;
 };
 
 }  // namespace render_data
@@ -0,0 +1,215 @@
+#include "render_data/mesh_cluster.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "utill/error_handling.h"
+#include "utill/thread_pool.h"
+
+namespace render_data {
+
+const static size_t kBoundsGrain = 1 << 12;
+
+static bool IsLeaf(const BVHNode& node) {
+  return node.bvh_level == uint32_t(-1);
+}
+
+// [x, y) triangle range of every subtree, children ranges are adjacent
+static std::vector<glm::uvec2> CalcSubtreeRanges(
+    std::span<const BVHNode> nodes) {
+  std::vector<glm::uvec2> res(nodes.size());
+  std::vector<std::pair<uint32_t, bool>> stack;
+  if (!nodes.empty()) {
+    stack.emplace_back(0, false);
+  }
+  while (!stack.empty()) {
+    auto [v, is_children_done] = stack.back();
+    stack.pop_back();
+    const BVHNode& node = nodes[v];
+    if (IsLeaf(node)) {
+      res[v] = glm::uvec2(node.left, node.right);
+    } else if (is_children_done) {
+      DCHECK(res[node.left].y == res[node.right].x)
+          << "Subtree triangles are not consecutive";
+      res[v] = glm::uvec2(res[node.left].x, res[node.right].y);
+    } else {
+      stack.emplace_back(v, true);
+      stack.emplace_back(node.left, false);
+      stack.emplace_back(node.right, false);
+    }
+  }
+  return res;
+}
+
+// Distinct position indices of a cluster being filled, few enough for a
+// linear search
+class ClusterVertexSet {
+  std::span<const glm::uvec4> index_;
+  std::vector<uint32_t> vertices_;
+
+ public:
+  explicit ClusterVertexSet(std::span<const glm::uvec4> index)
+      : index_(index) {}
+
+  uint32_t CountWith(uint32_t triangle) const {
+    uint32_t added[3];
+    uint32_t added_count = 0;
+    for (uint32_t corner = 0; corner < 3; corner++) {
+      uint32_t vertex = index_[3 * triangle + corner].x;
+      if (std::find(vertices_.begin(), vertices_.end(), vertex) ==
+              vertices_.end() &&
+          std::find(added, added + added_count, vertex) ==
+              added + added_count) {
+        added[added_count++] = vertex;
+      }
+    }
+    return vertices_.size() + added_count;
+  }
+
+  void Add(uint32_t triangle) {
+    for (uint32_t corner = 0; corner < 3; corner++) {
+      uint32_t vertex = index_[3 * triangle + corner].x;
+      if (std::find(vertices_.begin(), vertices_.end(), vertex) ==
+          vertices_.end()) {
+        vertices_.push_back(vertex);
+      }
+    }
+  }
+
+  uint32_t GetCount() const { return vertices_.size(); }
+  void Clear() { vertices_.clear(); }
+};
+
+// Splits [l, r) into runs of consecutive triangles within 'config' limits
+static void AppendRuns(uint32_t v,
+                       uint32_t l,
+                       uint32_t r,
+                       ClusterVertexSet& vertex_set,
+                       const ClusterConfig& config,
+                       std::vector<MeshCluster>& clusters) {
+  vertex_set.Clear();
+  MeshCluster cluster;
+  cluster.first_triangle = l;
+  cluster.bvh_node = v;
+  for (uint32_t triangle = l; triangle < r; triangle++) {
+    if (cluster.triangle_count == config.max_triangles ||
+        vertex_set.CountWith(triangle) > config.max_vertices) {
+      cluster.vertex_count = vertex_set.GetCount();
+      clusters.push_back(cluster);
+      cluster.first_triangle = triangle;
+      cluster.triangle_count = 0;
+      vertex_set.Clear();
+    }
+    vertex_set.Add(triangle);
+    ++cluster.triangle_count;
+  }
+  if (cluster.triangle_count > 0) {
+    cluster.vertex_count = vertex_set.GetCount();
+    clusters.push_back(cluster);
+  }
+}
+
+static void CalcClusterBounds(MeshCluster& cluster,
+                              std::span<const glm::vec4> position,
+                              std::span<const glm::uvec4> index) {
+  uint32_t first_corner = 3 * cluster.first_triangle;
+  uint32_t end_corner = first_corner + 3 * cluster.triangle_count;
+  BoundingBox bounds;
+  for (uint32_t i = first_corner; i < end_corner; i++) {
+    bounds.Unite(glm::vec3(position[index[i].x]));
+  }
+  glm::vec3 center = bounds.GetCenter();
+  float radius = 0;
+  for (uint32_t i = first_corner; i < end_corner; i++) {
+    radius = std::max(radius,
+                      glm::distance(glm::vec3(position[index[i].x]), center));
+  }
+  cluster.bounds_min = glm::vec4(bounds.x_range.x, bounds.y_range.x,
+                                 bounds.z_range.x, 0);
+  cluster.bounds_max = glm::vec4(bounds.x_range.y, bounds.y_range.y,
+                                 bounds.z_range.y, 0);
+  cluster.sphere = glm::vec4(center, radius);
+
+  std::vector<glm::vec3> normals;
+  normals.reserve(cluster.triangle_count);
+  glm::vec3 normal_sum(0);
+  for (uint32_t i = first_corner; i < end_corner; i += 3) {
+    glm::vec3 a(position[index[i].x]);
+    glm::vec3 b(position[index[i + 1].x]);
+    glm::vec3 c(position[index[i + 2].x]);
+    glm::vec3 normal = glm::cross(b - a, c - a);
+    float length = glm::length(normal);
+    // degenerate triangles are never hit, so don't widen the cone
+    if (length > 0) {
+      normals.push_back(normal / length);
+      normal_sum += normals.back();
+    }
+  }
+  cluster.cone = glm::vec4(0, 0, 0, 1);
+  float sum_length = glm::length(normal_sum);
+  if (normals.empty() || sum_length < 1e-6f) {
+    return;
+  }
+  glm::vec3 axis = normal_sum / sum_length;
+  float min_cos = 1;
+  for (const glm::vec3& normal : normals) {
+    min_cos = std::min(min_cos, glm::dot(normal, axis));
+  }
+  if (min_cos > 0) {
+    cluster.cone = glm::vec4(axis, std::sqrt(1 - min_cos * min_cos));
+  }
+}
+
+std::vector<MeshCluster> BuildMeshClusters(std::span<const BVHNode> nodes,
+                                           std::span<const glm::vec4> position,
+                                           std::span<const glm::uvec4> index,
+                                           ClusterConfig config) {
+  DCHECK(index.size() % 3 == 0) << "Index must hold whole triangles";
+  DCHECK(config.max_triangles > 0 && config.max_vertices >= 3)
+      << "Cluster must fit at least one triangle";
+  std::vector<glm::uvec2> ranges = CalcSubtreeRanges(nodes);
+  std::vector<MeshCluster> res;
+  ClusterVertexSet vertex_set(index);
+  std::vector<uint32_t> stack;
+  if (!nodes.empty()) {
+    stack.push_back(0);
+  }
+  while (!stack.empty()) {
+    uint32_t v = stack.back();
+    stack.pop_back();
+    const BVHNode& node = nodes[v];
+    uint32_t l = ranges[v].x;
+    uint32_t r = ranges[v].y;
+    DCHECK(r <= index.size() / 3) << "Index is not reordered by this BVH";
+    bool is_fitting = r - l <= config.max_triangles;
+    if (is_fitting && !IsLeaf(node)) {
+      vertex_set.Clear();
+      for (uint32_t triangle = l; triangle < r && is_fitting; triangle++) {
+        vertex_set.Add(triangle);
+        is_fitting = vertex_set.GetCount() <= config.max_vertices;
+      }
+    }
+    if (is_fitting || IsLeaf(node)) {
+      AppendRuns(v, l, r, vertex_set, config, res);
+      continue;
+    }
+    // left subtree is popped first, keeping clusters in triangle order
+    stack.push_back(node.right);
+    stack.push_back(node.left);
+  }
+  utill::ParallelFor(0, res.size(), kBoundsGrain,
+                     [&](size_t begin, size_t end) {
+                       for (size_t i = begin; i < end; i++) {
+                         CalcClusterBounds(res[i], position, index);
+                       }
+                     });
+  return res;
+}
+
+bool IsClusterBackfacing(const MeshCluster& cluster, glm::vec3 camera) {
+  glm::vec3 to_center = glm::vec3(cluster.sphere) - camera;
+  return glm::dot(to_center, glm::vec3(cluster.cone)) >=
+         cluster.cone.w * glm::length(to_center) + cluster.sphere.w;
+}
+
+}  // namespace render_data
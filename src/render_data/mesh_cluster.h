@@ -0,0 +1,53 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "render_data/bvh.h"
+
+namespace render_data {
+
+// Small spatially coherent group of consecutive triangles of a mesh
+// reordered with BVH::GetPrimitiveOrd(). Laid out to be read from a
+// structured buffer by culling passes.
+struct MeshCluster {
+  // w components are unused
+  glm::vec4 bounds_min;
+  glm::vec4 bounds_max;
+  // bounding sphere around the bounds center, radius in w
+  glm::vec4 sphere;
+  // normal cone: axis in xyz, sine of its half angle in w. w is 1 when
+  // normals span a hemisphere or more and the cluster can't be culled.
+  glm::vec4 cone;
+  uint32_t first_triangle = 0;
+  uint32_t triangle_count = 0;
+  uint32_t vertex_count = 0;
+  // BVH node whose subtree holds all triangles of the cluster
+  uint32_t bvh_node = 0;
+};
+
+static_assert(sizeof(MeshCluster) == 80, "Must match std430 layout");
+
+struct ClusterConfig {
+  uint32_t max_triangles = 124;
+  // distinct position indices
+  uint32_t max_vertices = 64;
+};
+
+// Cuts the BVH at the highest subtrees that fit 'config' limits, each
+// becomes one cluster. Leaves too big for a cluster are split into runs of
+// consecutive triangles. Clusters are sorted by first_triangle and cover
+// every triangle once. 'index' holds 3 corners per triangle in BVH primitive
+// order, position index in x component.
+std::vector<MeshCluster> BuildMeshClusters(std::span<const BVHNode> nodes,
+                                           std::span<const glm::vec4> position,
+                                           std::span<const glm::uvec4> index,
+                                           ClusterConfig config = {});
+
+// True if every triangle of the cluster faces away from 'camera', front
+// faces being the ones with cross(b - a, c - a) towards the viewer
+bool IsClusterBackfacing(const MeshCluster& cluster, glm::vec3 camera);
+
+}  // namespace render_data
@@ -0,0 +1,432 @@
+#include "render_data/mesh_lod.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <queue>
+#include <tuple>
+
+#include "utill/error_handling.h"
+
+namespace render_data {
+
+// open border edges are held by planes orthogonal to their triangle,
+// weighted so that moving along them is expensive
+const static double kBorderWeight = 16;
+// collapse is rejected when a triangle normal turns further than this
+const static float kMinNormalCos = 0.2f;
+
+// Sum of squared distances to a set of planes: dot(p, A * p) +
+// 2 * dot(b, p) + c with symmetric A
+struct Quadric {
+  double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+  double b0 = 0, b1 = 0, b2 = 0;
+  double c = 0;
+
+  Quadric() = default;
+  // plane dot(n, p) + d = 0 with unit 'n'
+  Quadric(glm::dvec3 n, double d, double weight)
+      : a00(weight * n.x * n.x),
+        a01(weight * n.x * n.y),
+        a02(weight * n.x * n.z),
+        a11(weight * n.y * n.y),
+        a12(weight * n.y * n.z),
+        a22(weight * n.z * n.z),
+        b0(weight * n.x * d),
+        b1(weight * n.y * d),
+        b2(weight * n.z * d),
+        c(weight * d * d) {}
+
+  Quadric& operator+=(const Quadric& other) {
+    a00 += other.a00;
+    a01 += other.a01;
+    a02 += other.a02;
+    a11 += other.a11;
+    a12 += other.a12;
+    a22 += other.a22;
+    b0 += other.b0;
+    b1 += other.b1;
+    b2 += other.b2;
+    c += other.c;
+    return *this;
+  }
+
+  Quadric operator+(const Quadric& other) const {
+    Quadric res = *this;
+    return res += other;
+  }
+
+  double Eval(glm::vec3 p) const {
+    double x = p.x, y = p.y, z = p.z;
+    return a00 * x * x + a11 * y * y + a22 * z * z +
+           2 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+           2 * (b0 * x + b1 * y + b2 * z) + c;
+  }
+};
+
+// Moves vertex 'from' onto vertex 'to'. Versions of both ends at the time
+// of push, collapse is stale once any of them changes.
+struct EdgeCollapse {
+  double cost = 0;
+  uint32_t from = 0;
+  uint32_t to = 0;
+  uint32_t from_version = 0;
+  uint32_t to_version = 0;
+
+  bool operator>(const EdgeCollapse& other) const {
+    return cost > other.cost;
+  }
+};
+
+/*
+ * Half edge collapse over triangles given by position indices. Vertices
+ * are position indices too, the ones not referenced by any triangle stay
+ * unused.
+ */
+class EdgeCollapser {
+  std::span<const glm::vec4> position_;
+  std::vector<glm::uvec3> triangle_;
+  std::vector<bool> is_triangle_live_;
+  std::vector<std::vector<uint32_t>> vertex_triangles_;
+  std::vector<Quadric> quadric_;
+  std::vector<uint32_t> version_;
+  std::priority_queue<EdgeCollapse,
+                      std::vector<EdgeCollapse>,
+                      std::greater<EdgeCollapse>>
+      queue_;
+  uint32_t live_count_ = 0;
+  double max_cost_ = 0;
+  // scratch of IsValid
+  mutable std::vector<uint32_t> from_neighbors_;
+  mutable std::vector<uint32_t> to_neighbors_;
+
+  glm::vec3 GetPosition(uint32_t v) const { return glm::vec3(position_[v]); }
+
+  void CollectNeighbors(uint32_t v, std::vector<uint32_t>& neighbors) const {
+    neighbors.clear();
+    for (uint32_t t : vertex_triangles_[v]) {
+      if (!is_triangle_live_[t]) {
+        continue;
+      }
+      for (uint32_t corner = 0; corner < 3; corner++) {
+        if (triangle_[t][corner] != v) {
+          neighbors.push_back(triangle_[t][corner]);
+        }
+      }
+    }
+    std::sort(neighbors.begin(), neighbors.end());
+    neighbors.erase(std::unique(neighbors.begin(), neighbors.end()),
+                    neighbors.end());
+  }
+
+  void PushEdge(uint32_t a, uint32_t b) {
+    Quadric quadric = quadric_[a] + quadric_[b];
+    queue_.push({quadric.Eval(GetPosition(b)), a, b, version_[a], version_[b]});
+    queue_.push({quadric.Eval(GetPosition(a)), b, a, version_[b], version_[a]});
+  }
+
+  void InitQuadrics();
+  bool IsValid(uint32_t from, uint32_t to) const;
+  void Collapse(const EdgeCollapse& collapse);
+
+ public:
+  EdgeCollapser(std::span<const glm::vec4> position,
+                std::vector<glm::uvec3>&& triangle);
+
+  void Run(uint32_t target_triangle_count);
+
+  double GetMaxCost() const { return max_cost_; }
+  bool IsTriangleLive(uint32_t t) const { return is_triangle_live_[t]; }
+  const glm::uvec3& GetTriangle(uint32_t t) const { return triangle_[t]; }
+};
+
+EdgeCollapser::EdgeCollapser(std::span<const glm::vec4> position,
+                             std::vector<glm::uvec3>&& triangle)
+    : position_(position),
+      triangle_(std::move(triangle)),
+      is_triangle_live_(triangle_.size(), true),
+      vertex_triangles_(position.size()),
+      quadric_(position.size()),
+      version_(position.size(), 0),
+      live_count_(triangle_.size()) {
+  for (uint32_t t = 0; t < triangle_.size(); t++) {
+    for (uint32_t corner = 0; corner < 3; corner++) {
+      DCHECK(triangle_[t][corner] < position.size())
+          << "Invalid position index";
+      vertex_triangles_[triangle_[t][corner]].push_back(t);
+    }
+  }
+  InitQuadrics();
+}
+
+void EdgeCollapser::InitQuadrics() {
+  // undirected edges, each once per adjacent triangle
+  std::vector<std::tuple<uint32_t, uint32_t, uint32_t>> edges;
+  edges.reserve(3 * triangle_.size());
+  for (uint32_t t = 0; t < triangle_.size(); t++) {
+    glm::vec3 a = GetPosition(triangle_[t].x);
+    glm::vec3 b = GetPosition(triangle_[t].y);
+    glm::vec3 c = GetPosition(triangle_[t].z);
+    glm::dvec3 normal(glm::cross(b - a, c - a));
+    double length = glm::length(normal);
+    if (length > 0) {
+      normal /= length;
+      Quadric plane(normal, -glm::dot(normal, glm::dvec3(a)), 1);
+      for (uint32_t corner = 0; corner < 3; corner++) {
+        quadric_[triangle_[t][corner]] += plane;
+      }
+    }
+    for (uint32_t corner = 0; corner < 3; corner++) {
+      uint32_t u = triangle_[t][corner];
+      uint32_t v = triangle_[t][(corner + 1) % 3];
+      if (u != v) {
+        edges.emplace_back(std::min(u, v), std::max(u, v), t);
+      }
+    }
+  }
+  std::sort(edges.begin(), edges.end());
+  std::vector<std::pair<uint32_t, uint32_t>> unique_edges;
+  for (size_t l = 0; l < edges.size();) {
+    auto [u, v, t] = edges[l];
+    size_t r = l + 1;
+    while (r < edges.size() && std::get<0>(edges[r]) == u &&
+           std::get<1>(edges[r]) == v) {
+      ++r;
+    }
+    if (r - l == 1) {
+      glm::vec3 a = GetPosition(triangle_[t].x);
+      glm::vec3 b = GetPosition(triangle_[t].y);
+      glm::vec3 c = GetPosition(triangle_[t].z);
+      glm::dvec3 edge(GetPosition(v) - GetPosition(u));
+      glm::dvec3 normal =
+          glm::cross(edge, glm::dvec3(glm::cross(b - a, c - a)));
+      double length = glm::length(normal);
+      if (length > 0) {
+        normal /= length;
+        Quadric plane(normal, -glm::dot(normal, glm::dvec3(GetPosition(u))),
+                      kBorderWeight);
+        quadric_[u] += plane;
+        quadric_[v] += plane;
+      }
+    }
+    unique_edges.emplace_back(u, v);
+    l = r;
+  }
+  // after all border planes are in
+  for (auto [u, v] : unique_edges) {
+    PushEdge(u, v);
+  }
+}
+
+bool EdgeCollapser::IsValid(uint32_t from, uint32_t to) const {
+  // more common neighbors than triangles on the edge would fold the surface
+  // onto itself
+  uint32_t edge_triangle_count = 0;
+  for (uint32_t t : vertex_triangles_[from]) {
+    if (!is_triangle_live_[t]) {
+      continue;
+    }
+    const glm::uvec3& triangle = triangle_[t];
+    if (triangle.x == to || triangle.y == to || triangle.z == to) {
+      ++edge_triangle_count;
+      continue;
+    }
+    glm::vec3 before[3];
+    glm::vec3 after[3];
+    for (uint32_t corner = 0; corner < 3; corner++) {
+      before[corner] = GetPosition(triangle[corner]);
+      after[corner] = triangle[corner] == from ? GetPosition(to)
+                                               : before[corner];
+    }
+    glm::vec3 normal_before =
+        glm::cross(before[1] - before[0], before[2] - before[0]);
+    glm::vec3 normal_after =
+        glm::cross(after[1] - after[0], after[2] - after[0]);
+    float length_before = glm::length(normal_before);
+    if (length_before > 0 &&
+        glm::dot(normal_before, normal_after) <=
+            kMinNormalCos * length_before * glm::length(normal_after)) {
+      return false;
+    }
+  }
+  CollectNeighbors(from, from_neighbors_);
+  CollectNeighbors(to, to_neighbors_);
+  uint32_t common_count = 0;
+  for (uint32_t v : from_neighbors_) {
+    common_count +=
+        std::binary_search(to_neighbors_.begin(), to_neighbors_.end(), v);
+  }
+  return common_count <= edge_triangle_count;
+}
+
+void EdgeCollapser::Collapse(const EdgeCollapse& collapse) {
+  uint32_t from = collapse.from;
+  uint32_t to = collapse.to;
+  std::vector<uint32_t>& to_triangles = vertex_triangles_[to];
+  for (uint32_t t : vertex_triangles_[from]) {
+    if (!is_triangle_live_[t]) {
+      continue;
+    }
+    glm::uvec3& triangle = triangle_[t];
+    if (triangle.x == to || triangle.y == to || triangle.z == to) {
+      is_triangle_live_[t] = false;
+      --live_count_;
+      continue;
+    }
+    for (uint32_t corner = 0; corner < 3; corner++) {
+      if (triangle[corner] == from) {
+        triangle[corner] = to;
+      }
+    }
+    to_triangles.push_back(t);
+  }
+  std::vector<uint32_t>().swap(vertex_triangles_[from]);
+  to_triangles.erase(
+      std::remove_if(to_triangles.begin(), to_triangles.end(),
+                     [this](uint32_t t) { return !is_triangle_live_[t]; }),
+      to_triangles.end());
+
+  quadric_[to] += quadric_[from];
+  max_cost_ = std::max(max_cost_, collapse.cost);
+  ++version_[from];
+  ++version_[to];
+  CollectNeighbors(to, to_neighbors_);
+  for (uint32_t v : to_neighbors_) {
+    PushEdge(to, v);
+  }
+}
+
+void EdgeCollapser::Run(uint32_t target_triangle_count) {
+  while (live_count_ > target_triangle_count && !queue_.empty()) {
+    EdgeCollapse collapse = queue_.top();
+    queue_.pop();
+    if (collapse.from_version != version_[collapse.from] ||
+        collapse.to_version != version_[collapse.to]) {
+      continue;
+    }
+    if (!IsValid(collapse.from, collapse.to)) {
+      continue;
+    }
+    Collapse(collapse);
+  }
+}
+
+// Index of the first position equal to each one, so that vertices split by
+// attribute seams move together
+static std::vector<uint32_t> CalcSharedPositionIndex(
+    const std::vector<glm::vec4>& position) {
+  std::vector<uint32_t> order(position.size());
+  std::iota(order.begin(), order.end(), 0);
+  auto as_tuple = [&position](uint32_t ind) {
+    return std::tie(position[ind].x, position[ind].y, position[ind].z);
+  };
+  std::stable_sort(order.begin(), order.end(),
+                   [&as_tuple](uint32_t a, uint32_t b) {
+                     return as_tuple(a) < as_tuple(b);
+                   });
+  std::vector<uint32_t> res(position.size());
+  for (uint32_t i = 0; i < order.size(); i++) {
+    bool is_same = i > 0 && as_tuple(order[i]) == as_tuple(order[i - 1]);
+    res[order[i]] = is_same ? res[order[i - 1]] : order[i];
+  }
+  return res;
+}
+
+Mesh SimplifyMesh(const Mesh& mesh,
+                  uint32_t target_triangle_count,
+                  float& error) {
+  DCHECK(mesh.index.size() % 3 == 0) << "Index must hold whole triangles";
+  std::vector<uint32_t> shared_position =
+      CalcSharedPositionIndex(mesh.position);
+  std::vector<glm::uvec3> triangle(mesh.index.size() / 3);
+  for (uint32_t t = 0; t < triangle.size(); t++) {
+    for (uint32_t corner = 0; corner < 3; corner++) {
+      uint32_t position_ind = mesh.index[3 * t + corner].x;
+      DCHECK(position_ind < mesh.position.size()) << "Invalid position index";
+      triangle[t][corner] = shared_position[position_ind];
+    }
+  }
+  EdgeCollapser collapser(mesh.position, std::move(triangle));
+  collapser.Run(target_triangle_count);
+  error = std::sqrt(std::max(collapser.GetMaxCost(), 0.0));
+
+  Mesh res;
+  res.position = mesh.position;
+  res.normal = mesh.normal;
+  res.tex_coord = mesh.tex_coord;
+  for (uint32_t t = 0; t < mesh.index.size() / 3; t++) {
+    if (!collapser.IsTriangleLive(t)) {
+      continue;
+    }
+    for (uint32_t corner = 0; corner < 3; corner++) {
+      glm::uvec4 index = mesh.index[3 * t + corner];
+      index.x = collapser.GetTriangle(t)[corner];
+      res.index.push_back(index);
+    }
+  }
+  return res;
+}
+
+static void AddLevel(Mesh&& mesh,
+                     float error,
+                     BVHBuildConfig bvh_config,
+                     std::vector<MeshLOD>& levels) {
+  MeshLOD level;
+  level.bvh = BVH(mesh, bvh_config);
+  mesh.ReorderPrimitives(level.bvh.GetPrimitiveOrd());
+  mesh.ReorderVertices();
+  level.mesh = std::move(mesh);
+  level.error = error;
+  levels.push_back(std::move(level));
+}
+
+std::vector<MeshLOD> BuildLODChain(Mesh&& mesh,
+                                   BVHBuildConfig bvh_config,
+                                   LODConfig config) {
+  std::vector<MeshLOD> res;
+  AddLevel(std::move(mesh), 0, bvh_config, res);
+  for (uint32_t i = 0; i < config.max_level_count; i++) {
+    uint32_t triangle_count = res.back().mesh.index.size() / 3;
+    uint32_t target_count = triangle_count * config.triangle_ratio;
+    if (target_count < config.min_triangle_count) {
+      break;
+    }
+    float error = 0;
+    Mesh level = SimplifyMesh(res.back().mesh, target_count, error);
+    // too few valid collapses left, further levels would barely differ
+    if (level.index.size() / 3 > (triangle_count + target_count) / 2) {
+      break;
+    }
+    AddLevel(std::move(level), res.back().error + error, bvh_config, res);
+  }
+  return res;
+}
+
+float CalcProjectedError(float error,
+                         float distance,
+                         const CameraInfo& camera) {
+  if (distance <= 0) {
+    return std::numeric_limits<float>::infinity();
+  }
+  // camera rays pass through a plane at distance 1 spanning [-1, 1]
+  // vertically, see PixCordToCameraSpace
+  return error * camera.screen_height / (2 * distance);
+}
+
+uint32_t SelectLOD(std::span<const float> level_error,
+                   float distance,
+                   const CameraInfo& camera,
+                   float max_pixel_error) {
+  uint32_t res = 0;
+  for (uint32_t i = 1; i < level_error.size(); i++) {
+    if (CalcProjectedError(level_error[i], distance, camera) >
+        max_pixel_error) {
+      break;
+    }
+    res = i;
+  }
+  return res;
+}
+
+}  // namespace render_data
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "render_data/bvh.h"
+#include "render_data/camera_info.h"
+#include "render_data/mesh.h"
+
+namespace render_data {
+
+struct LODConfig {
+  // levels after the source one
+  uint32_t max_level_count = 4;
+  // target triangle count of a level relative to the previous one
+  float triangle_ratio = 0.5;
+  // no level is built with less triangles than this
+  uint32_t min_triangle_count = 256;
+};
+
+// One level of detail, mesh is reordered with bvh.GetPrimitiveOrd() and
+// Mesh::ReorderVertices like bottom levels of TwoLevelBVH
+struct MeshLOD {
+  Mesh mesh;
+  BVH bvh;
+  // estimated max distance from this level surface to the source one, sum
+  // of SimplifyMesh errors of levels up to this one, in mesh units
+  float error = 0;
+};
+
+// Quadric error metric simplification of 'mesh' down to at most
+// 'target_triangle_count' triangles, or fewer collapses if no valid ones
+// are left. Vertices are only moved onto their neighbors, so corners keep
+// their normal and tex_coord indices. Positions shared by several vertex
+// indices move together, open borders are kept in place. 'error' gets the
+// quadric error of the worst collapse: square root of the summed squared
+// distances to source triangle planes around it, in mesh units.
+Mesh SimplifyMesh(const Mesh& mesh,
+                  uint32_t target_triangle_count,
+                  float& error);
+
+// Level 0 is 'mesh' itself, every next one is simplified from the previous
+// one. Stops early once simplification can't reach the target count.
+std::vector<MeshLOD> BuildLODChain(Mesh&& mesh,
+                                   BVHBuildConfig bvh_config,
+                                   LODConfig config = {});
+
+// Size in pixels of an 'error' long segment facing the camera at 'distance',
+// for the projection of raytrace.hlsl
+float CalcProjectedError(float error,
+                         float distance,
+                         const CameraInfo& camera);
+
+// Coarsest level whose projected error at 'distance' stays within
+// 'max_pixel_error'. 'level_error' is MeshLOD::error of every level, growing
+// with level; 'distance' is from the camera to the nearest point of the
+// object, zero inside of it.
+uint32_t SelectLOD(std::span<const float> level_error,
+                   float distance,
+                   const CameraInfo& camera,
+                   float max_pixel_error);
+
+}  // namespace render_data
@@ -0,0 +1,404 @@
+#include "render_data/obj_parser.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+#include "utill/thread_pool.h"
+
+namespace render_data {
+
+namespace {
+
+const size_t kChunkSize = 1 << 22;
+
+struct ObjChunk {
+  std::vector<glm::vec4> position;
+  std::vector<glm::vec4> normal;
+  std::vector<glm::vec2> tex_coord;
+  // (position, normal, tex_coord) indices of face vertices, -1 if missing.
+  // Negative obj indices are stored relative to the chunk start, slots
+  // listed in relative_* are rebased after merge.
+  std::vector<glm::ivec3> face_vertex;
+  std::vector<uint8_t> face_size;
+  std::vector<uint32_t> relative_position;
+  std::vector<uint32_t> relative_normal;
+  std::vector<uint32_t> relative_tex_coord;
+  // triangulated faces, same layout as Mesh::index
+  std::vector<glm::uvec4> index;
+};
+
+bool IsDigit(char c) {
+  return uint32_t(c - '0') < 10u;
+}
+
+bool IsSpace(char c) {
+  return c == ' ' || c == '\t';
+}
+
+const char* SkipSpaces(const char* p, const char* end) {
+  while (p < end && IsSpace(*p)) {
+    p++;
+  }
+  return p;
+}
+
+// Same algorithm as tinyobj tryParseDouble, so that values round the same
+bool TryParseDouble(const char* s, const char* s_end, double* result) {
+  if (s >= s_end) {
+    return false;
+  }
+  double mantissa = 0.0;
+  int exponent = 0;
+  char sign = '+';
+  char exp_sign = '+';
+  const char* curr = s;
+  int read = 0;
+  bool leading_decimal_dots = false;
+
+  if (*curr == '+' || *curr == '-') {
+    sign = *curr;
+    curr++;
+    if (curr != s_end && *curr == '.') {
+      leading_decimal_dots = true;
+    }
+  } else if (*curr == '.') {
+    leading_decimal_dots = true;
+  } else if (!IsDigit(*curr)) {
+    return false;
+  }
+
+  if (!leading_decimal_dots) {
+    while (curr != s_end && IsDigit(*curr)) {
+      mantissa *= 10;
+      mantissa += static_cast<int>(*curr - '0');
+      curr++;
+      read++;
+    }
+    if (read == 0) {
+      return false;
+    }
+  }
+  if (curr != s_end && *curr == '.') {
+    const double kPowLut[] = {1.0,     0.1,      0.01,      0.001,
+                              0.0001,  0.00001,  0.000001,  0.0000001};
+    const int kLutEntries = sizeof(kPowLut) / sizeof(kPowLut[0]);
+    curr++;
+    read = 1;
+    while (curr != s_end && IsDigit(*curr)) {
+      mantissa += static_cast<int>(*curr - '0') *
+                  (read < kLutEntries ? kPowLut[read] : std::pow(10.0, -read));
+      read++;
+      curr++;
+    }
+  }
+  if (curr != s_end && (*curr == 'e' || *curr == 'E')) {
+    curr++;
+    if (curr != s_end && (*curr == '+' || *curr == '-')) {
+      exp_sign = *curr;
+      curr++;
+    } else if (curr == s_end || !IsDigit(*curr)) {
+      return false;
+    }
+    read = 0;
+    while (curr != s_end && IsDigit(*curr)) {
+      if (exponent > 2147483647 / 10) {
+        return false;
+      }
+      exponent *= 10;
+      exponent += static_cast<int>(*curr - '0');
+      curr++;
+      read++;
+    }
+    exponent *= (exp_sign == '+' ? 1 : -1);
+    if (read == 0) {
+      return false;
+    }
+  }
+  *result = (sign == '+' ? 1 : -1) *
+            (exponent ? std::ldexp(mantissa * std::pow(5.0, exponent), exponent)
+                      : mantissa);
+  return true;
+}
+
+float ParseReal(const char*& p, const char* end) {
+  p = SkipSpaces(p, end);
+  const char* token_end = p;
+  while (token_end < end && !IsSpace(*token_end)) {
+    token_end++;
+  }
+  double val = 0.0;
+  TryParseDouble(p, token_end, &val);
+  p = token_end;
+  return static_cast<float>(val);
+}
+
+// atoi on a not null terminated range
+int ParseInt(const char* p, const char* end) {
+  while (p < end && (IsSpace(*p) || *p == '\v' || *p == '\f')) {
+    p++;
+  }
+  bool is_negative = false;
+  if (p < end && (*p == '+' || *p == '-')) {
+    is_negative = *p == '-';
+    p++;
+  }
+  int64_t res = 0;
+  while (p < end && IsDigit(*p)) {
+    res = res * 10 + (*p - '0');
+    p++;
+  }
+  return int(is_negative ? -res : res);
+}
+
+const char* SkipIndex(const char* p, const char* end) {
+  while (p < end && *p != '/' && !IsSpace(*p)) {
+    p++;
+  }
+  return p;
+}
+
+// tinyobj fixIndex. Negative indices are relative to 'local_count'
+// elements parsed in this chunk so far, 'slot' is remembered to add
+// elements of previous chunks after merge.
+bool FixIndex(int idx,
+              size_t local_count,
+              uint32_t slot,
+              std::vector<uint32_t>& relative_slots,
+              int& res) {
+  if (idx > 0) {
+    res = idx - 1;
+    return true;
+  }
+  if (idx == 0) {
+    return false;
+  }
+  res = int(local_count) + idx;
+  relative_slots.push_back(slot);
+  return true;
+}
+
+// v, v/vt, v//vn or v/vt/vn
+bool ParseFaceVertex(const char*& p, const char* end, ObjChunk& chunk) {
+  uint32_t slot = chunk.face_vertex.size();
+  glm::ivec3 vertex(-1);
+  if (!FixIndex(ParseInt(p, end), chunk.position.size(), slot,
+                chunk.relative_position, vertex.x)) {
+    return false;
+  }
+  p = SkipIndex(p, end);
+  if (p < end && *p == '/') {
+    p++;
+    if (p < end && *p == '/') {
+      p++;
+      if (!FixIndex(ParseInt(p, end), chunk.normal.size(), slot,
+                    chunk.relative_normal, vertex.y)) {
+        return false;
+      }
+      p = SkipIndex(p, end);
+    } else {
+      if (!FixIndex(ParseInt(p, end), chunk.tex_coord.size(), slot,
+                    chunk.relative_tex_coord, vertex.z)) {
+        return false;
+      }
+      p = SkipIndex(p, end);
+      if (p < end && *p == '/') {
+        p++;
+        if (!FixIndex(ParseInt(p, end), chunk.normal.size(), slot,
+                      chunk.relative_normal, vertex.y)) {
+          return false;
+        }
+        p = SkipIndex(p, end);
+      }
+    }
+  }
+  chunk.face_vertex.push_back(vertex);
+  return true;
+}
+
+bool ParseLine(const char* p, const char* end, ObjChunk& chunk) {
+  p = SkipSpaces(p, end);
+  if (p == end || *p == '#' || end - p < 2) {
+    return true;
+  }
+  if (p[0] == 'v' && IsSpace(p[1])) {
+    p += 2;
+    float x = ParseReal(p, end);
+    float y = ParseReal(p, end);
+    float z = ParseReal(p, end);
+    chunk.position.push_back(glm::vec4(x, y, z, 1.0));
+  } else if (p[0] == 'v' && p[1] == 'n' && end - p > 2 && IsSpace(p[2])) {
+    p += 3;
+    float x = ParseReal(p, end);
+    float y = ParseReal(p, end);
+    float z = ParseReal(p, end);
+    chunk.normal.push_back(glm::vec4(x, y, z, 0.0));
+  } else if (p[0] == 'v' && p[1] == 't' && end - p > 2 && IsSpace(p[2])) {
+    p += 3;
+    float u = ParseReal(p, end);
+    float v = ParseReal(p, end);
+    chunk.tex_coord.push_back(glm::vec2(u, v));
+  } else if (p[0] == 'f' && IsSpace(p[1])) {
+    p = SkipSpaces(p + 2, end);
+    uint32_t face_size = 0;
+    while (p < end) {
+      if (!ParseFaceVertex(p, end, chunk)) {
+        return false;
+      }
+      face_size++;
+      p = SkipSpaces(p, end);
+    }
+    if (face_size > 4) {
+      return false;
+    }
+    if (face_size < 3) {
+      // tinyobj drops degenerate faces
+      chunk.face_vertex.resize(chunk.face_vertex.size() - face_size);
+      return true;
+    }
+    chunk.face_size.push_back(face_size);
+  }
+  return true;
+}
+
+bool ParseChunk(const char* begin, const char* end, ObjChunk& chunk) {
+  const char* line_begin = begin;
+  while (line_begin < end) {
+    const char* line_end = line_begin;
+    while (line_end < end && *line_end != '\n' && *line_end != '\r') {
+      line_end++;
+    }
+    if (!ParseLine(line_begin, line_end, chunk)) {
+      return false;
+    }
+    line_begin = line_end + 1;
+  }
+  return true;
+}
+
+void RebaseRelativeIndices(ObjChunk& chunk,
+                           int position_base,
+                           int normal_base,
+                           int tex_coord_base) {
+  for (uint32_t slot : chunk.relative_position) {
+    chunk.face_vertex[slot].x += position_base;
+  }
+  for (uint32_t slot : chunk.relative_normal) {
+    chunk.face_vertex[slot].y += normal_base;
+  }
+  for (uint32_t slot : chunk.relative_tex_coord) {
+    chunk.face_vertex[slot].z += tex_coord_base;
+  }
+}
+
+glm::uvec4 ToMeshIndex(glm::ivec3 vertex) {
+  return glm::uvec4(uint32_t(vertex.x), uint32_t(vertex.y),
+                    uint32_t(vertex.z), 0);
+}
+
+// Quads are split along the shorter diagonal and skipped if they reference
+// missing positions, like tinyobj triangulation does
+void TriangulateChunk(const std::vector<glm::vec4>& position,
+                      ObjChunk& chunk) {
+  chunk.index.reserve(chunk.face_vertex.size() * 3 / 2);
+  const glm::ivec3* vertex = chunk.face_vertex.data();
+  for (uint8_t face_size : chunk.face_size) {
+    if (face_size == 3) {
+      for (uint32_t i = 0; i < 3; i++) {
+        chunk.index.push_back(ToMeshIndex(vertex[i]));
+      }
+      vertex += face_size;
+      continue;
+    }
+    bool is_valid = true;
+    for (uint32_t i = 0; i < 4; i++) {
+      is_valid &= size_t(uint32_t(vertex[i].x)) < position.size();
+    }
+    if (is_valid) {
+      glm::vec3 e02(position[vertex[2].x] - position[vertex[0].x]);
+      glm::vec3 e13(position[vertex[3].x] - position[vertex[1].x]);
+      float sqr02 = e02.x * e02.x + e02.y * e02.y + e02.z * e02.z;
+      float sqr13 = e13.x * e13.x + e13.y * e13.y + e13.z * e13.z;
+      const uint32_t kSplit02[] = {0, 1, 2, 0, 2, 3};
+      const uint32_t kSplit13[] = {0, 1, 3, 1, 2, 3};
+      const uint32_t* order = sqr02 < sqr13 ? kSplit02 : kSplit13;
+      for (uint32_t i = 0; i < 6; i++) {
+        chunk.index.push_back(ToMeshIndex(vertex[order[i]]));
+      }
+    }
+    vertex += face_size;
+  }
+}
+
+// Concatenates 'member' vectors of all chunks into 'dst'
+template <typename T, typename Member>
+void MergeChunks(std::vector<ObjChunk>& chunks,
+                 Member member,
+                 std::vector<T>& dst,
+                 std::vector<size_t>& chunk_offset) {
+  chunk_offset.resize(chunks.size() + 1);
+  chunk_offset[0] = 0;
+  for (size_t i = 0; i < chunks.size(); i++) {
+    chunk_offset[i + 1] = chunk_offset[i] + (chunks[i].*member).size();
+  }
+  dst.resize(chunk_offset.back());
+  utill::ParallelFor(0, chunks.size(), 1, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      std::vector<T>& src = chunks[i].*member;
+      std::copy(src.begin(), src.end(), dst.begin() + chunk_offset[i]);
+      src.clear();
+      src.shrink_to_fit();
+    }
+  });
+}
+
+}  // namespace
+
+bool ParseObj(std::string_view data, Mesh& mesh) {
+  std::vector<size_t> chunk_begin = {0};
+  while (chunk_begin.back() + kChunkSize < data.size()) {
+    size_t line_end = data.find('\n', chunk_begin.back() + kChunkSize);
+    if (line_end == std::string_view::npos) {
+      break;
+    }
+    chunk_begin.push_back(line_end + 1);
+  }
+  chunk_begin.push_back(data.size());
+
+  std::vector<ObjChunk> chunks(chunk_begin.size() - 1);
+  std::atomic<bool> is_supported = true;
+  utill::ParallelFor(0, chunks.size(), 1, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end && is_supported; i++) {
+      if (!ParseChunk(data.data() + chunk_begin[i],
+                      data.data() + chunk_begin[i + 1], chunks[i])) {
+        is_supported = false;
+      }
+    }
+  });
+  if (!is_supported) {
+    return false;
+  }
+
+  std::vector<size_t> position_offset;
+  std::vector<size_t> normal_offset;
+  std::vector<size_t> tex_coord_offset;
+  Mesh result;
+  MergeChunks(chunks, &ObjChunk::position, result.position, position_offset);
+  MergeChunks(chunks, &ObjChunk::normal, result.normal, normal_offset);
+  MergeChunks(chunks, &ObjChunk::tex_coord, result.tex_coord,
+              tex_coord_offset);
+  utill::ParallelFor(0, chunks.size(), 1, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      RebaseRelativeIndices(chunks[i], position_offset[i], normal_offset[i],
+                            tex_coord_offset[i]);
+      TriangulateChunk(result.position, chunks[i]);
+    }
+  });
+  std::vector<size_t> index_offset;
+  MergeChunks(chunks, &ObjChunk::index, result.index, index_offset);
+  mesh.Swap(result);
+  return true;
+}
+
+}  // namespace render_data
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string_view>
+
+#include "render_data/mesh.h"
+
+namespace render_data {
+
+// Parses contents of a Wavefront obj file into 'mesh'. File is split into
+// line aligned chunks parsed on utill::ThreadPool::GetGlobal(), chunk
+// results are merged with prefix sums of their counts. Produces the same
+// result as tinyobj::ObjReader with triangulation, including number
+// parsing and quad splitting. Returns false for input it doesn't reproduce
+// tinyobj results for: polygons with more than 4 vertices and malformed
+// face indices.
+bool ParseObj(std::string_view data, Mesh& mesh);
+
+}  // namespace render_data
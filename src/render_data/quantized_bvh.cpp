@@ -0,0 +1,145 @@
+#include "render_data/quantized_bvh.h"
+
+#include <bit>
+#include <cmath>
+
+#include "utill/error_handling.h"
+
+namespace render_data {
+
+const static int kExponentBias = 127;
+// keeps biased exponents inside normal float range
+const static int kMinExponent = -100;
+const static uint32_t kMaxQuantized = 255;
+const static uint32_t kMaxLeafPrimitives = 0xffff;
+
+static float GetStep(uint32_t exponents, uint32_t axis) {
+  uint32_t biased = (exponents >> (8 * axis)) & 0xff;
+  return std::bit_cast<float>(biased << 23);
+}
+
+static uint32_t GetByte(uint32_t packed, uint32_t slot) {
+  return (packed >> (8 * slot)) & 0xff;
+}
+
+// Shader decodes the same way: origin + float(q) * step
+static float Decode(float origin, uint32_t q, float step) {
+  return origin + float(q) * step;
+}
+
+// Smallest exponent with quantization step that covers [origin, max]
+static int CalcExponent(float origin, float max) {
+  int exponent = kMinExponent;
+  if (max > origin) {
+    exponent = std::max(
+        int(std::ceil(std::log2((max - origin) / kMaxQuantized))),
+        kMinExponent);
+  }
+  while (Decode(origin, kMaxQuantized, std::ldexp(1.0f, exponent)) < max) {
+    ++exponent;
+  }
+  return exponent;
+}
+
+static uint32_t QuantizeMin(float value, float origin, float step) {
+  uint32_t q = std::min<uint32_t>(
+      std::max(std::floor((value - origin) / step), 0.0f), kMaxQuantized);
+  while (q > 0 && Decode(origin, q, step) > value) {
+    --q;
+  }
+  return q;
+}
+
+static uint32_t QuantizeMax(float value, float origin, float step) {
+  uint32_t q = std::min<uint32_t>(
+      std::max(std::ceil((value - origin) / step), 0.0f), kMaxQuantized);
+  while (q < kMaxQuantized && Decode(origin, q, step) < value) {
+    ++q;
+  }
+  return q;
+}
+
+static QuantizedBVHNode QuantizeNode(const WideBVHNode<4>& node) {
+  QuantizedBVHNode res{};
+  BoundingBox bounds;
+  for (uint32_t slot = 0; slot < QuantizedBVHNode::kWidth; slot++) {
+    res.child[slot] = node.child[slot];
+    if (node.child[slot] != uint32_t(-1)) {
+      bounds.Unite(node.GetChildBounds(slot));
+    }
+  }
+  if (bounds.x_range.x > bounds.x_range.y) {
+    // node without children
+    bounds.Unite(glm::vec3(0));
+  }
+  res.origin = glm::vec3(bounds.x_range.x, bounds.y_range.x, bounds.z_range.x);
+  glm::vec3 max(bounds.x_range.y, bounds.y_range.y, bounds.z_range.y);
+  for (uint32_t axis = 0; axis < 3; axis++) {
+    uint32_t biased = CalcExponent(res.origin[axis], max[axis]) + kExponentBias;
+    DCHECK(0 < biased && biased < 0xff) << "Exponent out of range";
+    res.exponents |= biased << (8 * axis);
+  }
+
+  glm::vec3 step(GetStep(res.exponents, 0), GetStep(res.exponents, 1),
+                 GetStep(res.exponents, 2));
+  for (uint32_t slot = 0; slot < QuantizedBVHNode::kWidth; slot++) {
+    if (node.child[slot] == uint32_t(-1)) {
+      continue;
+    }
+    uint32_t primitive_count = node.GetPrimitiveCount(slot);
+    CHECK(primitive_count <= kMaxLeafPrimitives)
+        << "Leaf too large to quantize: " << primitive_count;
+    res.primitive_count[slot / 2] |= primitive_count << (16 * (slot % 2));
+
+    BoundingBox child_bounds = node.GetChildBounds(slot);
+    uint32_t shift = 8 * slot;
+    res.min_x |= QuantizeMin(child_bounds.x_range.x, res.origin.x, step.x)
+                 << shift;
+    res.max_x |= QuantizeMax(child_bounds.x_range.y, res.origin.x, step.x)
+                 << shift;
+    res.min_y |= QuantizeMin(child_bounds.y_range.x, res.origin.y, step.y)
+                 << shift;
+    res.max_y |= QuantizeMax(child_bounds.y_range.y, res.origin.y, step.y)
+                 << shift;
+    res.min_z |= QuantizeMin(child_bounds.z_range.x, res.origin.z, step.z)
+                 << shift;
+    res.max_z |= QuantizeMax(child_bounds.z_range.y, res.origin.z, step.z)
+                 << shift;
+    DCHECK(res.GetChildBounds(slot).Contains(child_bounds))
+        << "Quantized bounds must be conservative";
+  }
+  return res;
+}
+
+glm::vec3 QuantizedBVHNode::GetScale() const {
+  return glm::vec3(GetStep(exponents, 0), GetStep(exponents, 1),
+                   GetStep(exponents, 2));
+}
+
+BoundingBox QuantizedBVHNode::GetChildBounds(uint32_t slot) const {
+  glm::vec3 step = GetScale();
+  return BoundingBox{{Decode(origin.x, GetByte(min_x, slot), step.x),
+                      Decode(origin.x, GetByte(max_x, slot), step.x)},
+                     {Decode(origin.y, GetByte(min_y, slot), step.y),
+                      Decode(origin.y, GetByte(max_y, slot), step.y)},
+                     {Decode(origin.z, GetByte(min_z, slot), step.z),
+                      Decode(origin.z, GetByte(max_z, slot), step.z)}};
+}
+
+uint32_t QuantizedBVHNode::GetPrimitiveCount(uint32_t slot) const {
+  return (primitive_count[slot / 2] >> (16 * (slot % 2))) & 0xffff;
+}
+
+QuantizedBVH::QuantizedBVH(const WideBVH<4>& bvh) {
+  const auto& nodes = bvh.GetNodes();
+  node_.reserve(nodes.size());
+  for (const auto& node : nodes) {
+    node_.push_back(QuantizeNode(node));
+  }
+}
+
+const std::vector<QuantizedBVHNode>& QuantizedBVH::GetNodes() const {
+  return node_;
+}
+
+}  // namespace render_data
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "render_data/bvh.h"
+#include "render_data/wide_bvh.h"
+
+namespace render_data {
+
+/*
+ * WideBVHNode<4> with child bounds stored as 8 bit offsets from the node
+ * bounds minimum, 64 bytes instead of 128. Per axis quantization step is a
+ * power of two, so decoding is exact and decoded bounds always contain the
+ * original ones.
+ */
+struct QuantizedBVHNode {
+  static const uint32_t kWidth = 4;
+
+  glm::vec3 origin;
+  // biased float exponent of the quantization step, one byte per axis
+  uint32_t exponents;
+  // index of the child node, or first primitive of a leaf child,
+  // uint32_t(-1) for unused slots
+  std::array<uint32_t, kWidth> child;
+  // 16 bits per child, 0 for internal children
+  std::array<uint32_t, kWidth / 2> primitive_count;
+  // one byte per child
+  uint32_t min_x;
+  uint32_t max_x;
+  uint32_t min_y;
+  uint32_t max_y;
+  uint32_t min_z;
+  uint32_t max_z;
+
+  glm::vec3 GetScale() const;
+  BoundingBox GetChildBounds(uint32_t slot) const;
+  uint32_t GetPrimitiveCount(uint32_t slot) const;
+};
+
+static_assert(sizeof(QuantizedBVHNode) == 64,
+              "Must match QuantizedBVHNode in raytrace.hlsl");
+
+class QuantizedBVH {
+  std::vector<QuantizedBVHNode> node_;
+
+ public:
+  QuantizedBVH() = default;
+  // Leaves must hold less than 2^16 primitives
+  explicit QuantizedBVH(const WideBVH<4>& bvh);
+
+  const std::vector<QuantizedBVHNode>& GetNodes() const;
+};
+
+}  // namespace render_data
@@ -0,0 +1,202 @@
+#include "render_data/quantized_mesh.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "utill/error_handling.h"
+#include "utill/thread_pool.h"
+
+namespace render_data {
+
+const static uint32_t kMaxPosition = 0xffff;
+const static float kMaxSnorm = 32767.0f;
+const static size_t kEncodeGrain = 1 << 16;
+
+static glm::vec2 SignNotZero(glm::vec2 v) {
+  return glm::vec2(v.x >= 0 ? 1.0f : -1.0f, v.y >= 0 ? 1.0f : -1.0f);
+}
+
+// raytrace.hlsl decodes the same way
+static glm::vec3 DecodeOctahedral(glm::ivec2 q) {
+  glm::vec2 e = glm::max(glm::vec2(q) / kMaxSnorm, glm::vec2(-1.0f));
+  glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+  float t = std::max(-n.z, 0.0f);
+  n.x += n.x >= 0 ? -t : t;
+  n.y += n.y >= 0 ? -t : t;
+  return glm::normalize(n);
+}
+
+static uint32_t PackSnorm(glm::ivec2 q) {
+  return (uint32_t(q.x) & 0xffff) | (uint32_t(q.y) << 16);
+}
+
+static glm::ivec2 UnpackSnorm(uint32_t packed) {
+  return glm::ivec2(int16_t(packed & 0xffff), int16_t(packed >> 16));
+}
+
+// Rounded encoding may be off by one step in either axis from the closest
+// decodable direction, so all floor / ceil combinations are checked
+static uint32_t EncodeOctahedral(glm::vec3 n) {
+  float norm = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+  if (norm == 0) {
+    return PackSnorm(glm::ivec2(0));
+  }
+  n /= norm;
+  glm::vec2 e(n.x, n.y);
+  if (n.z < 0) {
+    e = (1.0f - glm::abs(glm::vec2(e.y, e.x))) * SignNotZero(e);
+  }
+  e = glm::clamp(e, -1.0f, 1.0f) * kMaxSnorm;
+  glm::vec3 dir = glm::normalize(n);
+  glm::ivec2 best(0);
+  float best_cos = -2;
+  for (int i = 0; i < 4; i++) {
+    glm::ivec2 q((i & 1) ? std::ceil(e.x) : std::floor(e.x),
+                 (i & 2) ? std::ceil(e.y) : std::floor(e.y));
+    float cos = glm::dot(DecodeOctahedral(q), dir);
+    if (cos > best_cos) {
+      best_cos = cos;
+      best = q;
+    }
+  }
+  return PackSnorm(best);
+}
+
+// acos loses precision for the small angles being measured
+static float GetAngleDegrees(glm::vec3 a, glm::vec3 b) {
+  return glm::degrees(
+      std::atan2(glm::length(glm::cross(a, b)), glm::dot(a, b)));
+}
+
+QuantizedMesh::QuantizedMesh(std::span<const glm::vec4> position,
+                             std::span<const glm::vec4> normal,
+                             std::span<const glm::vec2> tex_coord) {
+  glm::vec3 min(0);
+  glm::vec3 max(0);
+  if (!position.empty()) {
+    min = max = glm::vec3(position[0]);
+  }
+  for (const glm::vec4& pos : position) {
+    min = glm::min(min, glm::vec3(pos));
+    max = glm::max(max, glm::vec3(pos));
+  }
+  quantization_.origin = glm::vec4(min, 0);
+  quantization_.step = glm::vec4((max - min) / float(kMaxPosition), 0);
+
+  position_.resize(position.size());
+  normal_.resize(normal.size());
+  tex_coord_.resize(tex_coord.size());
+  glm::vec3 inv_step(0);
+  for (uint32_t axis = 0; axis < 3; axis++) {
+    if (quantization_.step[axis] > 0) {
+      inv_step[axis] = 1.0f / quantization_.step[axis];
+    }
+  }
+  utill::ParallelFor(0, position.size(), kEncodeGrain,
+                     [&](size_t begin, size_t end) {
+                       for (size_t i = begin; i < end; i++) {
+                         glm::vec3 offset = glm::vec3(position[i]) - min;
+                         glm::uvec3 q(glm::clamp(
+                             glm::round(offset * inv_step), 0.0f,
+                             float(kMaxPosition)));
+                         position_[i] = glm::uvec2(q.x | (q.y << 16), q.z);
+                       }
+                     });
+  utill::ParallelFor(0, normal.size(), kEncodeGrain,
+                     [&](size_t begin, size_t end) {
+                       for (size_t i = begin; i < end; i++) {
+                         normal_[i] = EncodeOctahedral(glm::vec3(normal[i]));
+                       }
+                     });
+  for (size_t i = 0; i < tex_coord.size(); i++) {
+    tex_coord_[i] = glm::packHalf2x16(tex_coord[i]);
+  }
+}
+
+QuantizedMesh::QuantizedMesh(const Mesh& mesh)
+    : QuantizedMesh(mesh.position, mesh.normal, mesh.tex_coord) {}
+
+const VertexQuantization& QuantizedMesh::GetQuantization() const {
+  return quantization_;
+}
+
+const std::vector<glm::uvec2>& QuantizedMesh::GetPosition() const {
+  return position_;
+}
+
+const std::vector<uint32_t>& QuantizedMesh::GetNormal() const {
+  return normal_;
+}
+
+const std::vector<uint32_t>& QuantizedMesh::GetTexCoord() const {
+  return tex_coord_;
+}
+
+glm::vec3 QuantizedMesh::DecodePosition(uint32_t ind) const {
+  DCHECK(ind < position_.size()) << "Index out of range";
+  glm::uvec2 packed = position_[ind];
+  glm::uvec3 q(packed.x & 0xffff, packed.x >> 16, packed.y & 0xffff);
+  return glm::vec3(quantization_.origin) +
+         glm::vec3(q) * glm::vec3(quantization_.step);
+}
+
+glm::vec3 QuantizedMesh::DecodeNormal(uint32_t ind) const {
+  DCHECK(ind < normal_.size()) << "Index out of range";
+  return DecodeOctahedral(UnpackSnorm(normal_[ind]));
+}
+
+glm::vec2 QuantizedMesh::DecodeTexCoord(uint32_t ind) const {
+  DCHECK(ind < tex_coord_.size()) << "Index out of range";
+  return glm::unpackHalf2x16(tex_coord_[ind]);
+}
+
+QuantizationError QuantizedMesh::CalcError(
+    std::span<const glm::vec4> position,
+    std::span<const glm::vec4> normal,
+    std::span<const glm::vec2> tex_coord) const {
+  DCHECK(position.size() == position_.size() &&
+         normal.size() == normal_.size() &&
+         tex_coord.size() == tex_coord_.size())
+      << "Attributes don't match quantized mesh";
+  QuantizationError res;
+  double position_sum = 0;
+  for (uint32_t i = 0; i < position.size(); i++) {
+    float error = glm::length(DecodePosition(i) - glm::vec3(position[i]));
+    res.max_position = std::max(res.max_position, error);
+    position_sum += error;
+  }
+  double normal_sum = 0;
+  uint32_t normal_count = 0;
+  for (uint32_t i = 0; i < normal.size(); i++) {
+    glm::vec3 n(normal[i]);
+    if (glm::length(n) == 0) {
+      continue;
+    }
+    float error = GetAngleDegrees(DecodeNormal(i), glm::normalize(n));
+    res.max_normal = std::max(res.max_normal, error);
+    normal_sum += error;
+    ++normal_count;
+  }
+  double tex_coord_sum = 0;
+  for (uint32_t i = 0; i < tex_coord.size(); i++) {
+    float error = glm::length(DecodeTexCoord(i) - tex_coord[i]);
+    res.max_tex_coord = std::max(res.max_tex_coord, error);
+    tex_coord_sum += error;
+  }
+  if (!position.empty()) {
+    res.mean_position = position_sum / position.size();
+  }
+  if (normal_count > 0) {
+    res.mean_normal = normal_sum / normal_count;
+  }
+  if (!tex_coord.empty()) {
+    res.mean_tex_coord = tex_coord_sum / tex_coord.size();
+  }
+  return res;
+}
+
+QuantizationError QuantizedMesh::CalcError(const Mesh& mesh) const {
+  return CalcError(mesh.position, mesh.normal, mesh.tex_coord);
+}
+
+}  // namespace render_data
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "render_data/mesh.h"
+
+namespace render_data {
+
+// Position decode parameters of a QuantizedMesh, raytrace.hlsl gets them as
+// push constants: position = origin + float3(q) * step
+struct VertexQuantization {
+  glm::vec4 origin = glm::vec4(0);
+  glm::vec4 step = glm::vec4(0);
+};
+
+static_assert(sizeof(VertexQuantization) == 32,
+              "Must match VertexQuantization in raytrace.hlsl");
+
+// Difference between decoded QuantizedMesh attributes and their fp32 source
+struct QuantizationError {
+  // in mesh units
+  float max_position = 0;
+  float mean_position = 0;
+  // angle in degrees, zero length source normals are skipped
+  float max_normal = 0;
+  float mean_normal = 0;
+  float max_tex_coord = 0;
+  float mean_tex_coord = 0;
+};
+
+/*
+ * Vertex attributes of a Mesh in 16 bytes per vertex instead of 40.
+ * Positions are 16 bit fixed point relative to the mesh bounds, two
+ * uint32_t per vertex with z in the low half of the second one. Normals
+ * are octahedral encoded as two 16 bit snorm values in one uint32_t.
+ * Texture coordinates are two half floats in one uint32_t. Low halves hold
+ * the first component everywhere. Mesh::index stays valid as is.
+ */
+class QuantizedMesh {
+  VertexQuantization quantization_;
+  std::vector<glm::uvec2> position_;
+  std::vector<uint32_t> normal_;
+  std::vector<uint32_t> tex_coord_;
+
+ public:
+  QuantizedMesh() = default;
+  QuantizedMesh(std::span<const glm::vec4> position,
+                std::span<const glm::vec4> normal,
+                std::span<const glm::vec2> tex_coord);
+  explicit QuantizedMesh(const Mesh& mesh);
+
+  const VertexQuantization& GetQuantization() const;
+  const std::vector<glm::uvec2>& GetPosition() const;
+  const std::vector<uint32_t>& GetNormal() const;
+  const std::vector<uint32_t>& GetTexCoord() const;
+
+  // Same decoding as raytrace.hlsl
+  glm::vec3 DecodePosition(uint32_t ind) const;
+  glm::vec3 DecodeNormal(uint32_t ind) const;
+  glm::vec2 DecodeTexCoord(uint32_t ind) const;
+
+  // Attributes must be the ones this mesh was built from
+  QuantizationError CalcError(std::span<const glm::vec4> position,
+                              std::span<const glm::vec4> normal,
+                              std::span<const glm::vec2> tex_coord) const;
+  QuantizationError CalcError(const Mesh& mesh) const;
+};
+
+}  // namespace render_data
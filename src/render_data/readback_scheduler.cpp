@@ -0,0 +1,289 @@
+#include "render_data/readback_scheduler.h"
+
+#include <algorithm>
+#include <memory>
+
+#include "base/base.h"
+#include "gpu_resources/physical_buffer.h"
+#include "gpu_resources/physical_image.h"
+#include "utill/error_handling.h"
+
+namespace render_data {
+
+// safe bufferOffset alignment for any image format
+const static vk::DeviceSize kReadbackDataAlignment = 16;
+
+static vk::DeviceSize AlignUp(vk::DeviceSize val, vk::DeviceSize alignment) {
+  return (val + alignment - 1) / alignment * alignment;
+}
+
+// Callback fulfilling the returned future with a copy of the read data
+static ReadbackCallback MakeFutureCallback(
+    std::future<std::vector<char>>& future) {
+  // std::function must be copyable, std::promise is not
+  auto promise = std::make_shared<std::promise<std::vector<char>>>();
+  future = promise->get_future();
+  return [promise](std::span<const char> data) {
+    promise->set_value(std::vector<char>(data.begin(), data.end()));
+  };
+}
+
+ReadbackScheduler::ReadbackScheduler(
+    gpu_resources::Buffer* staging_buffer,
+    const gpu_executer::TimelineSemaphore* frame_semaphore,
+    const std::vector<gpu_resources::Buffer*>& src_buffers,
+    const std::vector<gpu_resources::Image*>& src_images,
+    ReadbackSchedulerConfig config)
+    : Pass(0),
+      staging_buffer_(staging_buffer),
+      staging_ring_(staging_buffer,
+                    config.staging_size,
+                    vk::BufferUsageFlagBits::eTransferDst),
+      frame_semaphore_(frame_semaphore),
+      config_(config),
+      requests_(config.queue_max_size) {
+  DCHECK(frame_semaphore_) << "Frame semaphore must not be nullptr";
+  DCHECK(config_.frame_budget > 0) << "Readback budget must be > 0";
+  DCHECK(config_.frame_budget <= config_.staging_size)
+      << "Frame budget must fit the staging ring";
+
+  // uncached host reads are many times slower
+  gpu_resources::BufferProperties required_staging_properties{};
+  required_staging_properties.preferred_memory_flags =
+      vk::MemoryPropertyFlagBits::eHostCached;
+  staging_buffer_->RequireProperties(required_staging_properties);
+
+  gpu_resources::BufferProperties required_src_buffer_properties{};
+  required_src_buffer_properties.usage_flags =
+      vk::BufferUsageFlagBits::eTransferSrc;
+  for (gpu_resources::Buffer* buffer : src_buffers) {
+    buffer->RequireProperties(required_src_buffer_properties);
+  }
+
+  gpu_resources::ImageProperties required_src_image_properties{};
+  required_src_image_properties.usage_flags =
+      vk::ImageUsageFlagBits::eTransferSrc;
+  for (gpu_resources::Image* image : src_images) {
+    image->RequireProperties(required_src_image_properties);
+  }
+}
+
+bool ReadbackScheduler::ScheduleBufferReadback(
+    gpu_resources::Buffer* src,
+    std::vector<vk::BufferCopy2KHR> copy_regions,
+    ReadbackCallback callback) {
+  DCHECK(src) << "Readback source must not be nullptr";
+  DCHECK(callback) << "Readback callback must not be empty";
+  vk::DeviceSize data_size = 0;
+  for (const auto& region : copy_regions) {
+    data_size = std::max(data_size, region.dstOffset + region.size);
+  }
+  DCHECK(data_size > 0) << "Size of data to read back must be > 0";
+  if (requests_.IsFull() ||
+      AlignUp(data_size, kReadbackDataAlignment) > config_.frame_budget) {
+    return false;
+  }
+  ReadbackRequest request;
+  request.src_buffer = src;
+  request.buffer_regions = std::move(copy_regions);
+  request.data_size = data_size;
+  request.callback = std::move(callback);
+  requests_.PushBack(std::move(request));
+  return true;
+}
+
+bool ReadbackScheduler::ScheduleBufferReadback(gpu_resources::Buffer* src,
+                                               vk::DeviceSize size,
+                                               vk::DeviceSize src_offset,
+                                               ReadbackCallback callback) {
+  return ScheduleBufferReadback(src, {vk::BufferCopy2KHR(src_offset, 0, size)},
+                                std::move(callback));
+}
+
+std::future<std::vector<char>> ReadbackScheduler::ScheduleBufferReadback(
+    gpu_resources::Buffer* src,
+    vk::DeviceSize size,
+    vk::DeviceSize src_offset) {
+  std::future<std::vector<char>> res;
+  if (!ScheduleBufferReadback(src, size, src_offset,
+                              MakeFutureCallback(res))) {
+    return {};
+  }
+  return res;
+}
+
+bool ReadbackScheduler::ScheduleImageReadback(
+    gpu_resources::Image* src,
+    vk::DeviceSize data_size,
+    std::vector<vk::BufferImageCopy2KHR> copy_regions,
+    ReadbackCallback callback) {
+  DCHECK(src) << "Readback source must not be nullptr";
+  DCHECK(callback) << "Readback callback must not be empty";
+  DCHECK(data_size > 0) << "Size of data to read back must be > 0";
+  if (requests_.IsFull() ||
+      AlignUp(data_size, kReadbackDataAlignment) > config_.frame_budget) {
+    return false;
+  }
+  ReadbackRequest request;
+  request.src_image = src;
+  request.image_regions = std::move(copy_regions);
+  request.data_size = data_size;
+  request.callback = std::move(callback);
+  requests_.PushBack(std::move(request));
+  return true;
+}
+
+std::future<std::vector<char>> ReadbackScheduler::ScheduleImageReadback(
+    gpu_resources::Image* src,
+    vk::DeviceSize data_size,
+    std::vector<vk::BufferImageCopy2KHR> copy_regions) {
+  std::future<std::vector<char>> res;
+  if (!ScheduleImageReadback(src, data_size, std::move(copy_regions),
+                             MakeFutureCallback(res))) {
+    return {};
+  }
+  return res;
+}
+
+bool ReadbackScheduler::IsIdle() const {
+  return requests_.IsEmpty() && frame_requests_.empty() &&
+         in_flight_requests_.empty();
+}
+
+// Frame staging is one ring range, every request in it starts aligned
+void ReadbackScheduler::TakeFrameRequests() {
+  vk::DeviceSize staging_left =
+      std::min(config_.frame_budget,
+               staging_ring_.GetAvailableSize(kReadbackDataAlignment));
+  vk::DeviceSize staging_offset = 0;
+  while (!requests_.IsEmpty()) {
+    vk::DeviceSize staged_size =
+        AlignUp(requests_.GetFront().data_size, kReadbackDataAlignment);
+    if (staged_size > staging_left) {
+      break;
+    }
+    staging_left -= staged_size;
+    frame_requests_.push_back(requests_.PopFront());
+    frame_requests_.back().staging_offset = staging_offset;
+    staging_offset += staged_size;
+  }
+  gpu_resources::StagingRange frame_staging;
+  if (staging_offset > 0) {
+    // fits the available size, so never blocks
+    frame_staging =
+        staging_ring_.Allocate(staging_offset, kReadbackDataAlignment);
+  }
+  uint64_t frame = frame_semaphore_->GetSignalValue() + 1;
+  for (auto& request : frame_requests_) {
+    request.staging_offset += frame_staging.offset;
+    request.frame = frame;
+  }
+}
+
+// Runs after the ring reclaimed ranges for this frame, so requests in
+// reclaimed ranges are delivered before the frame overwrites them
+void ReadbackScheduler::DeliverCompleteRequests() {
+  uint64_t completed_frame = frame_semaphore_->GetCompletedValue();
+  auto complete_end = std::find_if(
+      in_flight_requests_.begin(), in_flight_requests_.end(),
+      [completed_frame](const ReadbackRequest& request) {
+        return request.frame > completed_frame;
+      });
+  if (complete_end == in_flight_requests_.begin()) {
+    return;
+  }
+  gpu_resources::PhysicalBuffer* staging = staging_buffer_->GetBuffer();
+  if (!(staging->GetMemoryFlags() &
+        vk::MemoryPropertyFlagBits::eHostCoherent)) {
+    auto device = base::Base::Get().GetContext().GetDevice();
+    device.invalidateMappedMemoryRanges(staging->GetMappedMemoryRange());
+  }
+  const char* mapping_start =
+      static_cast<const char*>(staging->GetMappingStart());
+  for (auto it = in_flight_requests_.begin(); it != complete_end; ++it) {
+    it->callback(std::span<const char>(mapping_start + it->staging_offset,
+                                       it->data_size));
+  }
+  in_flight_requests_.erase(in_flight_requests_.begin(), complete_end);
+}
+
+void ReadbackScheduler::OnPreRecord() {
+  TakeFrameRequests();
+  // everything allocated so far is written by the frame about to be
+  // submitted
+  staging_ring_.Retire(frame_semaphore_->GetSemaphore(),
+                       frame_semaphore_->GetSignalValue() + 1);
+  DeliverCompleteRequests();
+  if (frame_requests_.empty()) {
+    return;
+  }
+
+  vk::PipelineStageFlags2KHR pass_stage =
+      vk::PipelineStageFlagBits2KHR::eTransfer;
+  gpu_resources::ResourceAccess transfer_dst_access{};
+  transfer_dst_access.access_flags = vk::AccessFlagBits2KHR::eTransferWrite;
+  transfer_dst_access.stage_flags = pass_stage;
+  staging_buffer_->DeclareAccess(transfer_dst_access, GetPassIdx());
+
+  gpu_resources::ResourceAccess transfer_src_access{};
+  transfer_src_access.access_flags = vk::AccessFlagBits2KHR::eTransferRead;
+  transfer_src_access.stage_flags = pass_stage;
+  std::vector<gpu_resources::Buffer*> src_buffers;
+  std::vector<gpu_resources::Image*> src_images;
+  for (const auto& request : frame_requests_) {
+    if (request.src_buffer &&
+        std::find(src_buffers.begin(), src_buffers.end(),
+                  request.src_buffer) == src_buffers.end()) {
+      src_buffers.push_back(request.src_buffer);
+      request.src_buffer->DeclareAccess(transfer_src_access, GetPassIdx());
+    }
+    if (request.src_image &&
+        std::find(src_images.begin(), src_images.end(), request.src_image) ==
+            src_images.end()) {
+      src_images.push_back(request.src_image);
+    }
+  }
+  transfer_src_access.layout = vk::ImageLayout::eTransferSrcOptimal;
+  for (gpu_resources::Image* image : src_images) {
+    image->DeclareAccess(transfer_src_access, GetPassIdx());
+  }
+}
+
+void ReadbackScheduler::OnRecord(
+    vk::CommandBuffer primary_cmd,
+    const std::vector<vk::CommandBuffer>&) noexcept {
+  if (frame_requests_.empty()) {
+    return;
+  }
+  for (auto& request : frame_requests_) {
+    if (request.src_buffer) {
+      std::vector<vk::BufferCopy2KHR> copy_regions = request.buffer_regions;
+      for (auto& region : copy_regions) {
+        region.dstOffset += request.staging_offset;
+      }
+      gpu_resources::Buffer::RecordCopy(primary_cmd, *request.src_buffer,
+                                        *staging_buffer_, copy_regions);
+    } else {
+      std::vector<vk::BufferImageCopy2KHR> copy_regions =
+          request.image_regions;
+      for (auto& region : copy_regions) {
+        region.bufferOffset += request.staging_offset;
+      }
+      gpu_resources::PhysicalImage::RecordCopy(
+          primary_cmd, *request.src_image->GetImage(),
+          staging_buffer_->GetVkBuffer(), copy_regions);
+    }
+    in_flight_requests_.push_back(std::move(request));
+  }
+  frame_requests_.clear();
+
+  // the frame semaphore alone doesn't make device writes visible to the host
+  vk::MemoryBarrier2KHR host_read_barrier(
+      vk::PipelineStageFlagBits2KHR::eTransfer,
+      vk::AccessFlagBits2KHR::eTransferWrite,
+      vk::PipelineStageFlagBits2KHR::eHost, vk::AccessFlagBits2KHR::eHostRead);
+  primary_cmd.pipelineBarrier2KHR(
+      vk::DependencyInfoKHR({}, host_read_barrier, {}, {}));
+}
+
+}  // namespace render_data
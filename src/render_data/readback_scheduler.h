@@ -0,0 +1,117 @@
+#pragma once
+
+#include <functional>
+#include <future>
+#include <span>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "gpu_executer/timeline_semaphore.h"
+#include "gpu_resources/buffer.h"
+#include "gpu_resources/image.h"
+#include "gpu_resources/staging_ring.h"
+#include "render_graph/pass.h"
+#include "utill/ring_buffer.h"
+
+namespace render_data {
+
+struct ReadbackSchedulerConfig {
+  // max bytes read back in one frame
+  vk::DeviceSize frame_budget = 16 << 20;
+  // staging ring size, staging of a frame is reused once its data is
+  // delivered, so readbacks slow down when frames in flight fill the ring
+  vk::DeviceSize staging_size = 48 << 20;
+  // max queued requests
+  uint32_t queue_max_size = 256;
+};
+
+// Gets the read bytes, valid only during the call
+using ReadbackCallback = std::function<void(std::span<const char> data)>;
+
+/*
+ * Reads buffers and images of the render graph back to the host through a
+ * gpu_resources::StagingRing over 'staging_buffer'. Every frame requests are
+ * taken in schedule order while they fit config.frame_budget and the free
+ * part of the ring, the rest waits for later frames. Taken requests declare
+ * transfer reads on their sources, so they see writes of earlier passes of
+ * the frame, and are recorded as one copy per request.
+ *
+ * Nothing waits for the device: OnPreRecord of a later frame delivers
+ * requests whose frame 'frame_semaphore' reports complete, calling their
+ * callbacks on the render thread in schedule order. Requests still queued
+ * or in flight when the scheduler is destroyed are dropped.
+ */
+class ReadbackScheduler : public render_graph::Pass {
+  struct ReadbackRequest {
+    // one of them is set
+    gpu_resources::Buffer* src_buffer = nullptr;
+    gpu_resources::Image* src_image = nullptr;
+    // dstOffset / bufferOffset is relative to the read data
+    std::vector<vk::BufferCopy2KHR> buffer_regions;
+    std::vector<vk::BufferImageCopy2KHR> image_regions;
+    vk::DeviceSize data_size = 0;
+    ReadbackCallback callback;
+    // set once recorded
+    vk::DeviceSize staging_offset = 0;
+    uint64_t frame = 0;
+  };
+
+  gpu_resources::Buffer* staging_buffer_ = nullptr;
+  gpu_resources::StagingRing staging_ring_;
+  const gpu_executer::TimelineSemaphore* frame_semaphore_ = nullptr;
+  ReadbackSchedulerConfig config_;
+  utill::RingBuffer<ReadbackRequest> requests_;
+  // taken by OnPreRecord, recorded by OnRecord
+  std::vector<ReadbackRequest> frame_requests_;
+  // recorded, in frame order
+  std::vector<ReadbackRequest> in_flight_requests_;
+
+  void TakeFrameRequests();
+  void DeliverCompleteRequests();
+
+ public:
+  ReadbackScheduler() = default;
+  ReadbackScheduler(gpu_resources::Buffer* staging_buffer,
+                    const gpu_executer::TimelineSemaphore* frame_semaphore,
+                    const std::vector<gpu_resources::Buffer*>& src_buffers,
+                    const std::vector<gpu_resources::Image*>& src_images = {},
+                    ReadbackSchedulerConfig config = {});
+
+  // Reads 'copy_regions' of 'src', dstOffset is relative to the data passed
+  // to 'callback'. False if the queue is full or the regions, packed up to
+  // their end, exceed a frame budget.
+  bool ScheduleBufferReadback(gpu_resources::Buffer* src,
+                              std::vector<vk::BufferCopy2KHR> copy_regions,
+                              ReadbackCallback callback);
+  bool ScheduleBufferReadback(gpu_resources::Buffer* src,
+                              vk::DeviceSize size,
+                              vk::DeviceSize src_offset,
+                              ReadbackCallback callback);
+  // Same, an invalid future if it can't be scheduled
+  std::future<std::vector<char>> ScheduleBufferReadback(
+      gpu_resources::Buffer* src,
+      vk::DeviceSize size,
+      vk::DeviceSize src_offset = 0);
+
+  // bufferOffset of 'copy_regions' is relative to the 'data_size' bytes
+  // passed to 'callback'. False if the queue is full or 'data_size' exceeds
+  // a frame budget.
+  bool ScheduleImageReadback(gpu_resources::Image* src,
+                             vk::DeviceSize data_size,
+                             std::vector<vk::BufferImageCopy2KHR> copy_regions,
+                             ReadbackCallback callback);
+  std::future<std::vector<char>> ScheduleImageReadback(
+      gpu_resources::Image* src,
+      vk::DeviceSize data_size,
+      std::vector<vk::BufferImageCopy2KHR> copy_regions);
+
+  // No requests are queued or in flight, every callback was called
+  bool IsIdle() const;
+
+  void OnPreRecord() override;
+  void OnRecord(vk::CommandBuffer primary_cmd,
+                const std::vector<vk::CommandBuffer>&) noexcept override;
+};
+
+}  // namespace render_data
@@ -0,0 +1,239 @@
+#include "render_data/scene_cache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include "utill/error_handling.h"
+#include "utill/logger.h"
+
+namespace render_data {
+
+namespace {
+
+const uint32_t kCacheMagic = 0x43534c52;  // "RLSC"
+// bump on any change of the layout, of the cached types or of how the
+// cached mesh is prepared
+const uint32_t kCacheVersion = 3;
+const uint64_t kSectionAlignment = 4096;
+const uint32_t kSectionCount = uint32_t(SceneCacheSection::kCount);
+
+struct SectionRange {
+  uint64_t offset = 0;
+  uint64_t size = 0;
+};
+
+struct CacheHeader {
+  uint32_t magic = kCacheMagic;
+  uint32_t version = kCacheVersion;
+  uint64_t key = 0;
+  uint32_t is_compact_index_16bit = 0;
+  uint32_t padding = 0;
+  SectionRange section[kSectionCount];
+};
+
+// FNV-1a over 8 byte words
+class Hasher {
+  uint64_t hash_ = 0xcbf29ce484222325;
+
+ public:
+  void Add(const char* data, size_t size) {
+    const uint64_t kPrime = 0x100000001b3;
+    size_t word_end = size - size % sizeof(uint64_t);
+    for (size_t i = 0; i < word_end; i += sizeof(uint64_t)) {
+      uint64_t word;
+      memcpy(&word, data + i, sizeof(word));
+      hash_ = (hash_ ^ word) * kPrime;
+    }
+    for (size_t i = word_end; i < size; i++) {
+      hash_ = (hash_ ^ uint8_t(data[i])) * kPrime;
+    }
+  }
+  template <typename T>
+  void Add(const T& val) {
+    Add(reinterpret_cast<const char*>(&val), sizeof(val));
+  }
+  uint64_t Get() const { return hash_; }
+};
+
+template <typename T>
+std::span<const char> AsBytes(const std::vector<T>& data) {
+  return {reinterpret_cast<const char*>(data.data()), data.size() * sizeof(T)};
+}
+
+uint64_t AlignSection(uint64_t offset) {
+  return (offset + kSectionAlignment - 1) / kSectionAlignment *
+         kSectionAlignment;
+}
+
+}  // namespace
+
+uint64_t SceneCache::CalcKey(const std::string& source_path,
+                             const BVHBuildConfig& config) {
+  utill::MappedFile source(source_path);
+  if (!source.IsOpen()) {
+    return 0;
+  }
+  Hasher hasher;
+  hasher.Add(source.GetData(), source.GetSize());
+  // parallel_build doesn't change the result
+  hasher.Add(config.mode);
+  hasher.Add(config.max_depth);
+  hasher.Add(config.min_node_primitives);
+  hasher.Add(config.bin_count);
+  hasher.Add(config.spatial_split_budget);
+  return hasher.Get();
+}
+
+bool SceneCache::Write(const std::string& cache_path,
+                       uint64_t key,
+                       const Mesh& mesh,
+                       const CompactIndex& compact_index,
+                       const BVH& bvh) {
+  std::span<const char> data[kSectionCount] = {
+      AsBytes(mesh.position),
+      AsBytes(mesh.normal),
+      AsBytes(mesh.tex_coord),
+      AsBytes(mesh.index),
+      AsBytes(compact_index.data),
+      AsBytes(bvh.GetNodes()),
+      AsBytes(bvh.GetPrimitiveOrd()),
+  };
+  CacheHeader header;
+  header.key = key;
+  header.is_compact_index_16bit = compact_index.is_16bit;
+  uint64_t offset = AlignSection(sizeof(header));
+  for (uint32_t i = 0; i < kSectionCount; i++) {
+    header.section[i] = {offset, data[i].size()};
+    offset = AlignSection(offset + data[i].size());
+  }
+
+  // written under a temporary name, so that an interrupted write never
+  // leaves a cache that looks valid
+  std::string tmp_path = cache_path + ".tmp";
+  std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    LOG << "Failed to create scene cache: " << tmp_path;
+    return false;
+  }
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (uint32_t i = 0; i < kSectionCount; i++) {
+    out.seekp(header.section[i].offset);
+    out.write(data[i].data(), data[i].size());
+  }
+  // pad the last section, so that file size matches section ranges
+  out.seekp(offset - 1);
+  out.put(0);
+  out.close();
+  if (!out) {
+    LOG << "Failed to write scene cache: " << tmp_path;
+    return false;
+  }
+  std::error_code error;
+  std::filesystem::rename(tmp_path, cache_path, error);
+  if (error) {
+    LOG << "Failed to move scene cache to " << cache_path << ": "
+        << error.message();
+    return false;
+  }
+  return true;
+}
+
+bool SceneCache::Load(const std::string& cache_path, uint64_t key) {
+  file_ = utill::MappedFile(cache_path);
+  if (!file_.IsOpen()) {
+    return false;
+  }
+  CacheHeader header;
+  bool is_valid = file_.GetSize() >= sizeof(header);
+  if (is_valid) {
+    memcpy(&header, file_.GetData(), sizeof(header));
+    is_valid = header.magic == kCacheMagic &&
+               header.version == kCacheVersion && header.key == key;
+  }
+  for (uint32_t i = 0; i < kSectionCount && is_valid; i++) {
+    const SectionRange& range = header.section[i];
+    is_valid = range.offset % kSectionAlignment == 0 &&
+               range.offset <= file_.GetSize() &&
+               range.size <= file_.GetSize() - range.offset;
+  }
+  if (!is_valid) {
+    LOG << "Scene cache " << cache_path << " is outdated or corrupted";
+    file_ = utill::MappedFile();
+    return false;
+  }
+  return true;
+}
+
+bool SceneCache::IsLoaded() const {
+  return file_.IsOpen();
+}
+
+static const CacheHeader& GetHeader(const utill::MappedFile& file) {
+  DCHECK(file.IsOpen()) << "Scene cache is not loaded";
+  return *reinterpret_cast<const CacheHeader*>(file.GetData());
+}
+
+std::span<const char> SceneCache::GetSection(
+    SceneCacheSection section) const {
+  const SectionRange& range = GetHeader(file_).section[uint32_t(section)];
+  return {file_.GetData() + range.offset, range.size};
+}
+
+template <typename T>
+std::span<const T> SceneCache::GetTypedSection(
+    SceneCacheSection section) const {
+  std::span<const char> data = GetSection(section);
+  DCHECK(data.size() % sizeof(T) == 0) << "Unexpected section size";
+  return {reinterpret_cast<const T*>(data.data()), data.size() / sizeof(T)};
+}
+
+std::span<const glm::vec4> SceneCache::GetPosition() const {
+  return GetTypedSection<glm::vec4>(SceneCacheSection::kPosition);
+}
+
+std::span<const glm::vec4> SceneCache::GetNormal() const {
+  return GetTypedSection<glm::vec4>(SceneCacheSection::kNormal);
+}
+
+std::span<const glm::vec2> SceneCache::GetTexCoord() const {
+  return GetTypedSection<glm::vec2>(SceneCacheSection::kTexCoord);
+}
+
+std::span<const glm::uvec4> SceneCache::GetIndex() const {
+  return GetTypedSection<glm::uvec4>(SceneCacheSection::kIndex);
+}
+
+std::span<const uint32_t> SceneCache::GetCompactIndex() const {
+  return GetTypedSection<uint32_t>(SceneCacheSection::kCompactIndex);
+}
+
+bool SceneCache::IsCompactIndex16Bit() const {
+  return GetHeader(file_).is_compact_index_16bit != 0;
+}
+
+std::span<const BVHNode> SceneCache::GetBVHNodes() const {
+  return GetTypedSection<BVHNode>(SceneCacheSection::kBVHNodes);
+}
+
+std::span<const uint32_t> SceneCache::GetPrimitiveOrd() const {
+  return GetTypedSection<uint32_t>(SceneCacheSection::kPrimitiveOrd);
+}
+
+Mesh SceneCache::GetMesh() const {
+  Mesh mesh;
+  mesh.position.assign(GetPosition().begin(), GetPosition().end());
+  mesh.normal.assign(GetNormal().begin(), GetNormal().end());
+  mesh.tex_coord.assign(GetTexCoord().begin(), GetTexCoord().end());
+  mesh.index.assign(GetIndex().begin(), GetIndex().end());
+  return mesh;
+}
+
+BVH SceneCache::GetBVH(BVHBuildConfig config) const {
+  std::vector<BVHNode> nodes(GetBVHNodes().begin(), GetBVHNodes().end());
+  std::vector<uint32_t> primitive_ord(GetPrimitiveOrd().begin(),
+                                      GetPrimitiveOrd().end());
+  return BVH(std::move(nodes), std::move(primitive_ord), config);
+}
+
+}  // namespace render_data
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <span>
+#include <string>
+
+#include <glm/glm.hpp>
+
+#include "render_data/bvh.h"
+#include "render_data/mesh.h"
+#include "utill/mapped_file.h"
+
+namespace render_data {
+
+enum class SceneCacheSection {
+  kPosition,
+  kNormal,
+  kTexCoord,
+  kIndex,
+  kCompactIndex,
+  kBVHNodes,
+  kPrimitiveOrd,
+  kCount,
+};
+
+/*
+ * Binary cache of a mesh and its BVH built with a given BVHBuildConfig.
+ * Mesh is stored reordered by the BVH, welded and with vertices in first use
+ * order, together with its CompactIndex, i.e. ready for upload. File is a
+ * header followed by one section per SceneCacheSection, every section starts
+ * at a page aligned offset. Loading maps the file without parsing, sections
+ * can be copied to staging buffers straight from the mapping. Only the
+ * binary BVH and fp32 attributes are stored, other layouts and vertex
+ * formats are converted from owning copies.
+ */
+class SceneCache {
+  utill::MappedFile file_;
+
+  std::span<const char> GetSection(SceneCacheSection section) const;
+  template <typename T>
+  std::span<const T> GetTypedSection(SceneCacheSection section) const;
+
+ public:
+  // Hash of the source file contents and build parameters that affect the
+  // result. Returns 0 if source can't be read.
+  static uint64_t CalcKey(const std::string& source_path,
+                          const BVHBuildConfig& config);
+  // 'mesh' must be reordered with bvh.GetPrimitiveOrd(), welded and with
+  // reordered vertices, 'compact_index' is mesh.GetCompactIndex()
+  static bool Write(const std::string& cache_path,
+                    uint64_t key,
+                    const Mesh& mesh,
+                    const CompactIndex& compact_index,
+                    const BVH& bvh);
+
+  SceneCache() = default;
+  // Maps 'cache_path' if it is a valid cache with matching key and version
+  bool Load(const std::string& cache_path, uint64_t key);
+  bool IsLoaded() const;
+
+  std::span<const glm::vec4> GetPosition() const;
+  std::span<const glm::vec4> GetNormal() const;
+  std::span<const glm::vec2> GetTexCoord() const;
+  std::span<const glm::uvec4> GetIndex() const;
+  // CompactIndex::data, packed according to IsCompactIndex16Bit()
+  std::span<const uint32_t> GetCompactIndex() const;
+  bool IsCompactIndex16Bit() const;
+  std::span<const BVHNode> GetBVHNodes() const;
+  std::span<const uint32_t> GetPrimitiveOrd() const;
+
+  // Copies of the cached data, for code that needs owning containers
+  Mesh GetMesh() const;
+  BVH GetBVH(BVHBuildConfig config) const;
+};
+
+}  // namespace render_data
@@ -1,30 +1,27 @@
 #include "render_data/transfer_scheduler.h"
 
+#include <algorithm>
+#include <cstring>
+
+#include "base/base.h"
+#include "gpu_resources/physical_buffer.h"
+#include "gpu_resources/physical_image.h"
 #include "utill/error_handling.h"
 
 namespace render_data {
 
-namespace {
+// safe bufferOffset alignment for any image format
+const static vk::DeviceSize kImageDataAlignment = 16;
 
-void TransferRequest::FillStagingBuffer(gpu_resources::Buffer& staging_buffer,
-                                        vk::DeviceSize& dst_offset,
-                                        vk::DeviceSize src_offset,
-                                        vk::DeviceSize size) {
-  DCHECK(staging_buffer.GetSize() >= dst_offset + size)
-      << "Out of staging buffer memory";
-  staging_buffer.LoadDataFromPtr(data_.get() + src_offset, size, dst_offset);
-  dst_offset += size;
+static vk::DeviceSize AlignUp(vk::DeviceSize val, vk::DeviceSize alignment) {
+  return (val + alignment - 1) / alignment * alignment;
 }
 
-TransferRequest::TransferRequest(const std::string& dst_resource_name,
-                                 char* data,
-                                 vk::DeviceSize data_size,
-                                 uint32_t transaction_ind)
-    : dst_resource_name_(dst_resource_name), transaction_ind_(transaction_ind) {
+TransferRequest::TransferRequest(std::shared_ptr<const char[]> data,
+                                 vk::DeviceSize data_size)
+    : data_(std::move(data)), data_size_(data_size) {
+  DCHECK(data_) << "Transfer data must not be nullptr";
   DCHECK(data_size > 0) << "Size of data to transfer must be > 0";
-  DCHECK(data) << "Pointer to transfer data must not be nullptr";
-  data_ = std::make_unique<char[]>(data_size);
-  memcpy(data_.get(), data, data_size);
 }
 
 TransferRequest::TransferRequest(TransferRequest&& other) noexcept {
@@ -37,30 +34,70 @@ void TransferRequest::operator=(TransferRequest&& other) noexcept {
 }
 
 void TransferRequest::Swap(TransferRequest& other) noexcept {
-  dst_resource_name_.swap(other.dst_resource_name_);
   data_.swap(other.data_);
-  std::swap(transaction_ind_, other.transaction_ind_);
+  std::swap(data_size_, other.data_size_);
 }
 
-uint32_t TransferRequest::GetTransactionInd() const {
-  return transaction_ind_;
+const char* TransferRequest::GetData() const {
+  return data_.get();
 }
 
-const std::string& TransferRequest::GetDstResourceName() const {
-  return dst_resource_name_;
+vk::DeviceSize TransferRequest::GetDataSize() const {
+  return data_size_;
 }
 
-BufferTransferRequest::BufferTransferRequest(
-    const std::string& dst_buffer_name,
-    char* data,
-    vk::DeviceSize data_size,
-    std::vector<vk::BufferCopy2KHR> copy_regions,
-    uint32_t transaction_ind)
-    : TransferRequest(dst_buffer_name, data, data_size, transaction_ind),
-      copy_regions_(copy_regions) {
-  for (const auto& region : copy_regions_) {
-    total_size_ += region.size;
+static vk::DeviceSize CalcCopySize(
+    const std::vector<vk::BufferCopy2KHR>& copy_regions) {
+  vk::DeviceSize res = 0;
+  for (const auto& region : copy_regions) {
+    res += region.size;
+  }
+  return res;
+}
+
+// Region bytes packed one after another, srcOffset is rewritten to match
+static std::shared_ptr<const char[]> PackCopyRegions(
+    const char* data,
+    std::vector<vk::BufferCopy2KHR>& copy_regions) {
+  DCHECK(data) << "Pointer to transfer data must not be nullptr";
+  // not make_shared, it would zero the bytes before the copy
+  std::shared_ptr<char[]> res(new char[CalcCopySize(copy_regions)]);
+  vk::DeviceSize offset = 0;
+  for (auto& region : copy_regions) {
+    memcpy(res.get() + offset, data + region.srcOffset, region.size);
+    region.srcOffset = offset;
+    offset += region.size;
   }
+  return res;
+}
+
+static std::shared_ptr<const char[]> CopyData(const char* data,
+                                              vk::DeviceSize data_size) {
+  DCHECK(data) << "Pointer to transfer data must not be nullptr";
+  std::shared_ptr<char[]> res(new char[data_size]);
+  memcpy(res.get(), data, data_size);
+  return res;
+}
+
+BufferTransferRequest::BufferTransferRequest(
+    gpu_resources::Buffer* dst,
+    const char* data,
+    std::vector<vk::BufferCopy2KHR> copy_regions)
+    : dst_(dst), copy_regions_(std::move(copy_regions)) {
+  DCHECK(dst_) << "Transfer destination must not be nullptr";
+  data_ = PackCopyRegions(data, copy_regions_);
+  data_size_ = CalcCopySize(copy_regions_);
+  DCHECK(data_size_ > 0) << "Size of data to transfer must be > 0";
+}
+
+BufferTransferRequest::BufferTransferRequest(
+    gpu_resources::Buffer* dst,
+    std::shared_ptr<const char[]> data,
+    std::vector<vk::BufferCopy2KHR> copy_regions)
+    : TransferRequest(std::move(data), CalcCopySize(copy_regions)),
+      dst_(dst),
+      copy_regions_(std::move(copy_regions)) {
+  DCHECK(dst_) << "Transfer destination must not be nullptr";
 }
 
 BufferTransferRequest::BufferTransferRequest(
@@ -72,79 +109,547 @@ void BufferTransferRequest::operator=(BufferTransferRequest&& other) noexcept {
   BufferTransferRequest tmp(std::move(other));
   Swap(tmp);
 }
+
 void BufferTransferRequest::Swap(BufferTransferRequest& other) noexcept {
   TransferRequest::Swap(other);
+  std::swap(dst_, other.dst_);
   copy_regions_.swap(other.copy_regions_);
 }
 
-void BufferTransferRequest::RecordTransfer(
-    vk::CommandBuffer cmd,
-    gpu_resources::Buffer& dst_buffer,
-    gpu_resources::Buffer& staging_buffer,
-    vk::DeviceSize& staging_offset) {
-  for (auto& region : copy_regions_) {
-    vk::DeviceSize src_offset = staging_offset;
-    staging_buffer.LoadDataFromPtr(data_.get() + region.srcOffset, region.size,
-                                   staging_offset);
-    region.srcOffset = src_offset;
+gpu_resources::Buffer* BufferTransferRequest::GetDst() const {
+  return dst_;
+}
+
+const std::vector<vk::BufferCopy2KHR>& BufferTransferRequest::GetCopyRegions()
+    const {
+  return copy_regions_;
+}
+
+bool BufferTransferRequest::IsOverlapping(
+    const gpu_resources::Buffer* dst,
+    const vk::BufferCopy2KHR& other_region) const {
+  if (dst_ != dst) {
+    return false;
+  }
+  for (const auto& region : copy_regions_) {
+    if (region.dstOffset < other_region.dstOffset + other_region.size &&
+        other_region.dstOffset < region.dstOffset + region.size) {
+      return true;
+    }
   }
-  gpu_resources::Buffer::RecordCopy(cmd, staging_buffer, dst_buffer,
-                                    copy_regions_);
+  return false;
+}
+
+bool BufferTransferRequest::IsOverlapping(
+    const BufferTransferRequest& other) const {
+  for (const auto& other_region : other.copy_regions_) {
+    if (IsOverlapping(other.dst_, other_region)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+ImageTransferRequest::ImageTransferRequest(
+    gpu_resources::Image* dst,
+    const char* data,
+    vk::DeviceSize data_size,
+    std::vector<vk::BufferImageCopy2KHR> copy_regions)
+    : ImageTransferRequest(dst,
+                           CopyData(data, data_size),
+                           data_size,
+                           std::move(copy_regions)) {}
+
+ImageTransferRequest::ImageTransferRequest(
+    gpu_resources::Image* dst,
+    std::shared_ptr<const char[]> data,
+    vk::DeviceSize data_size,
+    std::vector<vk::BufferImageCopy2KHR> copy_regions)
+    : TransferRequest(std::move(data), data_size),
+      dst_(dst),
+      copy_regions_(std::move(copy_regions)) {
+  DCHECK(dst_) << "Transfer destination must not be nullptr";
 }
 
-}  // namespace
+ImageTransferRequest::ImageTransferRequest(
+    ImageTransferRequest&& other) noexcept {
+  Swap(other);
+}
+
+void ImageTransferRequest::operator=(ImageTransferRequest&& other) noexcept {
+  ImageTransferRequest tmp(std::move(other));
+  Swap(tmp);
+}
+
+void ImageTransferRequest::Swap(ImageTransferRequest& other) noexcept {
+  TransferRequest::Swap(other);
+  std::swap(dst_, other.dst_);
+  copy_regions_.swap(other.copy_regions_);
+}
+
+gpu_resources::Image* ImageTransferRequest::GetDst() const {
+  return dst_;
+}
+
+const std::vector<vk::BufferImageCopy2KHR>&
+ImageTransferRequest::GetCopyRegions() const {
+  return copy_regions_;
+}
+
+std::vector<std::vector<vk::BufferCopy2KHR>> SplitCopyRegions(
+    const std::vector<vk::BufferCopy2KHR>& copy_regions,
+    vk::DeviceSize max_size) {
+  DCHECK(max_size > 0) << "Size of a group must be > 0";
+  std::vector<std::vector<vk::BufferCopy2KHR>> res;
+  vk::DeviceSize group_size = max_size;
+  for (const auto& region : copy_regions) {
+    vk::DeviceSize region_offset = 0;
+    while (region_offset < region.size) {
+      if (group_size == max_size) {
+        res.emplace_back();
+        group_size = 0;
+      }
+      vk::DeviceSize size =
+          std::min(region.size - region_offset, max_size - group_size);
+      res.back().push_back(
+          vk::BufferCopy2KHR(region.srcOffset + region_offset,
+                             region.dstOffset + region_offset, size));
+      group_size += size;
+      region_offset += size;
+    }
+  }
+  return res;
+}
 
 TransferScheduler::TransferScheduler(
-    const std::string& staging_buffer_name,
-    const std::vector<std::string>& dst_buffers,
-    const std::vector<std::string>& dst_images,
-    uint32_t queue_max_size)
-    : buffer_requests_(queue_max_size),
-      image_requests_(queue_max_size),
-      staging_buffer_name_(staging_buffer_name) {
-  gpu_resources::ResourceAccess buffer_transfer_dst_usage{
-      vk::PipelineStageFlagBits2KHR::eTransfer,
-      vk::AccessFlagBits2KHR::eTransferWrite, vk::ImageLayout::eUndefined};
-  // for (const auto& buffer_name : dst_buffers) {
-  //   AddBuffer(buffer_name, render_graph::BufferPassBind(
-  //                              buffer_transfer_dst_usage,
-  //                              vk::BufferUsageFlagBits::eTransferDst));
-  // }
-
-  gpu_resources::ResourceAccess image_transfer_dst_usage =
-      buffer_transfer_dst_usage;
-  image_transfer_dst_usage.layout = vk::ImageLayout::eTransferDstOptimal;
-  // for (const auto& image_name : dst_images) {
-  //   AddImage(image_name,
-  //            render_graph::ImagePassBind(image_transfer_dst_usage,
-  //                                        vk::ImageUsageFlagBits::eTransferDst));
-  // }
-
-  gpu_resources::ResourceAccess staging_buffer_usage{
-      vk::PipelineStageFlagBits2KHR::eTransfer,
-      vk::AccessFlagBits2KHR::eTransferRead, vk::ImageLayout::eUndefined};
-  // AddBuffer(staging_buffer_name,
-  //           render_graph::BufferPassBind(
-  //               staging_buffer_usage,
-  //               vk::BufferUsageFlagBits::eTransferSrc));
-}
-
-void TransferScheduler::IncrementTransactionInd() {
-  ++transaction_ind_;
+    gpu_resources::Buffer* staging_buffer,
+    const gpu_executer::TimelineSemaphore* frame_semaphore,
+    const std::vector<gpu_resources::Buffer*>& dst_buffers,
+    const std::vector<gpu_resources::Image*>& dst_images,
+    TransferSchedulerConfig config)
+    : Pass(0),
+      staging_buffer_(staging_buffer),
+      staging_ring_(staging_buffer, config.staging_size),
+      frame_semaphore_(frame_semaphore),
+      config_(config),
+      buffer_requests_(config.queue_max_size),
+      image_requests_(config.queue_max_size) {
+  DCHECK(frame_semaphore_) << "Frame semaphore must not be nullptr";
+  DCHECK(config_.frame_budget > 0) << "Transfer budget must be > 0";
+  DCHECK(config_.frame_budget <= config_.staging_size)
+      << "Frame budget must fit the staging ring";
+
+  gpu_resources::BufferProperties required_dst_buffer_properties{};
+  required_dst_buffer_properties.usage_flags =
+      vk::BufferUsageFlagBits::eTransferDst;
+  if (config_.direct_write) {
+    required_dst_buffer_properties.preferred_memory_flags =
+        vk::MemoryPropertyFlagBits::eDeviceLocal |
+        vk::MemoryPropertyFlagBits::eHostVisible;
+  }
+  for (gpu_resources::Buffer* buffer : dst_buffers) {
+    buffer->RequireProperties(required_dst_buffer_properties);
+  }
+
+  gpu_resources::ImageProperties required_dst_image_properties{};
+  required_dst_image_properties.usage_flags =
+      vk::ImageUsageFlagBits::eTransferDst;
+  for (gpu_resources::Image* image : dst_images) {
+    image->RequireProperties(required_dst_image_properties);
+  }
 }
 
 bool TransferScheduler::ScheduleBufferTransfer(
-    const std::string& dst_buffer_name,
-    char* data,
-    vk::DeviceSize data_size,
+    gpu_resources::Buffer* dst,
+    const void* data,
     std::vector<vk::BufferCopy2KHR> copy_regions) {
-  if (buffer_requests_.IsFull()) {
+  std::vector<std::vector<vk::BufferCopy2KHR>> chunks =
+      SplitCopyRegions(copy_regions, config_.frame_budget);
+  if (buffer_requests_.GetCapacity() - buffer_requests_.GetSize() <
+      chunks.size()) {
+    return false;
+  }
+  for (auto& chunk : chunks) {
+    buffer_requests_.PushBack(BufferTransferRequest(
+        dst, static_cast<const char*>(data), std::move(chunk)));
+  }
+  return true;
+}
+
+bool TransferScheduler::ScheduleBufferTransfer(gpu_resources::Buffer* dst,
+                                               const void* data,
+                                               vk::DeviceSize data_size,
+                                               vk::DeviceSize dst_offset) {
+  return ScheduleBufferTransfer(
+      dst, data, {vk::BufferCopy2KHR(0, dst_offset, data_size)});
+}
+
+bool TransferScheduler::ScheduleBufferTransfer(
+    gpu_resources::Buffer* dst,
+    std::shared_ptr<const char[]> data,
+    std::vector<vk::BufferCopy2KHR> copy_regions) {
+  std::vector<std::vector<vk::BufferCopy2KHR>> chunks =
+      SplitCopyRegions(copy_regions, config_.frame_budget);
+  if (buffer_requests_.GetCapacity() - buffer_requests_.GetSize() <
+      chunks.size()) {
+    return false;
+  }
+  for (auto& chunk : chunks) {
+    buffer_requests_.PushBack(
+        BufferTransferRequest(dst, data, std::move(chunk)));
+  }
+  return true;
+}
+
+bool TransferScheduler::ScheduleBufferTransfer(
+    gpu_resources::Buffer* dst,
+    std::shared_ptr<const char[]> data,
+    vk::DeviceSize data_size,
+    vk::DeviceSize dst_offset) {
+  return ScheduleBufferTransfer(
+      dst, std::move(data), {vk::BufferCopy2KHR(0, dst_offset, data_size)});
+}
+
+std::span<char> TransferScheduler::ReserveBufferTransfer(
+    gpu_resources::Buffer* dst,
+    vk::DeviceSize size,
+    vk::DeviceSize dst_offset) {
+  DCHECK(dst) << "Transfer destination must not be nullptr";
+  vk::BufferCopy2KHR region(0, dst_offset, size);
+  if (reserved_size_ + size > config_.frame_budget) {
+    return {};
+  }
+  for (const auto& reserved : reserved_regions_) {
+    if (reserved.dst == dst &&
+        reserved.region.dstOffset < dst_offset + size &&
+        dst_offset < reserved.region.dstOffset + reserved.region.size) {
+      return {};
+    }
+  }
+  // queued requests would be taken after the reservation and overwrite it
+  for (size_t i = 0; i < buffer_requests_.GetSize(); i++) {
+    if (buffer_requests_[i].IsOverlapping(dst, region)) {
+      return {};
+    }
+  }
+
+  std::optional<gpu_resources::StagingRange> range =
+      staging_ring_.TryAllocate(size);
+  if (!range) {
+    return {};
+  }
+  region.srcOffset = range->offset;
+  reserved_size_ += size;
+  reserved_regions_.push_back({dst, region});
+  return range->data;
+}
+
+bool TransferScheduler::ScheduleImageTransfer(
+    gpu_resources::Image* dst,
+    const void* data,
+    vk::DeviceSize data_size,
+    std::vector<vk::BufferImageCopy2KHR> copy_regions) {
+  // image data is placed at an aligned offset of the frame slice
+  if (image_requests_.IsFull() ||
+      data_size + kImageDataAlignment > config_.frame_budget) {
+    return false;
+  }
+  image_requests_.PushBack(ImageTransferRequest(
+      dst, static_cast<const char*>(data), data_size, std::move(copy_regions)));
+  return true;
+}
+
+bool TransferScheduler::ScheduleImageTransfer(
+    gpu_resources::Image* dst,
+    std::shared_ptr<const char[]> data,
+    vk::DeviceSize data_size,
+    std::vector<vk::BufferImageCopy2KHR> copy_regions) {
+  if (image_requests_.IsFull() ||
+      data_size + kImageDataAlignment > config_.frame_budget) {
     return false;
   }
-  BufferTransferRequest request(dst_buffer_name, data, data_size, copy_regions,
-                                transaction_ind_);
-  buffer_requests_.PushBack(std::move(request));
+  image_requests_.PushBack(ImageTransferRequest(
+      dst, std::move(data), data_size, std::move(copy_regions)));
+  return true;
+}
+
+bool TransferScheduler::IsIdle() const {
+  return buffer_requests_.IsEmpty() && image_requests_.IsEmpty() &&
+         reserved_regions_.empty();
+}
+
+bool TransferScheduler::CanTakeBufferRequest(
+    const BufferTransferRequest& request) const {
+  for (const auto& taken : frame_buffer_requests_) {
+    if (taken.IsOverlapping(request)) {
+      return false;
+    }
+  }
+  for (const auto& taken : frame_direct_requests_) {
+    if (taken.IsOverlapping(request)) {
+      return false;
+    }
+  }
+  for (const auto& reserved : frame_reserved_regions_) {
+    if (request.IsOverlapping(reserved.dst, reserved.region)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TransferScheduler::CanTakeImageRequest(
+    const ImageTransferRequest& request) const {
+  for (const auto& taken : frame_image_requests_) {
+    if (taken.GetDst() == request.GetDst()) {
+      return false;
+    }
+  }
   return true;
 }
 
-}  // namespace render_data
\ No newline at end of file
+// Host writes before the submit are visible to the frame, but would race
+// with frames in flight that access 'dst'
+bool TransferScheduler::CanWriteDirectly(const gpu_resources::Buffer* dst,
+                                         uint64_t completed_frame) const {
+  // shaders reading host memory over the bus would be slower than a copy
+  return config_.direct_write &&
+         (dst->GetBuffer()->GetMemoryFlags() &
+          vk::MemoryPropertyFlagBits::eDeviceLocal) &&
+         dst->GetBuffer()->GetMappingStart() &&
+         dst->GetLastAccessFrame() <= completed_frame;
+}
+
+// Frame staging is one ring range, so staged requests must fit its free
+// part too, direct writes count against the frame budget only
+void TransferScheduler::TakeFrameRequests() {
+  vk::DeviceSize budget_left = config_.frame_budget - frame_reserved_size_;
+  vk::DeviceSize staging_size =
+      staging_ring_.GetAvailableSize(kImageDataAlignment);
+  vk::DeviceSize staging_left = staging_size;
+  uint64_t completed_frame = frame_semaphore_->GetCompletedValue();
+  while (!buffer_requests_.IsEmpty()) {
+    const BufferTransferRequest& request = buffer_requests_.GetFront();
+    bool is_direct = CanWriteDirectly(request.GetDst(), completed_frame);
+    vk::DeviceSize staged_size = is_direct ? 0 : request.GetDataSize();
+    if (request.GetDataSize() > budget_left || staged_size > staging_left ||
+        !CanTakeBufferRequest(request)) {
+      break;
+    }
+    budget_left -= request.GetDataSize();
+    staging_left -= staged_size;
+    if (is_direct) {
+      frame_direct_requests_.push_back(buffer_requests_.PopFront());
+    } else {
+      frame_buffer_requests_.push_back(buffer_requests_.PopFront());
+    }
+  }
+  while (!image_requests_.IsEmpty()) {
+    const ImageTransferRequest& request = image_requests_.GetFront();
+    vk::DeviceSize staged_size = request.GetDataSize() + kImageDataAlignment;
+    if (staged_size > budget_left || staged_size > staging_left ||
+        !CanTakeImageRequest(request)) {
+      break;
+    }
+    budget_left -= staged_size;
+    staging_left -= staged_size;
+    frame_image_requests_.push_back(image_requests_.PopFront());
+  }
+  frame_staging_ = {};
+  if (staging_left < staging_size) {
+    // fits the available size, so never blocks
+    frame_staging_ = staging_ring_.Allocate(staging_size - staging_left,
+                                            kImageDataAlignment);
+  }
+}
+
+void TransferScheduler::OnPreRecord() {
+  frame_reserved_regions_ = std::move(reserved_regions_);
+  reserved_regions_.clear();
+  frame_reserved_size_ = reserved_size_;
+  reserved_size_ = 0;
+  TakeFrameRequests();
+  // everything allocated so far is read by the frame about to be submitted
+  staging_ring_.Retire(frame_semaphore_->GetSemaphore(),
+                       frame_semaphore_->GetSignalValue() + 1);
+  if (frame_buffer_requests_.empty() && frame_image_requests_.empty() &&
+      frame_reserved_regions_.empty()) {
+    return;
+  }
+
+  vk::PipelineStageFlags2KHR pass_stage =
+      vk::PipelineStageFlagBits2KHR::eTransfer;
+  gpu_resources::ResourceAccess transfer_src_access{};
+  transfer_src_access.access_flags = vk::AccessFlagBits2KHR::eTransferRead;
+  transfer_src_access.stage_flags = pass_stage;
+  staging_buffer_->DeclareAccess(transfer_src_access, GetPassIdx());
+
+  gpu_resources::ResourceAccess transfer_dst_access{};
+  transfer_dst_access.access_flags = vk::AccessFlagBits2KHR::eTransferWrite;
+  transfer_dst_access.stage_flags = pass_stage;
+  for (gpu_resources::Buffer* dst : GetFrameDstBuffers()) {
+    dst->DeclareAccess(transfer_dst_access, GetPassIdx());
+  }
+  transfer_dst_access.layout = vk::ImageLayout::eTransferDstOptimal;
+  for (const auto& request : frame_image_requests_) {
+    request.GetDst()->DeclareAccess(transfer_dst_access, GetPassIdx());
+  }
+}
+
+std::vector<gpu_resources::Buffer*> TransferScheduler::GetFrameDstBuffers()
+    const {
+  std::vector<gpu_resources::Buffer*> res;
+  auto add_dst = [&res](gpu_resources::Buffer* dst) {
+    if (std::find(res.begin(), res.end(), dst) == res.end()) {
+      res.push_back(dst);
+    }
+  };
+  for (const auto& reserved : frame_reserved_regions_) {
+    add_dst(reserved.dst);
+  }
+  for (const auto& request : frame_buffer_requests_) {
+    add_dst(request.GetDst());
+  }
+  return res;
+}
+
+// Region data is written to staging in destination order, so regions
+// adjacent in the destination are adjacent in staging too and merge into one.
+// Reserved regions are already in staging and merge only if they happen to
+// be adjacent in both.
+void TransferScheduler::RecordBufferTransfers(vk::CommandBuffer cmd,
+                                              vk::DeviceSize& staging_offset) {
+  struct RegionSource {
+    // nullptr for reserved regions
+    const char* data;
+    vk::BufferCopy2KHR region;
+  };
+  std::vector<RegionSource> sources;
+  std::vector<vk::BufferCopy2KHR> copy_regions;
+  for (gpu_resources::Buffer* dst : GetFrameDstBuffers()) {
+    sources.clear();
+    for (const auto& reserved : frame_reserved_regions_) {
+      if (reserved.dst == dst) {
+        sources.push_back({nullptr, reserved.region});
+      }
+    }
+    for (const auto& request : frame_buffer_requests_) {
+      if (request.GetDst() != dst) {
+        continue;
+      }
+      for (const auto& region : request.GetCopyRegions()) {
+        sources.push_back({request.GetData(), region});
+      }
+    }
+    std::sort(sources.begin(), sources.end(),
+              [](const RegionSource& lhs, const RegionSource& rhs) {
+                return lhs.region.dstOffset < rhs.region.dstOffset;
+              });
+
+    copy_regions.clear();
+    for (const RegionSource& source : sources) {
+      vk::BufferCopy2KHR region = source.region;
+      if (source.data) {
+        staging_buffer_->LoadDataFromPtr(
+            (void*)(source.data + region.srcOffset), region.size,
+            staging_offset);
+        region.srcOffset = staging_offset;
+        staging_offset += region.size;
+      }
+      if (!copy_regions.empty() &&
+          copy_regions.back().dstOffset + copy_regions.back().size ==
+              region.dstOffset &&
+          copy_regions.back().srcOffset + copy_regions.back().size ==
+              region.srcOffset) {
+        copy_regions.back().size += region.size;
+      } else {
+        copy_regions.push_back(region);
+      }
+    }
+    gpu_resources::Buffer::RecordCopy(cmd, *staging_buffer_, *dst,
+                                      copy_regions);
+  }
+}
+
+void TransferScheduler::RecordImageTransfers(vk::CommandBuffer cmd,
+                                             vk::DeviceSize& staging_offset) {
+  for (const auto& request : frame_image_requests_) {
+    staging_offset = AlignUp(staging_offset, kImageDataAlignment);
+    staging_buffer_->LoadDataFromPtr((void*)request.GetData(),
+                                     request.GetDataSize(), staging_offset);
+    std::vector<vk::BufferImageCopy2KHR> copy_regions =
+        request.GetCopyRegions();
+    for (auto& region : copy_regions) {
+      region.bufferOffset += staging_offset;
+    }
+    staging_offset += request.GetDataSize();
+    vk::CopyBufferToImageInfo2KHR copy(
+        staging_buffer_->GetVkBuffer(),
+        request.GetDst()->GetImage()->GetImage(),
+        vk::ImageLayout::eTransferDstOptimal, copy_regions);
+    cmd.copyBufferToImage2KHR(copy);
+  }
+}
+
+void TransferScheduler::WriteDirectTransfers() {
+  std::vector<vk::MappedMemoryRange> flush_ranges;
+  for (const auto& request : frame_direct_requests_) {
+    gpu_resources::Buffer* dst = request.GetDst();
+    bool is_coherent = static_cast<bool>(
+        dst->GetBuffer()->GetMemoryFlags() &
+        vk::MemoryPropertyFlagBits::eHostCoherent);
+    for (const auto& region : request.GetCopyRegions()) {
+      dst->LoadDataFromPtr((void*)(request.GetData() + region.srcOffset),
+                           region.size, region.dstOffset);
+      if (!is_coherent) {
+        flush_ranges.push_back(dst->GetBuffer()->GetMappedMemoryRange(
+            region.dstOffset, region.size));
+      }
+    }
+  }
+  frame_direct_requests_.clear();
+  if (!flush_ranges.empty()) {
+    auto device = base::Base::Get().GetContext().GetDevice();
+    device.flushMappedMemoryRanges(flush_ranges);
+  }
+}
+
+void TransferScheduler::OnRecord(
+    vk::CommandBuffer primary_cmd,
+    const std::vector<vk::CommandBuffer>&) noexcept {
+  WriteDirectTransfers();
+  if (frame_buffer_requests_.empty() && frame_image_requests_.empty() &&
+      frame_reserved_regions_.empty()) {
+    return;
+  }
+  vk::DeviceSize staging_offset = frame_staging_.offset;
+  RecordBufferTransfers(primary_cmd, staging_offset);
+  RecordImageTransfers(primary_cmd, staging_offset);
+  DCHECK(staging_offset <= frame_staging_.offset + frame_staging_.data.size())
+      << "Frame transfers exceed their staging range";
+
+  // ring ranges never wrap, reservations got ranges of their own
+  gpu_resources::PhysicalBuffer* staging = staging_buffer_->GetBuffer();
+  if (!(staging->GetMemoryFlags() &
+        vk::MemoryPropertyFlagBits::eHostCoherent)) {
+    std::vector<vk::MappedMemoryRange> flush_ranges;
+    if (!frame_staging_.data.empty()) {
+      flush_ranges.push_back(staging->GetMappedMemoryRange(
+          frame_staging_.offset, frame_staging_.data.size()));
+    }
+    for (const auto& reserved : frame_reserved_regions_) {
+      flush_ranges.push_back(staging->GetMappedMemoryRange(
+          reserved.region.srcOffset, reserved.region.size));
+    }
+    if (!flush_ranges.empty()) {
+      auto device = base::Base::Get().GetContext().GetDevice();
+      device.flushMappedMemoryRanges(flush_ranges);
+    }
+  }
+  frame_buffer_requests_.clear();
+  frame_image_requests_.clear();
+  frame_reserved_regions_.clear();
+  frame_reserved_size_ = 0;
+}
+
+}  // namespace render_data
@@ -1,98 +1,238 @@
 #pragma once
 
 #include <memory>
-#include <string>
+#include <span>
 #include <vector>
 
 #include <vulkan/vulkan.hpp>
 
+#include "gpu_executer/timeline_semaphore.h"
+#include "gpu_resources/buffer.h"
+#include "gpu_resources/image.h"
+#include "gpu_resources/staging_ring.h"
 #include "render_graph/pass.h"
 #include "utill/ring_buffer.h"
 
 namespace render_data {
 
-namespace {
+struct TransferSchedulerConfig {
+  // max bytes uploaded in one frame
+  vk::DeviceSize frame_budget = 16 << 20;
+  // staging ring size, staging of a frame is reclaimed once it completes,
+  // so uploads slow down when frames in flight fill the ring
+  vk::DeviceSize staging_size = 48 << 20;
+  // max queued requests of each kind
+  uint32_t queue_max_size = 256;
+  // destination buffers prefer device local host visible memory, and
+  // uploads to it are written to the mapping instead of staging and a GPU
+  // copy
+  bool direct_write = true;
+};
+
+// Shares ownership of 'data' for the owning Schedule* overloads
+template <typename T>
+std::shared_ptr<const char[]> MakeTransferData(std::vector<T>&& data) {
+  auto owner = std::make_shared<std::vector<T>>(std::move(data));
+  return std::shared_ptr<const char[]>(
+      owner, reinterpret_cast<const char*>(owner->data()));
+}
 
+// Bytes to upload, either a copy of caller data or data the caller handed
+// over, shared by requests split from one upload
 class TransferRequest {
  protected:
-  std::string dst_resource_name_;
-  std::unique_ptr<char[]> data_;
-  uint32_t transaction_ind_;
-
-  void FillStagingBuffer(gpu_resources::Buffer& staging_buffer,
-                         vk::DeviceSize& dst_offset,
-                         vk::DeviceSize src_offset,
-                         vk::DeviceSize size);
+  std::shared_ptr<const char[]> data_;
+  // bytes copied to staging
+  vk::DeviceSize data_size_ = 0;
 
  public:
   TransferRequest() = default;
-  TransferRequest(const std::string& dst_resource_name,
-                  char* data,
-                  vk::DeviceSize data_size,
-                  uint32_t transaction_ind);
+  TransferRequest(std::shared_ptr<const char[]> data,
+                  vk::DeviceSize data_size);
 
   TransferRequest(TransferRequest&& other) noexcept;
   void operator=(TransferRequest&& other) noexcept;
   void Swap(TransferRequest& other) noexcept;
 
-  uint32_t GetTransactionInd() const;
-  const std::string& GetDstResourceName() const;
+  const char* GetData() const;
+  vk::DeviceSize GetDataSize() const;
 };
 
 class BufferTransferRequest : public TransferRequest {
+  gpu_resources::Buffer* dst_ = nullptr;
+  // srcOffset is relative to the request data
   std::vector<vk::BufferCopy2KHR> copy_regions_;
-  vk::DeviceSize total_size_;
 
  public:
   BufferTransferRequest() = default;
-  BufferTransferRequest(const std::string& dst_buffer_name,
-                        char* data,
-                        vk::DeviceSize data_size,
-                        std::vector<vk::BufferCopy2KHR> copy_regions,
-                        uint32_t transaction_ind);
+  // Packs a copy of 'copy_regions' bytes one after another, their srcOffset
+  // is relative to 'data'
+  BufferTransferRequest(gpu_resources::Buffer* dst,
+                        const char* data,
+                        std::vector<vk::BufferCopy2KHR> copy_regions);
+  // Keeps 'data' without copying, srcOffset stays relative to it
+  BufferTransferRequest(gpu_resources::Buffer* dst,
+                        std::shared_ptr<const char[]> data,
+                        std::vector<vk::BufferCopy2KHR> copy_regions);
 
   BufferTransferRequest(BufferTransferRequest&& other) noexcept;
   void operator=(BufferTransferRequest&& other) noexcept;
   void Swap(BufferTransferRequest& other) noexcept;
 
-  void RecordTransfer(vk::CommandBuffer cmd,
-                      gpu_resources::Buffer& dst_buffer,
-                      gpu_resources::Buffer& staging_buffer,
-                      vk::DeviceSize& staging_offset);
+  gpu_resources::Buffer* GetDst() const;
+  const std::vector<vk::BufferCopy2KHR>& GetCopyRegions() const;
+  // Whether both write to the same bytes of the same buffer
+  bool IsOverlapping(const gpu_resources::Buffer* dst,
+                     const vk::BufferCopy2KHR& region) const;
+  bool IsOverlapping(const BufferTransferRequest& other) const;
 };
 
-struct ImageTransferRequest {
-  std::string dst_image_name;
-  std::unique_ptr<char[]> data;
-  std::vector<vk::BufferImageCopy2KHR> copy_regions;
-  uint32_t transaction_ind;
-};
+class ImageTransferRequest : public TransferRequest {
+  gpu_resources::Image* dst_ = nullptr;
+  // bufferOffset is relative to the request data
+  std::vector<vk::BufferImageCopy2KHR> copy_regions_;
 
-}  // namespace
+ public:
+  ImageTransferRequest() = default;
+  ImageTransferRequest(gpu_resources::Image* dst,
+                       const char* data,
+                       vk::DeviceSize data_size,
+                       std::vector<vk::BufferImageCopy2KHR> copy_regions);
+  ImageTransferRequest(gpu_resources::Image* dst,
+                       std::shared_ptr<const char[]> data,
+                       vk::DeviceSize data_size,
+                       std::vector<vk::BufferImageCopy2KHR> copy_regions);
+
+  ImageTransferRequest(ImageTransferRequest&& other) noexcept;
+  void operator=(ImageTransferRequest&& other) noexcept;
+  void Swap(ImageTransferRequest& other) noexcept;
+
+  gpu_resources::Image* GetDst() const;
+  const std::vector<vk::BufferImageCopy2KHR>& GetCopyRegions() const;
+};
 
+// Splits 'copy_regions' into groups of at most 'max_size' bytes, cutting
+// regions that don't fit
+std::vector<std::vector<vk::BufferCopy2KHR>> SplitCopyRegions(
+    const std::vector<vk::BufferCopy2KHR>& copy_regions,
+    vk::DeviceSize max_size);
+
+/*
+ * Uploads queued data to buffers and images of the render graph through a
+ * gpu_resources::StagingRing over 'staging_buffer'. Every frame requests are
+ * taken in schedule order while they fit config.frame_budget and the free
+ * part of the ring, buffer requests first, the rest waits for later frames.
+ * Staging of a frame is reclaimed once 'frame_semaphore' of the render graph
+ * reports the frame complete. Copies of a frame are recorded as one
+ * copyBuffer2KHR per destination buffer with adjacent regions merged, and
+ * one copyBufferToImage2KHR per image request. A request writing bytes
+ * already written in the frame waits for the next one, so later requests
+ * win. Only destinations written this frame get transfer write accesses
+ * declared, so passes after it get their barriers generated.
+ *
+ * The copying Schedule* overloads copy bytes on the CPU twice: into the
+ * request, then into staging. The owning overloads copy them only into
+ * staging, ReserveBufferTransfer lets the caller write them there, so
+ * large or per-frame uploads should use one of those.
+ *
+ * With config.direct_write, a buffer request whose destination got device
+ * local host visible memory, with resizable BAR or unified memory, is
+ * written straight to its mapping by OnRecord, when no frame in flight
+ * accesses the destination. Only the written ranges are flushed. Other
+ * requests fall back to staging.
+ */
 class TransferScheduler : public render_graph::Pass {
+  struct ReservedRegion {
+    gpu_resources::Buffer* dst;
+    // srcOffset is in the staging buffer
+    vk::BufferCopy2KHR region;
+  };
+
+  gpu_resources::Buffer* staging_buffer_ = nullptr;
+  gpu_resources::StagingRing staging_ring_;
+  const gpu_executer::TimelineSemaphore* frame_semaphore_ = nullptr;
+  TransferSchedulerConfig config_;
   utill::RingBuffer<BufferTransferRequest> buffer_requests_;
   utill::RingBuffer<ImageTransferRequest> image_requests_;
-  std::string staging_buffer_name_;
-  uint32_t transaction_ind_ = 0;
+  // written by callers into ring ranges, recorded by the next frame
+  std::vector<ReservedRegion> reserved_regions_;
+  vk::DeviceSize reserved_size_ = 0;
+  // taken by OnPreRecord, recorded by OnRecord
+  std::vector<BufferTransferRequest> frame_buffer_requests_;
+  std::vector<ImageTransferRequest> frame_image_requests_;
+  std::vector<BufferTransferRequest> frame_direct_requests_;
+  std::vector<ReservedRegion> frame_reserved_regions_;
+  vk::DeviceSize frame_reserved_size_ = 0;
+  gpu_resources::StagingRange frame_staging_;
+
+  bool CanWriteDirectly(const gpu_resources::Buffer* dst,
+                        uint64_t completed_frame) const;
+  void TakeFrameRequests();
+  std::vector<gpu_resources::Buffer*> GetFrameDstBuffers() const;
+  bool CanTakeBufferRequest(const BufferTransferRequest& request) const;
+  bool CanTakeImageRequest(const ImageTransferRequest& request) const;
+  void RecordBufferTransfers(vk::CommandBuffer cmd,
+                             vk::DeviceSize& staging_offset);
+  void RecordImageTransfers(vk::CommandBuffer cmd,
+                            vk::DeviceSize& staging_offset);
+  void WriteDirectTransfers();
 
  public:
-  TransferScheduler(const std::string& staging_buffer_name,
-                    const std::vector<std::string>& dst_buffers = {},
-                    const std::vector<std::string>& dst_images = {},
-                    uint32_t queue_max_size = 128);
-
-  void IncrementTransactionInd();
-
-  bool ScheduleBufferTransfer(const std::string& dst_buffer_name,
-                              char* data,
+  TransferScheduler() = default;
+  TransferScheduler(gpu_resources::Buffer* staging_buffer,
+                    const gpu_executer::TimelineSemaphore* frame_semaphore,
+                    const std::vector<gpu_resources::Buffer*>& dst_buffers,
+                    const std::vector<gpu_resources::Image*>& dst_images = {},
+                    TransferSchedulerConfig config = {});
+
+  // Copies data of 'copy_regions', srcOffset relative to 'data'. Regions
+  // are split into requests of at most a frame budget. False if the queue
+  // has no room for all of them, nothing is scheduled then.
+  bool ScheduleBufferTransfer(gpu_resources::Buffer* dst,
+                              const void* data,
+                              std::vector<vk::BufferCopy2KHR> copy_regions);
+  bool ScheduleBufferTransfer(gpu_resources::Buffer* dst,
+                              const void* data,
                               vk::DeviceSize data_size,
+                              vk::DeviceSize dst_offset = 0);
+  // Take 'data' instead of copying it, it may be a std::unique_ptr with any
+  // deleter, see also MakeTransferData
+  bool ScheduleBufferTransfer(gpu_resources::Buffer* dst,
+                              std::shared_ptr<const char[]> data,
                               std::vector<vk::BufferCopy2KHR> copy_regions);
-
-  bool ScheduleImageTransfer(const std::string& dst_image_name,
-                             char* data,
-                             vk::DeviceSize data_size,
-                             std::vector<vk::BufferImageCopy2KHR> copy_regions);
+  bool ScheduleBufferTransfer(gpu_resources::Buffer* dst,
+                              std::shared_ptr<const char[]> data,
+                              vk::DeviceSize data_size,
+                              vk::DeviceSize dst_offset = 0);
+
+  // Staging memory for 'size' bytes that the next frame copies to
+  // 'dst_offset' of 'dst', for data produced in place. Must be written
+  // before the next frame is recorded. Empty if the next frame budget or the
+  // staging ring can't fit it, or it overlaps queued or reserved writes.
+  std::span<char> ReserveBufferTransfer(gpu_resources::Buffer* dst,
+                                        vk::DeviceSize size,
+                                        vk::DeviceSize dst_offset = 0);
+
+  // bufferOffset of 'copy_regions' is relative to 'data'. False if the
+  // queue is full or 'data_size' exceeds a frame budget.
+  bool ScheduleImageTransfer(
+      gpu_resources::Image* dst,
+      const void* data,
+      vk::DeviceSize data_size,
+      std::vector<vk::BufferImageCopy2KHR> copy_regions);
+  bool ScheduleImageTransfer(
+      gpu_resources::Image* dst,
+      std::shared_ptr<const char[]> data,
+      vk::DeviceSize data_size,
+      std::vector<vk::BufferImageCopy2KHR> copy_regions);
+
+  // No requests are queued, everything scheduled is recorded by the
+  // current frame or earlier ones
+  bool IsIdle() const;
+
+  void OnPreRecord() override;
+  void OnRecord(vk::CommandBuffer primary_cmd,
+                const std::vector<vk::CommandBuffer>&) noexcept override;
 };
 
 }  // namespace render_data
@@ -0,0 +1,158 @@
+#include "render_data/two_level_bvh.h"
+
+#include <algorithm>
+
+#include "utill/error_handling.h"
+
+namespace render_data {
+
+static void RebaseIndex(uint32_t& index, uint32_t offset) {
+  if (index != uint32_t(-1)) {
+    index += offset;
+  }
+}
+
+static BoundingBox TransformBounds(const BoundingBox& bounds,
+                                   const utill::Transform& transform) {
+  BoundingBox res;
+  for (uint32_t corner = 0; corner < 8; corner++) {
+    glm::vec3 pt((corner & 1) ? bounds.x_range.y : bounds.x_range.x,
+                 (corner & 2) ? bounds.y_range.y : bounds.y_range.x,
+                 (corner & 4) ? bounds.z_range.y : bounds.z_range.x);
+    res.Unite(transform.TransformPoint(pt));
+  }
+  return res;
+}
+
+// Depth of the deepest leaf, root is at 0
+static uint32_t CalcDepth(const std::vector<BVHNode>& nodes) {
+  uint32_t res = 0;
+  std::vector<std::pair<uint32_t, uint32_t>> stack = {{0, 0}};
+  while (!stack.empty()) {
+    auto [v, d] = stack.back();
+    stack.pop_back();
+    if (nodes[v].bvh_level == uint32_t(-1)) {
+      res = std::max(res, d);
+      continue;
+    }
+    stack.push_back({nodes[v].left, d + 1});
+    stack.push_back({nodes[v].right, d + 1});
+  }
+  return res;
+}
+
+void TwoLevelBVH::AddBottomLevel(const Mesh& mesh, const BVH& bvh) {
+  uint32_t node_offset = blas_node_.size();
+  uint32_t triangle_offset = mesh_.index.size() / 3;
+  uint32_t position_offset = mesh_.position.size();
+  uint32_t normal_offset = mesh_.normal.size();
+  uint32_t tex_coord_offset = mesh_.tex_coord.size();
+
+  blas_root_.push_back(node_offset);
+  for (BVHNode node : bvh.GetNodes()) {
+    if (node.bvh_level == uint32_t(-1)) {
+      node.left += triangle_offset;
+      node.right += triangle_offset;
+    } else {
+      RebaseIndex(node.left, node_offset);
+      RebaseIndex(node.right, node_offset);
+    }
+    RebaseIndex(node.parent, node_offset);
+    blas_node_.push_back(node);
+  }
+
+  mesh_.position.insert(mesh_.position.end(), mesh.position.begin(),
+                        mesh.position.end());
+  mesh_.normal.insert(mesh_.normal.end(), mesh.normal.begin(),
+                      mesh.normal.end());
+  mesh_.tex_coord.insert(mesh_.tex_coord.end(), mesh.tex_coord.begin(),
+                         mesh.tex_coord.end());
+  mesh_.index.reserve(mesh_.index.size() + mesh.index.size());
+  for (glm::uvec4 index : mesh.index) {
+    RebaseIndex(index.x, position_offset);
+    RebaseIndex(index.y, normal_offset);
+    RebaseIndex(index.z, tex_coord_offset);
+    mesh_.index.push_back(index);
+  }
+}
+
+TwoLevelBVH::TwoLevelBVH(std::vector<Mesh>&& meshes,
+                         BVHBuildConfig blas_config) {
+  for (auto& mesh : meshes) {
+    DCHECK(!mesh.index.empty()) << "Can't build bottom level of empty mesh";
+    BVH bvh(mesh, blas_config);
+    mesh.ReorderPrimitives(bvh.GetPrimitiveOrd());
+    mesh.ReorderVertices();
+    AddBottomLevel(mesh, bvh);
+  }
+  meshes.clear();
+}
+
+TwoLevelBVH::TwoLevelBVH(std::vector<Mesh>&& meshes,
+                         const std::vector<BVH>& bottom_levels) {
+  DCHECK(meshes.size() == bottom_levels.size())
+      << "Every mesh needs its bottom level";
+  for (uint32_t i = 0; i < meshes.size(); i++) {
+    DCHECK(!meshes[i].index.empty())
+        << "Can't build bottom level of empty mesh";
+    AddBottomLevel(meshes[i], bottom_levels[i]);
+  }
+  meshes.clear();
+}
+
+void TwoLevelBVH::BuildTopLevel(const std::vector<MeshInstance>& instances) {
+  DCHECK(!instances.empty()) << "Top level needs at least one instance";
+  std::vector<std::pair<BoundingBox, uint32_t>> primitives;
+  primitives.reserve(instances.size());
+  for (uint32_t i = 0; i < instances.size(); i++) {
+    DCHECK(instances[i].mesh_ind < blas_root_.size()) << "Invalid mesh index";
+    const BVHNode& blas_root = blas_node_[blas_root_[instances[i].mesh_ind]];
+    primitives.push_back(
+        {TransformBounds(blas_root.bounds, instances[i].object_to_world), i});
+  }
+
+  BVHBuildConfig tlas_config;
+  tlas_config.mode = BVHBuildMode::kBinnedSAH;
+  // instance is much more expensive to test than a triangle
+  tlas_config.min_node_primitives = 1;
+  tlas_config.max_depth = kMaxTopLevelDepth;
+  tlas_ = BVH(std::move(primitives), tlas_config);
+  // the shader stack would silently drop subtrees of deeper levels
+  CHECK(CalcDepth(tlas_.GetNodes()) <= kMaxTopLevelDepth)
+      << "Top level is too deep for the traversal stack";
+
+  instance_.clear();
+  instance_.reserve(instances.size());
+  for (uint32_t instance_ind : tlas_.GetPrimitiveOrd()) {
+    const MeshInstance& instance = instances[instance_ind];
+    GPUInstance gpu_instance;
+    gpu_instance.world_to_object = instance.object_to_world.GetInverse();
+    gpu_instance.object_to_world = instance.object_to_world;
+    gpu_instance.blas_root = blas_root_[instance.mesh_ind];
+    instance_.push_back(gpu_instance);
+  }
+}
+
+void TwoLevelBVH::ExpandBottomLevelBounds(const glm::vec3& margin) {
+  for (BVHNode& node : blas_node_) {
+    node.bounds.Expand(margin);
+  }
+}
+
+const Mesh& TwoLevelBVH::GetMesh() const {
+  return mesh_;
+}
+
+const std::vector<BVHNode>& TwoLevelBVH::GetBottomLevelNodes() const {
+  return blas_node_;
+}
+
+const std::vector<BVHNode>& TwoLevelBVH::GetTopLevelNodes() const {
+  return tlas_.GetNodes();
+}
+
+const std::vector<GPUInstance>& TwoLevelBVH::GetInstances() const {
+  return instance_;
+}
+
+}  // namespace render_data
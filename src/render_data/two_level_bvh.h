@@ -0,0 +1,71 @@
+#pragma once
+
+#include <vector>
+
+#include "render_data/bvh.h"
+#include "render_data/mesh.h"
+#include "utill/transform.h"
+
+namespace render_data {
+
+struct MeshInstance {
+  // index in meshes passed to TwoLevelBVH
+  uint32_t mesh_ind = 0;
+  utill::Transform object_to_world;
+};
+
+// MeshInstance as read by raytrace.hlsl
+struct GPUInstance {
+  utill::Transform world_to_object;
+  utill::Transform object_to_world;
+  // root of the instance mesh bottom level in GetBottomLevelNodes()
+  uint32_t blas_root = 0;
+  uint32_t padding[3] = {};
+};
+
+/*
+ * Top level BVH over mesh instances, each of them referencing bottom level
+ * BVH of its mesh. Bottom levels are built once and stay resident, packed
+ * into one node array next to one packed mesh. Top level is small and is
+ * meant to be rebuilt whenever instances move.
+ */
+class TwoLevelBVH {
+  Mesh mesh_;
+  std::vector<BVHNode> blas_node_;
+  std::vector<uint32_t> blas_root_;
+  BVH tlas_;
+  std::vector<GPUInstance> instance_;
+
+  // 'mesh' is reordered with bvh.GetPrimitiveOrd()
+  void AddBottomLevel(const Mesh& mesh, const BVH& bvh);
+
+ public:
+  // TLAS_STACK_SIZE of raytrace.hlsl is one more, traversal pushes both
+  // children of a node
+  static const uint32_t kMaxTopLevelDepth = 31;
+
+  TwoLevelBVH() = default;
+  // Every mesh is reordered by its own BVH and appended to GetMesh(), leaves
+  // of GetBottomLevelNodes() index its triangles
+  TwoLevelBVH(std::vector<Mesh>&& meshes, BVHBuildConfig blas_config);
+  // Takes bottom levels built earlier, e.g. MeshLOD levels. Meshes must be
+  // reordered with primitive order of their BVHs.
+  TwoLevelBVH(std::vector<Mesh>&& meshes,
+              const std::vector<BVH>& bottom_levels);
+
+  // At least one instance is required. Top level is at most
+  // kMaxTopLevelDepth deep, deeper nodes are cut into bigger leaves.
+  void BuildTopLevel(const std::vector<MeshInstance>& instances);
+
+  // BVH::ExpandBounds of every bottom level. Top level is built from their
+  // roots, so BuildTopLevel has to run again afterwards.
+  void ExpandBottomLevelBounds(const glm::vec3& margin);
+
+  const Mesh& GetMesh() const;
+  const std::vector<BVHNode>& GetBottomLevelNodes() const;
+  const std::vector<BVHNode>& GetTopLevelNodes() const;
+  // In top level leaf order, so leaf ranges index it directly
+  const std::vector<GPUInstance>& GetInstances() const;
+};
+
+}  // namespace render_data
@@ -0,0 +1,144 @@
+#include "render_data/wide_bvh.h"
+
+#include <algorithm>
+
+#include "utill/error_handling.h"
+
+namespace render_data {
+
+template <uint32_t Width>
+BoundingBox WideBVHNode<Width>::GetChildBounds(uint32_t slot) const {
+  return BoundingBox{{min_x[slot], max_x[slot]},
+                     {min_y[slot], max_y[slot]},
+                     {min_z[slot], max_z[slot]}};
+}
+
+template <uint32_t Width>
+uint32_t WideBVHNode<Width>::GetPrimitiveCount(uint32_t slot) const {
+  return primitive_count[slot];
+}
+
+template <uint32_t Width>
+void WideBVHNode<Width>::SetChild(uint32_t slot,
+                                  const BoundingBox& bounds,
+                                  uint32_t child_ind,
+                                  uint32_t child_primitive_count) {
+  min_x[slot] = bounds.x_range.x;
+  max_x[slot] = bounds.x_range.y;
+  min_y[slot] = bounds.y_range.x;
+  max_y[slot] = bounds.y_range.y;
+  min_z[slot] = bounds.z_range.x;
+  max_z[slot] = bounds.z_range.y;
+  child[slot] = child_ind;
+  primitive_count[slot] = child_primitive_count;
+}
+
+static bool IsLeaf(const BVHNode& node) {
+  return node.bvh_level == uint32_t(-1);
+}
+
+template <uint32_t Width>
+uint32_t WideBVH<Width>::Collapse(const std::vector<BVHNode>& nodes,
+                                  uint32_t v) {
+  std::vector<uint32_t> children = {nodes[v].left, nodes[v].right};
+  while (children.size() < Width) {
+    uint32_t best_ind = uint32_t(-1);
+    float best_area = -1;
+    for (uint32_t i = 0; i < children.size(); i++) {
+      const BVHNode& child = nodes[children[i]];
+      if (!IsLeaf(child) && child.bounds.GetSurfaceArea() > best_area) {
+        best_area = child.bounds.GetSurfaceArea();
+        best_ind = i;
+      }
+    }
+    if (best_ind == uint32_t(-1)) {
+      break;
+    }
+    uint32_t opened = children[best_ind];
+    children[best_ind] = nodes[opened].left;
+    children.push_back(nodes[opened].right);
+  }
+
+  uint32_t wide_ind = node_.size();
+  node_.push_back({});
+  BoundingBox empty_bounds;
+  for (uint32_t slot = 0; slot < Width; slot++) {
+    node_[wide_ind].SetChild(slot, empty_bounds, uint32_t(-1), 0);
+  }
+  for (uint32_t slot = 0; slot < children.size(); slot++) {
+    const BVHNode& child = nodes[children[slot]];
+    if (IsLeaf(child)) {
+      node_[wide_ind].SetChild(slot, child.bounds, child.left,
+                               child.right - child.left);
+    } else {
+      // recursion may reallocate node_, so index it again afterwards
+      uint32_t child_wide_ind = Collapse(nodes, children[slot]);
+      node_[wide_ind].SetChild(slot, child.bounds, child_wide_ind, 0);
+    }
+  }
+  return wide_ind;
+}
+
+template <uint32_t Width>
+WideBVH<Width>::WideBVH(const BVH& bvh) {
+  static_assert(Width >= 2);
+  const auto& nodes = bvh.GetNodes();
+  if (nodes.empty()) {
+    return;
+  }
+  if (!IsLeaf(nodes[0])) {
+    Collapse(nodes, 0);
+    return;
+  }
+  // whole tree is one leaf
+  node_.push_back({});
+  BoundingBox empty_bounds;
+  for (uint32_t slot = 1; slot < Width; slot++) {
+    node_[0].SetChild(slot, empty_bounds, uint32_t(-1), 0);
+  }
+  node_[0].SetChild(0, nodes[0].bounds, nodes[0].left,
+                    nodes[0].right - nodes[0].left);
+}
+
+template <uint32_t Width>
+const std::vector<WideBVHNode<Width>>& WideBVH<Width>::GetNodes() const {
+  return node_;
+}
+
+// Stack growth over its size when 'v' is popped. Internal children are
+// pushed together, the one traversed first is popped with its siblings
+// still on the stack.
+template <uint32_t Width>
+uint32_t WideBVH<Width>::CalcStackSize(uint32_t v) const {
+  const WideBVHNode<Width>& node = node_[v];
+  uint32_t internal_count = 0;
+  for (uint32_t slot = 0; slot < Width; slot++) {
+    if (node.child[slot] != uint32_t(-1) && node.primitive_count[slot] == 0) {
+      ++internal_count;
+    }
+  }
+  uint32_t res = internal_count;
+  for (uint32_t slot = 0; slot < Width; slot++) {
+    if (node.child[slot] != uint32_t(-1) && node.primitive_count[slot] == 0) {
+      res = std::max(res,
+                     internal_count - 1 + CalcStackSize(node.child[slot]));
+    }
+  }
+  return res;
+}
+
+template <uint32_t Width>
+uint32_t WideBVH<Width>::CalcTraversalStackSize() const {
+  if (node_.empty()) {
+    return 0;
+  }
+  // the root is pushed before the traversal starts
+  return std::max(1u, CalcStackSize(0));
+}
+
+template struct WideBVHNode<4>;
+template struct WideBVHNode<8>;
+template class WideBVH<4>;
+template class WideBVH<8>;
+
+}  // namespace render_data
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include "render_data/bvh.h"
+
+namespace render_data {
+
+/*
+ * Node of a BVH collapsed to 'Width' children. Child bounds are stored as
+ * structure of arrays so that one node fetch is enough to test all children.
+ * Leaves are stored in the child slots of their parent. Unused slots have
+ * 'child' set to uint32_t(-1).
+ */
+template <uint32_t Width>
+struct WideBVHNode {
+  std::array<float, Width> min_x;
+  std::array<float, Width> max_x;
+  std::array<float, Width> min_y;
+  std::array<float, Width> max_y;
+  std::array<float, Width> min_z;
+  std::array<float, Width> max_z;
+  // index of the child node, or first primitive of a leaf child
+  std::array<uint32_t, Width> child;
+  // 0 for internal children, number of primitives for leaf children
+  std::array<uint32_t, Width> primitive_count;
+
+  BoundingBox GetChildBounds(uint32_t slot) const;
+  uint32_t GetPrimitiveCount(uint32_t slot) const;
+
+  void SetChild(uint32_t slot,
+                const BoundingBox& bounds,
+                uint32_t child_ind,
+                uint32_t child_primitive_count);
+};
+
+template <uint32_t Width>
+class WideBVH {
+  std::vector<WideBVHNode<Width>> node_;
+
+  uint32_t Collapse(const std::vector<BVHNode>& nodes, uint32_t v);
+  uint32_t CalcStackSize(uint32_t v) const;
+
+ public:
+  WideBVH() = default;
+  // Collapses binary 'bvh' greedily: child slots are filled by repeatedly
+  // opening the internal child with the largest surface area.
+  // Primitive order of 'bvh' is preserved.
+  explicit WideBVH(const BVH& bvh);
+
+  const std::vector<WideBVHNode<Width>>& GetNodes() const;
+  // Max stack size of a depth first traversal pushing every internal child
+  // of a node, in any order. At most depth * (Width - 1) + 1.
+  uint32_t CalcTraversalStackSize() const;
+};
+
+extern template class WideBVH<4>;
+extern template class WideBVH<8>;
+
+}  // namespace render_data
@@ -42,10 +42,25 @@ void RenderGraph::AddPass(Pass* pass,
   passes_.push_back(pass);
 }
 
+void RenderGraph::AddPass(Pass* pass,
+                          vk::PipelineStageFlags2KHR stage_flags,
+                          const gpu_executer::TimelineWait* timeline_wait) {
+  DCHECK(pass) << "Can't add null";
+  pass->OnRegister(passes_.size(), resource_manager_.GetAccessSyncronizer(),
+                   descriptor_pool_);
+  executer_.ScheduleTask(pass, stage_flags, timeline_wait,
+                         pass->GetSecondaryCmdCount());
+  passes_.push_back(pass);
+}
+
 gpu_resources::ResourceManager& RenderGraph::GetResourceManager() {
   return resource_manager_;
 }
 
+const gpu_executer::TimelineSemaphore& RenderGraph::GetFrameSemaphore() const {
+  return executer_.GetFrameSemaphore();
+}
+
 void RenderGraph::Init() {
   LOG << "Initializing resources";
   initialize_task_ = PreFrameResourceInitializerTask(
@@ -62,6 +77,8 @@ void RenderGraph::Init() {
 }
 
 void RenderGraph::RenderFrame() {
+  resource_manager_.GetAccessSyncronizer()->SetFrame(
+      executer_.GetFrameSemaphore().GetSignalValue() + 1);
   for (Pass* pass : passes_) {
     pass->OnPreRecord();
   }
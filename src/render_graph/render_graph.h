@@ -43,7 +43,14 @@ class RenderGraph {
                vk::PipelineStageFlags2KHR stage_flags = {},
                vk::Semaphore external_signal = {},
                vk::Semaphore external_wait = {});
+  // 'timeline_wait' is read every frame, the pass may update it in
+  // OnPreRecord
+  void AddPass(Pass* pass,
+               vk::PipelineStageFlags2KHR stage_flags,
+               const gpu_executer::TimelineWait* timeline_wait);
   gpu_resources::ResourceManager& GetResourceManager();
+  // see gpu_executer::Executer::GetFrameSemaphore
+  const gpu_executer::TimelineSemaphore& GetFrameSemaphore() const;
   void Init();
   void RenderFrame();
 };
@@ -0,0 +1,131 @@
+#include "utill/mapped_file.h"
+
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "utill/logger.h"
+
+namespace utill {
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string& path) {
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return;
+  }
+  file_handle_ = file;
+  LARGE_INTEGER file_size{};
+  if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+    Close();
+    return;
+  }
+  mapping_handle_ =
+      CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mapping_handle_) {
+    LOG << "Failed to create file mapping: " << path;
+    Close();
+    return;
+  }
+  data_ = static_cast<const char*>(
+      MapViewOfFile(mapping_handle_, FILE_MAP_READ, 0, 0, 0));
+  if (!data_) {
+    LOG << "Failed to map file: " << path;
+    Close();
+    return;
+  }
+  size_ = file_size.QuadPart;
+}
+
+void MappedFile::Close() noexcept {
+  if (data_) {
+    UnmapViewOfFile(data_);
+  }
+  if (mapping_handle_) {
+    CloseHandle(mapping_handle_);
+  }
+  if (file_handle_) {
+    CloseHandle(file_handle_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+  mapping_handle_ = nullptr;
+  file_handle_ = nullptr;
+}
+#else
+MappedFile::MappedFile(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  struct stat file_stat {};
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+    close(fd);
+    return;
+  }
+  void* mapping =
+      mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // mapping keeps its own reference to the file
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    LOG << "Failed to map file: " << path;
+    return;
+  }
+  data_ = static_cast<const char*>(mapping);
+  size_ = file_stat.st_size;
+}
+
+void MappedFile::Close() noexcept {
+  if (data_) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+}
+#endif
+
+MappedFile::MappedFile(MappedFile&& other) noexcept {
+  Swap(other);
+}
+
+void MappedFile::operator=(MappedFile&& other) noexcept {
+  MappedFile tmp;
+  tmp.Swap(other);
+  Swap(tmp);
+}
+
+void MappedFile::Swap(MappedFile& other) noexcept {
+  std::swap(data_, other.data_);
+  std::swap(size_, other.size_);
+#ifdef _WIN32
+  std::swap(file_handle_, other.file_handle_);
+  std::swap(mapping_handle_, other.mapping_handle_);
+#endif
+}
+
+bool MappedFile::IsOpen() const {
+  return data_ != nullptr;
+}
+
+const char* MappedFile::GetData() const {
+  return data_;
+}
+
+size_t MappedFile::GetSize() const {
+  return size_;
+}
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+}  // namespace utill
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+namespace utill {
+
+/*
+ * Read-only mapping of a whole file. Pages are loaded by the OS on first
+ * access, so opening doesn't read the file.
+ */
+class MappedFile {
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+#ifdef _WIN32
+  void* file_handle_ = nullptr;
+  void* mapping_handle_ = nullptr;
+#endif
+
+  void Close() noexcept;
+
+ public:
+  MappedFile() = default;
+  // Leaves the mapping empty if file can't be opened
+  explicit MappedFile(const std::string& path);
+
+  MappedFile(const MappedFile&) = delete;
+  void operator=(const MappedFile&) = delete;
+
+  MappedFile(MappedFile&& other) noexcept;
+  void operator=(MappedFile&& other) noexcept;
+  void Swap(MappedFile& other) noexcept;
+
+  bool IsOpen() const;
+  // Start of the mapping, aligned to the OS page size
+  const char* GetData() const;
+  size_t GetSize() const;
+
+  ~MappedFile();
+};
+
+}  // namespace utill
@@ -1,37 +1,57 @@
+#pragma once
+
 #include <vector>
 
+#include "utill/error_handling.h"
+
 namespace utill {
 
+// Fixed capacity FIFO queue, T must be default constructible and movable
 template <typename T>
 class RingBuffer {
   std::vector<T> data_;
   size_t start_ = 0;
   size_t size_ = 0;
 
-  size_t GetAbsoluteElementInd(size_t ind) {
+  size_t GetAbsoluteElementInd(size_t ind) const {
     return (start_ + ind) % data_.size();
   }
 
  public:
-  RingBuffer(size_t cap) : data_(cap) {}
+  RingBuffer() = default;
+  explicit RingBuffer(size_t cap) : data_(cap) {}
 
   bool PushBack(T&& val) {
-    if (size_ == data_.size()) {
+    if (IsFull()) {
       return false;
     }
     data_[GetAbsoluteElementInd(size_)] = std::move(val);
+    ++size_;
     return true;
   }
 
   T PopFront() {
+    DCHECK(!IsEmpty()) << "Pop from empty ring buffer";
+    T res = std::move(data_[start_]);
+    start_ = GetAbsoluteElementInd(1);
     --size_;
-    return data[start_++];
+    return res;
+  }
+
+  T& operator[](size_t ind) {
+    DCHECK(ind < size_) << "Index out of range";
+    return data_[GetAbsoluteElementInd(ind)];
+  }
+  const T& operator[](size_t ind) const {
+    DCHECK(ind < size_) << "Index out of range";
+    return data_[GetAbsoluteElementInd(ind)];
   }
 
-  T& GetFront() { return data[start_]; }
-  T& GetBack() { return data[GetAbsoluteElementInd(size_ - 1)]; }
+  T& GetFront() { return (*this)[0]; }
+  T& GetBack() { return (*this)[size_ - 1]; }
   size_t GetSize() const { return size_; }
   size_t GetCapacity() const { return data_.size(); }
+  bool IsEmpty() const { return size_ == 0; }
   bool IsFull() const { return GetSize() == GetCapacity(); }
 };
 
@@ -0,0 +1,186 @@
+#include "utill/thread_pool.h"
+
+#include "utill/error_handling.h"
+
+namespace utill {
+
+namespace {
+
+thread_local const ThreadPool* t_worker_pool = nullptr;
+thread_local uint32_t t_worker_ind = uint32_t(-1);
+
+}  // namespace
+
+uint32_t ThreadPool::GetCurrentWorkerInd() const {
+  return t_worker_pool == this ? t_worker_ind : uint32_t(-1);
+}
+
+bool ThreadPool::TryPopOwn(uint32_t queue_ind, std::function<void()>& task) {
+  WorkerQueue& queue = *queues_[queue_ind];
+  std::lock_guard lock(queue.mutex);
+  if (queue.tasks.empty()) {
+    return false;
+  }
+  task = std::move(queue.tasks.back());
+  queue.tasks.pop_back();
+  return true;
+}
+
+bool ThreadPool::TrySteal(uint32_t thief_ind, std::function<void()>& task) {
+  uint32_t queue_count = queues_.size();
+  uint32_t start = thief_ind == uint32_t(-1) ? 0 : thief_ind + 1;
+  for (uint32_t i = 0; i < queue_count; i++) {
+    WorkerQueue& queue = *queues_[(start + i) % queue_count];
+    std::lock_guard lock(queue.mutex);
+    if (queue.tasks.empty()) {
+      continue;
+    }
+    task = std::move(queue.tasks.front());
+    queue.tasks.pop_front();
+    return true;
+  }
+  return false;
+}
+
+bool ThreadPool::TryGetTask(std::function<void()>& task) {
+  if (queued_task_count_.load() == 0) {
+    return false;
+  }
+  uint32_t worker_ind = GetCurrentWorkerInd();
+  bool found = (worker_ind != uint32_t(-1) && TryPopOwn(worker_ind, task)) ||
+               TrySteal(worker_ind, task);
+  if (found) {
+    --queued_task_count_;
+  }
+  return found;
+}
+
+void ThreadPool::WorkerLoop(uint32_t worker_ind) {
+  t_worker_pool = this;
+  t_worker_ind = worker_ind;
+  std::function<void()> task;
+  while (true) {
+    if (TryGetTask(task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+    std::unique_lock lock(sleep_mutex_);
+    wake_cv_.wait(lock, [this]() {
+      return is_stopping_ || queued_task_count_.load() > 0;
+    });
+    if (is_stopping_) {
+      return;
+    }
+  }
+}
+
+ThreadPool::ThreadPool(uint32_t thread_count) {
+  DCHECK(thread_count > 0) << "Thread pool needs at least one worker";
+  queues_.reserve(thread_count);
+  for (uint32_t i = 0; i < thread_count; i++) {
+    queues_.push_back(std::make_unique<WorkerQueue>());
+  }
+  workers_.reserve(thread_count);
+  for (uint32_t i = 0; i < thread_count; i++) {
+    workers_.emplace_back(&ThreadPool::WorkerLoop, this, i);
+  }
+}
+
+ThreadPool& ThreadPool::GetGlobal() {
+  static ThreadPool pool;
+  return pool;
+}
+
+uint32_t ThreadPool::GetThreadCount() const {
+  return workers_.size();
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+  uint32_t queue_ind = GetCurrentWorkerInd();
+  if (queue_ind == uint32_t(-1)) {
+    queue_ind = next_queue_ind_++ % queues_.size();
+  }
+  // counted before the push, so a thief can't decrement it below zero
+  ++queued_task_count_;
+  {
+    WorkerQueue& queue = *queues_[queue_ind];
+    std::lock_guard lock(queue.mutex);
+    queue.tasks.push_back(std::move(task));
+  }
+  {
+    std::lock_guard lock(sleep_mutex_);
+  }
+  wake_cv_.notify_one();
+}
+
+bool ThreadPool::TryRunPendingTask() {
+  std::function<void()> task;
+  if (!TryGetTask(task)) {
+    return false;
+  }
+  task();
+  return true;
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard lock(sleep_mutex_);
+    is_stopping_ = true;
+  }
+  wake_cv_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+TaskGroup::TaskGroup(ThreadPool& pool) : pool_(pool) {}
+
+void TaskGroup::Run(std::function<void()> task) {
+  ++pending_count_;
+  pool_.Submit([this, task = std::move(task)]() {
+    // the task is done even if it throws, or Wait() would never return
+    struct PendingGuard {
+      std::atomic<uint32_t>& pending_count;
+      ~PendingGuard() { --pending_count; }
+    } guard{pending_count_};
+    try {
+      task();
+    } catch (...) {
+      std::lock_guard lock(exception_mutex_);
+      if (!exception_) {
+        exception_ = std::current_exception();
+      }
+    }
+  });
+}
+
+void TaskGroup::WaitForTasks() {
+  while (pending_count_.load() > 0) {
+    if (!pool_.TryRunPendingTask()) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void TaskGroup::Wait() {
+  WaitForTasks();
+  std::exception_ptr exception;
+  {
+    std::lock_guard lock(exception_mutex_);
+    std::swap(exception, exception_);
+  }
+  if (exception) {
+    std::rethrow_exception(exception);
+  }
+}
+
+bool TaskGroup::IsDone() const {
+  return pending_count_.load() == 0;
+}
+
+TaskGroup::~TaskGroup() {
+  WaitForTasks();
+}
+
+}  // namespace utill
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace utill {
+
+/*
+ * Work-stealing pool. Every worker owns a task deque: tasks submitted from a
+ * worker go to the back of its own deque and are taken from the back (LIFO),
+ * idle workers steal from the front of other deques (FIFO).
+ */
+class ThreadPool {
+  struct WorkerQueue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  std::vector<std::unique_ptr<WorkerQueue>> queues_;
+  std::vector<std::thread> workers_;
+  std::atomic<uint32_t> queued_task_count_ = 0;
+  std::atomic<uint32_t> next_queue_ind_ = 0;
+  bool is_stopping_ = false;
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_cv_;
+
+  uint32_t GetCurrentWorkerInd() const;
+  bool TryPopOwn(uint32_t queue_ind, std::function<void()>& task);
+  bool TrySteal(uint32_t thief_ind, std::function<void()>& task);
+  bool TryGetTask(std::function<void()>& task);
+  void WorkerLoop(uint32_t worker_ind);
+
+ public:
+  explicit ThreadPool(uint32_t thread_count = std::max(
+                          std::thread::hardware_concurrency(), 1u));
+
+  ThreadPool(const ThreadPool&) = delete;
+  void operator=(const ThreadPool&) = delete;
+
+  static ThreadPool& GetGlobal();
+
+  uint32_t GetThreadCount() const;
+  void Submit(std::function<void()> task);
+  // Runs one queued task on the calling thread if there is any. Used by
+  // waiting threads so that nested waits can't starve the pool.
+  bool TryRunPendingTask();
+
+  ~ThreadPool();
+};
+
+class TaskGroup {
+  ThreadPool& pool_;
+  std::atomic<uint32_t> pending_count_ = 0;
+  // first exception thrown by a task, rethrown by Wait()
+  std::mutex exception_mutex_;
+  std::exception_ptr exception_;
+
+  void WaitForTasks();
+
+ public:
+  explicit TaskGroup(ThreadPool& pool = ThreadPool::GetGlobal());
+
+  TaskGroup(const TaskGroup&) = delete;
+  void operator=(const TaskGroup&) = delete;
+
+  void Run(std::function<void()> task);
+  // Rethrows the first exception of the tasks finished since the last call
+  void Wait();
+  // True once every task passed to Run has finished, doesn't block
+  bool IsDone() const;
+
+  // Waits for the tasks, dropping their exceptions
+  ~TaskGroup();
+};
+
+// Calls func(chunk_begin, chunk_end) for consecutive chunks of at most
+// 'grain' elements covering [begin, end). Returns once all chunks are done.
+template <typename Func>
+void ParallelFor(size_t begin, size_t end, size_t grain, Func&& func) {
+  grain = std::max<size_t>(grain, 1);
+  if (end <= begin + grain) {
+    if (begin < end) {
+      func(begin, end);
+    }
+    return;
+  }
+  TaskGroup group;
+  size_t chunk_begin = begin;
+  for (; chunk_begin + grain < end; chunk_begin += grain) {
+    group.Run([&func, chunk_begin, grain]() {
+      func(chunk_begin, chunk_begin + grain);
+    });
+  }
+  func(chunk_begin, end);
+  group.Wait();
+}
+
+}  // namespace utill
@@ -41,6 +41,10 @@ Transform Transform::Combine(const std::vector<Transform>& transforms) {
   return res;
 }
 
+Transform Transform::GetInverse() const {
+  return glm::inverse(tranform_mat_);
+}
+
 glm::vec3 Transform::GetDirX() const {
   return tranform_mat_[0];
 }
@@ -27,6 +27,8 @@ class Transform {
   static Transform Combine(const Transform& fst, const Transform& snd);
   static Transform Combine(const std::vector<Transform>& transforms);
 
+  Transform GetInverse() const;
+
   glm::vec3 GetPos() const;
   glm::vec3 GetDirX() const;
   glm::vec3 GetDirY() const;